@@ -0,0 +1,362 @@
+#!/usr/bin/env python3
+"""Build, sign and check factory provisioning bundles (format in src/factory.h).
+
+    factory_bundle.py keygen KEY.pem
+    factory_bundle.py pubkey KEY.pem OUT.c
+    factory_bundle.py build  KEY.pem SPEC.json OUT.cbor
+    factory_bundle.py verify KEY.pem BUNDLE.cbor
+
+"keygen" makes a P-256 signing key. "pubkey" writes the C source holding its
+public point; the build runs it on FACTORY_PUB_KEY (see CMakeLists.txt), so
+the firmware only ever embeds the key it was configured with. "build" signs
+a bundle for one unit from a JSON spec:
+
+    {
+      "creds": [{"tag": 42, "type": "ca", "pem": "ca.pem"}],
+      "cfg": {"mq_addr": "broker.example.com", "mq_port": "8883"},
+      "password": {"password": "secret", "iterations": 100000}
+    }
+
+"type" is ca, cert or key; "pem" paths are relative to the spec. "password"
+is optional and may give "salt" and "hash" (hex) instead of "password", for
+a hash made elsewhere. "verify" checks the signature and every limit the
+device enforces, so a bundle can be checked before it goes to the station.
+KEY.pem may be the private or the public half for "pubkey" and "verify".
+
+Signing and key handling go through the openssl command line tool.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import secrets
+import subprocess
+import sys
+import tempfile
+
+BUNDLE_VERSION = 1
+BUNDLE_MAX = 12 * 1024
+MAX_CREDS = 8
+MAX_CFG = 48
+PW_MAX = 64
+SALT_LEN = 16
+HASH_LEN = 32
+MIN_ITERATIONS = 10000
+MAX_ITERATIONS = 1000000
+MAX_KEY_LEN = 64
+MAX_VALUE_LEN = 2048
+PW_REF_KEY = "pbkdf2"   # where the device stores item 4
+CRED_TYPES = {"ca": 0, "cert": 1, "key": 2}
+
+P256_OID = bytes.fromhex("2a8648ce3d030107")
+SPKI_LEN = 91
+POINT_LEN = 65
+
+
+class BundleError(Exception):
+    pass
+
+
+# ---------- CBOR, definite lengths only: what zcbor decodes on the device ----------
+
+def cbor_head(major, n):
+    if n < 24:
+        return bytes([major << 5 | n])
+    for info, size in ((24, 1), (25, 2), (26, 4), (27, 8)):
+        if n < 1 << (8 * size):
+            return bytes([major << 5 | info]) + n.to_bytes(size, "big")
+    raise BundleError("CBOR length too large")
+
+
+def cbor(obj):
+    if isinstance(obj, bool) or obj is None:
+        raise BundleError("unsupported CBOR item")
+    if isinstance(obj, int):
+        return cbor_head(0, obj)
+    if isinstance(obj, (bytes, bytearray)):
+        return cbor_head(2, len(obj)) + bytes(obj)
+    if isinstance(obj, str):
+        data = obj.encode()
+        return cbor_head(3, len(data)) + data
+    if isinstance(obj, list):
+        return cbor_head(4, len(obj)) + b"".join(cbor(x) for x in obj)
+    if isinstance(obj, dict):
+        return cbor_head(5, len(obj)) + b"".join(cbor(k) + cbor(v) for k, v in obj.items())
+    raise BundleError("unsupported CBOR item")
+
+
+def cbor_item(data, pos):
+    if pos >= len(data):
+        raise BundleError("truncated CBOR")
+    major, info = data[pos] >> 5, data[pos] & 0x1F
+    pos += 1
+    if info < 24:
+        n = info
+    elif info <= 27:
+        size = 1 << (info - 24)
+        if pos + size > len(data):
+            raise BundleError("truncated CBOR")
+        n = int.from_bytes(data[pos:pos + size], "big")
+        pos += size
+    else:
+        raise BundleError("indefinite or reserved CBOR length")
+
+    if major == 0:
+        return n, pos
+    if major in (2, 3):
+        if pos + n > len(data):
+            raise BundleError("truncated CBOR string")
+        raw = bytes(data[pos:pos + n])
+        return (raw if major == 2 else raw.decode()), pos + n
+    if major == 4:
+        items = []
+        for _ in range(n):
+            item, pos = cbor_item(data, pos)
+            items.append(item)
+        return items, pos
+    if major == 5:
+        items = {}
+        for _ in range(n):
+            key, pos = cbor_item(data, pos)
+            items[key], pos = cbor_item(data, pos)
+        return items, pos
+    raise BundleError("unsupported CBOR major type %d" % major)
+
+
+def cbor_decode(data):
+    obj, pos = cbor_item(data, 0)
+    if pos != len(data):
+        raise BundleError("%d trailing bytes after CBOR item" % (len(data) - pos))
+    return obj
+
+
+# ---------- keys and ECDSA through openssl ----------
+
+def openssl(args, data=None):
+    try:
+        res = subprocess.run(["openssl"] + args, input=data, capture_output=True)
+    except FileNotFoundError:
+        raise BundleError("the openssl command line tool is required")
+    if res.returncode != 0:
+        raise BundleError("openssl %s failed: %s" % (args[0], res.stderr.decode().strip()))
+    return res.stdout
+
+
+def is_public_pem(path):
+    with open(path, "rb") as f:
+        return b"PUBLIC KEY-----" in f.read()
+
+
+def public_point(key_path):
+    """Uncompressed P-256 point (0x04 || X || Y) of a private or public PEM key"""
+    if is_public_pem(key_path):
+        der = openssl(["pkey", "-pubin", "-in", key_path, "-outform", "DER"])
+    else:
+        der = openssl(["pkey", "-in", key_path, "-pubout", "-outform", "DER"])
+    if len(der) != SPKI_LEN or P256_OID not in der[:SPKI_LEN - POINT_LEN] or der[-POINT_LEN] != 0x04:
+        raise BundleError("%s is not a P-256 key" % key_path)
+    return der[-POINT_LEN:]
+
+
+def der_int(data, pos):
+    if data[pos] != 0x02:
+        raise BundleError("bad DER signature")
+    n = data[pos + 1]
+    return int.from_bytes(data[pos + 2:pos + 2 + n], "big"), pos + 2 + n
+
+
+def der_len(n):
+    return bytes([n]) if n < 0x80 else bytes([0x81, n])
+
+
+def der_uint(v):
+    raw = v.to_bytes(32, "big").lstrip(b"\0") or b"\0"
+    if raw[0] & 0x80:
+        raw = b"\0" + raw
+    return b"\x02" + der_len(len(raw)) + raw
+
+
+def sign(key_path, payload):
+    """ECDSA P-256 / SHA-256 as the raw r || s the device's psa_verify_message() takes"""
+    der = openssl(["dgst", "-sha256", "-sign", key_path], payload)
+    if der[0] != 0x30:
+        raise BundleError("bad DER signature")
+    pos = 3 if der[1] == 0x81 else 2
+    r, pos = der_int(der, pos)
+    s, _ = der_int(der, pos)
+    return r.to_bytes(32, "big") + s.to_bytes(32, "big")
+
+
+def signature_ok(key_path, payload, sig):
+    r = int.from_bytes(sig[:32], "big")
+    s = int.from_bytes(sig[32:], "big")
+    body = der_uint(r) + der_uint(s)
+    der = b"\x30" + der_len(len(body)) + body
+
+    with tempfile.TemporaryDirectory() as tmp:
+        sig_path = os.path.join(tmp, "sig.der")
+        pub_path = os.path.join(tmp, "pub.pem")
+        with open(sig_path, "wb") as f:
+            f.write(der)
+        if is_public_pem(key_path):
+            pub_path = key_path
+        else:
+            openssl(["pkey", "-in", key_path, "-pubout", "-out", pub_path])
+        res = subprocess.run(["openssl", "dgst", "-sha256", "-verify", pub_path,
+                              "-signature", sig_path], input=payload, capture_output=True)
+    return res.returncode == 0
+
+
+# ---------- bundle ----------
+
+def check_manifest(m):
+    """The checks factory.c makes, with a message instead of -EBADMSG"""
+    if not isinstance(m, dict) or m.get(1) != BUNDLE_VERSION:
+        raise BundleError("manifest is not a version %d map" % BUNDLE_VERSION)
+    if list(m) not in ([1, 2, 3], [1, 2, 3, 4]):
+        raise BundleError("manifest keys must be 1, 2, 3 and optionally 4, in order")
+
+    creds, cfg = m[2], m[3]
+    if not isinstance(creds, list) or len(creds) > MAX_CREDS:
+        raise BundleError("at most %d credentials" % MAX_CREDS)
+    for c in creds:
+        if (not isinstance(c, list) or len(c) != 3 or not isinstance(c[0], int) or
+                c[1] not in CRED_TYPES.values() or not isinstance(c[2], bytes)):
+            raise BundleError("credential entries are [sec_tag, type 0..2, pem bstr]")
+
+    if not isinstance(cfg, list) or len(cfg) > MAX_CFG:
+        raise BundleError("at most %d config entries" % MAX_CFG)
+    keys = set()
+    for kv in cfg:
+        if len(kv) != 2 or not all(isinstance(x, str) for x in kv):
+            raise BundleError("config entries are [key tstr, value tstr]")
+        k, v = kv
+        if not k or len(k.encode()) > MAX_KEY_LEN or len(v.encode()) > MAX_VALUE_LEN:
+            raise BundleError("config '%s' is empty or too large" % k)
+        if "\0" in k or "\0" in v:
+            raise BundleError("config '%s' holds a NUL byte" % k)
+        if k in keys or (k == PW_REF_KEY and 4 in m):
+            raise BundleError("config '%s' appears twice" % k)
+        keys.add(k)
+
+    if 4 in m:
+        pw = m[4]
+        if (not isinstance(pw, list) or len(pw) != 3 or
+                not all(isinstance(x, bytes) and 0 < len(x) <= PW_MAX for x in pw[:2]) or
+                not isinstance(pw[2], int)):
+            raise BundleError("password entry is [salt bstr, hash bstr, iterations]")
+        if not MIN_ITERATIONS <= pw[2] <= MAX_ITERATIONS:
+            raise BundleError("PBKDF2 iterations must be %d..%d" % (MIN_ITERATIONS, MAX_ITERATIONS))
+
+
+def password_item(pw):
+    iterations = pw.get("iterations", 0)
+    if "password" in pw:
+        salt = secrets.token_bytes(SALT_LEN)
+        digest = hashlib.pbkdf2_hmac("sha256", pw["password"].encode(), salt, iterations, HASH_LEN)
+    else:
+        salt, digest = bytes.fromhex(pw["salt"]), bytes.fromhex(pw["hash"])
+    return [salt, digest, iterations]
+
+
+def build(key_path, spec_path):
+    with open(spec_path) as f:
+        spec = json.load(f)
+    base = os.path.dirname(os.path.abspath(spec_path))
+
+    creds = []
+    for c in spec.get("creds", []):
+        if c.get("type") not in CRED_TYPES:
+            raise BundleError("credential type must be one of %s" % ", ".join(CRED_TYPES))
+        with open(os.path.join(base, c["pem"]), "rb") as f:
+            creds.append([c["tag"], CRED_TYPES[c["type"]], f.read()])
+
+    manifest = {1: BUNDLE_VERSION, 2: creds, 3: [[k, v] for k, v in spec.get("cfg", {}).items()]}
+    if "password" in spec:
+        manifest[4] = password_item(spec["password"])
+    check_manifest(manifest)
+
+    payload = cbor(manifest)
+    bundle = cbor([payload, sign(key_path, payload)])
+    if len(bundle) > BUNDLE_MAX:
+        raise BundleError("bundle is %d bytes, the device takes %d" % (len(bundle), BUNDLE_MAX))
+    return bundle, manifest
+
+
+def verify(key_path, bundle):
+    if len(bundle) > BUNDLE_MAX:
+        raise BundleError("bundle is %d bytes, the device takes %d" % (len(bundle), BUNDLE_MAX))
+    env = cbor_decode(bundle)
+    if (not isinstance(env, list) or len(env) != 2 or not isinstance(env[0], bytes) or
+            not isinstance(env[1], bytes) or len(env[1]) != 64):
+        raise BundleError("envelope is not [payload bstr, signature bstr .size 64]")
+    if not signature_ok(key_path, env[0], env[1]):
+        raise BundleError("signature does not verify with %s" % key_path)
+    manifest = cbor_decode(env[0])
+    check_manifest(manifest)
+    return manifest
+
+
+def summary(manifest, size):
+    return "%d bytes: %d credentials, %d config keys%s" % (
+        size, len(manifest[2]), len(manifest[3]),
+        ", password hash (%d iterations)" % manifest[4][2] if 4 in manifest else "")
+
+
+def c_source(point, key_path):
+    body = ", ".join("0x%02x" % b for b in point)
+    return ("/* Generated by scripts/factory_bundle.py from %s; do not edit */\n"
+            "#include <stdint.h>\n"
+            "#include <stddef.h>\n"
+            "\n"
+            "/* Factory bundle signing key: uncompressed P-256 public point (0x04 || X || Y) */\n"
+            "const uint8_t factory_pub_key[%d] = { %s };\n"
+            "const size_t factory_pub_key_len = %d;\n"
+            % (os.path.basename(key_path), len(point), body, len(point)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("keygen", help="generate a P-256 signing key")
+    p.add_argument("key")
+    p = sub.add_parser("pubkey", help="write the C source embedding the public key")
+    p.add_argument("key")
+    p.add_argument("out")
+    p = sub.add_parser("build", help="build and sign a bundle from a JSON spec")
+    p.add_argument("key")
+    p.add_argument("spec")
+    p.add_argument("out")
+    p = sub.add_parser("verify", help="check a bundle as the device would")
+    p.add_argument("key")
+    p.add_argument("bundle")
+    args = ap.parse_args()
+
+    try:
+        if args.cmd == "keygen":
+            openssl(["genpkey", "-algorithm", "EC", "-pkeyopt", "ec_paramgen_curve:P-256",
+                     "-out", args.key])
+        elif args.cmd == "pubkey":
+            src = c_source(public_point(args.key), args.key)
+            # Leave an unchanged file alone so the firmware does not relink for nothing
+            if not os.path.exists(args.out) or open(args.out).read() != src:
+                with open(args.out, "w") as f:
+                    f.write(src)
+        elif args.cmd == "build":
+            bundle, manifest = build(args.key, args.spec)
+            with open(args.out, "wb") as f:
+                f.write(bundle)
+            print(summary(manifest, len(bundle)))
+        else:
+            with open(args.bundle, "rb") as f:
+                bundle = f.read()
+            print("OK " + summary(verify(args.key, bundle), len(bundle)))
+    except (BundleError, OSError, ValueError, KeyError) as e:
+        print("error: %s" % e, file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
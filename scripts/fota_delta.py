@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""Build and apply delta FOTA patches (format described in src/fota_delta.h).
+
+    fota_delta.py diff  --from-version 1.3.2+1 old.signed.bin new.signed.bin out.patch
+    fota_delta.py apply old.signed.bin in.patch out.bin
+
+"diff" also prints the manifest.txt lines that announce the patch. "apply"
+rebuilds the image exactly as the device does and checks both hashes, so a
+patch can be verified on the host before it is published.
+"""
+
+import argparse
+import hashlib
+import re
+import struct
+import sys
+
+MAGIC = 0x314C4446  # "FDL1"
+HDR = struct.Struct("<IIII32s32s")
+OP_COPY = ord("C")
+OP_DATA = ord("D")
+
+BLOCK = 16          # index granularity in the source image
+MIN_COPY = 24       # shorter matches cost more as a copy op than as literals
+MAX_CANDIDATES = 8  # source offsets kept per block
+
+
+def build_index(src):
+    index = {}
+    for off in range(0, len(src) - BLOCK + 1):
+        offs = index.setdefault(src[off:off + BLOCK], [])
+        if len(offs) < MAX_CANDIDATES:
+            offs.append(off)
+    return index
+
+
+def longest_match(src, dst, pos, candidates):
+    best_off, best_len = 0, 0
+    limit = len(dst) - pos
+    for off in candidates:
+        n = BLOCK
+        top = min(limit, len(src) - off)
+        while n < top and src[off + n] == dst[pos + n]:
+            n += 1
+        if n > best_len:
+            best_off, best_len = off, n
+    return best_off, best_len
+
+
+def diff(src, dst):
+    index = build_index(src)
+    ops = []
+    literal = bytearray()
+    pos = 0
+
+    def flush():
+        if literal:
+            ops.append(struct.pack("<BI", OP_DATA, len(literal)) + bytes(literal))
+            literal.clear()
+
+    while pos < len(dst):
+        candidates = index.get(dst[pos:pos + BLOCK]) if pos + BLOCK <= len(dst) else None
+        if candidates:
+            off, n = longest_match(src, dst, pos, candidates)
+            if n >= MIN_COPY:
+                flush()
+                ops.append(struct.pack("<BII", OP_COPY, off, n))
+                pos += n
+                continue
+        literal.append(dst[pos])
+        pos += 1
+    flush()
+
+    hdr = HDR.pack(MAGIC, len(src), len(dst), 0,
+                   hashlib.sha256(src).digest(), hashlib.sha256(dst).digest())
+    return hdr + b"".join(ops)
+
+
+def apply(src, patch):
+    magic, src_size, dst_size, _, src_sha, dst_sha = HDR.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError("not a delta patch")
+    if src_size != len(src) or hashlib.sha256(src).digest() != src_sha:
+        raise ValueError("patch was made from a different source image")
+
+    out = bytearray()
+    pos = HDR.size
+    while len(out) < dst_size:
+        op = patch[pos]
+        if op == OP_COPY:
+            off, n = struct.unpack_from("<II", patch, pos + 1)
+            if off + n > src_size:
+                raise ValueError("copy outside the source image at %d" % pos)
+            out += src[off:off + n]
+            pos += 9
+        elif op == OP_DATA:
+            (n,) = struct.unpack_from("<I", patch, pos + 1)
+            out += patch[pos + 5:pos + 5 + n]
+            pos += 5 + n
+        else:
+            raise ValueError("unknown op 0x%02x at %d" % (op, pos))
+    if len(out) != dst_size or pos != len(patch):
+        raise ValueError("patch length does not match its header")
+    if hashlib.sha256(out).digest() != dst_sha:
+        raise ValueError("rebuilt image hash mismatch")
+    return bytes(out)
+
+
+def version(text):
+    # Same rule as fota_version_parse(): major.minor.revision[+build]
+    m = re.fullmatch(r"(\d+)\.(\d+)\.(\d+)(?:\+(\d+))?", text)
+    if not m or int(m[1]) > 255 or int(m[2]) > 255 or int(m[3]) > 65535 \
+            or int(m[4] or 0) > 0xFFFFFFFF:
+        raise argparse.ArgumentTypeError("not a major.minor.revision[+build] version: %s" % text)
+    return text
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("diff", help="create a patch from old to new")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("patch")
+    p.add_argument("--from-version", required=True, type=version,
+                   help="version of old, which the device must be running to use the patch")
+    p = sub.add_parser("apply", help="rebuild new from old and a patch")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("out")
+    args = parser.parse_args()
+
+    try:
+        if args.cmd == "diff":
+            src, dst = read(args.old), read(args.new)
+            patch = diff(src, dst)
+            apply(src, patch)
+            with open(args.patch, "wb") as f:
+                f.write(patch)
+            print("%s: %d bytes (%.1f%% of the %d byte image)"
+                  % (args.patch, len(patch), 100.0 * len(patch) / len(dst), len(dst)),
+                  file=sys.stderr)
+            print("size=%d" % len(dst))
+            print("sha256=%s" % hashlib.sha256(dst).hexdigest())
+            print("delta_from=%s" % args.from_version)
+            print("delta=%s" % args.patch.rsplit("/", 1)[-1])
+        else:
+            out = apply(read(args.old), read(args.patch))
+            with open(args.out, "wb") as f:
+                f.write(out)
+            print("%s: %d bytes, hash ok" % (args.out, len(out)), file=sys.stderr)
+    except ValueError as e:
+        sys.exit("error: %s" % e)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""Local HTTP server for FOTA resume tests.
+
+    fota_test_server.py serve ROOT [--port 8080] [--drops 5] [--seed N] [--manifest-delay S]
+    fota_test_server.py check ROOT PATH [--port 8080] [--drops 5] [--seed N] [--manifest-delay S]
+
+"serve" publishes ROOT (manifest.txt, the signed image, delta patches) with
+HTTP range support, the way fota_download and the manifest fetch use it. The
+first --drops responses for files other than manifest.txt are cut off at a
+random byte offset by closing the socket, so the device has to pause, keep
+its checkpoint and resume with a range request. Every request and drop is
+logged with its offsets.
+
+Point the device at it (ota_addr = host:port, file path under ROOT) and run
+a check. A pass ends in FOTA_STATE_UPDATE_PENDING with "Image SHA-256
+verified", with one "Resuming at N bytes, checkpoint of M bytes verified"
+line per drop and no restart from 0. Rebooting the device between drops
+exercises the checkpoint path across a reset.
+
+--manifest-delay holds every manifest.txt response for S seconds before the
+headers go out. Use it with S close to the device's 30 s manifest timeout to
+check that a stalled update check stays on the "fota" work queue: while it
+waits, shell commands (e.g. "kernel uptime") answer at once, MQTT keeps
+publishing, and "kernel threads" shows the system work queue idle.
+
+"check" runs the same server in-process and downloads PATH with a resuming
+client that continues from what it received, then compares the SHA-256.
+With --manifest-delay it also requests manifest.txt first and fails unless
+the image completes while that request is still held. It validates the
+server itself; it does not replace the device run.
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import random
+import re
+import socket
+import sys
+import threading
+import time
+import urllib.request
+
+CHUNK = 1024
+RANGE_RE = re.compile(r"bytes=(\d+)-(\d*)$")
+
+
+class DropState:
+    def __init__(self, drops, seed):
+        self.left = drops
+        self.rng = random.Random(seed)
+        self.lock = threading.Lock()
+
+    def cut(self, length):
+        """Bytes to send before dropping, or None to send everything."""
+        with self.lock:
+            if self.left <= 0 or length < 2:
+                return None
+            self.left -= 1
+            return self.rng.randrange(1, length)
+
+
+def make_handler(root, drops, manifest_delay):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, fmt, *args):
+            sys.stderr.write("[%s] %s\n" % (self.address_string(), fmt % args))
+
+        def do_HEAD(self):
+            self.serve(send_body=False)
+
+        def do_GET(self):
+            self.serve(send_body=True)
+
+        def serve(self, send_body):
+            rel = self.path.split("?", 1)[0].lstrip("/")
+            path = os.path.realpath(os.path.join(root, rel))
+            if not path.startswith(os.path.realpath(root) + os.sep) or not os.path.isfile(path):
+                self.send_error(404)
+                return
+            with open(path, "rb") as f:
+                data = f.read()
+
+            start, end = 0, len(data) - 1
+            rng = self.headers.get("Range")
+            if rng:
+                m = RANGE_RE.match(rng.strip())
+                if not m or int(m.group(1)) >= len(data):
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % len(data))
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                start = int(m.group(1))
+                if m.group(2):
+                    end = min(int(m.group(2)), len(data) - 1)
+                self.send_response(206)
+                self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(data)))
+            else:
+                self.send_response(200)
+            body = data[start:end + 1]
+            is_manifest = os.path.basename(path) == "manifest.txt"
+            if is_manifest and manifest_delay > 0:
+                self.log_message("holding %s for %.1f s", rel, manifest_delay)
+                time.sleep(manifest_delay)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            if not send_body:
+                return
+
+            cut = None if is_manifest else drops.cut(len(body))
+            sent = 0
+            for off in range(0, cut if cut is not None else len(body), CHUNK):
+                stop = min(off + CHUNK, cut if cut is not None else len(body))
+                self.wfile.write(body[off:stop])
+                sent = stop
+            self.wfile.flush()
+            if cut is not None:
+                self.log_message("dropped %s at byte %d of the file (%d of %d sent)",
+                                 rel, start + sent, sent, len(body))
+                self.connection.shutdown(socket.SHUT_RDWR)
+                self.close_connection = True
+
+    return Handler
+
+
+def start_server(root, port, drops, seed, manifest_delay):
+    handler = make_handler(root, DropState(drops, seed), manifest_delay)
+    server = http.server.ThreadingHTTPServer(("", port), handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def check(args):
+    server = start_server(args.root, args.port, args.drops, args.seed, args.manifest_delay)
+    base = "http://127.0.0.1:%d/" % server.server_address[1]
+    url = base + args.path.lstrip("/")
+    expected = open(os.path.join(args.root, args.path), "rb").read()
+    got = bytearray()
+    attempts = 0
+
+    manifest_done = threading.Event()
+    if args.manifest_delay > 0:
+        def fetch_manifest():
+            try:
+                urllib.request.urlopen(base + "manifest.txt").read()
+            except Exception:  # noqa: BLE001 - a 404 still ends the held request
+                pass
+            manifest_done.set()
+        threading.Thread(target=fetch_manifest, daemon=True).start()
+
+    while len(got) < len(expected):
+        attempts += 1
+        if attempts > args.drops + 1:
+            print("FAIL: more attempts than drops")
+            return 1
+        req = urllib.request.Request(url)
+        if got:
+            req.add_header("Range", "bytes=%d-" % len(got))
+        try:
+            with urllib.request.urlopen(req) as r:
+                while True:
+                    buf = r.read(CHUNK)
+                    if not buf:
+                        break
+                    got += buf
+        except Exception as e:  # noqa: BLE001 - any cut-off ends this attempt
+            print("attempt %d stopped at %d bytes: %s" % (attempts, len(got), e.__class__.__name__))
+    if args.manifest_delay > 0 and manifest_done.is_set():
+        print("FAIL: the image waited for the held manifest request")
+        server.shutdown()
+        return 1
+    server.shutdown()
+
+    ok = hashlib.sha256(got).digest() == hashlib.sha256(expected).digest()
+    print("%s: %d bytes in %d attempts" % ("PASS" if ok else "FAIL", len(got), attempts))
+    return 0 if ok else 1
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    for name in ("serve", "check"):
+        p = sub.add_parser(name)
+        p.add_argument("root")
+        if name == "check":
+            p.add_argument("path")
+        p.add_argument("--port", type=int, default=8080 if name == "serve" else 0)
+        p.add_argument("--drops", type=int, default=5, help="responses to cut off")
+        p.add_argument("--seed", type=int, default=None, help="repeat a run's drop offsets")
+        p.add_argument("--manifest-delay", type=float, default=0.0, metavar="S",
+                       help="hold manifest.txt responses for S seconds")
+    args = ap.parse_args()
+
+    if args.cmd == "check":
+        return check(args)
+
+    server = start_server(args.root, args.port, args.drops, args.seed, args.manifest_delay)
+    print("Serving %s on port %d, %d drop(s), manifest delay %.1f s"
+          % (args.root, server.server_address[1], args.drops, args.manifest_delay))
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        server.shutdown()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,431 @@
+#include "config.h"
+#include "bench.h"
+#include "bench_psa.h"
+#include "shell_commands.h"
+#include "encryption_helper.h"
+#include "cfg_nonce.h"
+#include "cfg_mac.h"
+#include "fota.h"
+#include "fota_writer.h"
+#include <string.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <dfu/dfu_target.h>
+#include <dfu/dfu_target_mcuboot.h>
+#include <psa/crypto.h>
+
+LOG_MODULE_REGISTER(bench, LOG_LEVEL_INF);
+
+/*
+ * "bench crypto [reps]": timings for the PSA calls the firmware relies on.
+ * Each row is the mean over reps calls. For AES-GCM the empty-payload row is
+ * the per-call overhead and the slope to the largest payload the throughput.
+ * Everything runs with volatile keys except the store-key row, which only
+ * authenticates a record already in the blob. The PSA rows live in
+ * bench_psa.c; nothing here is counted in the cfg_stats decrypt figures.
+ *
+ * "bench dfu [kib] [net_ms]": a simulated download into the secondary slot,
+ * one BENCH_MAX_PAYLOAD fragment per net_ms of socket wait, with inline erase
+ * and with the erase-ahead writer. "blocked" is the time the writer spent in
+ * dfu_target_write(), i.e. what the downloader thread loses per image. On
+ * native_sim, give the flash simulator realistic erase/write times first.
+ */
+
+extern psa_key_id_t my_key_id;
+
+static uint8_t in_buf[BENCH_MAX_PAYLOAD];
+static uint8_t out_buf[BENCH_MAX_PAYLOAD + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH];
+
+static uint32_t mean_us(uint32_t cycles, int reps)
+{
+    return k_cyc_to_us_floor32(cycles / reps);
+}
+
+static void bench_transition(const struct shell *sh, int reps)
+{
+    uint32_t us;
+
+    if (bench_psa_transition(reps, &us) == 0) {
+        shell_print(sh, "NS->S round trip (psa_framework_version): %u us", us);
+    } else {
+        shell_print(sh, "NS->S round trip: n/a (no TF-M)");
+    }
+}
+
+static int bench_aead(const struct shell *sh, psa_key_id_t key, int reps)
+{
+    struct bench_aead_row rows[BENCH_AEAD_ROWS];
+
+    int err = bench_psa_aead(key, reps, rows);
+    if (err) {
+        shell_error(sh, "AES-GCM failed: %d", err);
+        return err;
+    }
+
+    shell_print(sh, "AES-256-GCM      bytes    enc us   dec us   enc KiB/s  dec KiB/s");
+    for (int s = 0; s < BENCH_AEAD_ROWS; s++) {
+        shell_print(sh, "                 %5u  %8u %8u   %9u  %9u", (unsigned)rows[s].len,
+                    rows[s].enc_us, rows[s].dec_us, bench_kib_per_s(rows[s].len, rows[s].enc_us),
+                    bench_kib_per_s(rows[s].len, rows[s].dec_us));
+    }
+
+    const struct bench_aead_row *first = &rows[0], *last = &rows[BENCH_AEAD_ROWS - 1];
+    shell_print(sh, "  per-call overhead: enc %u us, dec %u us", first->enc_us, first->dec_us);
+    shell_print(sh, "  marginal throughput: enc %u KiB/s, dec %u KiB/s",
+                bench_kib_per_s(last->len, last->enc_us - MIN(first->enc_us, last->enc_us)),
+                bench_kib_per_s(last->len, last->dec_us - MIN(first->dec_us, last->dec_us)));
+    return 0;
+}
+
+/* cfg_entry_check() neither keeps the plaintext nor counts in the production stats */
+static int time_check(const ConfigEntry *e, psa_key_id_t key, int reps, uint32_t *us)
+{
+    int err = 0;
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps && !err; i++) {
+        err = cfg_entry_check(e, key, NULL);
+    }
+    *us = mean_us(k_cycle_get_32() - t0, reps);
+    return err;
+}
+
+/*
+ * Record decrypt with the store key: persistent id vs. the cached slot. Only
+ * authenticates a record already in the blob, so the store key never
+ * encrypts anything here.
+ */
+static int bench_persistent_key(const struct shell *sh, int reps)
+{
+    const ConfigEntry *e = NULL;
+    uint32_t persistent_us, cached_us;
+    size_t len = 0;
+
+    for (int i = 0; i < num_entries; i++) {
+        if (cfg_entry_check(&entries[i], my_key_id, &len) == 0) {
+            e = &entries[i];
+            break;
+        }
+    }
+    if (!e) {
+        shell_warn(sh, "No record decrypts under store key 0x%08x", my_key_id);
+        return 0;
+    }
+
+    int err = time_check(e, my_key_id, reps, &persistent_us);
+    if (!err) {
+        psa_key_id_t k = cfg_key_get();
+        err = time_check(e, k, reps, &cached_us);
+        cfg_key_put(k);
+    }
+    if (err) {
+        shell_error(sh, "Store key decrypt failed: %d", err);
+        return err;
+    }
+
+    shell_print(sh, "AES-GCM dec %u B record, store key 0x%08x: %u us persistent id, %u us cached (%d us)",
+                (unsigned)len, my_key_id, persistent_us, cached_us,
+                (int)cached_us - (int)persistent_us);
+    return 0;
+}
+
+static int bench_pbkdf2(const struct shell *sh)
+{
+    uint32_t one_us, per_iter_ns;
+
+    int err = bench_psa_pbkdf2(&one_us, &per_iter_ns);
+    if (err) {
+        shell_error(sh, "PBKDF2 failed: %d", err);
+        return err;
+    }
+
+    shell_print(sh, "PBKDF2-HMAC-SHA256: %u ns/iteration, %u us fixed; %u iterations = %u ms",
+                per_iter_ns, one_us, PBKDF2_ITERATIONS,
+                (uint32_t)(((uint64_t)per_iter_ns * PBKDF2_ITERATIONS) / 1000000U));
+    return 0;
+}
+
+static int bench_hmac(const struct shell *sh, int reps)
+{
+    for (size_t len = 64; len <= BENCH_MAX_PAYLOAD; len *= 16) {
+        uint32_t us;
+        int err = bench_psa_hmac(len, reps, &us);
+        if (err) {
+            shell_error(sh, "HMAC-SHA256 at %u bytes failed: %d", (unsigned)len, err);
+            return err;
+        }
+        shell_print(sh, "HMAC-SHA256 %4u B: %u us (%u KiB/s)", (unsigned)len, us, bench_kib_per_s(len, us));
+    }
+    return 0;
+}
+
+static int bench_sha3(const struct shell *sh, int reps)
+{
+    for (size_t len = 64; len <= BENCH_MAX_PAYLOAD; len *= 16) {
+        uint32_t us;
+        int err = bench_psa_sha3(len, reps, &us);
+        if (err == -ENOTSUP) {
+            shell_warn(sh, "SHA3-256 not available");
+            return 0;
+        }
+        if (err) {
+            shell_error(sh, "SHA3-256 at %u bytes failed: %d", (unsigned)len, err);
+            return err;
+        }
+        shell_print(sh, "SHA3-256    %4u B: %u us (%u KiB/s)", (unsigned)len, us, bench_kib_per_s(len, us));
+    }
+    return 0;
+}
+
+static int bench_random(const struct shell *sh, int reps)
+{
+    static const size_t sizes[] = { 16, 256 };
+
+    for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+        uint32_t us;
+        int err = bench_psa_random(sizes[s], reps, &us);
+        if (err) {
+            shell_error(sh, "generate_random %u B failed: %d", (unsigned)sizes[s], err);
+            return err;
+        }
+        shell_print(sh, "generate_random %3u B: %u us", (unsigned)sizes[s], us);
+    }
+    return 0;
+}
+
+/*
+ * Boot-time blob authentication: one HMAC pass versus authenticating every
+ * entry, chunked ones included, under whichever key holds it.
+ */
+static int bench_blob_auth(const struct shell *sh, int reps)
+{
+    int err = 0, n = 0;
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps && !err; i++) {
+        err = cfg_mac_verify();
+    }
+    uint32_t mac_us = mean_us(k_cycle_get_32() - t0, reps);
+    if (err) {
+        shell_error(sh, "Blob HMAC failed: %d", err);
+        return err;
+    }
+
+    psa_key_id_t cur = cfg_key_get(), prev = cfg_key_get_prev();
+    t0 = k_cycle_get_32();
+    for (int r = 0; r < reps && !err; r++) {
+        for (int i = 0; i < num_entries && !err; i++) {
+            err = cfg_entry_check(&entries[i], cur, NULL);
+            if (err == -EBADMSG && prev != PSA_KEY_ID_NULL) {
+                err = cfg_entry_check(&entries[i], prev, NULL);
+            }
+            n++;
+        }
+    }
+    uint32_t dec_us = mean_us(k_cycle_get_32() - t0, reps);
+    cfg_key_put(cur);
+    cfg_key_put(prev);
+    if (err) {
+        /* Torn copies left by an interrupted compaction fail here; the timing would be short */
+        shell_error(sh, "Entry %d did not authenticate: %d", (n - 1) % MAX(num_entries, 1), err);
+        return err;
+    }
+
+    shell_print(sh, "Blob HMAC %u B: %u us; full decrypt pass (%d entries): %u us",
+                (unsigned)CFG_MAC_OFFSET, mac_us, reps ? n / reps : 0, dec_us);
+    return 0;
+}
+
+/* One provisioning-sized field: IV + AES-GCM of BENCH_FIELD_LEN bytes under a short AAD */
+static int provision_fields(psa_key_id_t key, bool counter, int fields, uint32_t *us)
+{
+    static const uint8_t aad[] = "bench.field";
+    uint8_t iv[NRF_CRYPTO_EXAMPLE_AES_IV_SIZE];
+    size_t olen;
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < fields; i++) {
+        if (counter) {
+            int err = cfg_nonce_next(key, iv, sizeof(iv));
+            if (err) return err;
+        } else if (psa_generate_random(iv, sizeof(iv)) != PSA_SUCCESS) {
+            return -EIO;
+        }
+        if (psa_aead_encrypt(key, PSA_ALG_GCM, iv, sizeof(iv), aad, sizeof(aad) - 1,
+                             in_buf, BENCH_FIELD_LEN, out_buf, sizeof(out_buf), &olen) != PSA_SUCCESS) {
+            return -EIO;
+        }
+    }
+    *us = mean_us(k_cycle_get_32() - t0, fields);
+    return 0;
+}
+
+/*
+ * "bench nonce [fields]": bulk-provisioning cost per field with random IVs
+ * versus counter IVs. The counter belongs to the volatile scratch key and its
+ * ITS record is removed afterwards; the store key's counter is not touched
+ * beyond its cached block being reloaded on the next write.
+ */
+static int cmd_bench_nonce(const struct shell *sh, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    int fields = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_FIELDS;
+    if (fields <= 0) {
+        shell_error(sh, "Usage: bench nonce [fields]");
+        return -EINVAL;
+    }
+
+    psa_key_id_t aes;
+    psa_status_t st = bench_key_volatile(PSA_KEY_TYPE_AES, PSA_ALG_GCM,
+                                         PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT, 256, &aes);
+    if (st != PSA_SUCCESS) {
+        shell_error(sh, "AES key import failed: %d", st);
+        return -EIO;
+    }
+    memset(in_buf, 0xA5, BENCH_FIELD_LEN);
+
+    uint32_t random_us = 0, counter_us = 0;
+    int err = provision_fields(aes, false, fields, &random_us);
+    if (!err) err = provision_fields(aes, true, fields, &counter_us);
+    int forget_err = cfg_nonce_forget(aes);
+    psa_destroy_key(aes);
+    if (!err) err = forget_err;
+    memset(out_buf, 0, sizeof(out_buf));
+
+    if (err) {
+        shell_error(sh, "Benchmark failed: %d", err);
+        return err;
+    }
+
+    shell_print(sh, "Bulk provision, %d fields of %d B (block of %d counters per ITS write)",
+                fields, BENCH_FIELD_LEN, CFG_NONCE_BLOCK);
+    shell_print(sh, "random IV : %u us/field", random_us);
+    shell_print(sh, "counter IV: %u us/field", counter_us);
+    if (counter_us) {
+        shell_print(sh, "speedup   : %u.%02ux", random_us / counter_us,
+                    (unsigned)(((uint64_t)(random_us % counter_us) * 100) / counter_us));
+    }
+    return 0;
+}
+
+static void dfu_bench_evt(enum dfu_target_evt_id evt_id)
+{
+    ARG_UNUSED(evt_id);
+}
+
+static int bench_dfu_run(const struct shell *sh, uint32_t ahead, size_t bytes, uint32_t net_ms)
+{
+    static uint8_t stream_buf[BENCH_MAX_PAYLOAD] __aligned(4);
+    uint32_t blocked_us = 0, worst_us = 0;
+
+    int err = fota_writer_set_ahead(ahead);
+    if (err) return err;
+
+    dfu_target_mcuboot_reset();
+    err = dfu_target_mcuboot_set_buf(stream_buf, sizeof(stream_buf));
+    if (!err) err = dfu_target_init(DFU_TARGET_IMAGE_TYPE_MCUBOOT, 0, bytes, dfu_bench_evt);
+    if (err) return err;
+
+    int64_t t0 = k_uptime_get();
+    for (size_t done = 0; !err && done < bytes; done += BENCH_MAX_PAYLOAD) {
+        /* The socket wait an erase-ahead writer can use */
+        k_sleep(K_MSEC(net_ms));
+
+        uint32_t c0 = k_cycle_get_32();
+        err = dfu_target_write(in_buf, MIN(BENCH_MAX_PAYLOAD, bytes - done));
+        uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - c0);
+        blocked_us += us;
+        worst_us = MAX(worst_us, us);
+    }
+    uint32_t total_ms = (uint32_t)(k_uptime_get() - t0);
+    dfu_target_reset();
+
+    if (err) return err;
+    shell_print(sh, "%-12s total %6u ms  blocked %6u ms  longest write %7u us",
+                ahead ? "erase-ahead" : "inline", total_ms, blocked_us / 1000U, worst_us);
+    return 0;
+}
+
+static int cmd_bench_dfu(const struct shell *sh, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    int kib = (argc > 1) ? atoi(argv[1]) : BENCH_DFU_KIB;
+    int net_ms = (argc > 2) ? atoi(argv[2]) : BENCH_DFU_NET_MS;
+    if (kib <= 0 || net_ms < 0) {
+        shell_error(sh, "Usage: bench dfu [kib] [net_ms]");
+        return -EINVAL;
+    }
+
+    /* The run overwrites the secondary slot */
+    if (fota_writer_busy() || fota_slot_in_use()) {
+        shell_error(sh, "Secondary slot in use (download running or update pending)");
+        return -EBUSY;
+    }
+
+    uint32_t ahead = fota_writer_get_ahead();
+    memset(in_buf, 0xA5, BENCH_MAX_PAYLOAD);
+    shell_print(sh, "DFU write benchmark, %d KiB in %d B fragments, %d ms network wait each, %u pages ahead",
+                kib, BENCH_MAX_PAYLOAD, net_ms, ahead ? ahead : FOTA_ERASE_AHEAD_PAGES);
+
+    int err = bench_dfu_run(sh, 0, (size_t)kib * 1024U, net_ms);
+    if (!err) err = bench_dfu_run(sh, ahead ? ahead : FOTA_ERASE_AHEAD_PAGES, (size_t)kib * 1024U, net_ms);
+    fota_writer_set_ahead(ahead);
+    dfu_target_mcuboot_reset();
+
+    if (err) {
+        shell_error(sh, "Benchmark failed: %d", err);
+    }
+    return err;
+}
+
+static int cmd_bench_crypto(const struct shell *sh, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    int reps = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_REPS;
+    if (reps <= 0) {
+        shell_error(sh, "Usage: bench crypto [reps]");
+        return -EINVAL;
+    }
+
+    psa_key_id_t aes;
+    psa_status_t st = bench_key_volatile(PSA_KEY_TYPE_AES, PSA_ALG_GCM,
+                                         PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT, 256, &aes);
+    if (st != PSA_SUCCESS) {
+        shell_error(sh, "AES key import failed: %d", st);
+        return -EIO;
+    }
+
+    shell_print(sh, "Crypto benchmark, %d reps per row (cycle timer %u Hz)", reps,
+                sys_clock_hw_cycles_per_sec());
+
+    bench_transition(sh, reps);
+    int err = bench_aead(sh, aes, reps);
+    psa_destroy_key(aes);
+    if (err) return err;
+
+    err = bench_persistent_key(sh, reps);
+    if (!err) err = bench_blob_auth(sh, reps);
+    if (!err) err = bench_pbkdf2(sh);
+    if (!err) err = bench_hmac(sh, reps);
+    if (!err) err = bench_sha3(sh, reps);
+    if (!err) err = bench_random(sh, reps);
+    return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(bench_cmds,
+    SHELL_CMD_ARG(crypto, NULL, "Time PSA crypto calls: bench crypto [reps]", cmd_bench_crypto, 1, 1),
+    SHELL_CMD_ARG(nonce, NULL, "Random vs counter IVs for bulk provisioning: bench nonce [fields]",
+                  cmd_bench_nonce, 1, 1),
+    SHELL_CMD_ARG(dfu, NULL, "Inline vs erase-ahead secondary slot writes: bench dfu [kib] [net_ms]",
+                  cmd_bench_dfu, 1, 2),
+    SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(bench, &bench_cmds, "Benchmarks (auth)", NULL);
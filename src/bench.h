@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Default repetitions per measurement for "bench crypto" */
+#define BENCH_DEFAULT_REPS   20
+#define BENCH_MAX_PAYLOAD    1024
+/* PBKDF2 is timed at 1 and at this many iterations; the slope is the per-iteration cost */
+#define BENCH_PBKDF2_ITERS   1000
+/* "bench nonce": fields encrypted per IV mode and the size of each */
+#define BENCH_DEFAULT_FIELDS 200
+#define BENCH_FIELD_LEN      32
+/* "bench dfu": simulated image size and socket wait per fragment (about LTE-M rates) */
+#define BENCH_DFU_KIB        128
+#define BENCH_DFU_NET_MS     20
+
+#endif /* BENCH_H */
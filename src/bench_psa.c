@@ -0,0 +1,188 @@
+#include "config.h"
+#include "bench.h"
+#include "bench_psa.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#ifdef CONFIG_BUILD_WITH_TFM
+#include <psa/client.h>
+#endif
+
+const size_t bench_aead_sizes[BENCH_AEAD_ROWS] = { 0, 16, 64, 256, BENCH_MAX_PAYLOAD };
+
+static uint8_t in_buf[BENCH_MAX_PAYLOAD + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH];
+static uint8_t out_buf[BENCH_MAX_PAYLOAD + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH];
+
+static uint32_t mean_us(uint32_t cycles, int reps)
+{
+    return k_cyc_to_us_floor32(cycles / reps);
+}
+
+static int status_err(psa_status_t st)
+{
+    if (st == PSA_SUCCESS) return 0;
+    return (st == PSA_ERROR_NOT_SUPPORTED) ? -ENOTSUP : -EIO;
+}
+
+uint32_t bench_kib_per_s(size_t bytes, uint32_t us)
+{
+    return us ? (uint32_t)(((uint64_t)bytes * 1000000U / us) / 1024U) : 0;
+}
+
+psa_status_t bench_key_volatile(psa_key_type_t type, psa_algorithm_t alg,
+                                psa_key_usage_t usage, size_t bits, psa_key_id_t *id)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    uint8_t key[32];
+
+    if (bits / 8 > sizeof(key)) return PSA_ERROR_INVALID_ARGUMENT;
+
+    psa_status_t st = psa_generate_random(key, bits / 8);
+    if (st != PSA_SUCCESS) return st;
+
+    psa_set_key_type(&attr, type);
+    psa_set_key_algorithm(&attr, alg);
+    psa_set_key_usage_flags(&attr, usage);
+    psa_set_key_bits(&attr, bits);
+    psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+
+    st = psa_import_key(&attr, key, bits / 8, id);
+    psa_reset_key_attributes(&attr);
+    memset(key, 0, sizeof(key));
+    return st;
+}
+
+int bench_psa_transition(int reps, uint32_t *us)
+{
+#ifdef CONFIG_BUILD_WITH_TFM
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps; i++) {
+        (void)psa_framework_version();
+    }
+    *us = mean_us(k_cycle_get_32() - t0, reps);
+    return 0;
+#else
+    ARG_UNUSED(reps);
+    ARG_UNUSED(us);
+    return -ENOTSUP;
+#endif
+}
+
+int bench_psa_aead(psa_key_id_t key, int reps, struct bench_aead_row rows[BENCH_AEAD_ROWS])
+{
+    uint8_t iv[NRF_CRYPTO_EXAMPLE_AES_IV_SIZE] = {0};
+    size_t olen, clen = 0;
+
+    memset(in_buf, 0xA5, sizeof(in_buf));
+
+    for (int s = 0; s < BENCH_AEAD_ROWS; s++) {
+        size_t len = bench_aead_sizes[s];
+        psa_status_t st = PSA_SUCCESS;
+
+        uint32_t t0 = k_cycle_get_32();
+        for (int i = 0; i < reps && st == PSA_SUCCESS; i++) {
+            st = psa_aead_encrypt(key, PSA_ALG_GCM, iv, sizeof(iv), NULL, 0,
+                                  in_buf, len, out_buf, sizeof(out_buf), &clen);
+        }
+        rows[s].enc_us = mean_us(k_cycle_get_32() - t0, reps);
+        if (st != PSA_SUCCESS) return status_err(st);
+
+        t0 = k_cycle_get_32();
+        for (int i = 0; i < reps && st == PSA_SUCCESS; i++) {
+            st = psa_aead_decrypt(key, PSA_ALG_GCM, iv, sizeof(iv), NULL, 0,
+                                  out_buf, clen, in_buf, sizeof(in_buf), &olen);
+        }
+        rows[s].dec_us = mean_us(k_cycle_get_32() - t0, reps);
+        if (st != PSA_SUCCESS) return status_err(st);
+        if (olen != len) return -EIO;
+
+        rows[s].len = len;
+    }
+    return 0;
+}
+
+static psa_status_t pbkdf2_once(uint32_t iters)
+{
+    static const uint8_t pw[] = "benchmark";
+    uint8_t salt[PBKDF2_SALT_LEN] = {0};
+    psa_key_derivation_operation_t op = PSA_KEY_DERIVATION_OPERATION_INIT;
+    psa_status_t st;
+
+    st = psa_key_derivation_setup(&op, PSA_ALG_PBKDF2_HMAC(PSA_ALG_SHA_256)); if (st) goto done;
+    st = psa_key_derivation_input_integer(&op, PSA_KEY_DERIVATION_INPUT_COST, iters); if (st) goto done;
+    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_SALT, salt, sizeof(salt)); if (st) goto done;
+    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_PASSWORD, pw, sizeof(pw) - 1); if (st) goto done;
+    st = psa_key_derivation_output_bytes(&op, out_buf, PBKDF2_HASH_LEN);
+done:
+    psa_key_derivation_abort(&op);
+    return st;
+}
+
+int bench_psa_pbkdf2(uint32_t *fixed_us, uint32_t *per_iter_ns)
+{
+    uint32_t t0 = k_cycle_get_32();
+    psa_status_t st = pbkdf2_once(1);
+    uint32_t one_us = k_cyc_to_us_floor32(k_cycle_get_32() - t0);
+    if (st != PSA_SUCCESS) return status_err(st);
+
+    t0 = k_cycle_get_32();
+    st = pbkdf2_once(BENCH_PBKDF2_ITERS);
+    uint32_t many_us = k_cyc_to_us_floor32(k_cycle_get_32() - t0);
+    if (st != PSA_SUCCESS) return status_err(st);
+
+    *fixed_us = one_us;
+    *per_iter_ns = (uint32_t)(((uint64_t)(many_us - MIN(one_us, many_us)) * 1000U) /
+                              (BENCH_PBKDF2_ITERS - 1));
+    return 0;
+}
+
+int bench_psa_hmac(size_t len, int reps, uint32_t *us)
+{
+    psa_key_id_t key;
+    size_t mac_len;
+
+    if (len > BENCH_MAX_PAYLOAD) return -EINVAL;
+
+    psa_status_t st = bench_key_volatile(PSA_KEY_TYPE_HMAC, PSA_ALG_HMAC(PSA_ALG_SHA_256),
+                                         PSA_KEY_USAGE_SIGN_MESSAGE, 256, &key);
+    if (st != PSA_SUCCESS) return status_err(st);
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps && st == PSA_SUCCESS; i++) {
+        st = psa_mac_compute(key, PSA_ALG_HMAC(PSA_ALG_SHA_256), in_buf, len,
+                             out_buf, PSA_HASH_LENGTH(PSA_ALG_SHA_256), &mac_len);
+    }
+    *us = mean_us(k_cycle_get_32() - t0, reps);
+
+    psa_destroy_key(key);
+    return status_err(st);
+}
+
+int bench_psa_sha3(size_t len, int reps, uint32_t *us)
+{
+    psa_status_t st = PSA_SUCCESS;
+    size_t hash_len;
+
+    if (len > BENCH_MAX_PAYLOAD) return -EINVAL;
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps && st == PSA_SUCCESS; i++) {
+        st = psa_hash_compute(PSA_ALG_SHA3_256, in_buf, len, out_buf, 32, &hash_len);
+    }
+    *us = mean_us(k_cycle_get_32() - t0, reps);
+    return status_err(st);
+}
+
+int bench_psa_random(size_t len, int reps, uint32_t *us)
+{
+    psa_status_t st = PSA_SUCCESS;
+
+    if (len > sizeof(out_buf)) return -EINVAL;
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < reps && st == PSA_SUCCESS; i++) {
+        st = psa_generate_random(out_buf, len);
+    }
+    *us = mean_us(k_cycle_get_32() - t0, reps);
+    return status_err(st);
+}
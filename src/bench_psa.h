@@ -0,0 +1,40 @@
+#ifndef BENCH_PSA_H
+#define BENCH_PSA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <psa/crypto.h>
+
+/*
+ * PSA timings behind "bench crypto", kept free of the shell and the config
+ * store so tests/bench can run them on native_sim with the software driver.
+ * Every call checks each PSA status: 0 on success, -EIO if any iteration
+ * failed (nothing is reported for a failed row), -ENOTSUP if the algorithm
+ * is not built in. Times are means over reps calls.
+ */
+
+/* AES-256-GCM payload sizes; row 0 (empty) is the per-call overhead */
+#define BENCH_AEAD_ROWS 5
+extern const size_t bench_aead_sizes[BENCH_AEAD_ROWS];
+
+struct bench_aead_row {
+    size_t len;
+    uint32_t enc_us;
+    uint32_t dec_us;
+};
+
+uint32_t bench_kib_per_s(size_t bytes, uint32_t us);
+
+/* Random volatile key, never stored; destroy it with psa_destroy_key() */
+psa_status_t bench_key_volatile(psa_key_type_t type, psa_algorithm_t alg,
+                                psa_key_usage_t usage, size_t bits, psa_key_id_t *id);
+
+int bench_psa_transition(int reps, uint32_t *us);
+int bench_psa_aead(psa_key_id_t key, int reps, struct bench_aead_row rows[BENCH_AEAD_ROWS]);
+/* Cost at 1 iteration and the slope up to BENCH_PBKDF2_ITERS */
+int bench_psa_pbkdf2(uint32_t *fixed_us, uint32_t *per_iter_ns);
+int bench_psa_hmac(size_t len, int reps, uint32_t *us);
+int bench_psa_sha3(size_t len, int reps, uint32_t *us);
+int bench_psa_random(size_t len, int reps, uint32_t *us);
+
+#endif /* BENCH_PSA_H */
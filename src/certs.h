@@ -10,4 +10,6 @@ extern const uint8_t aes_key[];
 extern const size_t ca_cert_len;
 extern const size_t public_cert_len;
 extern const size_t private_key_len;
+extern const uint8_t factory_pub_key[];
+extern const size_t factory_pub_key_len;
 #endif
@@ -0,0 +1,133 @@
+#include "config.h"
+#include "cfg_its.h"
+#include "cfg_maint.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <psa/internal_trusted_storage.h>
+
+LOG_MODULE_REGISTER(cfg_its, LOG_LEVEL_INF);
+
+#define TAG_LEN  NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH
+
+/* Keys read on every login / reconnect; UID = CFG_ITS_UID_BASE + index */
+static const char *const hot_keys[] = {
+    "mq_pass",
+    "ota_pass",
+    PBKDF2_REF_KEY,
+};
+
+struct its_obj {
+    uint8_t tag[TAG_LEN];
+    char value[DECRYPTED_OUTPUT_MAX];
+};
+
+static int policy_index(const char *key)
+{
+    for (int i = 0; i < ARRAY_SIZE(hot_keys); i++) {
+        if (strcmp(key, hot_keys[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* Compare a mirrored tag with the record's, which may sit in a continuation slot */
+static bool tag_matches(const ConfigEntry *e, const uint8_t *tag)
+{
+    uint8_t cur[TAG_LEN];
+
+    return e && cfg_entry_tag(e, cur) == 0 && memcmp(tag, cur, TAG_LEN) == 0;
+}
+
+const char *cfg_its_policy_key(int index)
+{
+    return (index >= 0 && index < ARRAY_SIZE(hot_keys)) ? hot_keys[index] : NULL;
+}
+
+bool cfg_its_is_hot(const char *key)
+{
+    return IS_ENABLED(CFG_ITS_TIER_ENABLED) && policy_index(key) >= 0;
+}
+
+static int load_obj(int idx, struct its_obj *obj, size_t *value_len)
+{
+    size_t len = 0;
+    psa_status_t st = psa_its_get(CFG_ITS_UID_BASE + idx, 0, sizeof(*obj), obj, &len);
+
+    if (st == PSA_ERROR_DOES_NOT_EXIST) return -ENOENT;
+    if (st != PSA_SUCCESS || len < TAG_LEN) return -EIO;
+
+    *value_len = len - TAG_LEN;
+    return 0;
+}
+
+int cfg_its_get(const char *key, const ConfigEntry *e, char *out, size_t out_size, size_t *out_len)
+{
+    struct its_obj obj;
+    size_t len;
+
+    if (!cfg_its_is_hot(key) || !e || e->ciphertext_len < TAG_LEN) return -ENOENT;
+
+    int err = load_obj(policy_index(key), &obj, &len);
+    if (err) return err;
+
+    if (!tag_matches(e, obj.tag)) {
+        LOG_DBG("ITS copy of '%s' is stale", key);
+        err = -ESTALE;
+    } else if (len >= out_size) {
+        err = -ENOBUFS;
+    } else {
+        memcpy(out, obj.value, len);
+        out[len] = '\0';
+        *out_len = len;
+    }
+
+    memset(&obj, 0, sizeof(obj));
+    return err;
+}
+
+void cfg_its_put(const char *key, const ConfigEntry *e, const char *value, size_t len)
+{
+    struct its_obj obj;
+
+    if (!cfg_its_is_hot(key) || !e || len > sizeof(obj.value) || cfg_entry_tag(e, obj.tag)) {
+        return;
+    }
+
+    memcpy(obj.value, value, len);
+
+    psa_status_t st = psa_its_set(CFG_ITS_UID_BASE + policy_index(key), TAG_LEN + len,
+                                  &obj, PSA_STORAGE_FLAG_NONE);
+    if (st != PSA_SUCCESS) {
+        LOG_WRN("Mirroring '%s' to ITS failed (psa_status: %d)", key, st);
+    }
+
+    memset(&obj, 0, sizeof(obj));
+}
+
+void cfg_its_remove(const char *key)
+{
+    if (!cfg_its_is_hot(key)) return;
+
+    psa_status_t st = psa_its_remove(CFG_ITS_UID_BASE + policy_index(key));
+    if (st != PSA_SUCCESS && st != PSA_ERROR_DOES_NOT_EXIST) {
+        LOG_WRN("Removing '%s' from ITS failed (psa_status: %d)", key, st);
+    }
+}
+
+int cfg_its_state(const char *key)
+{
+    struct its_obj obj;
+    size_t len;
+
+    int idx = policy_index(key);
+    if (idx < 0) return -EINVAL;
+
+    int err = load_obj(idx, &obj, &len);
+    if (err) return err;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    int fresh = tag_matches(cfg_find_entry(key), obj.tag);
+    k_mutex_unlock(&cfg_blob_lock);
+    memset(&obj, 0, sizeof(obj));
+    return fresh;
+}
@@ -0,0 +1,25 @@
+#ifndef CFG_ITS_H
+#define CFG_ITS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Hot tier: selected keys are mirrored as individual psa_its objects so hot
+ * reads skip the blob AEAD. The blob stays the source of truth; each object
+ * carries the GCM tag of the record it was taken from and is ignored once
+ * that no longer matches entries[].
+ */
+#define CFG_ITS_TIER_ENABLED  1
+#define CFG_ITS_UID_BASE      0xC0F10000ULL
+
+bool cfg_its_is_hot(const char *key);
+int cfg_its_get(const char *key, const ConfigEntry *e, char *out, size_t out_size, size_t *out_len);
+void cfg_its_put(const char *key, const ConfigEntry *e, const char *value, size_t len);
+void cfg_its_remove(const char *key);
+
+/* Per-key state for the shell: 1 fresh, 0 stale, -ENOENT not mirrored */
+int cfg_its_state(const char *key);
+const char *cfg_its_policy_key(int index);
+
+#endif /* CFG_ITS_H */
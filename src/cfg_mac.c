@@ -0,0 +1,397 @@
+#include "config.h"
+#include "cfg_mac.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <psa/internal_trusted_storage.h>
+
+LOG_MODULE_REGISTER(cfg_mac, LOG_LEVEL_INF);
+
+#define MAC_ALG        PSA_ALG_HMAC(PSA_ALG_SHA_256)
+#define SEAL_MAGIC     0x324C4553u   /* "SEL2": one MAC per body page */
+#define SEAL_MAGIC_V1  0x4C414553u   /* "SEAL": one MAC over the whole body */
+#define MAC_PAGES      DIV_ROUND_UP(CFG_MAC_OFFSET, FLASH_PAGE_SIZE)
+#define ALL_PAGES      ((uint8_t)BIT_MASK(MAC_PAGES))
+
+BUILD_ASSERT(MAC_PAGES <= 8, "open_pages is a uint8_t bitmap");
+
+/* Pending-update flag of the previous scheme; an interrupted legacy update is not trusted */
+#define LEGACY_PENDING_UID  0xC0F30000ULL
+
+enum seal_state {
+    SEAL_COMMITTED    = 0,   /* every page MAC describes flash */
+    SEAL_OPEN         = 1,   /* an update is writing open_pages; the other MACs still hold */
+    SEAL_PROVISIONING = 2,   /* the blank blob is being provisioned, nothing to trust yet */
+};
+
+struct cfg_seal {
+    uint32_t magic;
+    uint8_t state;
+    uint8_t open_pages;
+    uint8_t reserved[2];
+    uint8_t mac[MAC_PAGES][CFG_MAC_LEN];
+};
+
+/* ITS record before per-page MACs, migrated by the boot check */
+struct cfg_seal_v1 {
+    uint32_t magic;
+    uint8_t state;           /* 0 committed, 1 pend announced, 2 provisioning */
+    uint8_t reserved[3];
+    uint8_t mac[CFG_MAC_LEN];
+    uint8_t pend[CFG_MAC_LEN];
+};
+
+static bool key_ready;
+static bool key_created;
+/* Set by the boot check; a blob that was not accepted is never parsed or resealed */
+static bool trusted;
+static bool checked;
+static struct cfg_seal seal;
+static struct cfg_seal_v1 seal_v1;
+static uint32_t seal_writes;
+static K_MUTEX_DEFINE(mac_lock);
+
+/* Open the device MAC key, generating it inside the secure side if missing */
+static int ensure_key(void)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t id;
+
+    if (key_ready) return 0;
+
+    psa_status_t st = psa_get_key_attributes(CFG_MAC_KEY_ID, &attr);
+    psa_reset_key_attributes(&attr);
+    if (st == PSA_SUCCESS) {
+        key_ready = true;
+        return 0;
+    }
+    if (st != PSA_ERROR_DOES_NOT_EXIST && st != PSA_ERROR_INVALID_HANDLE) {
+        LOG_ERR("MAC key 0x%08x query failed: %d", CFG_MAC_KEY_ID, st);
+        return -EIO;
+    }
+
+    psa_set_key_id(&attr, CFG_MAC_KEY_ID);
+    psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_PERSISTENT);
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_SIGN_MESSAGE | PSA_KEY_USAGE_VERIFY_MESSAGE);
+    psa_set_key_algorithm(&attr, MAC_ALG);
+    psa_set_key_type(&attr, PSA_KEY_TYPE_HMAC);
+    psa_set_key_bits(&attr, 256);
+
+    st = psa_generate_key(&attr, &id);
+    psa_reset_key_attributes(&attr);
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("MAC key generation failed: %d", st);
+        return -EIO;
+    }
+
+    LOG_INF("Generated blob MAC key 0x%08x", CFG_MAC_KEY_ID);
+    key_ready = true;
+    key_created = true;
+    return 0;
+}
+
+/* HMAC over an optional one-byte label followed by [start, end) of the body as flash reads now */
+static int mac_range(const uint8_t *label, uint32_t start, uint32_t end, uint8_t *mac)
+{
+    psa_mac_operation_t op = PSA_MAC_OPERATION_INIT;
+    size_t mac_len;
+
+    int err = ensure_key();
+    if (err) return err;
+
+    psa_status_t st = psa_mac_sign_setup(&op, CFG_MAC_KEY_ID, MAC_ALG);
+    if (st == PSA_SUCCESS && label) st = psa_mac_update(&op, label, 1);
+    if (st == PSA_SUCCESS) st = psa_mac_update(&op, ENCRYPTED_BLOB_ADDR + start, end - start);
+    if (st == PSA_SUCCESS) st = psa_mac_sign_finish(&op, mac, CFG_MAC_LEN, &mac_len);
+    psa_mac_abort(&op);
+
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Blob MAC failed: %d", st);
+        return -EIO;
+    }
+    return 0;
+}
+
+/* The page index is MACed too, so pages cannot be swapped */
+static int mac_page(int p, uint8_t *mac)
+{
+    uint8_t label = (uint8_t)p;
+    uint32_t start = (uint32_t)p * FLASH_PAGE_SIZE;
+
+    return mac_range(&label, start, MIN(start + FLASH_PAGE_SIZE, CFG_MAC_OFFSET), mac);
+}
+
+/* Single MAC over the whole body: the legacy flash trailer and v1 seals */
+static int mac_body(uint8_t *mac)
+{
+    return mac_range(NULL, 0, CFG_MAC_OFFSET, mac);
+}
+
+static bool mac_equal(const uint8_t *a, const uint8_t *b)
+{
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < CFG_MAC_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+/* 0 for a current seal, 1 for a v1 record left in seal_v1, -ENOENT if there is none */
+static int seal_load(void)
+{
+    static union {
+        struct cfg_seal v2;
+        struct cfg_seal_v1 v1;
+    } buf;
+    size_t len = 0;
+
+    psa_status_t st = psa_its_get(CFG_MAC_SEAL_UID, 0, sizeof(buf), &buf, &len);
+    if (st == PSA_ERROR_DOES_NOT_EXIST) return -ENOENT;
+    if (st == PSA_SUCCESS && len == sizeof(buf.v2) && buf.v2.magic == SEAL_MAGIC) {
+        seal = buf.v2;
+        return 0;
+    }
+    if (st == PSA_SUCCESS && len == sizeof(buf.v1) && buf.v1.magic == SEAL_MAGIC_V1) {
+        seal_v1 = buf.v1;
+        return 1;
+    }
+    LOG_ERR("Blob seal unreadable: %d", st);
+    return -EIO;
+}
+
+static int seal_store(void)
+{
+    seal.magic = SEAL_MAGIC;
+    psa_status_t st = psa_its_set(CFG_MAC_SEAL_UID, sizeof(seal), &seal, PSA_STORAGE_FLAG_NONE);
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Storing blob seal failed: %d", st);
+        return -EIO;
+    }
+    seal_writes++;
+    return 0;
+}
+
+/* Recompute the MACs of the given pages and commit them */
+static int seal_pages(uint8_t pages)
+{
+    for (int p = 0; p < MAC_PAGES; p++) {
+        if (!(pages & BIT(p))) continue;
+        int err = mac_page(p, seal.mac[p]);
+        if (err) return err;
+    }
+    seal.state = SEAL_COMMITTED;
+    seal.open_pages = 0;
+    return seal_store();
+}
+
+/* 0 if every page matches its MAC, 1 if only the pages of an open update differ or may */
+static int match_seal(void)
+{
+    uint8_t now[CFG_MAC_LEN];
+
+    if (seal.state == SEAL_PROVISIONING) return -EBADMSG;
+
+    uint8_t skip = (seal.state == SEAL_OPEN) ? seal.open_pages : 0;
+    for (int p = 0; p < MAC_PAGES; p++) {
+        if (skip & BIT(p)) continue;
+        int err = mac_page(p, now);
+        if (err) return err;
+        if (!mac_equal(now, seal.mac[p])) return -EBADMSG;
+    }
+    return skip ? 1 : 0;
+}
+
+/* A v1 seal is trusted like before (committed or announced MAC) and then split into pages */
+static int match_v1(void)
+{
+    uint8_t now[CFG_MAC_LEN];
+
+    if (seal_v1.state == SEAL_PROVISIONING) return -EBADMSG;
+
+    int err = mac_body(now);
+    if (err) return err;
+    if (mac_equal(now, seal_v1.mac)) return 0;
+    if (seal_v1.state == 1 && mac_equal(now, seal_v1.pend)) return 0;
+    return -EBADMSG;
+}
+
+static int migrate_v1(void)
+{
+    if (seal_v1.state == SEAL_PROVISIONING) {
+        /* Keep the marker so the cut-off provisioning is redone */
+        memset(&seal, 0, sizeof(seal));
+        seal.state = SEAL_PROVISIONING;
+        return seal_store();
+    }
+
+    int err = match_v1();
+    if (err) {
+        LOG_ERR("Blob does not match its v1 seal");
+        return err;
+    }
+    err = seal_pages(ALL_PAGES);
+    if (!err) {
+        LOG_INF("Blob seal moved to per-page MACs");
+    }
+    return err;
+}
+
+/* No seal in ITS yet: only a fresh key or a blob still carrying a valid flash MAC is adopted */
+static int adopt_locked(void)
+{
+    uint8_t now[CFG_MAC_LEN];
+    uint8_t flag;
+    size_t len = 0;
+
+    if (key_created) {
+        LOG_INF("Blob MAC key is new, sealing the blob");
+        return seal_pages(ALL_PAGES);
+    }
+
+    int err = mac_body(now);
+    if (err) return err;
+
+    if (!mac_equal(now, ENCRYPTED_BLOB_ADDR + CFG_MAC_OFFSET)) {
+        if (psa_its_get(LEGACY_PENDING_UID, 0, sizeof(flag), &flag, &len) == PSA_SUCCESS) {
+            LOG_ERR("Blob MAC stale after an interrupted legacy update, not trusted");
+        } else {
+            LOG_ERR("Blob MAC mismatch: blob was modified outside the store");
+        }
+        return -EBADMSG;
+    }
+
+    err = seal_pages(ALL_PAGES);
+    if (!err) {
+        psa_its_remove(LEGACY_PENDING_UID);
+        LOG_INF("Moved the blob seal from the flash trailer into ITS");
+    }
+    return err;
+}
+
+int cfg_mac_check(void)
+{
+    k_mutex_lock(&mac_lock, K_FOREVER);
+
+    int err = ensure_key();
+    if (!err) err = seal_load();
+    if (err == -ENOENT) {
+        err = adopt_locked();
+    } else if (err == 1) {
+        err = migrate_v1();
+    } else if (!err) {
+        err = match_seal();
+        if (err == 1) {
+            /* Reset inside an update: its records are still authenticated one by one by GCM */
+            LOG_WRN("Update cut off, resealing pages 0x%02x", seal.open_pages);
+            err = seal_pages(seal.open_pages);
+        } else if (err == -EBADMSG) {
+            LOG_ERR("Blob does not match its seal");
+        }
+    }
+
+    /* Fail closed: -EBADMSG and -EIO alike leave the blob untrusted */
+    trusted = (err == 0);
+    checked = true;
+    k_mutex_unlock(&mac_lock);
+    return err;
+}
+
+int cfg_mac_verify(void)
+{
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    int err = checked ? 0 : ensure_key();
+    if (!err && !checked) err = seal_load();
+    if (err == 1) {
+        err = match_v1();
+    } else if (!err) {
+        err = match_seal();
+    }
+    k_mutex_unlock(&mac_lock);
+    return (err == 1) ? 0 : err;
+}
+
+bool cfg_mac_trusted(void)
+{
+    return trusted;
+}
+
+int cfg_mac_announce(uint32_t off, uint32_t span)
+{
+    int err = 0;
+
+    if (off >= CFG_MAC_OFFSET || !span) return 0;
+
+    uint32_t end = MIN(off + span, CFG_MAC_OFFSET);
+    uint8_t pages = 0;
+    for (uint32_t p = off / FLASH_PAGE_SIZE; p <= (end - 1) / FLASH_PAGE_SIZE; p++) {
+        pages |= BIT(p);
+    }
+
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    /* Writes to a rejected blob (admin recovery) go through unsealed */
+    if (trusted && (seal.state != SEAL_OPEN || (pages & ~seal.open_pages))) {
+        struct cfg_seal prev = seal;
+
+        seal.state = SEAL_OPEN;
+        seal.open_pages |= pages;
+        err = seal_store();
+        if (err) {
+            seal = prev;
+            LOG_ERR("Announcing blob write @0x%x failed: %d", off, err);
+        }
+    }
+    k_mutex_unlock(&mac_lock);
+    return err;
+}
+
+int cfg_mac_commit(void)
+{
+    int err = 0;
+
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    if (!trusted) {
+        err = -EACCES;
+    } else if (seal.state == SEAL_OPEN) {
+        err = seal_pages(seal.open_pages);
+    }
+    k_mutex_unlock(&mac_lock);
+    return err;
+}
+
+uint32_t cfg_mac_seal_writes(void)
+{
+    return seal_writes;
+}
+
+int cfg_mac_provision_begin(void)
+{
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    int err = checked ? -EACCES : ensure_key();
+    if (!err) {
+        memset(&seal, 0, sizeof(seal));
+        seal.state = SEAL_PROVISIONING;
+        err = seal_store();
+    }
+    k_mutex_unlock(&mac_lock);
+    return err;
+}
+
+int cfg_mac_provision_end(void)
+{
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    int err = checked ? -EACCES : seal_pages(ALL_PAGES);
+    k_mutex_unlock(&mac_lock);
+    return err;
+}
+
+bool cfg_mac_provision_interrupted(void)
+{
+    k_mutex_lock(&mac_lock, K_FOREVER);
+    int err = checked ? -EACCES : seal_load();
+    bool interrupted = (err == 0 && seal.state == SEAL_PROVISIONING) ||
+                       (err == 1 && seal_v1.state == SEAL_PROVISIONING);
+    k_mutex_unlock(&mac_lock);
+    return interrupted;
+}
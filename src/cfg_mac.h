@@ -0,0 +1,60 @@
+#ifndef CFG_MAC_H
+#define CFG_MAC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <psa/crypto.h>
+
+/*
+ * Blob authenticity: one HMAC-SHA256 per flash page of the blob body
+ * [0, CFG_MAC_OFFSET), keyed by a device-unique persistent key generated on
+ * first use. The seal lives in ITS, where the non-secure side cannot forge
+ * it; the flash trailer would need its page erased on every update. An update
+ * opens the pages it is about to write in the seal (one ITS write, no MAC)
+ * and commit MACs just those pages once. After a reset the blob is accepted
+ * if every page matches, or if only the pages of an open update differ: those
+ * are resealed as found, their records still authenticated one by one by GCM
+ * and torn copies skipped by the parser. Anything else is rejected at boot
+ * before any field is decrypted.
+ */
+#define CFG_MAC_KEY_ID    ((psa_key_id_t)0x6001)
+#define CFG_MAC_SEAL_UID  0xC0F30001ULL
+
+/*
+ * Boot check: 0 authentic (an announced write that landed is committed),
+ * -EBADMSG tampered, torn or unsealed, -EIO if the check itself failed.
+ * Blobs from before the ITS seal are adopted if their flash trailer MAC
+ * verifies, or if the device key was only just created.
+ */
+int cfg_mac_check(void);
+
+/* Same result as cfg_mac_check() for diagnostics, without changing the trust decision */
+int cfg_mac_verify(void);
+
+/* True once cfg_mac_check() accepted the blob; until then nothing parses, writes or reseals it */
+bool cfg_mac_trusted(void);
+
+/*
+ * Called by the flash wrappers before each body write or erase of
+ * [off, off + span). Only stores the seal when the write reaches a page the
+ * update has not opened yet; the write must not be issued if it fails.
+ */
+int cfg_mac_announce(uint32_t off, uint32_t span);
+
+/* End of an update: MAC the open pages and commit, -EACCES while the blob is not trusted */
+int cfg_mac_commit(void);
+
+/* ITS seal writes since boot, to measure the wear the seal adds */
+uint32_t cfg_mac_seal_writes(void);
+
+/*
+ * Provisioning of a blank blob, before the boot check: begin marks it in
+ * progress, end seals what was written. A blob whose provisioning was cut
+ * off is reported so it can be erased and provisioned again.
+ */
+int cfg_mac_provision_begin(void);
+int cfg_mac_provision_end(void);
+bool cfg_mac_provision_interrupted(void);
+
+#endif /* CFG_MAC_H */
@@ -0,0 +1,577 @@
+#include "config.h"
+#include "cfg_maint.h"
+#include "cfg_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/storage/flash_map.h>
+
+LOG_MODULE_REGISTER(cfg_maint, LOG_LEVEL_INF);
+
+/*
+ * Background maintenance of the encrypted config blob.
+ *
+ * Compaction never rewrites a page that still holds the only copy of an
+ * entry. One step evacuates a victim page: every live entry is programmed
+ * into an erased slot on another page (program-only, no erase), then the
+ * victim page is erased. Readers keep using entries[] in RAM the whole time;
+ * only mem_offset is retargeted. A reset at any point leaves each entry with
+ * at least one intact copy, and the journal in the spare page after the blob
+ * tells the next boot which victim to finish.
+ */
+
+#define JOURNAL_MAGIC      0xC5A7
+#define JOURNAL_REC_COUNT  (FLASH_PAGE_SIZE / sizeof(struct journal_rec))
+#define SLOT_PTR(slot)     (ENCRYPTED_BLOB_ADDR + (size_t)(slot) * ENTRY_SIZE)
+
+struct journal_rec {
+    uint16_t magic;
+    uint8_t  op;
+    uint8_t  arg;
+    uint32_t seq;
+    uint32_t aux;
+    uint32_t crc;
+};
+BUILD_ASSERT(sizeof(struct journal_rec) == 16, "journal record must stay 16 bytes");
+
+K_MUTEX_DEFINE(cfg_blob_lock);
+struct k_work_q cfg_maint_wq;
+static K_THREAD_STACK_DEFINE(cfg_maint_stack, CFG_MAINT_STACK_SIZE);
+static struct k_work_delayable compact_work;
+
+static bool journal_ok;
+static int journal_next = -1;   /* next free record, -1 = not scanned yet */
+static uint32_t journal_seq;
+
+static atomic_t compact_running;
+static int resume_victim = -1;
+static bool compact_dirty;      /* body changed since the last CRC commit */
+
+/* ---------- journal ---------- */
+
+static bool rec_valid(const struct journal_rec *r)
+{
+    return r->magic == JOURNAL_MAGIC &&
+           r->crc == crc32_ieee((const uint8_t *)r, offsetof(struct journal_rec, crc));
+}
+
+static bool rec_erased(const struct journal_rec *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    for (size_t i = 0; i < sizeof(*r); i++) {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+static void journal_scan(void)
+{
+    const struct journal_rec *recs = (const struct journal_rec *)(ENCRYPTED_BLOB_ADDR + CFG_JOURNAL_OFFSET);
+
+    journal_next = JOURNAL_REC_COUNT;
+    journal_seq = 0;
+
+    for (int i = 0; i < JOURNAL_REC_COUNT; i++) {
+        if (rec_erased(&recs[i])) {
+            journal_next = i;
+            break;
+        }
+        /* Torn records keep their index but are otherwise ignored */
+        if (rec_valid(&recs[i]) && recs[i].seq >= journal_seq) {
+            journal_seq = recs[i].seq + 1;
+        }
+    }
+}
+
+bool cfg_journal_last(uint8_t *op, uint8_t *arg, uint32_t *aux)
+{
+    if (!journal_ok) return false;
+
+    const struct journal_rec *recs = (const struct journal_rec *)(ENCRYPTED_BLOB_ADDR + CFG_JOURNAL_OFFSET);
+    const struct journal_rec *last = NULL;
+
+    for (int i = 0; i < JOURNAL_REC_COUNT; i++) {
+        if (rec_erased(&recs[i])) break;
+        if (rec_valid(&recs[i]) && (!last || recs[i].seq > last->seq)) {
+            last = &recs[i];
+        }
+    }
+
+    if (!last) return false;
+    if (op)  *op = last->op;
+    if (arg) *arg = last->arg;
+    if (aux) *aux = last->aux;
+    return true;
+}
+
+int cfg_journal_append(uint8_t op, uint8_t arg, uint32_t aux)
+{
+    if (!journal_ok) return -ENODEV;
+    if (journal_next < 0) journal_scan();
+
+    const struct flash_area *fa;
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open for journal failed: %d", err);
+        return err;
+    }
+
+    if (journal_next >= JOURNAL_REC_COUNT) {
+        /* Every record carries its victim page, so only the one being appended matters */
+        err = cfg_flash_erase(fa, CFG_JOURNAL_OFFSET, FLASH_PAGE_SIZE);
+        if (err) {
+            LOG_ERR("Journal erase failed: %d", err);
+            flash_area_close(fa);
+            return err;
+        }
+        journal_next = 0;
+    }
+
+    struct journal_rec rec = {
+        .magic = JOURNAL_MAGIC,
+        .op = op,
+        .arg = arg,
+        .seq = journal_seq,
+        .aux = aux,
+    };
+    rec.crc = crc32_ieee((const uint8_t *)&rec, offsetof(struct journal_rec, crc));
+
+    err = cfg_flash_write(fa, CFG_JOURNAL_OFFSET + journal_next * sizeof(rec), &rec, sizeof(rec));
+    if (err) {
+        LOG_ERR("Journal write failed: %d", err);
+    } else {
+        journal_next++;
+        journal_seq++;
+    }
+
+    flash_area_close(fa);
+    return err;
+}
+
+/* ---------- slot helpers ---------- */
+
+/* A continuation is live only while a head slot of its record still claims its seq */
+static bool cont_has_head(const uint8_t *cont)
+{
+    uint8_t seq = cont[1 + CFG_REC_ID_LEN];
+
+    if (seq == 0) return false;
+
+    for (int s = 0; s < CFG_USABLE_SLOTS; s++) {
+        const uint8_t *h = SLOT_PTR(s);
+        size_t iv_len = h[0];
+
+        /* Also skips erased, tombstoned and continuation slots */
+        if (iv_len < CFG_REC_ID_LEN || iv_len > MAX_IV_LEN ||
+            memcmp(h + 1 + iv_len - CFG_REC_ID_LEN, cont + 1, CFG_REC_ID_LEN) != 0) {
+            continue;
+        }
+
+        size_t aad_len = h[1 + iv_len] | (h[2 + iv_len] << 8);
+        if (aad_len > MAX_AAD_LEN) continue;
+
+        const uint8_t *p = h + 1 + iv_len + 2 + aad_len;
+        size_t ct_len = p[0] | (p[1] << 8);
+        size_t room = ENTRY_SIZE - (1 + iv_len + 2 + aad_len + 2);
+
+        if (ct_len > room &&
+            ct_len <= CFG_MAX_VALUE_LEN + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH &&
+            seq <= DIV_ROUND_UP(ct_len - room, CFG_CONT_DATA_LEN)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+enum cfg_slot_state cfg_slot_state(int slot)
+{
+    const uint8_t *p = SLOT_PTR(slot);
+
+    if (p[0] == 0xFF) {
+        for (int i = 1; i < ENTRY_SIZE; i++) {
+            if (p[i] != 0xFF) return CFG_SLOT_DEAD;
+        }
+        return CFG_SLOT_ERASED;
+    }
+
+    /*
+     * Continuation slots are linked by record id, so compaction may move them
+     * like records. Orphans (head never written or already tombstoned) are
+     * dead and reclaimed with their page.
+     */
+    if (p[0] == CFG_SLOT_CONT) {
+        return cont_has_head(p) ? CFG_SLOT_LIVE : CFG_SLOT_DEAD;
+    }
+
+    if (p[0] == CFG_SLOT_TOMBSTONE || p[0] > MAX_IV_LEN) {
+        return CFG_SLOT_DEAD;
+    }
+
+    return CFG_SLOT_LIVE;
+}
+
+static int page_first_slot(int page)
+{
+    return page * ENTRIES_PER_PAGE;
+}
+
+static int page_end_slot(int page)
+{
+    return MIN((page + 1) * ENTRIES_PER_PAGE, CFG_USABLE_SLOTS);
+}
+
+static void scan_slots(uint8_t *state, struct cfg_compact_status *st)
+{
+    int last_used = -1;
+
+    memset(st, 0, sizeof(*st));
+
+    for (int s = 0; s < CFG_USABLE_SLOTS; s++) {
+        state[s] = cfg_slot_state(s);
+        switch (state[s]) {
+        case CFG_SLOT_LIVE:   st->live++;   last_used = s; break;
+        case CFG_SLOT_DEAD:   st->dead++;   last_used = s; break;
+        case CFG_SLOT_ERASED: st->erased++; break;
+        }
+    }
+
+    for (int s = 0; s < last_used; s++) {
+        if (state[s] == CFG_SLOT_ERASED) st->holes++;
+    }
+
+    st->frag_pct = (last_used < 0) ? 0 : ((st->dead + st->holes) * 100) / (last_used + 1);
+}
+
+static int count_in(const uint8_t *state, int first, int end, enum cfg_slot_state which)
+{
+    int n = 0;
+    for (int s = first; s < end; s++) {
+        if (state[s] == which) n++;
+    }
+    return n;
+}
+
+static int pick_victim(const uint8_t *state)
+{
+    int total_erased = count_in(state, 0, CFG_USABLE_SLOTS, CFG_SLOT_ERASED);
+    int best = -1, best_dead = 0;
+
+    /* Reclaim dead slots first, as long as the page's live entries fit elsewhere */
+    for (int p = 0; p < CONFIG_PAGE_COUNT; p++) {
+        int first = page_first_slot(p), end = page_end_slot(p);
+        int live = count_in(state, first, end, CFG_SLOT_LIVE);
+        int dead = count_in(state, first, end, CFG_SLOT_DEAD);
+        int erased_outside = total_erased - count_in(state, first, end, CFG_SLOT_ERASED);
+
+        if (live <= erased_outside && dead > best_dead) {
+            best = p;
+            best_dead = dead;
+        }
+    }
+    if (best >= 0) return best;
+
+    /* Nothing dead left: pack the highest populated page into holes below it */
+    for (int p = CONFIG_PAGE_COUNT - 1; p > 0; p--) {
+        int live = count_in(state, page_first_slot(p), page_end_slot(p), CFG_SLOT_LIVE);
+        if (live == 0) continue;
+        if (live <= count_in(state, 0, page_first_slot(p), CFG_SLOT_ERASED)) return p;
+        break;
+    }
+
+    return -1;
+}
+
+/* Slot outside [first, end) holding a byte-identical copy of slot s, or -1 */
+static int find_copy(int s, int first, int end)
+{
+    for (int t = 0; t < CFG_USABLE_SLOTS; t++) {
+        if (t >= first && t < end) continue;
+        if (cfg_slot_state(t) == CFG_SLOT_LIVE &&
+            memcmp(SLOT_PTR(t), SLOT_PTR(s), ENTRY_SIZE) == 0) {
+            return t;
+        }
+    }
+    return -1;
+}
+
+static int find_erased(int first, int end)
+{
+    for (int t = 0; t < CFG_USABLE_SLOTS; t++) {
+        if (t >= first && t < end) continue;
+        if (cfg_slot_state(t) == CFG_SLOT_ERASED) return t;
+    }
+    return -1;
+}
+
+int cfg_find_erased_slot(void)
+{
+    return find_erased(0, 0);
+}
+
+/* Collect n erased slots in ascending order; -ENOSPC if there are fewer */
+int cfg_find_erased_slots(int *slots, int n)
+{
+    int found = 0;
+
+    for (int t = 0; t < CFG_USABLE_SLOTS && found < n; t++) {
+        if (cfg_slot_state(t) == CFG_SLOT_ERASED) slots[found++] = t;
+    }
+    return (found == n) ? 0 : -ENOSPC;
+}
+
+int cfg_tombstone_slot(const struct flash_area *fa, int slot)
+{
+    uint8_t zeros[ENTRY_SIZE];
+
+    /* Programming 1->0 only, so this works over torn data without an erase */
+    memset(zeros, 0x00, sizeof(zeros));
+    return cfg_flash_write(fa, (off_t)slot * ENTRY_SIZE, zeros, ENTRY_SIZE);
+}
+
+static void retarget_entries(int from_slot, int to_slot)
+{
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].mem_offset == (uint32_t)from_slot * ENTRY_SIZE) {
+            entries[i].mem_offset = (uint32_t)to_slot * ENTRY_SIZE;
+        }
+    }
+}
+
+/* ---------- compaction ---------- */
+
+/* Seal and rotation state live in ITS, so the last page needs nothing kept across the erase */
+static int erase_victim(const struct flash_area *fa, int victim)
+{
+    return cfg_flash_erase(fa, (off_t)victim * FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+}
+
+static int compact_step(int victim)
+{
+    const int first = page_first_slot(victim);
+    const int end = page_end_slot(victim);
+    uint8_t buf[ENTRY_SIZE];
+    const struct flash_area *fa;
+    int moved = 0;
+
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
+    }
+
+    err = cfg_journal_append(CFG_JOP_COMPACT_BEGIN, victim, 0);
+    if (err) goto out_close;
+
+    for (int s = first; s < end; s++) {
+        if (cfg_slot_state(s) != CFG_SLOT_LIVE) continue;
+
+        /* Already copied before a reset? */
+        int d = find_copy(s, first, end);
+        if (d < 0) {
+            d = find_erased(first, end);
+            if (d < 0) {
+                LOG_WRN("No erased slot left to evacuate page %d", victim);
+                err = -ENOSPC;
+                goto out_end;
+            }
+
+            memcpy(buf, SLOT_PTR(s), ENTRY_SIZE);
+
+            err = cfg_journal_append(CFG_JOP_COMPACT_COPY, victim, d);
+            if (err) goto out_end;
+
+            err = cfg_flash_write(fa, (off_t)d * ENTRY_SIZE, buf, ENTRY_SIZE);
+            if (err || memcmp(SLOT_PTR(d), buf, ENTRY_SIZE) != 0) {
+                LOG_ERR("Copy of slot %d into slot %d failed: %d", s, d, err);
+                cfg_tombstone_slot(fa, d);
+                err = err ? err : -EIO;
+                goto out_end;
+            }
+            moved++;
+        }
+
+        retarget_entries(s, d);
+    }
+
+    err = erase_victim(fa, victim);
+    if (err) {
+        LOG_ERR("Erase of page %d failed: %d", victim, err);
+    } else {
+        LOG_INF("Compacted page %d (%d entries moved)", victim, moved);
+    }
+
+out_end:
+    cfg_journal_append(CFG_JOP_COMPACT_END, victim, (uint32_t)(-err));
+out_close:
+    flash_area_close(fa);
+    return err;
+}
+
+static void compact_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    uint8_t state[CFG_USABLE_SLOTS];
+    struct cfg_compact_status st;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    scan_slots(state, &st);
+    int victim = (resume_victim >= 0) ? resume_victim : pick_victim(state);
+    resume_victim = -1;
+
+    if (victim >= 0) {
+        int err = compact_step(victim);
+        compact_dirty = true;
+        if (!err) {
+            k_mutex_unlock(&cfg_blob_lock);
+            k_work_reschedule_for_queue(&cfg_maint_wq, &compact_work, K_MSEC(CFG_COMPACT_STEP_DELAY_MS));
+            return;
+        }
+        LOG_ERR("Compaction step on page %d failed: %d", victim, err);
+    }
+
+    if (compact_dirty && update_crc() == 0) {
+        cfg_journal_append(CFG_JOP_COMMIT, 0, 0);
+        compact_dirty = false;
+        LOG_INF("Compaction finished, frag %d%% before last step", st.frag_pct);
+    }
+
+    atomic_set(&compact_running, 0);
+    k_mutex_unlock(&cfg_blob_lock);
+}
+
+static bool slot_in_page(int slot, int page)
+{
+    for (int s = page_first_slot(page); s < page_end_slot(page); s++) {
+        if (memcmp(SLOT_PTR(slot), SLOT_PTR(s), ENTRY_SIZE) == 0) return true;
+    }
+    return false;
+}
+
+/* A torn program only cleared some of the bits a victim slot has cleared, never others */
+static bool torn_copy_of(int slot, int page)
+{
+    const uint8_t *t = SLOT_PTR(slot);
+
+    for (int s = page_first_slot(page); s < page_end_slot(page); s++) {
+        const uint8_t *src = SLOT_PTR(s);
+        int i = 0;
+
+        while (i < ENTRY_SIZE && (t[i] & src[i]) == src[i]) {
+            i++;
+        }
+        if (i == ENTRY_SIZE) return true;
+    }
+    return false;
+}
+
+/*
+ * The journal page is outside the MAC, so a record is only a hint: it can
+ * resume a compaction, and a slot is dropped only if its contents prove it
+ * is an unfinished copy. A forged record cannot delete a live entry.
+ */
+static void compact_recover(void)
+{
+    uint8_t op, arg;
+    uint32_t aux;
+
+    if (!cfg_journal_last(&op, &arg, &aux)) return;
+
+    switch (op) {
+    case CFG_JOP_COMPACT_COPY:
+        /* Reset while programming slot aux: keep it only if the copy completed */
+        if (arg < CONFIG_PAGE_COUNT && aux < CFG_USABLE_SLOTS &&
+            cfg_slot_state(aux) != CFG_SLOT_ERASED &&
+            !slot_in_page(aux, arg) && torn_copy_of(aux, arg)) {
+            const struct flash_area *fa;
+            if (flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa) == 0) {
+                LOG_WRN("Dropping torn copy in slot %u", aux);
+                cfg_tombstone_slot(fa, aux);
+                flash_area_close(fa);
+            }
+        }
+        __fallthrough;
+    case CFG_JOP_COMPACT_BEGIN:
+        if (arg >= CONFIG_PAGE_COUNT) {
+            LOG_WRN("Ignoring journal record for page %u", arg);
+            break;
+        }
+        LOG_INF("Resuming interrupted compaction of page %u", arg);
+        resume_victim = arg;
+        compact_dirty = true;
+        break;
+    case CFG_JOP_COMPACT_END:
+        /* Last run stopped before its CRC commit */
+        compact_dirty = true;
+        break;
+    default:
+        break;
+    }
+}
+
+void cfg_compact_kick(bool force)
+{
+    if (!journal_ok) return;
+
+    if (!force && resume_victim < 0 && !compact_dirty) {
+        struct cfg_compact_status st;
+        cfg_compact_get_status(&st);
+        if (st.frag_pct < CFG_COMPACT_FRAG_THRESHOLD_PCT) return;
+        LOG_INF("Blob fragmentation %d%% >= %d%%, starting compaction",
+                st.frag_pct, CFG_COMPACT_FRAG_THRESHOLD_PCT);
+    }
+
+    if (!atomic_cas(&compact_running, 0, 1)) return;
+
+    k_work_schedule_for_queue(&cfg_maint_wq, &compact_work, K_MSEC(CFG_COMPACT_STEP_DELAY_MS));
+}
+
+void cfg_compact_get_status(struct cfg_compact_status *st)
+{
+    uint8_t state[CFG_USABLE_SLOTS];
+    uint8_t op;
+
+    scan_slots(state, st);
+    st->running = atomic_get(&compact_running) != 0;
+    st->journal_open = cfg_journal_last(&op, NULL, NULL) &&
+                       (op == CFG_JOP_COMPACT_BEGIN || op == CFG_JOP_COMPACT_COPY);
+}
+
+int cfg_maint_init(void)
+{
+    static bool started;
+    const struct flash_area *fa;
+
+    if (!started) {
+        struct k_work_queue_config cfg = { .name = "cfg_maint" };
+
+        k_work_queue_start(&cfg_maint_wq, cfg_maint_stack,
+                           K_THREAD_STACK_SIZEOF(cfg_maint_stack),
+                           K_LOWEST_APPLICATION_THREAD_PRIO, &cfg);
+        k_work_init_delayable(&compact_work, compact_work_handler);
+        started = true;
+    }
+
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
+    }
+    journal_ok = fa->fa_size >= CFG_JOURNAL_OFFSET + FLASH_PAGE_SIZE;
+    flash_area_close(fa);
+
+    if (!journal_ok) {
+        LOG_WRN("encrypted_blob_slot0 has no spare journal page, background compaction disabled");
+        return -ENOSPC;
+    }
+
+    journal_scan();
+    compact_recover();
+    cfg_compact_kick(false);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef CFG_MAINT_H
+#define CFG_MAINT_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Start compaction once this share of the used slot range is dead */
+#define CFG_COMPACT_FRAG_THRESHOLD_PCT 25
+/* Pause between two page steps so the maintenance queue never hogs the flash */
+#define CFG_COMPACT_STEP_DELAY_MS      200
+#define CFG_MAINT_STACK_SIZE           2048
+
+/* Journal opcodes */
+#define CFG_JOP_COMPACT_BEGIN  0x01   /* arg = victim page */
+#define CFG_JOP_COMPACT_COPY   0x02   /* arg = victim page, aux = destination slot */
+#define CFG_JOP_COMPACT_END    0x03   /* arg = victim page, aux = 0 ok / errno */
+#define CFG_JOP_COMMIT         0x04   /* CRC rewritten after a maintenance run */
+
+enum cfg_slot_state {
+    CFG_SLOT_ERASED,
+    CFG_SLOT_LIVE,
+    CFG_SLOT_DEAD,      /* tombstone, torn copy, orphaned continuation or partially erased */
+};
+
+struct cfg_compact_status {
+    int live;
+    int dead;
+    int erased;
+    int holes;          /* erased slots below the last live slot */
+    int frag_pct;
+    bool running;
+    bool journal_open;
+};
+
+extern struct k_mutex cfg_blob_lock;
+extern struct k_work_q cfg_maint_wq;
+
+int cfg_maint_init(void);
+
+enum cfg_slot_state cfg_slot_state(int slot);
+int cfg_find_erased_slot(void);
+int cfg_find_erased_slots(int *slots, int n);
+int cfg_tombstone_slot(const struct flash_area *fa, int slot);
+int cfg_journal_append(uint8_t op, uint8_t arg, uint32_t aux);
+bool cfg_journal_last(uint8_t *op, uint8_t *arg, uint32_t *aux);
+
+void cfg_compact_kick(bool force);
+void cfg_compact_get_status(struct cfg_compact_status *st);
+
+#endif /* CFG_MAINT_H */
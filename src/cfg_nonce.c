@@ -0,0 +1,127 @@
+#include "cfg_nonce.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <psa/internal_trusted_storage.h>
+
+LOG_MODULE_REGISTER(cfg_nonce, LOG_LEVEL_INF);
+
+#define NONCE_MAGIC    0x4E434531u   /* "NCE1" */
+#define NONCE_IV_LEN   12
+
+/* Persisted per key id: every counter below limit may already have been used */
+struct nonce_rec {
+    uint32_t magic;
+    uint32_t prefix;
+    uint64_t limit;
+};
+
+static struct {
+    bool loaded;
+    psa_key_id_t key_id;
+    uint32_t prefix;
+    uint64_t next;
+    uint64_t limit;
+} ctr;
+
+static K_MUTEX_DEFINE(nonce_lock);
+
+static psa_storage_uid_t nonce_uid(psa_key_id_t key_id)
+{
+    return CFG_NONCE_UID_BASE | (uint32_t)key_id;
+}
+
+static int load_counter(psa_key_id_t key_id)
+{
+    struct nonce_rec rec;
+    size_t len = 0;
+
+    psa_status_t st = psa_its_get(nonce_uid(key_id), 0, sizeof(rec), &rec, &len);
+    if (st == PSA_ERROR_DOES_NOT_EXIST) {
+        /* Fresh prefix, so a wiped ITS does not restart an old sequence */
+        st = psa_generate_random((uint8_t *)&rec.prefix, sizeof(rec.prefix));
+        if (st != PSA_SUCCESS) return -EIO;
+        rec.magic = NONCE_MAGIC;
+        rec.limit = 0;
+    } else if (st != PSA_SUCCESS || len != sizeof(rec) || rec.magic != NONCE_MAGIC) {
+        LOG_WRN("Nonce counter for key 0x%08x unreadable (psa_status: %d)", key_id, st);
+        return -EIO;
+    }
+
+    ctr.key_id = key_id;
+    ctr.prefix = rec.prefix;
+    /* Whatever was left of the last block before reset is skipped */
+    ctr.next = rec.limit;
+    ctr.limit = rec.limit;
+    ctr.loaded = true;
+    return 0;
+}
+
+static int reserve_block(void)
+{
+    struct nonce_rec rec = {
+        .magic = NONCE_MAGIC,
+        .prefix = ctr.prefix,
+        .limit = ctr.next + CFG_NONCE_BLOCK,
+    };
+
+    if (rec.limit < ctr.next) return -ERANGE;
+
+    psa_status_t st = psa_its_set(nonce_uid(ctr.key_id), sizeof(rec), &rec, PSA_STORAGE_FLAG_NONE);
+    if (st != PSA_SUCCESS) {
+        LOG_WRN("Reserving nonce block failed (psa_status: %d)", st);
+        return -EIO;
+    }
+    ctr.limit = rec.limit;
+    return 0;
+}
+
+int cfg_nonce_next(psa_key_id_t key_id, uint8_t *iv, size_t iv_len)
+{
+    int err = 0;
+
+    if (!IS_ENABLED(CFG_NONCE_COUNTER_ENABLED) || iv_len != NONCE_IV_LEN) return -ENOTSUP;
+
+    k_mutex_lock(&nonce_lock, K_FOREVER);
+
+    if (!ctr.loaded || ctr.key_id != key_id) {
+        ctr.loaded = false;
+        err = load_counter(key_id);
+    }
+    if (!err && ctr.next == ctr.limit) {
+        err = reserve_block();
+    }
+    if (!err) {
+        sys_put_be32(ctr.prefix, iv);
+        sys_put_be64(ctr.next++, iv + 4);
+    }
+
+    k_mutex_unlock(&nonce_lock);
+    return err;
+}
+
+int cfg_nonce_forget(psa_key_id_t key_id)
+{
+    k_mutex_lock(&nonce_lock, K_FOREVER);
+    if (ctr.loaded && ctr.key_id == key_id) {
+        ctr.loaded = false;
+    }
+    psa_status_t st = psa_its_remove(nonce_uid(key_id));
+    k_mutex_unlock(&nonce_lock);
+
+    if (st != PSA_SUCCESS && st != PSA_ERROR_DOES_NOT_EXIST) {
+        LOG_WRN("Removing nonce counter for key 0x%08x failed (psa_status: %d)", key_id, st);
+        return -EIO;
+    }
+    return 0;
+}
+
+psa_status_t cfg_nonce_generate(psa_key_id_t key_id, uint8_t *iv, size_t iv_len)
+{
+    if (cfg_nonce_next(key_id, iv, iv_len) == 0) {
+        return PSA_SUCCESS;
+    }
+    return psa_generate_random(iv, iv_len);
+}
@@ -0,0 +1,28 @@
+#ifndef CFG_NONCE_H
+#define CFG_NONCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <psa/crypto.h>
+
+/*
+ * Deterministic GCM nonces: a per-key 32-bit random prefix followed by a
+ * 64-bit big-endian write counter, so the last IV bytes (the record id of
+ * chunked entries) change on every write. The counter is reserved in blocks
+ * of CFG_NONCE_BLOCK in ITS before any value of the block is handed out, so
+ * a reset only skips the rest of a block and never repeats a nonce.
+ */
+#define CFG_NONCE_COUNTER_ENABLED  1
+#define CFG_NONCE_UID_BASE         0xC0F2000000000000ULL
+#define CFG_NONCE_BLOCK            64
+
+/* Next IV for key_id; falls back to psa_generate_random if the counter is unavailable */
+psa_status_t cfg_nonce_generate(psa_key_id_t key_id, uint8_t *iv, size_t iv_len);
+
+/* Counter-only variant, no fallback: -ENOTSUP, -EIO or -ERANGE on failure */
+int cfg_nonce_next(psa_key_id_t key_id, uint8_t *iv, size_t iv_len);
+
+/* Drop the counter record of a key that is gone (scratch keys); 0 if there was none */
+int cfg_nonce_forget(psa_key_id_t key_id);
+
+#endif /* CFG_NONCE_H */
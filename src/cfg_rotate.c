@@ -0,0 +1,404 @@
+#include "config.h"
+#include "cfg_rotate.h"
+#include "cfg_maint.h"
+#include "encryption_helper.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <psa/internal_trusted_storage.h>
+
+LOG_MODULE_REGISTER(cfg_rotate, LOG_LEVEL_INF);
+
+/* RAM copy of the ITS state record; written back through write_state() */
+static struct cfg_rot_state rot;
+/* rot is backed by a valid record or by probing the entries; rotations wait for it */
+static bool rot_known;
+static struct k_work_delayable rot_work;
+static bool work_ready;
+
+/* Step scratch: names of the keys on the current page and one plaintext value */
+static char names[ENTRIES_PER_PAGE][MAX_AAD_LEN + 1];
+static char value_buf[CFG_MAX_VALUE_LEN + 1];
+
+/* ITS record, or the blob trailer of devices that rotated before the state moved to ITS */
+static bool read_state(struct cfg_rot_state *st, bool *legacy)
+{
+    size_t len = 0;
+
+    psa_status_t s = psa_its_get(CFG_ROT_STATE_UID, 0, sizeof(*st), st, &len);
+    *legacy = (s == PSA_ERROR_DOES_NOT_EXIST);
+    if (*legacy) {
+        memcpy(st, ENCRYPTED_BLOB_ADDR + CFG_ROT_OFFSET, sizeof(*st));
+    } else if (s != PSA_SUCCESS || len != sizeof(*st)) {
+        LOG_ERR("Rotation state unreadable: %d", s);
+        return false;
+    }
+    return st->magic == CFG_ROT_MAGIC &&
+           (st->phase == CFG_ROT_IDLE || st->phase == CFG_ROT_RUNNING) &&
+           (st->active_key == CFG_KEY_ID_A || st->active_key == CFG_KEY_ID_B);
+}
+
+static int write_state(const struct cfg_rot_state *st)
+{
+    psa_status_t s = psa_its_set(CFG_ROT_STATE_UID, sizeof(*st), st, PSA_STORAGE_FLAG_NONE);
+    if (s != PSA_SUCCESS) {
+        LOG_ERR("Storing rotation state failed: %d", s);
+        return -EIO;
+    }
+    return 0;
+}
+
+psa_key_id_t cfg_rotate_active_key(void)
+{
+    struct cfg_rot_state st;
+    bool legacy;
+
+    return read_state(&st, &legacy) ? st.active_key : CFG_KEY_ID_A;
+}
+
+static psa_key_id_t other_key(psa_key_id_t id)
+{
+    return (id == CFG_KEY_ID_A) ? CFG_KEY_ID_B : CFG_KEY_ID_A;
+}
+
+static bool key_exists(psa_key_id_t id)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+
+    psa_status_t st = psa_get_key_attributes(id, &attr);
+    psa_reset_key_attributes(&attr);
+    return st == PSA_SUCCESS;
+}
+
+/* Parsed entries that authenticate under the persistent key id */
+static int count_under(psa_key_id_t id)
+{
+    int n = 0;
+
+    if (!key_exists(id)) return 0;
+    for (int i = 0; i < num_entries; i++) {
+        if (cfg_entry_check(&entries[i], id, NULL) == 0) n++;
+    }
+    return n;
+}
+
+/* The only place a store key is destroyed: never while a parsed entry still needs it */
+static int destroy_unused(psa_key_id_t id)
+{
+    if (!key_exists(id)) return 0;
+
+    int n = count_under(id);
+    if (n) {
+        LOG_ERR("Key 0x%08x still protects %d entries, not destroyed", id, n);
+        return -EBUSY;
+    }
+    psa_status_t st = psa_destroy_key(id);
+    if (st != PSA_SUCCESS) {
+        LOG_WRN("Destroying key 0x%08x failed: %d", id, st);
+        return -EIO;
+    }
+    return 0;
+}
+
+static int generate_key(psa_key_id_t id)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t out;
+
+    /* A leftover from an interrupted start; refused if it protects anything after all */
+    int err = destroy_unused(id);
+    if (err) return err;
+
+    psa_set_key_id(&attr, id);
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT | PSA_KEY_USAGE_COPY);
+    psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_PERSISTENT);
+    psa_set_key_algorithm(&attr, PSA_ALG_GCM);
+    psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+    psa_set_key_bits(&attr, 256);
+
+    psa_status_t st = psa_generate_key(&attr, &out);
+    psa_reset_key_attributes(&attr);
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Generating store key 0x%08x failed: %d", id, st);
+        return -EIO;
+    }
+    return 0;
+}
+
+/* Decrypt into value_buf under the active key, or the previous one if prev */
+static int decrypt_under(const ConfigEntry *e, bool prev, size_t *len)
+{
+    psa_key_id_t k = prev ? cfg_key_get_prev() : cfg_key_get();
+    int err = cfg_entry_decrypt(e, k, value_buf, sizeof(value_buf), len);
+    cfg_key_put(k);
+    return err;
+}
+
+/* Re-encrypt one key under the new key if its live copy is still under the old one */
+static int rotate_name(const char *name)
+{
+    const ConfigEntry *e = cfg_find_entry(name);
+    size_t len;
+
+    if (!e) return 0;   /* erased since the page was listed */
+
+    if (decrypt_under(e, false, &len) == 0) {
+        return 0;
+    }
+    if (decrypt_under(e, true, &len) != 0) {
+        LOG_ERR("'%s' authenticates under neither key, left as is", name);
+        return 0;
+    }
+
+    /* config_set() encrypts with the active (new) key and tombstones the old copy */
+    int err = config_set(name, value_buf);
+    memset(value_buf, 0, sizeof(value_buf));
+    return err;
+}
+
+static int list_page(int page)
+{
+    int n = 0;
+
+    for (int i = 0; i < num_entries && n < ENTRIES_PER_PAGE; i++) {
+        if (entries[i].mem_offset / FLASH_PAGE_SIZE != (uint32_t)page) continue;
+        memcpy(names[n], entries[i].aad, entries[i].aad_len);
+        names[n][entries[i].aad_len] = '\0';
+        n++;
+    }
+    return n;
+}
+
+/* True once no parsed entry needs the previous key any more */
+static bool all_rotated(void)
+{
+    for (int i = 0; i < num_entries; i++) {
+        if (decrypt_under(&entries[i], false, NULL) != 0 && decrypt_under(&entries[i], true, NULL) == 0) {
+            memset(value_buf, 0, sizeof(value_buf));
+            return false;
+        }
+    }
+    memset(value_buf, 0, sizeof(value_buf));
+    return true;
+}
+
+static int finish(void)
+{
+    struct cfg_rot_state done = rot;
+    psa_key_id_t old = rot.prev_key;
+
+    if (!all_rotated()) {
+        /* Something was written under the old key behind the job; go round again */
+        LOG_WRN("Entries left under key 0x%08x, restarting pass", old);
+        done.next_page = 0;
+        int err = write_state(&done);
+        if (!err) rot = done;
+        return err ? err : -EAGAIN;
+    }
+
+    done.phase = CFG_ROT_IDLE;
+    done.next_page = 0;
+    done.prev_key = PSA_KEY_ID_NULL;
+    int err = write_state(&done);
+    if (err) return err;
+
+    rot = done;
+    cfg_key_set_ids(rot.active_key, PSA_KEY_ID_NULL);
+    if (destroy_unused(old) == 0) {
+        LOG_INF("Key rotation complete, store key 0x%08x, 0x%08x destroyed", rot.active_key, old);
+    }
+    return 0;
+}
+
+static void rot_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    int err = 0;
+    int delay = CFG_ROT_STEP_DELAY_MS;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    if (rot.phase != CFG_ROT_RUNNING) goto out;
+
+    if (rot.next_page >= CONFIG_PAGE_COUNT) {
+        err = finish();
+        if (!err) goto out;
+    } else {
+        int page = rot.next_page;
+        int n = list_page(page);
+
+        for (int k = 0; k < n && !err; k++) {
+            err = rotate_name(names[k]);
+        }
+
+        if (!err) {
+            struct cfg_rot_state next = rot;
+            next.next_page++;
+            err = write_state(&next);
+            if (!err) {
+                rot = next;
+                LOG_INF("Key rotation: page %d re-encrypted (%d keys)", page, n);
+            }
+        }
+    }
+
+    if (err == -ENOSPC) {
+        /* Re-encryption appends; let compaction free slots first */
+        cfg_compact_kick(true);
+    }
+    if (err && err != -EAGAIN) {
+        LOG_WRN("Key rotation step failed: %d, retrying", err);
+        delay = CFG_ROT_RETRY_DELAY_MS;
+    }
+    k_work_reschedule_for_queue(&cfg_maint_wq, &rot_work, K_MSEC(delay));
+
+out:
+    k_mutex_unlock(&cfg_blob_lock);
+}
+
+/*
+ * No valid state record: work out the keys from the parsed entries. One key
+ * in use means idle under it; both means a rotation was cut off, and it is
+ * resumed towards the key holding more entries (either direction ends with
+ * everything under one key before the other is destroyed). With no entry
+ * to go by nothing is recorded, destroyed or rotated.
+ */
+static int probe_state(void)
+{
+    int under_a = count_under(CFG_KEY_ID_A);
+    int under_b = count_under(CFG_KEY_ID_B);
+    psa_key_id_t active = (under_b > under_a) ? CFG_KEY_ID_B : CFG_KEY_ID_A;
+
+    rot = (struct cfg_rot_state){
+        .magic = CFG_ROT_MAGIC,
+        .phase = (under_a && under_b) ? CFG_ROT_RUNNING : CFG_ROT_IDLE,
+        .active_key = active,
+        .prev_key = (under_a && under_b) ? other_key(active) : PSA_KEY_ID_NULL,
+    };
+    if (!under_a && !under_b) {
+        /* A blank store is provisioned under key A */
+        if (key_exists(CFG_KEY_ID_B) && !key_exists(CFG_KEY_ID_A)) rot.active_key = CFG_KEY_ID_B;
+        LOG_WRN("No rotation state and no entry to probe, key rotation disabled");
+        return 0;
+    }
+
+    int err = write_state(&rot);
+    if (!err) {
+        rot_known = true;
+        LOG_INF("Rotation state rebuilt from entries: %d under 0x%08x, %d under 0x%08x",
+                under_a, CFG_KEY_ID_A, under_b, CFG_KEY_ID_B);
+    }
+    return err;
+}
+
+int cfg_rotate_init(void)
+{
+    if (!work_ready) {
+        k_work_init_delayable(&rot_work, rot_work_handler);
+        work_ready = true;
+    }
+
+    bool legacy;
+    int err = 0;
+
+    rot_known = read_state(&rot, &legacy);
+    if (!rot_known) {
+        err = probe_state();
+    } else if (legacy) {
+        /* Compaction erases the trailer gap with the last page, so move the state before it runs */
+        err = write_state(&rot);
+        if (!err) LOG_INF("Moved key rotation state from the blob trailer into ITS");
+    }
+
+    if (rot_known && rot.phase == CFG_ROT_IDLE && count_under(other_key(rot.active_key))) {
+        /* Idle, yet entries are under the other key: finish them rather than lose them */
+        LOG_WRN("Entries left under key 0x%08x, resuming rotation", other_key(rot.active_key));
+        struct cfg_rot_state next = rot;
+        next.phase = CFG_ROT_RUNNING;
+        next.next_page = 0;
+        next.prev_key = other_key(rot.active_key);
+        err = write_state(&next);
+        if (!err) rot = next;
+    }
+
+    if (rot.phase == CFG_ROT_RUNNING) {
+        cfg_key_set_ids(rot.active_key, rot.prev_key);
+        LOG_INF("Key rotation to 0x%08x interrupted at page %u", rot.active_key, rot.next_page);
+    } else {
+        cfg_key_set_ids(rot.active_key, PSA_KEY_ID_NULL);
+        /* Generated by a start that never reached the state record, or not destroyed after finishing */
+        if (rot_known && !err) {
+            destroy_unused(other_key(rot.active_key));
+        }
+    }
+    return err;
+}
+
+void cfg_rotate_resume(void)
+{
+    if (work_ready && rot.phase == CFG_ROT_RUNNING) {
+        k_work_reschedule_for_queue(&cfg_maint_wq, &rot_work, K_MSEC(CFG_ROT_STEP_DELAY_MS));
+    }
+}
+
+int cfg_rotate_start(void)
+{
+    int err;
+
+    if (!work_ready) return -EAGAIN;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    if (rot.phase == CFG_ROT_RUNNING) {
+        err = -EBUSY;
+        goto out;
+    }
+    if (!rot_known) {
+        /* Entries may have been written since boot; only the probe result is trusted */
+        err = probe_state();
+        if (!err && !rot_known) err = -ENODATA;
+        if (!err && rot.phase == CFG_ROT_RUNNING) {
+            cfg_key_set_ids(rot.active_key, rot.prev_key);
+            k_work_reschedule_for_queue(&cfg_maint_wq, &rot_work, K_MSEC(CFG_ROT_STEP_DELAY_MS));
+            err = -EBUSY;
+        }
+        if (err) goto out;
+    }
+
+    psa_key_id_t old = cfg_key_active_id();
+    psa_key_id_t new = other_key(old);
+
+    err = generate_key(new);
+    if (err) goto out;
+
+    struct cfg_rot_state next = {
+        .magic = CFG_ROT_MAGIC,
+        .phase = CFG_ROT_RUNNING,
+        .next_page = 0,
+        .active_key = new,
+        .prev_key = old,
+    };
+    err = write_state(&next);
+    if (err) {
+        psa_destroy_key(new);
+        goto out;
+    }
+
+    /* Writers switch under the blob lock, so nothing new lands under the old key */
+    rot = next;
+    cfg_key_set_ids(new, old);
+    k_work_reschedule_for_queue(&cfg_maint_wq, &rot_work, K_MSEC(CFG_ROT_STEP_DELAY_MS));
+    LOG_INF("Key rotation 0x%08x -> 0x%08x started", old, new);
+
+out:
+    k_mutex_unlock(&cfg_blob_lock);
+    return err;
+}
+
+void cfg_rotate_get_state(struct cfg_rot_state *st)
+{
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    *st = rot;
+    k_mutex_unlock(&cfg_blob_lock);
+}
@@ -0,0 +1,59 @@
+#ifndef CFG_ROTATE_H
+#define CFG_ROTATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <psa/crypto.h>
+
+/*
+ * Store-key rotation. The AES key alternates between two persistent ids.
+ * A rotation generates a fresh key under the other id, switches writers to
+ * it and re-encrypts the blob one page per maintenance-queue step. Progress
+ * lives in an ITS record (older devices kept it in the blob trailer at
+ * CFG_ROT_OFFSET and are moved over at init), so a reset resumes at the last
+ * unfinished page. Until the job completes,
+ * readers try the new key first and fall back to the old one. Without a
+ * valid record the state is rebuilt by probing which key authenticates the
+ * entries, and a key is only destroyed once no parsed entry needs it.
+ */
+#define CFG_KEY_ID_A              ((psa_key_id_t)0x00000005)
+#define CFG_KEY_ID_B              ((psa_key_id_t)0x00000006)
+#define CFG_ROT_STEP_DELAY_MS     200
+#define CFG_ROT_RETRY_DELAY_MS    2000
+
+#define CFG_ROT_MAGIC             0x544F524Bu   /* "KROT" */
+#define CFG_ROT_STATE_UID         0xC0F30002ULL   /* next to the blob seal */
+
+enum cfg_rot_phase {
+    CFG_ROT_IDLE    = 0,
+    CFG_ROT_RUNNING = 1,
+};
+
+struct cfg_rot_state {
+    uint32_t magic;
+    uint8_t phase;
+    uint8_t next_page;
+    uint16_t reserved;
+    uint32_t active_key;
+    uint32_t prev_key;
+};
+
+/* Active store key id from the rotation state; CFG_KEY_ID_A for devices without one */
+psa_key_id_t cfg_rotate_active_key(void);
+
+/* Apply the recorded key ids; call after parsing, before anything decrypts */
+int cfg_rotate_init(void);
+
+/* Reschedule an interrupted rotation; call once cfg_maint_wq runs */
+void cfg_rotate_resume(void);
+
+/*
+ * Start a rotation: -EBUSY if one runs, -ENODATA while the state is unknown
+ * (no valid record and no entry to probe), -EIO if the new key cannot be
+ * created
+ */
+int cfg_rotate_start(void);
+
+void cfg_rotate_get_state(struct cfg_rot_state *st);
+
+#endif /* CFG_ROTATE_H */
@@ -0,0 +1,140 @@
+#include "config.h"
+#include "cfg_settings.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+LOG_MODULE_REGISTER(cfg_settings, LOG_LEVEL_INF);
+
+#define NAME_MAX_LEN  (sizeof(CFG_SETTINGS_ROOT) + MAX_AAD_LEN + 1)
+
+/* "mq_user" -> "cfg/mq/user": the first '_' or '.' becomes the subtree separator */
+static void key_to_name(const ConfigEntry *e, char *name, size_t size)
+{
+    snprintk(name, size, CFG_SETTINGS_ROOT "/%.*s", e->aad_len, e->aad);
+
+    char *sep = strpbrk(name + sizeof(CFG_SETTINGS_ROOT), "_.");
+    if (sep) *sep = '/';
+}
+
+/* cb_arg of read_value(): the store key and its plaintext length from the record */
+struct value_ref {
+    const char *key;
+    size_t val_len;
+};
+
+struct read_ctx {
+    uint8_t *data;
+    size_t len;
+    size_t pos;     /* get_config_stream()'s total: reset when it retries under the old key */
+};
+
+/* Keeps the first len bytes; the rest is still decrypted so the tag gets checked */
+static int truncating_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    struct read_ctx *r = ctx;
+
+    if (r->pos < r->len) {
+        memcpy(r->data + r->pos, data, MIN(len, r->len - r->pos));
+    }
+    return 0;
+}
+
+/*
+ * Decrypts straight into the handler's buffer, whatever the value size. A
+ * buffer with room for the NUL takes the get_config() path (hot tier, torn
+ * copies); a smaller one, e.g. an exact-size read, is filled from the stream.
+ */
+static ssize_t read_value(void *cb_arg, void *data, size_t len)
+{
+    const struct value_ref *ref = cb_arg;
+
+    if (len == 0) return 0;
+
+    if (len > ref->val_len) {
+        const char *val = get_config(ref->key, data, len);
+        if (val != data) return -EIO;
+        return strlen(val);
+    }
+
+    struct read_ctx r = { .data = data, .len = len };
+    int err = get_config_stream(ref->key, truncating_sink, &r, &r.pos);
+    if (err) {
+        memset(data, 0, len);   /* unauthenticated plaintext */
+        return -EIO;
+    }
+    return MIN(len, r.pos);
+}
+
+static int load_entry(const ConfigEntry *e, void *user)
+{
+    const struct settings_load_arg *arg = user;
+    char name[NAME_MAX_LEN];
+    char key[MAX_AAD_LEN + 1];
+
+    memcpy(key, e->aad, e->aad_len);
+    key[e->aad_len] = '\0';
+    key_to_name(e, name, sizeof(name));
+
+    /* Value length is known from the record; decryption only happens if a handler reads it */
+    size_t val_len = (e->ciphertext_len > NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH) ?
+                     e->ciphertext_len - NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH : 0;
+
+    struct value_ref ref = { .key = key, .val_len = val_len };
+
+    settings_call_set_handler(name, val_len, read_value, &ref, arg);
+    return 0;
+}
+
+static int cfg_store_load(struct settings_store *cs, const struct settings_load_arg *arg)
+{
+    char prefix[MAX_AAD_LEN + 1] = "";
+    const char *next = NULL;
+
+    ARG_UNUSED(cs);
+
+    if (arg && arg->subtree && arg->subtree[0]) {
+        if (!settings_name_steq(arg->subtree, CFG_SETTINGS_ROOT, &next)) {
+            return 0;
+        }
+        /* "cfg/mq[/...]" -> only keys starting with "mq" are looked at */
+        if (next) {
+            size_t n = 0;
+            while (next[n] && next[n] != '/' && n < MAX_AAD_LEN) n++;
+            memcpy(prefix, next, n);
+            prefix[n] = '\0';
+        }
+    }
+
+    return cfg_foreach_prefix(prefix, load_entry, (void *)arg);
+}
+
+/* Load-only source: FCB stays the settings destination, store keys are written with config_set() */
+static const struct settings_store_itf cfg_store_itf = {
+    .csi_load = cfg_store_load,
+};
+
+static struct settings_store cfg_store = {
+    .cs_itf = &cfg_store_itf,
+};
+
+int cfg_settings_init(void)
+{
+    static bool registered;
+
+    if (registered) return 0;
+
+    /* Brings up FCB first; this store is only added as a source next to it */
+    int err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init failed: %d", err);
+        return err;
+    }
+
+    settings_src_register(&cfg_store);
+    registered = true;
+
+    LOG_INF("Encrypted config store registered as settings source under '%s/'", CFG_SETTINGS_ROOT);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef CFG_SETTINGS_H
+#define CFG_SETTINGS_H
+
+#include <stddef.h>
+
+/*
+ * Encrypted config store as a settings source.
+ *
+ * Key "<a>_<b>" (or "<a>.<b>") is exposed as settings name "cfg/<a>/<b>",
+ * so a module can call settings_load_subtree("cfg/mq") to receive only the
+ * mq_* keys, decrypted on demand into its own buffer. The store is load-only:
+ * Zephyr has a single save destination and FCB keeps it for the other
+ * settings users, so settings_save_one() never reaches the store. Store keys
+ * are written with config_set()/config_erase().
+ */
+#define CFG_SETTINGS_ROOT  "cfg"
+
+int cfg_settings_init(void);
+
+#endif /* CFG_SETTINGS_H */
@@ -0,0 +1,336 @@
+#include "config.h"
+#include "cfg_stats.h"
+#include "cfg_mac.h"
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/stats/stats.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/storage/flash_map.h>
+
+LOG_MODULE_REGISTER(cfg_stats, LOG_LEVEL_INF);
+
+/*
+ * "cfg_store" STATS group, readable over MCUmgr (stat group).
+ * Erase counters are per blob page plus the journal page. Write amplification
+ * is bytes_prog / bytes_chg: bytes handed to the flash driver vs. bytes whose
+ * stored value actually changed. Latencies are bucketed per AEAD call.
+ */
+BUILD_ASSERT(CONFIG_PAGE_COUNT == 3, "update the per-page erase counters");
+
+STATS_SECT_START(cfg_store)
+STATS_SECT_ENTRY32(erase_p0)
+STATS_SECT_ENTRY32(erase_p1)
+STATS_SECT_ENTRY32(erase_p2)
+STATS_SECT_ENTRY32(erase_jrnl)
+STATS_SECT_ENTRY32(bytes_prog)
+STATS_SECT_ENTRY32(bytes_chg)
+STATS_SECT_ENTRY32(auth_fail)
+STATS_SECT_ENTRY32(parse_err)
+STATS_SECT_ENTRY32(dec_fail)
+STATS_SECT_ENTRY32(dec_lt250us)
+STATS_SECT_ENTRY32(dec_lt1ms)
+STATS_SECT_ENTRY32(dec_lt4ms)
+STATS_SECT_ENTRY32(dec_ge4ms)
+STATS_SECT_ENTRY32(enc_fail)
+STATS_SECT_ENTRY32(enc_lt250us)
+STATS_SECT_ENTRY32(enc_lt1ms)
+STATS_SECT_ENTRY32(enc_lt4ms)
+STATS_SECT_ENTRY32(enc_ge4ms)
+STATS_SECT_END;
+
+STATS_SECT_DECL(cfg_store) cfg_store_stats;
+
+STATS_NAME_START(cfg_store)
+STATS_NAME(cfg_store, erase_p0)
+STATS_NAME(cfg_store, erase_p1)
+STATS_NAME(cfg_store, erase_p2)
+STATS_NAME(cfg_store, erase_jrnl)
+STATS_NAME(cfg_store, bytes_prog)
+STATS_NAME(cfg_store, bytes_chg)
+STATS_NAME(cfg_store, auth_fail)
+STATS_NAME(cfg_store, parse_err)
+STATS_NAME(cfg_store, dec_fail)
+STATS_NAME(cfg_store, dec_lt250us)
+STATS_NAME(cfg_store, dec_lt1ms)
+STATS_NAME(cfg_store, dec_lt4ms)
+STATS_NAME(cfg_store, dec_ge4ms)
+STATS_NAME(cfg_store, enc_fail)
+STATS_NAME(cfg_store, enc_lt250us)
+STATS_NAME(cfg_store, enc_lt1ms)
+STATS_NAME(cfg_store, enc_lt4ms)
+STATS_NAME(cfg_store, enc_ge4ms)
+STATS_NAME_END(cfg_store);
+
+/* Counters follow the stats header; persisted as one settings value */
+#define COUNTERS_PTR   ((uint8_t *)&cfg_store_stats + sizeof(struct stats_hdr))
+#define COUNTERS_SIZE  (sizeof(cfg_store_stats) - sizeof(struct stats_hdr))
+
+#define CMP_CHUNK 64
+
+static struct k_work_delayable save_work;
+static bool initialized;
+
+/*
+ * "v1" had the same layout with crc_fail where auth_fail is now. Its other
+ * counters carry over; the CRC failure count is not an auth failure count.
+ */
+static uint8_t v1_counters[COUNTERS_SIZE];
+static bool have_v1, have_v2;
+
+static int cfg_stats_settings_set(const char *name, size_t len,
+                                  settings_read_cb read_cb, void *cb_arg)
+{
+    uint8_t *dst;
+
+    if (settings_name_steq(name, "v2", NULL)) {
+        dst = COUNTERS_PTR;
+    } else if (settings_name_steq(name, "v1", NULL)) {
+        dst = v1_counters;
+    } else {
+        return -ENOENT;
+    }
+
+    if (len != COUNTERS_SIZE) {
+        LOG_WRN("Stored counters %s have a different layout (%u bytes), starting fresh",
+                name, (unsigned)len);
+        return 0;
+    }
+
+    int rc = read_cb(cb_arg, dst, COUNTERS_SIZE);
+    if (rc < 0) {
+        return rc;
+    }
+    if (dst == COUNTERS_PTR) {
+        have_v2 = true;
+    } else {
+        have_v1 = true;
+    }
+    return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(cfg_stats, "cfgstat", NULL, cfg_stats_settings_set, NULL, NULL);
+
+static void save_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    int err = settings_save_one("cfgstat/v2", COUNTERS_PTR, COUNTERS_SIZE);
+    if (err) {
+        LOG_ERR("Saving config store stats failed: %d", err);
+    }
+}
+
+static void schedule_save(void)
+{
+    if (initialized) {
+        /* No-op while a save is already pending, so bursts coalesce */
+        k_work_schedule(&save_work, K_SECONDS(CFG_STATS_SAVE_DELAY_S));
+    }
+}
+
+int cfg_stats_init(void)
+{
+    int err;
+
+    err = stats_init_and_reg(STATS_HDR(cfg_store_stats),
+                             STATS_SIZE_INIT_PARMS(cfg_store_stats, STATS_SIZE_32),
+                             STATS_NAME_INIT_PARMS(cfg_store), "cfg_store");
+    if (err) {
+        LOG_ERR("stats_init_and_reg failed: %d", err);
+        return err;
+    }
+
+    err = settings_subsys_init();
+    if (err) {
+        LOG_ERR("settings_subsys_init failed: %d", err);
+        return err;
+    }
+
+    err = settings_load_subtree("cfgstat");
+    if (err) {
+        LOG_WRN("Loading persisted config store stats failed: %d", err);
+    }
+
+    /* v2 wins if a reset hit between saving it and deleting v1 */
+    if (have_v1 && !have_v2) {
+        memcpy(COUNTERS_PTR, v1_counters, COUNTERS_SIZE);
+        cfg_store_stats.auth_fail = 0;
+        err = settings_save_one("cfgstat/v2", COUNTERS_PTR, COUNTERS_SIZE);
+        if (err) {
+            LOG_ERR("Migrating config store stats failed: %d", err);
+        } else {
+            have_v2 = true;
+            LOG_INF("Migrated config store stats to v2, crc_fail dropped");
+        }
+    }
+    if (have_v1 && have_v2) {
+        settings_delete("cfgstat/v1");
+    }
+
+    k_work_init_delayable(&save_work, save_work_handler);
+    initialized = true;
+
+    LOG_INF("Blob page erases: %u/%u/%u, journal %u",
+            cfg_store_stats.erase_p0, cfg_store_stats.erase_p1,
+            cfg_store_stats.erase_p2, cfg_store_stats.erase_jrnl);
+    return 0;
+}
+
+static bool is_blob_area(const struct flash_area *fa)
+{
+    return fa->fa_id == FLASH_AREA_ID(encrypted_blob_slot0);
+}
+
+static void count_erase(off_t off, size_t len)
+{
+    for (off_t p = off; p < off + (off_t)len; p += FLASH_PAGE_SIZE) {
+        switch (p / FLASH_PAGE_SIZE) {
+        case 0: STATS_INC(cfg_store_stats, erase_p0); break;
+        case 1: STATS_INC(cfg_store_stats, erase_p1); break;
+        case 2: STATS_INC(cfg_store_stats, erase_p2); break;
+        default: STATS_INC(cfg_store_stats, erase_jrnl); break;
+        }
+    }
+    schedule_save();
+}
+
+/* Number of bytes in data that differ from what is currently stored at off */
+static size_t count_changed(const struct flash_area *fa, off_t off, const uint8_t *data, size_t len)
+{
+    uint8_t old[CMP_CHUNK];
+    size_t changed = 0;
+
+    for (size_t done = 0; done < len; done += CMP_CHUNK) {
+        size_t n = MIN(CMP_CHUNK, len - done);
+        if (flash_area_read(fa, off + done, old, n)) {
+            return len;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (old[i] != data[done + i]) changed++;
+        }
+    }
+    return changed;
+}
+
+/* Body writes are announced to the ITS seal first; nothing is written if that fails */
+static int body_announce(const struct flash_area *fa, off_t off, size_t span)
+{
+    return is_blob_area(fa) ? cfg_mac_announce(off, span) : 0;
+}
+
+int cfg_flash_erase(const struct flash_area *fa, off_t off, size_t len)
+{
+    int err = body_announce(fa, off, len);
+    if (err) return err;
+
+    err = flash_area_erase(fa, off, len);
+    if (!err && is_blob_area(fa)) {
+        count_erase(off, len);
+    }
+    return err;
+}
+
+int cfg_flash_write(const struct flash_area *fa, off_t off, const void *data, size_t len)
+{
+    size_t changed = is_blob_area(fa) ? count_changed(fa, off, data, len) : 0;
+
+    int err = body_announce(fa, off, len);
+    if (err) return err;
+
+    err = flash_area_write(fa, off, data, len);
+    if (!err && is_blob_area(fa)) {
+        STATS_INCN(cfg_store_stats, bytes_prog, len);
+        STATS_INCN(cfg_store_stats, bytes_chg, changed);
+        schedule_save();
+    }
+    return err;
+}
+
+int cfg_flash_rewrite_page(const struct flash_area *fa, off_t page_off, const uint8_t *page_buf, size_t len)
+{
+    /* Compare against the old contents before the erase wipes them */
+    size_t changed = is_blob_area(fa) ? count_changed(fa, page_off, page_buf, len) : 0;
+
+    int err = body_announce(fa, page_off, FLASH_PAGE_SIZE);
+    if (err) return err;
+
+    err = flash_area_erase(fa, page_off, FLASH_PAGE_SIZE);
+    if (err) {
+        LOG_ERR("flash_area_erase failed: %d (offset: 0x%x)", err, (unsigned int)page_off);
+        return err;
+    }
+
+    err = flash_area_write(fa, page_off, page_buf, len);
+    if (err) {
+        LOG_ERR("flash_area_write failed: %d (offset: 0x%x)", err, (unsigned int)page_off);
+    }
+
+    if (is_blob_area(fa)) {
+        count_erase(page_off, FLASH_PAGE_SIZE);
+        if (!err) {
+            STATS_INCN(cfg_store_stats, bytes_prog, len);
+            STATS_INCN(cfg_store_stats, bytes_chg, changed);
+        }
+    }
+    return err;
+}
+
+void cfg_stats_programmed(size_t len)
+{
+    STATS_INCN(cfg_store_stats, bytes_prog, len);
+    STATS_INCN(cfg_store_stats, bytes_chg, len);
+    schedule_save();
+}
+
+void cfg_stats_auth_failed(void)
+{
+    STATS_INC(cfg_store_stats, auth_fail);
+    schedule_save();
+}
+
+void cfg_stats_parse_error(void)
+{
+    STATS_INC(cfg_store_stats, parse_err);
+    schedule_save();
+}
+
+void cfg_stats_decrypt_done(uint32_t cycles, bool ok)
+{
+    uint32_t us = k_cyc_to_us_floor32(cycles);
+
+    if (!ok) {
+        STATS_INC(cfg_store_stats, dec_fail);
+        schedule_save();
+    }
+
+    if (us < 250) {
+        STATS_INC(cfg_store_stats, dec_lt250us);
+    } else if (us < 1000) {
+        STATS_INC(cfg_store_stats, dec_lt1ms);
+    } else if (us < 4000) {
+        STATS_INC(cfg_store_stats, dec_lt4ms);
+    } else {
+        STATS_INC(cfg_store_stats, dec_ge4ms);
+    }
+}
+
+void cfg_stats_encrypt_done(uint32_t cycles, bool ok)
+{
+    uint32_t us = k_cyc_to_us_floor32(cycles);
+
+    if (!ok) {
+        STATS_INC(cfg_store_stats, enc_fail);
+        schedule_save();
+    }
+
+    if (us < 250) {
+        STATS_INC(cfg_store_stats, enc_lt250us);
+    } else if (us < 1000) {
+        STATS_INC(cfg_store_stats, enc_lt1ms);
+    } else if (us < 4000) {
+        STATS_INC(cfg_store_stats, enc_lt4ms);
+    } else {
+        STATS_INC(cfg_store_stats, enc_ge4ms);
+    }
+}
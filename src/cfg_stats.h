@@ -0,0 +1,28 @@
+#ifndef CFG_STATS_H
+#define CFG_STATS_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Persist counters at most this often; wear data survives reboots via settings */
+#define CFG_STATS_SAVE_DELAY_S  300
+
+int cfg_stats_init(void);
+
+/* Flash wrappers for encrypted_blob_slot0: count erases per page and bytes programmed/changed */
+int cfg_flash_erase(const struct flash_area *fa, off_t off, size_t len);
+int cfg_flash_write(const struct flash_area *fa, off_t off, const void *data, size_t len);
+int cfg_flash_rewrite_page(const struct flash_area *fa, off_t page_off, const uint8_t *page_buf, size_t len);
+
+/* Bytes programmed into a blank blob outside the wrappers (stream_flash provisioning) */
+void cfg_stats_programmed(size_t len);
+
+/* Boot check rejected the blob (takes the slot of the retired CRC counter) */
+void cfg_stats_auth_failed(void);
+void cfg_stats_parse_error(void);
+void cfg_stats_decrypt_done(uint32_t cycles, bool ok);
+void cfg_stats_encrypt_done(uint32_t cycles, bool ok);
+
+#endif /* CFG_STATS_H */
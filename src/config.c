@@ -15,7 +15,15 @@
 #include <zephyr/sys/crc.h>
 #include <zephyr/storage/flash_map.h>
 #include "encryption_helper.h"
+#include "cfg_stats.h"
+#include "cfg_maint.h"
+#include "cfg_its.h"
+#include "cfg_nonce.h"
+#include "cfg_mac.h"
+#include <psa/internal_trusted_storage.h>
 LOG_MODULE_REGISTER(configuration, LOG_LEVEL_INF);
+
+extern psa_key_id_t my_key_id;
 char json_payload[512] = "NO PVT";
 char sensor_payload[512] = "NO SENSOR DATA";
 char lte_payload[512] = "NO LTE DATA";
@@ -42,46 +50,16 @@ int num_entries = 0;
 
 
 
+/*
+ * Closing an update MACs the pages it opened and commits the seal in ITS (see
+ * cfg_mac.h); the blob itself is not touched again.
+ */
 int update_crc(void)
 {
-    const struct flash_area *fa;
-    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
-    if (err) {
-        LOG_ERR("flash_area_open for CRC failed: %d", err);
-        return err;
-    }
-
-    uint32_t new_crc = manual_crc32(ENCRYPTED_BLOB_ADDR, ENCRYPTED_BLOB_SIZE - 4);
-    uint32_t crc_offset = CRC_LOCATION_OFFSET;
-    uint32_t page_start = (crc_offset / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE;
-
-    static uint8_t page_buf[FLASH_PAGE_SIZE];
-
-    err = flash_area_read(fa, page_start, page_buf, FLASH_PAGE_SIZE);
+    int err = cfg_mac_commit();
     if (err) {
-        LOG_ERR("flash_area_read for CRC page failed: %d", err);
-        flash_area_close(fa);
-        return err;
+        LOG_ERR("Committing the blob seal failed: %d", err);
     }
-
-    uint32_t crc_offset_in_page = crc_offset - page_start;
-    memcpy(&page_buf[crc_offset_in_page], &new_crc, 4);
-
-    err = flash_area_erase(fa, page_start, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_erase CRC page failed: %d", err);
-        flash_area_close(fa);
-        return err;
-    }
-
-    err = flash_area_write(fa, page_start, page_buf, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("CRC write failed: %d", err);
-    } else {
-        LOG_INF("CRC updated: 0x%08X at offset 0x%x", new_crc, crc_offset);
-    }
-
-    flash_area_close(fa);
     return err;
 }
 
@@ -107,61 +85,984 @@ uint32_t manual_crc32(const uint8_t *data, size_t len) {
     return crc;
 }
 
-const char *get_config(const char *aad)
+/*
+ * Key index: entries[] positions sorted by AAD (bytewise, shorter first on a
+ * common prefix). Equal keys keep flash order, so lookups still try the first
+ * parsed copy first. Rebuilt by parse_encrypted_blob(); compaction only moves
+ * mem_offset and never changes the order.
+ */
+static uint8_t key_order[MAX_ENTRIES];
+BUILD_ASSERT(MAX_ENTRIES <= UINT8_MAX, "key_order holds entries[] positions as uint8_t");
+
+static int key_cmp(const ConfigEntry *e, const uint8_t *key, size_t key_len)
 {
-    static char decrypted[DECRYPTED_OUTPUT_MAX]; // persistent output
-    size_t decrypted_len = 0;
+    size_t n = MIN(e->aad_len, key_len);
+    int c = memcmp(e->aad, key, n);
+    if (c != 0) return c;
+    return (e->aad_len > key_len) - (e->aad_len < key_len);
+}
 
+static void build_key_index(void)
+{
+    /* Insertion sort: at most MAX_ENTRIES keys, and stable for duplicates */
     for (int i = 0; i < num_entries; i++) {
-        ConfigEntry *e = &entries[i];
+        int j = i;
+        while (j > 0 && key_cmp(&entries[key_order[j - 1]], entries[i].aad, entries[i].aad_len) > 0) {
+            key_order[j] = key_order[j - 1];
+            j--;
+        }
+        key_order[j] = i;
+    }
+}
+
+/* First position in key_order whose key is >= key */
+static int key_lower_bound(const uint8_t *key, size_t key_len)
+{
+    int lo = 0, hi = num_entries;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (key_cmp(&entries[key_order[mid]], key, key_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const ConfigEntry *cfg_find_entry(const char *key)
+{
+    size_t key_len = strlen(key);
+    int pos = key_lower_bound((const uint8_t *)key, key_len);
+
+    if (pos < num_entries && key_cmp(&entries[key_order[pos]], (const uint8_t *)key, key_len) == 0) {
+        return &entries[key_order[pos]];
+    }
+    return NULL;
+}
+
+int cfg_foreach_prefix(const char *prefix, cfg_foreach_cb_t cb, void *user)
+{
+    const ConfigEntry *prev = NULL;
+
+    int ret = 0;
+
+    if (!prefix) prefix = "";
+    size_t prefix_len = strlen(prefix);
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    for (int pos = key_lower_bound((const uint8_t *)prefix, prefix_len); pos < num_entries && !ret; pos++) {
+        const ConfigEntry *e = &entries[key_order[pos]];
+
+        if (e->aad_len < prefix_len || memcmp(e->aad, prefix, prefix_len) != 0) {
+            break;
+        }
+        /* Duplicates are adjacent; report each key once */
+        if (prev && key_cmp(prev, e->aad, e->aad_len) == 0) {
+            continue;
+        }
+        prev = e;
+
+        ret = cb(e, user);
+    }
+    k_mutex_unlock(&cfg_blob_lock);
+    return ret;
+}
+
+/* ---------- chunked records ---------- */
+
+#define TAG_LEN  NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH
+
+static const uint8_t *rec_id(const ConfigEntry *e)
+{
+    return e->iv + e->iv_len - CFG_REC_ID_LEN;
+}
+
+/* Bytes of ct||tag that fit in the head slot after the record header */
+static size_t head_room(size_t iv_len, size_t aad_len)
+{
+    return ENTRY_SIZE - (1 + iv_len + 2 + aad_len + 2);
+}
+
+static const uint8_t *find_cont(const uint8_t *id, uint8_t seq)
+{
+    for (int s = 0; s < CFG_USABLE_SLOTS; s++) {
+        const uint8_t *p = ENCRYPTED_BLOB_ADDR + (size_t)s * ENTRY_SIZE;
+        if (p[0] == CFG_SLOT_CONT && p[1 + CFG_REC_ID_LEN] == seq &&
+            memcmp(p + 1, id, CFG_REC_ID_LEN) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Segment seq of the ciphertext: 0 is the head part held in RAM, then continuation slots */
+static int ct_segment(const ConfigEntry *e, int seq, const uint8_t **data, size_t *len)
+{
+    if (seq == 0) {
+        *data = e->ciphertext;
+        *len = e->chunks ? head_room(e->iv_len, e->aad_len) : e->ciphertext_len;
+        return 0;
+    }
+
+    const uint8_t *p = find_cont(rec_id(e), seq);
+    if (!p) return -ENOENT;
+
+    size_t done = head_room(e->iv_len, e->aad_len) + (size_t)(seq - 1) * CFG_CONT_DATA_LEN;
+    *data = p + CFG_CONT_HDR_LEN;
+    *len = MIN(CFG_CONT_DATA_LEN, e->ciphertext_len - done);
+    return 0;
+}
+
+int cfg_entry_tag(const ConfigEntry *e, uint8_t *tag)
+{
+    size_t pos = 0;
+    int err = 0;
+
+    if (!e || e->ciphertext_len < TAG_LEN) return -EINVAL;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    for (int seq = 0; seq <= e->chunks; seq++) {
+        const uint8_t *p;
+        size_t n;
+        if (ct_segment(e, seq, &p, &n)) {
+            err = -ENOENT;
+            break;
+        }
+
+        /* Copy whatever part of [ct_len - TAG_LEN, ct_len) this segment covers */
+        for (size_t i = 0; i < n; i++, pos++) {
+            if (pos >= e->ciphertext_len - TAG_LEN) {
+                tag[pos - (e->ciphertext_len - TAG_LEN)] = p[i];
+            }
+        }
+    }
+    k_mutex_unlock(&cfg_blob_lock);
+    return err;
+}
+
+/*
+ * Multipart GCM over the record segments. Plaintext goes to the sink as it is
+ * produced; the tag is only checked at the end, so a sink must hold off on
+ * acting on the data until this returns 0. count=false keeps the pass out of
+ * cfg_stats (benchmarks).
+ */
+static int stream_entry(const ConfigEntry *e, psa_key_id_t key, cfg_sink_t sink, void *ctx,
+                        size_t *total, bool count)
+{
+    psa_aead_operation_t op = PSA_AEAD_OPERATION_INIT;
+    uint8_t out[CFG_CONT_DATA_LEN + NRF_CRYPTO_EXAMPLE_AES_BLOCK_SIZE];
+    uint8_t tag[TAG_LEN];
+    size_t data_len, fed = 0, tag_have = 0, olen;
+    int err = 0;
+
+    if (e->ciphertext_len < TAG_LEN) return -EBADMSG;
+    data_len = e->ciphertext_len - TAG_LEN;
+    if (total) *total = 0;
+
+    uint32_t t0 = k_cycle_get_32();
+    psa_status_t st = psa_aead_decrypt_setup(&op, key, PSA_ALG_GCM);
+    if (st == PSA_SUCCESS) st = psa_aead_set_lengths(&op, e->aad_len, data_len);
+    if (st == PSA_SUCCESS) st = psa_aead_set_nonce(&op, e->iv, e->iv_len);
+    if (st == PSA_SUCCESS) st = psa_aead_update_ad(&op, e->aad, e->aad_len);
+
+    for (int seq = 0; st == PSA_SUCCESS && !err && seq <= e->chunks; seq++) {
+        const uint8_t *p;
+        size_t n;
+
+        err = ct_segment(e, seq, &p, &n);
+        if (err) break;
+
+        size_t d = (fed < data_len) ? MIN(n, data_len - fed) : 0;
+        /* A contiguous legacy record can exceed one slot; feed it in slot-sized pieces */
+        for (size_t off = 0; st == PSA_SUCCESS && !err && off < d; off += CFG_CONT_DATA_LEN) {
+            size_t piece = MIN(CFG_CONT_DATA_LEN, d - off);
+            st = psa_aead_update(&op, p + off, piece, out, sizeof(out), &olen);
+            if (st == PSA_SUCCESS && olen) {
+                err = sink(ctx, out, olen);
+                if (total) *total += olen;
+            }
+        }
+        fed += d;
+        if (st != PSA_SUCCESS || err) break;
+        if (n - d > TAG_LEN - tag_have) {
+            err = -EBADMSG;
+            break;
+        }
+        memcpy(tag + tag_have, p + d, n - d);
+        tag_have += n - d;
+    }
+
+    if (st == PSA_SUCCESS && !err) {
+        st = (tag_have == TAG_LEN) ? psa_aead_verify(&op, out, sizeof(out), &olen, tag, TAG_LEN)
+                                   : PSA_ERROR_INVALID_SIGNATURE;
+        if (st == PSA_SUCCESS && olen) {
+            err = sink(ctx, out, olen);
+            if (total) *total += olen;
+        }
+    }
+
+    psa_aead_abort(&op);
+    memset(out, 0, sizeof(out));
+    if (count) {
+        cfg_stats_decrypt_done(k_cycle_get_32() - t0, st == PSA_SUCCESS && !err);
+    }
+
+    if (err) return err;
+    if (st != PSA_SUCCESS) {
+        LOG_DBG("Streaming decryption failed (psa_status: %d)", st);
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+/*
+ * During a key rotation an entry may still be under the previous key; that is
+ * tried second, so a sink can see one failed (unauthenticated) pass first.
+ */
+int get_config_stream(const char *key, cfg_sink_t sink, void *ctx, size_t *total)
+{
+    if (!key || !sink) return -EINVAL;
+
+    /* Continuation slots are read from flash, keep the compactor off them meanwhile */
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    const ConfigEntry *e = cfg_find_entry(key);
+    int err = -ENOENT;
+    if (e) {
+        psa_key_id_t k = cfg_key_get();
+        err = stream_entry(e, k, sink, ctx, total, true);
+        cfg_key_put(k);
+    }
+    if (err == -EBADMSG && cfg_key_has_prev()) {
+        psa_key_id_t k = cfg_key_get_prev();
+        err = stream_entry(e, k, sink, ctx, total, true);
+        cfg_key_put(k);
+    }
+    k_mutex_unlock(&cfg_blob_lock);
+    return err;
+}
+
+struct buf_sink_ctx {
+    char *buf;
+    size_t size;
+    size_t len;
+};
 
-        if (e->aad_len == strlen(aad) &&
-            memcmp(e->aad, aad, e->aad_len) == 0) {
+static int buf_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    struct buf_sink_ctx *b = ctx;
+
+    if (b->len + len >= b->size) return -ENOBUFS;
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return 0;
+}
 
-            int ret = decrypt_config_field_data(
+int cfg_entry_decrypt(const ConfigEntry *e, psa_key_id_t key, char *out, size_t out_size, size_t *out_len)
+{
+    struct buf_sink_ctx b = { .buf = out, .size = out_size };
+
+    if (!e || !out || !out_size) return -EINVAL;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    int err = stream_entry(e, key, buf_sink, &b, NULL, true);
+    k_mutex_unlock(&cfg_blob_lock);
+
+    if (err) {
+        memset(out, 0, b.len);   /* unauthenticated plaintext */
+        b.len = 0;
+    }
+    out[b.len] = '\0';
+    if (out_len) *out_len = b.len;
+    return err;
+}
+
+static int discard_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    ARG_UNUSED(ctx);
+    ARG_UNUSED(data);
+    ARG_UNUSED(len);
+    return 0;
+}
+
+int cfg_entry_check(const ConfigEntry *e, psa_key_id_t key, size_t *len)
+{
+    if (!e) return -EINVAL;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    int err = stream_entry(e, key, discard_sink, NULL, len, false);
+    k_mutex_unlock(&cfg_blob_lock);
+    return err;
+}
+
+const char *get_config(const char *aad, char *out, size_t out_size)
+{
+    size_t decrypted_len = 0;
+    size_t aad_len = strlen(aad);
+    bool hot = cfg_its_is_hot(aad);
+    bool found = false;
+    const char *val = NULL;
+
+    if (!out || !out_size) return NULL;
+
+    /* entries[] and key_order[] are rebuilt by parse_encrypted_blob() under the same lock */
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    for (int pos = key_lower_bound((const uint8_t *)aad, aad_len); pos < num_entries; pos++) {
+        ConfigEntry *e = &entries[key_order[pos]];
+
+        if (key_cmp(e, (const uint8_t *)aad, aad_len) != 0) {
+            break;
+        }
+
+        found = true;
+        if (hot && cfg_its_get(aad, e, out, out_size, &decrypted_len) == 0) {
+            val = out;
+            break;
+        }
+
+        int ret;
+        if (e->chunks || out_size <= NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE) {
+            /* Fits out or fails; larger values need get_config_stream() */
+            psa_key_id_t k = cfg_key_get();
+            ret = cfg_entry_decrypt(e, k, out, out_size, &decrypted_len);
+            cfg_key_put(k);
+            if (ret == -EBADMSG && cfg_key_has_prev()) {
+                k = cfg_key_get_prev();
+                ret = cfg_entry_decrypt(e, k, out, out_size, &decrypted_len);
+                cfg_key_put(k);
+            }
+        } else {
+            ret = decrypt_config_field_data(
                 (const char *)e->ciphertext, e->ciphertext_len,
                 (const char *)e->iv,
                 (const char *)e->aad, e->aad_len,
-                decrypted, &decrypted_len
+                out, out_size - 1, &decrypted_len
             );
+        }
 
-            if (ret != 0) {
-                LOG_ERR("Decryption failed for AAD: %s", aad);
-                return NULL;
-            }
+        if (ret != 0) {
+            // an interrupted compaction step can leave a torn copy; try the next match
+            continue;
+        }
 
-            decrypted[decrypted_len] = '\0'; // null-terminate
-            return decrypted;
+        out[decrypted_len] = '\0'; // null-terminate
+        if (hot) {
+            cfg_its_put(aad, e, out, decrypted_len);
         }
+        val = out;
+        break;
+    }
+
+    k_mutex_unlock(&cfg_blob_lock);
+
+    if (val) {
+        return val;
+    }
+    out[0] = '\0';
+    if (found) {
+        LOG_ERR("Decryption failed for AAD: %s", aad);
+        return NULL;
     }
 
     LOG_WRN("AAD not found: %s", aad);
     return "NULL";
 }
 
-void parse_encrypted_blob(void)
+/* Tombstone continuation slots 1..chunks of a record, including compaction duplicates */
+static void tombstone_chain(const struct flash_area *fa, const uint8_t *id, int chunks)
+{
+    for (int s = 0; s < CFG_USABLE_SLOTS; s++) {
+        const uint8_t *p = ENCRYPTED_BLOB_ADDR + (size_t)s * ENTRY_SIZE;
+        uint8_t seq = p[1 + CFG_REC_ID_LEN];
+
+        if (p[0] == CFG_SLOT_CONT && seq >= 1 && seq <= chunks &&
+            memcmp(p + 1, id, CFG_REC_ID_LEN) == 0) {
+            cfg_tombstone_slot(fa, s);
+        }
+    }
+}
+
+/* Tombstone every parsed copy of key except the one at keep_offset */
+static int tombstone_copies(const struct flash_area *fa, const char *key, uint32_t keep_offset)
+{
+    size_t key_len = strlen(key);
+    int err = 0;
+
+    for (int pos = key_lower_bound((const uint8_t *)key, key_len); pos < num_entries; pos++) {
+        const ConfigEntry *e = &entries[key_order[pos]];
+
+        if (key_cmp(e, (const uint8_t *)key, key_len) != 0) break;
+        if (e->mem_offset == keep_offset) continue;
+
+        int ret = cfg_tombstone_slot(fa, e->mem_offset / ENTRY_SIZE);
+        if (ret) {
+            LOG_ERR("Tombstoning '%s' @0x%04x failed: %d", key, (unsigned)e->mem_offset, ret);
+            err = ret;
+        }
+        if (e->chunks) {
+            tombstone_chain(fa, rec_id(e), e->chunks);
+        }
+    }
+    return err;
+}
+
+/*
+ * Writer for chunked records: ciphertext fills the head slot image in RAM and
+ * then continuation slots, each programmed as soon as it is full. The head
+ * is programmed last by the caller, so a torn write leaves only orphaned
+ * continuations, which the parser ignores.
+ */
+struct chunk_writer {
+    const struct flash_area *fa;
+    const int *slots;           /* [0] head, [1..n] continuations */
+    const uint8_t *id;
+    uint8_t head[ENTRY_SIZE];
+    size_t head_pos;
+    uint8_t cont[ENTRY_SIZE];
+    size_t cont_pos;
+    int seq;
+};
+
+static int chunk_flush(struct chunk_writer *w)
+{
+    int slot = w->slots[w->seq];
+
+    memset(w->cont + w->cont_pos, 0x00, ENTRY_SIZE - w->cont_pos);
+    int err = cfg_flash_write(w->fa, (off_t)slot * ENTRY_SIZE, w->cont, ENTRY_SIZE);
+    if (err || memcmp(ENCRYPTED_BLOB_ADDR + (size_t)slot * ENTRY_SIZE, w->cont, ENTRY_SIZE) != 0) {
+        LOG_ERR("Writing continuation %d into slot %d failed: %d", w->seq, slot, err);
+        return err ? err : -EIO;
+    }
+    w->seq++;
+    w->cont_pos = 0;
+    return 0;
+}
+
+static int chunk_emit(struct chunk_writer *w, const uint8_t *data, size_t len)
+{
+    while (len) {
+        size_t n;
+
+        if (w->head_pos < ENTRY_SIZE) {
+            n = MIN(len, ENTRY_SIZE - w->head_pos);
+            memcpy(w->head + w->head_pos, data, n);
+            w->head_pos += n;
+        } else {
+            if (w->cont_pos == 0) {
+                w->cont[0] = CFG_SLOT_CONT;
+                memcpy(w->cont + 1, w->id, CFG_REC_ID_LEN);
+                w->cont[1 + CFG_REC_ID_LEN] = (uint8_t)w->seq;
+                w->cont_pos = CFG_CONT_HDR_LEN;
+            }
+            n = MIN(len, ENTRY_SIZE - w->cont_pos);
+            memcpy(w->cont + w->cont_pos, data, n);
+            w->cont_pos += n;
+            if (w->cont_pos == ENTRY_SIZE) {
+                int err = chunk_flush(w);
+                if (err) return err;
+            }
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Multipart GCM straight into the slots, so the value is never held as one ciphertext buffer */
+static int chunk_encrypt(struct chunk_writer *w, const uint8_t *iv, const char *key,
+                         const char *value, size_t len)
+{
+    psa_aead_operation_t op = PSA_AEAD_OPERATION_INIT;
+    uint8_t out[64 + NRF_CRYPTO_EXAMPLE_AES_BLOCK_SIZE];
+    uint8_t tag[TAG_LEN];
+    size_t olen, tag_len;
+    int err = 0;
+
+    uint32_t t0 = k_cycle_get_32();
+    psa_key_id_t k = cfg_key_get();
+    psa_status_t st = psa_aead_encrypt_setup(&op, k, PSA_ALG_GCM);
+    if (st == PSA_SUCCESS) st = psa_aead_set_lengths(&op, strlen(key), len);
+    if (st == PSA_SUCCESS) st = psa_aead_set_nonce(&op, iv, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
+    if (st == PSA_SUCCESS) st = psa_aead_update_ad(&op, (const uint8_t *)key, strlen(key));
+
+    for (size_t off = 0; st == PSA_SUCCESS && !err && off < len; off += 64) {
+        st = psa_aead_update(&op, (const uint8_t *)value + off, MIN(64, len - off),
+                             out, sizeof(out), &olen);
+        if (st == PSA_SUCCESS) err = chunk_emit(w, out, olen);
+    }
+    if (st == PSA_SUCCESS && !err) {
+        st = psa_aead_finish(&op, out, sizeof(out), &olen, tag, sizeof(tag), &tag_len);
+        if (st == PSA_SUCCESS) err = chunk_emit(w, out, olen);
+        if (st == PSA_SUCCESS && !err) err = chunk_emit(w, tag, tag_len);
+    }
+    if (st == PSA_SUCCESS && !err && w->cont_pos) {
+        err = chunk_flush(w);
+    }
+
+    psa_aead_abort(&op);
+    cfg_key_put(k);
+    cfg_stats_encrypt_done(k_cycle_get_32() - t0, st == PSA_SUCCESS);
+
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Chunked encryption failed (psa_status: %d)", st);
+        return -EIO;
+    }
+    return err;
+}
+
+/* Slots a record takes: 1, or the head plus its continuations when it is chunked */
+static int record_slots(const char *key, const char *value)
+{
+    size_t key_len = strlen(key), len = strlen(value);
+    size_t need = 1 + NRF_CRYPTO_EXAMPLE_AES_IV_SIZE + 2 + key_len + 2 + len + TAG_LEN;
+
+    if (key_len > MAX_AAD_LEN || len > CFG_MAX_VALUE_LEN) {
+        LOG_ERR("Entry '%s' is too large (%u bytes)", key, (unsigned)need);
+        return -E2BIG;
+    }
+    if (need <= ENTRY_SIZE) return 1;
+    return 1 + DIV_ROUND_UP(len + TAG_LEN - head_room(NRF_CRYPTO_EXAMPLE_AES_IV_SIZE, key_len),
+                            CFG_CONT_DATA_LEN);
+}
+
+/* Program a chunked record into slots (head first in the array); old copies are left alone */
+static int chunked_write(const struct flash_area *fa, const char *key, const char *value,
+                         int *slots)
+{
+    size_t key_len = strlen(key), len = strlen(value);
+    size_t ct_len = len + TAG_LEN;
+    int n = record_slots(key, value) - 1;
+    uint8_t iv[NRF_CRYPTO_EXAMPLE_AES_IV_SIZE];
+    const uint8_t *id = iv + sizeof(iv) - CFG_REC_ID_LEN;
+    static struct chunk_writer w;
+    int err;
+
+    /* The record id links continuations, so it must not match a live chain */
+    do {
+        if (cfg_nonce_generate(my_key_id, iv, sizeof(iv)) != PSA_SUCCESS) {
+            return PROVISIONING_ERROR_IV_GEN;
+        }
+    } while (find_cont(id, 1));
+
+    memset(&w, 0, sizeof(w));
+    w.fa = fa;
+    w.slots = slots;
+    w.id = id;
+    w.seq = 1;
+
+    uint8_t *p = w.head;
+    *p++ = sizeof(iv);
+    memcpy(p, iv, sizeof(iv));
+    p += sizeof(iv);
+    *p++ = key_len & 0xFF;
+    *p++ = (key_len >> 8) & 0xFF;
+    memcpy(p, key, key_len);
+    p += key_len;
+    *p++ = ct_len & 0xFF;
+    *p++ = (ct_len >> 8) & 0xFF;
+    w.head_pos = p - w.head;
+
+    err = chunk_encrypt(&w, iv, key, value, len);
+    if (!err) {
+        err = cfg_flash_write(fa, (off_t)slots[0] * ENTRY_SIZE, w.head, ENTRY_SIZE);
+        if (!err && memcmp(ENCRYPTED_BLOB_ADDR + (size_t)slots[0] * ENTRY_SIZE, w.head, ENTRY_SIZE) != 0) {
+            err = -EIO;
+        }
+        if (err) {
+            LOG_ERR("Writing head of '%s' into slot %d failed: %d", key, slots[0], err);
+            cfg_tombstone_slot(fa, slots[0]);
+        }
+    }
+    if (err) {
+        tombstone_chain(fa, id, n);
+    }
+    memset(&w, 0, sizeof(w));
+    return err ? err : slots[0];
+}
+
+/* Program one single-slot record; a torn or failed write is tombstoned */
+static int single_write(const struct flash_area *fa, const char *key, const char *value, int slot)
+{
+    uint8_t record[ENTRY_SIZE];
+
+    int err = create_encrypted_entry_with_aad(key, value, record);
+    if (err) return err;
+
+    err = cfg_flash_write(fa, (off_t)slot * ENTRY_SIZE, record, ENTRY_SIZE);
+    if (err || memcmp(ENCRYPTED_BLOB_ADDR + (size_t)slot * ENTRY_SIZE, record, ENTRY_SIZE) != 0) {
+        LOG_ERR("Writing '%s' into slot %d failed: %d", key, slot, err);
+        cfg_tombstone_slot(fa, slot);
+        return err ? err : -EIO;
+    }
+    return slot;
+}
+
+/* Write key into the record_slots() erased slots given; returns the head slot */
+static int write_record(const struct flash_area *fa, const char *key, const char *value, int *slots)
+{
+    return (record_slots(key, value) > 1) ? chunked_write(fa, key, value, slots)
+                                          : single_write(fa, key, value, slots[0]);
+}
+
+/* Called with cfg_blob_lock held; same append-then-tombstone order as config_set() */
+static int config_set_chunked(const struct flash_area *fa, const char *key, const char *value)
+{
+    int slots[1 + DIV_ROUND_UP(CFG_MAX_VALUE_LEN + TAG_LEN, CFG_CONT_DATA_LEN)];
+    int n = record_slots(key, value);
+
+    int err = cfg_find_erased_slots(slots, n);
+    if (err) {
+        LOG_WRN("No room for %d slots for '%s'", n, key);
+        return err;
+    }
+
+    int slot = chunked_write(fa, key, value, slots);
+    if (slot < 0) return slot;
+
+    tombstone_copies(fa, key, (uint32_t)slot * ENTRY_SIZE);
+    return slot;
+}
+
+/* Before the blob is parsed, entries[] is empty and there are no old copies to tombstone */
+int cfg_provision_chunked(const struct flash_area *fa, const char *key, const char *value)
+{
+    if (strlen(key) > MAX_AAD_LEN || strlen(value) > CFG_MAX_VALUE_LEN) return -E2BIG;
+    return config_set_chunked(fa, key, value);
+}
+
+/*
+ * Append-style update: the new record is programmed into an erased slot and
+ * only then are the old copies tombstoned, so no page erase is needed and a
+ * reset in between leaves at least one valid copy. Dead slots are reclaimed
+ * by background compaction. The caller holds cfg_blob_lock and reseals.
+ * Returns the (head) slot or a negative errno.
+ */
+static int store_record(const struct flash_area *fa, const char *key, const char *value)
+{
+    int n = record_slots(key, value);
+
+    if (n < 0) return n;
+    if (n > 1) {
+        return config_set_chunked(fa, key, value);
+    }
+
+    int slot = cfg_find_erased_slot();
+    if (slot < 0) {
+        LOG_WRN("No erased slot left for '%s'", key);
+        return -ENOSPC;
+    }
+
+    slot = single_write(fa, key, value, slot);
+    if (slot < 0) return slot;
+
+    tombstone_copies(fa, key, (uint32_t)slot * ENTRY_SIZE);
+    return slot;
+}
+
+int config_set(const char *key, const char *value)
+{
+    const struct flash_area *fa;
+
+    if (!key || !value) return -EINVAL;
+    if (!cfg_mac_trusted()) return -EACCES;
+
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
+    }
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    int slot = store_record(fa, key, value);
+    if (slot < 0) {
+        err = slot;
+        goto out;
+    }
+
+    err = update_crc();
+    parse_encrypted_blob();
+    cfg_its_put(key, cfg_find_entry(key), value, strlen(value));
+    LOG_INF("Stored '%s' in slot %d", key, slot);
+
+out:
+    k_mutex_unlock(&cfg_blob_lock);
+    flash_area_close(fa);
+    if (!err || err == -ENOSPC) {
+        cfg_compact_kick(err == -ENOSPC);
+    }
+    return err;
+}
+
+/*
+ * Batch intent, kept in ITS so a forged record cannot make recovery drop a
+ * live slot. WRITING: the new records may be partial, so every slot of the
+ * batch that is no longer erased is tombstoned and the old copies stay.
+ * WRITTEN: all records are complete, so the old copies of their keys go.
+ */
+#define CFG_BATCH_UID     0xC0F30003ULL   /* next to the blob seal and rotation state */
+#define CFG_BATCH_MAGIC   0x48544142u     /* "BATH" */
+
+enum cfg_batch_phase {
+    CFG_BATCH_WRITING = 1,
+    CFG_BATCH_WRITTEN = 2,
+};
+
+struct cfg_batch_intent {
+    uint32_t magic;
+    uint8_t phase;
+    uint8_t reserved[3];
+    uint8_t slots[DIV_ROUND_UP(CFG_USABLE_SLOTS, 8)];
+};
+
+static struct cfg_batch_intent batch_intent;
+
+static int batch_intent_save(uint8_t phase)
+{
+    batch_intent.magic = CFG_BATCH_MAGIC;
+    batch_intent.phase = phase;
+    psa_status_t st = psa_its_set(CFG_BATCH_UID, sizeof(batch_intent), &batch_intent,
+                                  PSA_STORAGE_FLAG_NONE);
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Saving batch intent failed: %d", st);
+        return -EIO;
+    }
+    return 0;
+}
+
+static bool batch_has_slot(int slot)
+{
+    return batch_intent.slots[slot / 8] & BIT(slot % 8);
+}
+
+/* Drop whatever the batch programmed; its slots were erased when it started */
+static void batch_roll_back(const struct flash_area *fa)
+{
+    for (int s = 0; s < CFG_USABLE_SLOTS; s++) {
+        if (batch_has_slot(s) && cfg_slot_state(s) != CFG_SLOT_ERASED) {
+            cfg_tombstone_slot(fa, s);
+        }
+    }
+}
+
+/* Every record of the batch is complete: retire the old copies of its keys */
+static int batch_roll_forward(const struct flash_area *fa)
+{
+    char key[MAX_AAD_LEN + 1];
+    int err = 0;
+
+    for (int i = 0; i < num_entries; i++) {
+        const ConfigEntry *e = &entries[i];
+
+        if (!batch_has_slot(e->mem_offset / ENTRY_SIZE)) continue;
+        memcpy(key, e->aad, e->aad_len);
+        key[e->aad_len] = '\0';
+        int ret = tombstone_copies(fa, key, e->mem_offset);
+        if (ret && !err) err = ret;
+    }
+    return err;
+}
+
+void config_batch_recover(void)
+{
+    const struct flash_area *fa;
+    size_t len;
+
+    if (psa_its_get(CFG_BATCH_UID, 0, sizeof(batch_intent), &batch_intent, &len) != PSA_SUCCESS) {
+        return;
+    }
+    if (len != sizeof(batch_intent) || batch_intent.magic != CFG_BATCH_MAGIC) {
+        LOG_WRN("Dropping unreadable batch intent");
+        psa_its_remove(CFG_BATCH_UID);
+        return;
+    }
+    if (flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa)) return;
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    if (batch_intent.phase == CFG_BATCH_WRITTEN) {
+        LOG_WRN("Completing a batch interrupted after its records were written");
+        batch_roll_forward(fa);
+    } else {
+        LOG_WRN("Rolling back a batch interrupted while writing");
+        batch_roll_back(fa);
+    }
+    if (update_crc() == 0) {
+        psa_its_remove(CFG_BATCH_UID);
+    }
+    parse_encrypted_blob();
+    k_mutex_unlock(&cfg_blob_lock);
+    flash_area_close(fa);
+}
+
+/* Nothing of the batch is stored: errno for the failing pairs, -ECANCELED for the rest */
+static int batch_fail(int *results, size_t n, int err)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (results[i] == 0) results[i] = -ECANCELED;
+    }
+    return err;
+}
+
+int config_set_batch(const char *const *keys, const char *const *values, size_t n, int *results)
+{
+    static int slots[CFG_USABLE_SLOTS];
+    static int heads[CFG_USABLE_SLOTS];
+    const struct flash_area *fa;
+    int err = 0, total = 0;
+    bool written = false;
+
+    if (!keys || !values || !results) return -EINVAL;
+    if (n > CFG_USABLE_SLOTS) return -E2BIG;
+    if (!cfg_mac_trusted()) return -EACCES;
+
+    /* Reject the whole batch up front: a bad pair must not leave the others half applied */
+    for (size_t i = 0; i < n; i++) {
+        int ret = (keys[i] && values[i]) ? record_slots(keys[i], values[i]) : -EINVAL;
+        /* Copies written earlier in the batch are not parsed yet, so they could not be tombstoned */
+        for (size_t j = 0; j < i && ret > 0; j++) {
+            if (keys[j] && strcmp(keys[i], keys[j]) == 0) ret = -EEXIST;
+        }
+        results[i] = (ret < 0) ? ret : 0;
+        if (ret < 0) {
+            if (!err) err = ret;
+        } else {
+            total += ret;
+        }
+    }
+    if (err) return batch_fail(results, n, err);
+    if (!n) return 0;
+
+    int ret = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (ret) {
+        LOG_ERR("flash_area_open failed: %d", ret);
+        return batch_fail(results, n, ret);
+    }
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    err = (total <= CFG_USABLE_SLOTS) ? cfg_find_erased_slots(slots, total) : -ENOSPC;
+    if (err) {
+        LOG_WRN("No room for %d slots for a batch of %u entries", total, (unsigned)n);
+        batch_fail(results, n, err);
+        goto out;
+    }
+
+    memset(&batch_intent, 0, sizeof(batch_intent));
+    for (int s = 0; s < total; s++) {
+        batch_intent.slots[slots[s] / 8] |= BIT(slots[s] % 8);
+    }
+    err = batch_intent_save(CFG_BATCH_WRITING);
+    if (err) {
+        batch_fail(results, n, err);
+        goto out;
+    }
+
+    for (size_t i = 0, s = 0; i < n && !err; i++) {
+        ret = write_record(fa, keys[i], values[i], &slots[s]);
+        if (ret < 0) {
+            results[i] = err = ret;
+        } else {
+            heads[i] = ret;
+            s += record_slots(keys[i], values[i]);
+        }
+    }
+    if (!err) {
+        err = batch_intent_save(CFG_BATCH_WRITTEN);
+    }
+
+    written = !err;
+    if (written) {
+        for (size_t i = 0; i < n; i++) {
+            tombstone_copies(fa, keys[i], (uint32_t)heads[i] * ENTRY_SIZE);
+        }
+    } else {
+        batch_roll_back(fa);
+        batch_fail(results, n, err);
+    }
+
+    /* One reseal and re-parse for the whole batch instead of one per key */
+    ret = update_crc();
+    if (ret) {
+        /* The intent stays, so the next boot finishes or undoes the batch */
+        if (!err) err = ret;
+    } else {
+        psa_its_remove(CFG_BATCH_UID);
+    }
+    parse_encrypted_blob();
+    if (written) {
+        for (size_t i = 0; i < n; i++) {
+            cfg_its_put(keys[i], cfg_find_entry(keys[i]), values[i], strlen(values[i]));
+        }
+    }
+    LOG_INF("Stored %u of %u entries in one update", written ? (unsigned)n : 0, (unsigned)n);
+
+out:
+    k_mutex_unlock(&cfg_blob_lock);
+    flash_area_close(fa);
+    if (written || err == -ENOSPC) {
+        cfg_compact_kick(err == -ENOSPC);
+    }
+    return err;
+}
+
+int config_erase(const char *key)
+{
+    const struct flash_area *fa;
+
+    if (!key) return -EINVAL;
+    if (!cfg_mac_trusted()) return -EACCES;
+
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
+    }
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    if (!cfg_find_entry(key)) {
+        err = -ENOENT;
+    } else {
+        err = tombstone_copies(fa, key, UINT32_MAX);
+        if (!err) {
+            err = update_crc();
+        }
+        parse_encrypted_blob();
+        cfg_its_remove(key);
+    }
+
+    k_mutex_unlock(&cfg_blob_lock);
+    flash_area_close(fa);
+
+    if (!err) {
+        LOG_INF("Erased '%s'", key);
+        cfg_compact_kick(false);
+    }
+    return err;
+}
+
+static void parse_blob(void)
 {
     const uint8_t *start = ENCRYPTED_BLOB_ADDR;
     const uint8_t *end = ENCRYPTED_BLOB_ADDR + ENCRYPTED_BLOB_SIZE;
     const size_t entry_span = ENTRY_SIZE;
     const size_t max_offset = CRC_LOCATION_OFFSET;
 
-    LOG_INF("Begin blob parsing at address %p, total size: %d", (void *)start, ENCRYPTED_BLOB_SIZE);
-
-    uint32_t computed_crc = manual_crc32(start, ENCRYPTED_BLOB_SIZE - 4);
-    uint32_t stored_crc = *(uint32_t *)(start + CRC_LOCATION_OFFSET);
-    if (computed_crc != stored_crc) {
-        LOG_WRN("CRC mismatch: computed=0x%08X, stored=0x%08X", computed_crc, stored_crc);
-    } else {
-        LOG_INF("CRC check passed: 0x%08X", computed_crc);
+    num_entries = 0;
+    if (!cfg_mac_trusted()) {
+        LOG_ERR("Blob failed authentication, not parsing it");
+        build_key_index();
+        return;
     }
 
-    num_entries = 0;
+    LOG_INF("Begin blob parsing at address %p, total size: %d", (void *)start, ENCRYPTED_BLOB_SIZE);
 
     for (uintptr_t offset = 0; offset + entry_span <= max_offset && num_entries < MAX_ENTRIES; offset += entry_span) {
         const uint8_t *ptr = start + offset;
 
-        if (ptr[0] == 0xFF) {
+        if (ptr[0] == 0xFF || ptr[0] == CFG_SLOT_TOMBSTONE || ptr[0] == CFG_SLOT_CONT) {
             continue;
         }
 
@@ -171,6 +1072,7 @@ void parse_encrypted_blob(void)
         e->iv_len = *ptr++;
         if (e->iv_len > MAX_IV_LEN || ptr + e->iv_len > end) {
             LOG_ERR("Invalid or oversized IV length: %d at entry %d", e->iv_len, num_entries);
+            cfg_stats_parse_error();
             continue;
         }
         memcpy(e->iv, ptr, e->iv_len);
@@ -181,6 +1083,7 @@ void parse_encrypted_blob(void)
         ptr += 2;
         if (e->aad_len > MAX_AAD_LEN || ptr + e->aad_len > end) {
             LOG_ERR("Invalid or oversized AAD length: %d at entry %d", e->aad_len, num_entries);
+            cfg_stats_parse_error();
             continue;
         }
         memcpy(e->aad, ptr, e->aad_len);
@@ -189,8 +1092,37 @@ void parse_encrypted_blob(void)
         if (ptr + 2 > end) continue;
         e->ciphertext_len = ptr[0] | (ptr[1] << 8);
         ptr += 2;
+        e->chunks = 0;
+
+        /* Chunked record: head slot holds what fits, the rest is in continuation slots */
+        size_t room = head_room(e->iv_len, e->aad_len);
+        if (e->ciphertext_len > room && e->iv_len >= CFG_REC_ID_LEN &&
+            e->ciphertext_len <= CFG_MAX_VALUE_LEN + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH &&
+            find_cont(rec_id(e), 1)) {
+            size_t n = DIV_ROUND_UP(e->ciphertext_len - room, CFG_CONT_DATA_LEN);
+            size_t seq = 2;
+
+            while (seq <= n && find_cont(rec_id(e), seq)) {
+                seq++;
+            }
+            if (seq <= n) {
+                LOG_ERR("Chunked entry %d @ offset 0x%04X misses continuation %u/%u",
+                        num_entries, (int)offset, (unsigned)seq, (unsigned)n);
+                cfg_stats_parse_error();
+                continue;
+            }
+            e->chunks = n;
+            memcpy(e->ciphertext, ptr, room);
+
+            LOG_INF("Parsed entry %d @ offset 0x%04X: IV=%d, AAD=%d, Cipher+Tag=%d in %u chunks",
+                    num_entries, (int)offset, e->iv_len, e->aad_len, e->ciphertext_len, (unsigned)n + 1);
+            num_entries++;
+            continue;
+        }
+
         if (e->ciphertext_len > MAX_CIPHERTEXT_LEN || ptr + e->ciphertext_len > end) {
             LOG_ERR("Invalid or oversized ciphertext length: %d at entry %d", e->ciphertext_len, num_entries);
+            cfg_stats_parse_error();
             continue;
         }
         memcpy(e->ciphertext, ptr, e->ciphertext_len);
@@ -202,10 +1134,21 @@ void parse_encrypted_blob(void)
         num_entries++;
     }
 
+    build_key_index();
+
     LOG_INF("Total parsed entries: %d", num_entries);
 }
 
+void parse_encrypted_blob(void)
+{
+    /* Readers index entries[] under cfg_blob_lock, so it is only rebuilt with it held */
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    parse_blob();
+    k_mutex_unlock(&cfg_blob_lock);
+}
+
 void parse_hardware_info(hardware_info_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
 
     if (!cfg) {
@@ -216,46 +1159,48 @@ void parse_hardware_info(hardware_info_t *cfg) {
     cfg->power_enabled = false;
 
 
-    val = get_config("hw_info");
+    val = get_config("hw_info", buf, sizeof(buf));
     if (val) {
 
         sscanf(val, "%31[^,],%15[^,],%15[^,]",
                cfg->sn, cfg->hw_ver, cfg->fw_ver);
     }
 
-    val = get_config("pwr_st");
+    val = get_config("pwr_st", buf, sizeof(buf));
     if (val) {
         cfg->power_enabled = atoi(val) ? true : false;
     }
 }
 
 void parse_modem_info(modem_info_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
 
-    val = get_config("mdm_info");
+    val = get_config("mdm_info", buf, sizeof(buf));
     if (val) {
         sscanf(val, "%31[^,],%31[^,],%20[^,]", 
                cfg->make, cfg->model, cfg->fw_ver);
     }
 
-    val = get_config("mdm_imei");
+    val = get_config("mdm_imei", buf, sizeof(buf));
     if (val) strncpy(cfg->imei, val, sizeof(cfg->imei) - 1);
 
-    val = get_config("sim_info"); 
+    val = get_config("sim_info", buf, sizeof(buf)); 
     if (val) {
         sscanf(val, "%31[^,],%31[^,]", cfg->sim, cfg->esim);
     }
 
-    val = get_config("lte_bnd");
+    val = get_config("lte_bnd", buf, sizeof(buf));
     if (val) {
         cfg->lte_bandmask = (uint16_t)strtol(val, NULL, 0);
     }
 }
 
 void parse_system_enable_config(void) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     memset(&sys_enable_config, 0, sizeof(sys_enable_config));
 
-    const char *raw = get_config("sys_en");
+    const char *raw = get_config("sys_en", buf, sizeof(buf));
     if (!raw) {
         return;
     }
@@ -278,102 +1223,134 @@ void parse_system_enable_config(void) {
 }
 
 void parse_mqtt_config(mqtt_config_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
-    val = get_config("mq_rt");
+    val = get_config("mq_rt", buf, sizeof(buf));
     if (val) cfg->publish_rate = atoi(val);
-    val = get_config("mq_addr");
+    val = get_config("mq_addr", buf, sizeof(buf));
     if (val) strncpy(cfg->broker_addr, val, sizeof(cfg->broker_addr) - 1);
-    val = get_config("mq_port");
+    val = get_config("mq_port", buf, sizeof(buf));
     if (val) cfg->broker_port = atoi(val);
-    val = get_config("mq_clid");
+    val = get_config("mq_clid", buf, sizeof(buf));
     if (val) strncpy(cfg->client_id, val, sizeof(cfg->client_id) - 1);
-    val = get_config("mq_user");
+    val = get_config("mq_user", buf, sizeof(buf));
     if (val) strncpy(cfg->username, val, sizeof(cfg->username) - 1);
-    val = get_config("mq_pass");
+    val = get_config("mq_pass", buf, sizeof(buf));
     if (val) strncpy(cfg->password, val, sizeof(cfg->password) - 1);
-    val = get_config("mq_tls");
+    val = get_config("mq_tls", buf, sizeof(buf));
     if (val) cfg->tls_enabled = atoi(val) ? true : false;
-    val = get_config("mq_qos");
+    val = get_config("mq_qos", buf, sizeof(buf));
     if (val) cfg->qos = atoi(val);
 }
 
+/* Unset means "now"; a value that is none of the documented forms must not reboot the device by surprise */
+static void parse_apply_policy(ota_config_t *cfg, const char *val)
+{
+    char *end;
+
+    cfg->apply_delay_s = 0;
+    if (!val || strcmp(val, "NULL") == 0 || strcmp(val, "idle") == 0) {
+        cfg->apply_policy = OTA_APPLY_IDLE;
+    } else if (strcmp(val, "now") == 0) {
+        cfg->apply_policy = OTA_APPLY_NOW;
+    } else if (strcmp(val, "manual") == 0) {
+        cfg->apply_policy = OTA_APPLY_MANUAL;
+    } else {
+        unsigned long s = (*val >= '0' && *val <= '9') ? strtoul(val, &end, 10) : 0;
+
+        if (s == 0 || *end != '\0' || s > OTA_APPLY_MAX_DELAY_S) {
+            LOG_WRN("Invalid ota_apply '%s', holding updates for 'fota apply'", val);
+            cfg->apply_policy = OTA_APPLY_MANUAL;
+            return;
+        }
+        cfg->apply_policy = OTA_APPLY_DELAY;
+        cfg->apply_delay_s = (int)s;
+    }
+}
+
 void parse_ota_config(ota_config_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
-    val = get_config("ota_int");
+    val = get_config("ota_int", buf, sizeof(buf));
     if (val) cfg->check_interval = atoi(val);
-    val = get_config("ota_addr");
+    val = get_config("ota_addr", buf, sizeof(buf));
     if (val) strncpy(cfg->server_addr, val, sizeof(cfg->server_addr) - 1);
-    val = get_config("ota_port");
+    val = get_config("ota_port", buf, sizeof(buf));
     if (val) cfg->server_port = atoi(val);
-    val = get_config("ota_user");
+    val = get_config("ota_user", buf, sizeof(buf));
     if (val) strncpy(cfg->username, val, sizeof(cfg->username) - 1);
-    val = get_config("ota_pass");
+    val = get_config("ota_pass", buf, sizeof(buf));
     if (val) strncpy(cfg->password, val, sizeof(cfg->password) - 1);
-    val = get_config("ota_tls");
+    val = get_config("ota_tls", buf, sizeof(buf));
     if (val) cfg->tls_enabled = atoi(val) ? true : false;
-    val = get_config("ota_cert");
+    val = get_config("ota_cert", buf, sizeof(buf));
     if (val) strncpy(cfg->cert_tag, val, sizeof(cfg->cert_tag) - 1);
+    parse_apply_policy(cfg, get_config("ota_apply", buf, sizeof(buf)));
 }
 
 void parse_sensor_config(sensor_config_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
 
-    val = get_config("sens_rt");
+    val = get_config("sens_rt", buf, sizeof(buf));
     if (val) cfg->sampling_rate = atoi(val);
     else cfg->sampling_rate = 10;
 
-    val = get_config("sens_flt");
+    val = get_config("sens_flt", buf, sizeof(buf));
     if (val) cfg->filter_window = atoi(val);
     else cfg->filter_window = 5;
 
-    val = get_config("sens_cal");
+    val = get_config("sens_cal", buf, sizeof(buf));
     if (val) cfg->auto_calibrate = atoi(val) ? true : false;
     else cfg->auto_calibrate = false;
 }
 
 void parse_gnss_config(gnss_config_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
 
-    val = get_config("gnss_rt");
+    val = get_config("gnss_rt", buf, sizeof(buf));
     if (val) cfg->update_rate = atoi(val);
     else cfg->update_rate = 1;
 
-    val = get_config("gnss_ver");
+    val = get_config("gnss_ver", buf, sizeof(buf));
     if (val) strncpy(cfg->version, val, sizeof(cfg->version) - 1);
     else strncpy(cfg->version, "u-blox8", sizeof(cfg->version));
 
-    val = get_config("gnss_con");
+    val = get_config("gnss_con", buf, sizeof(buf));
     if (val) cfg->constellation_mask = (uint8_t)strtol(val, NULL, 0);
     else cfg->constellation_mask = 0x01;
 
-    val = get_config("gnss_acc");
+    val = get_config("gnss_acc", buf, sizeof(buf));
     if (val) cfg->accuracy_threshold = atoi(val);
     else cfg->accuracy_threshold = 3;
 }
 
 void parse_customer_info(customer_info_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *val;
 
-    val = get_config("uas_num");
+    val = get_config("uas_num", buf, sizeof(buf));
     if (val) strncpy(cfg->uas_num, val, sizeof(cfg->uas_num) - 1);
 
-    val = get_config("cust_desc");
+    val = get_config("cust_desc", buf, sizeof(buf));
     if (val) strncpy(cfg->description, val, sizeof(cfg->description) - 1);
 
-    val = get_config("uas_status");
+    val = get_config("uas_status", buf, sizeof(buf));
     if (val) strncpy(cfg->uas_status, val, sizeof(cfg->uas_status) - 1);
 
-    val = get_config("cust_f2");
+    val = get_config("cust_f2", buf, sizeof(buf));
     if (val) strncpy(cfg->field2, val, sizeof(cfg->field2) - 1);
 
-    val = get_config("cust_f3");
+    val = get_config("cust_f3", buf, sizeof(buf));
     if (val) strncpy(cfg->field3, val, sizeof(cfg->field3) - 1);
 
-    val = get_config("cust_f4");
+    val = get_config("cust_f4", buf, sizeof(buf));
     if (val) strncpy(cfg->field4, val, sizeof(cfg->field4) - 1);
 }
 
 void parse_message_settings(message_settings_t *cfg) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char *v;
 
     // Defaults first (optional but recommended)
@@ -381,14 +1358,15 @@ void parse_message_settings(message_settings_t *cfg) {
     strncpy(cfg->gps_format, "NMEA", sizeof(cfg->gps_format)-1);
     strncpy(cfg->units,      "METRIC", sizeof(cfg->units)-1);
 
-    v = get_config("msg_fmt"); if (v) { cfg->msg_format[0] = '\0'; strncat(cfg->msg_format, v, sizeof(cfg->msg_format)-1); }
-    v = get_config("gps_fmt"); if (v) { cfg->gps_format[0] = '\0'; strncat(cfg->gps_format, v, sizeof(cfg->gps_format)-1); }
-    v = get_config("units");   if (v) { cfg->units[0]      = '\0'; strncat(cfg->units,      v, sizeof(cfg->units)-1); }
+    v = get_config("msg_fmt", buf, sizeof(buf)); if (v) { cfg->msg_format[0] = '\0'; strncat(cfg->msg_format, v, sizeof(cfg->msg_format)-1); }
+    v = get_config("gps_fmt", buf, sizeof(buf)); if (v) { cfg->gps_format[0] = '\0'; strncat(cfg->gps_format, v, sizeof(cfg->gps_format)-1); }
+    v = get_config("units", buf, sizeof(buf));   if (v) { cfg->units[0]      = '\0'; strncat(cfg->units,      v, sizeof(cfg->units)-1); }
 }
 
 
 
 void set_filename(void) {
+    char buf[DECRYPTED_OUTPUT_MAX];
     const char root[] = "firmware_storage";
     const char file[] = "zephyr_signed.bin";
 
@@ -396,7 +1374,7 @@ void set_filename(void) {
     char device[MQTT_MAX_STR_LEN];
 
     // copy results immediately so we don't lose them
-    const char *cfg_val = get_config("name");
+    const char *cfg_val = get_config("name", buf, sizeof(buf));
     if (cfg_val) {
         strncpy(customer, cfg_val, sizeof(customer));
         customer[sizeof(customer) - 1] = '\0'; // ensure null-terminated
@@ -404,7 +1382,7 @@ void set_filename(void) {
         customer[0] = '\0';
     }
 
-    cfg_val = get_config("mq_clid");
+    cfg_val = get_config("mq_clid", buf, sizeof(buf));
     if (cfg_val) {
         strncpy(device, cfg_val, sizeof(device));
         device[sizeof(device) - 1] = '\0';
@@ -480,6 +1458,7 @@ void print_ota_config(void) {
     printf("Password:       %s\n", ota_config.password);
     printf("TLS Enabled:    %s\n", ota_config.tls_enabled ? "Yes" : "No");
     printf("Cert Tag:       %s\n", ota_config.cert_tag);
+    printf("Apply Policy:   %d (delay %d s)\n", ota_config.apply_policy, ota_config.apply_delay_s);
 }
 
 void print_customer_info(void) {
@@ -31,7 +31,8 @@
 #define BLOB_HEADER_SIZE 0
 #define ENTRY_SIZE 128
 
-#define MAX_ENTRIES         63
+/* One entries[] row per slot: duplicates left mid-compaction must not push live keys out */
+#define MAX_ENTRIES         CFG_USABLE_SLOTS
 #define MAX_IV_LEN          16
 #define MAX_AAD_LEN         64
 #define MAX_CIPHERTEXT_LEN  256
@@ -46,6 +47,37 @@
 #define FLASH_PAGE_CRC_SIZE  (ENCRYPTED_BLOB_SIZE - FLASH_CRC_PAGE_OFFSET)
 #define CRC_LOCATION_OFFSET (ENCRYPTED_BLOB_SIZE - 4)
 
+/*
+ * Trailer: the blob MAC covers [0, CFG_MAC_OFFSET) and is sealed in ITS (see
+ * cfg_mac.h). The CFG_MAC_LEN bytes before the CRC held it in flash before
+ * that and are only read to adopt such blobs.
+ */
+#define CFG_MAC_LEN         32
+#define CFG_MAC_OFFSET      (CRC_LOCATION_OFFSET - CFG_MAC_LEN)
+
+/* Entry slots that do not overlap the MAC/CRC trailer */
+#define CFG_USABLE_SLOTS (CFG_MAC_OFFSET / ENTRY_SIZE)
+/* Trailer gap where store-key rotation state lived before it moved to ITS (see cfg_rotate.h) */
+#define CFG_ROT_OFFSET   (CFG_USABLE_SLOTS * ENTRY_SIZE)
+#define CFG_ROT_MAX_LEN  (CFG_MAC_OFFSET - CFG_ROT_OFFSET)
+/* A slot whose first byte was programmed to 0x00 is dead and skipped by the parser */
+#define CFG_SLOT_TOMBSTONE 0x00
+/* Spare page after the blob (slot0 runs up to ENCRYPTED_BLOB_ADDR_2), used for the maintenance journal */
+#define CFG_JOURNAL_OFFSET ENCRYPTED_BLOB_SIZE
+
+/*
+ * Values that do not fit one slot are chunked: the head slot is a normal
+ * record whose ct_len exceeds the slot, the rest of ct||tag follows in
+ * continuation slots laid out as
+ *   CFG_SLOT_CONT | record id (last 4 IV bytes) | seq (1..n) | data
+ * Continuations are found by id, so slots may sit anywhere and move freely.
+ */
+#define CFG_SLOT_CONT       0xC0
+#define CFG_REC_ID_LEN      4
+#define CFG_CONT_HDR_LEN    (1 + CFG_REC_ID_LEN + 1)
+#define CFG_CONT_DATA_LEN   (ENTRY_SIZE - CFG_CONT_HDR_LEN)
+#define CFG_MAX_VALUE_LEN   2048
+
 
 #define PROVISIONING_SUCCESS            (0)
 #define PROVISIONING_ERROR_CRYPTO_INIT  (-100)
@@ -73,7 +105,20 @@
 #define AUTO_LOGOUT_MS   60000      
 
 #define MAX_BLOB (8 * 1024) 
+/* Default cost for blobs provisioned before pbkdf2.iter existed */
 #define PBKDF2_ITERATIONS 64000u
+#define PBKDF2_MIN_ITERATIONS   10000u
+#define PBKDF2_MAX_ITERATIONS   1000000u
+#define PBKDF2_TARGET_MS        250u
+#define PBKDF2_CALIB_ITERATIONS 4000u
+#define PBKDF2_SALT_LEN         16
+#define PBKDF2_HASH_LEN         32
+/*
+ * Password reference, one record "<iterations>:<salt hex>:<hash hex>" so it
+ * is replaced as a whole. Blobs from before it hold pbkdf2.salt, pbkdf2.hash
+ * and optionally pbkdf2.iter instead.
+ */
+#define PBKDF2_REF_KEY          "pbkdf2"
 extern char firmware_filename[MQTT_MAX_STR_LEN];
 extern char json_payload[512];
 extern char sensor_payload[512];
@@ -131,8 +176,23 @@ typedef struct {
 } mqtt_config_t;
 
 
+/*
+ * When a downloaded image is applied ("ota_apply": idle, now, manual or a
+ * delay of 1..OTA_APPLY_MAX_DELAY_S seconds). Unset defaults to idle; any
+ * other value selects manual.
+ */
+enum ota_apply_policy {
+    OTA_APPLY_NOW,
+    OTA_APPLY_IDLE,
+    OTA_APPLY_DELAY,
+    OTA_APPLY_MANUAL,
+};
+#define OTA_APPLY_MAX_DELAY_S (7 * 24 * 3600)
+
 typedef struct {
     int check_interval;
+    enum ota_apply_policy apply_policy;
+    int apply_delay_s;
     char server_addr[64];
     int server_port;
     char username[64];
@@ -198,12 +258,16 @@ typedef struct {
     uint16_t ciphertext_len;
 
     uint32_t mem_offset;  
+    uint8_t chunks;       /* continuation slots; ciphertext[] then holds only the head part */
 } ConfigEntry;
 
 
 extern ConfigEntry entries[MAX_ENTRIES];
 extern int num_entries;
 
+/* Return non-zero to stop the iteration; that value is passed back to the caller */
+typedef int (*cfg_foreach_cb_t)(const ConfigEntry *e, void *user);
+
 extern mqtt_config_t mqtt_config;
 extern ota_config_t ota_config;
 extern hardware_info_t hw_info;
@@ -213,8 +277,42 @@ extern gnss_config_t gnss_config;
 extern customer_info_t customer_info;
 extern message_settings_t message_settings;
 
+/* Rebuilds entries[] under cfg_blob_lock */
 void parse_encrypted_blob(void);
-const char *get_config(const char *aad);
+/*
+ * Decrypt the value of aad into out, NUL-terminated. Returns out, the string
+ * "NULL" if the key is not stored, or NULL if no copy decrypts into out_size.
+ */
+const char *get_config(const char *aad, char *out, size_t out_size);
+/* The entry is only stable while cfg_blob_lock is held; a reparse may move it */
+const ConfigEntry *cfg_find_entry(const char *key);
+/* cb runs with cfg_blob_lock held */
+int cfg_foreach_prefix(const char *prefix, cfg_foreach_cb_t cb, void *user);
+int config_set(const char *key, const char *value);
+/*
+ * Store n key/value pairs under one lock hold with a single MAC/CRC reseal.
+ * All or nothing: every pair is checked and the slots for the whole batch are
+ * reserved before anything is written, and a failure rolls the written
+ * records back. results[i] gets 0 or the errno for that pair (-EEXIST for a
+ * repeated key, -ECANCELED when another pair failed); returns the first error.
+ */
+int config_set_batch(const char *const *keys, const char *const *values, size_t n, int *results);
+/* Boot, after the first parse: finish or undo a batch a reset interrupted */
+void config_batch_recover(void);
+int config_erase(const char *key);
+
+/* Receives plaintext in order; nothing is authentic until get_config_stream() returns 0 */
+typedef int (*cfg_sink_t)(void *ctx, const uint8_t *data, size_t len);
+int get_config_stream(const char *key, cfg_sink_t sink, void *ctx, size_t *total);
+int cfg_entry_tag(const ConfigEntry *e, uint8_t *tag);
 void config_init(void);
 uint32_t manual_crc32(const uint8_t *data, size_t len);
+/* Close a body update: commits the blob seal in ITS, -EACCES while the blob is not trusted */
 int update_crc(void);
+/* Decrypt an entry (chunked or not) with a given key id into out, NUL-terminated */
+int cfg_entry_decrypt(const ConfigEntry *e, psa_key_id_t key, char *out, size_t out_size, size_t *out_len);
+/* Authenticate an entry under key, discarding the plaintext; not counted in cfg_stats */
+int cfg_entry_check(const ConfigEntry *e, psa_key_id_t key, size_t *len);
+struct flash_area;
+/* Provisioning only: write a value too large for one slot as a chunked record (cfg_blob_lock held) */
+int cfg_provision_chunked(const struct flash_area *fa, const char *key, const char *value);
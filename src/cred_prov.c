@@ -0,0 +1,141 @@
+#include "cred_prov.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <psa/crypto.h>
+#include <psa/internal_trusted_storage.h>
+
+#define MANIFEST_MAGIC  0x43524431u   /* "CRD1" */
+#define DIGEST_LEN      PSA_HASH_LENGTH(PSA_ALG_SHA_256)
+
+struct cred_digest {
+    uint32_t type;
+    uint8_t sha256[DIGEST_LEN];
+};
+
+struct cred_manifest {
+    uint32_t magic;
+    uint32_t count;
+    struct cred_digest ent[CRED_MAX_ITEMS];
+};
+
+static psa_storage_uid_t manifest_uid(sec_tag_t tag)
+{
+    return CRED_MANIFEST_UID_BASE | (uint32_t)tag;
+}
+
+static bool load_manifest(sec_tag_t tag, struct cred_manifest *m)
+{
+    size_t len = 0;
+
+    psa_status_t st = psa_its_get(manifest_uid(tag), 0, sizeof(*m), m, &len);
+    return st == PSA_SUCCESS && len == sizeof(*m) &&
+           m->magic == MANIFEST_MAGIC && m->count <= CRED_MAX_ITEMS;
+}
+
+static bool manifest_has(const struct cred_manifest *m, const struct cred_digest *d)
+{
+    for (uint32_t i = 0; i < m->count; i++) {
+        if (m->ent[i].type == d->type &&
+            memcmp(m->ent[i].sha256, d->sha256, DIGEST_LEN) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int digest_item(const struct cred_item *it, struct cred_digest *d)
+{
+    size_t out_len;
+
+    d->type = it->type;
+    psa_status_t st = psa_hash_compute(PSA_ALG_SHA_256, it->data, it->len,
+                                       d->sha256, sizeof(d->sha256), &out_len);
+    return st == PSA_SUCCESS ? 0 : -EIO;
+}
+
+int cred_provision(sec_tag_t tag, const struct cred_item *items, size_t n)
+{
+    struct cred_manifest old;
+    struct cred_manifest cur = { .magic = MANIFEST_MAGIC, .count = n };
+    bool stale[CRED_MAX_ITEMS];
+    int n_stale = 0, written = 0, err = 0;
+    int64_t t0 = k_uptime_get();
+
+    if (n > CRED_MAX_ITEMS) return -EINVAL;
+    if (psa_crypto_init() != PSA_SUCCESS) return -EIO;
+
+    for (size_t i = 0; i < n; i++) {
+        if (digest_item(&items[i], &cur.ent[i])) {
+            printk("Credential digest failed for type %d\n", items[i].type);
+            return -EIO;
+        }
+    }
+
+    bool have_old = load_manifest(tag, &old);
+    for (size_t i = 0; i < n; i++) {
+        stale[i] = !have_old || !manifest_has(&old, &cur.ent[i]);
+        n_stale += stale[i];
+    }
+
+    if (n_stale == 0) {
+        printk("Credentials for sec tag %d unchanged, skipping modem check\n", tag);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (!stale[i]) continue;
+
+        /*
+         * Without a manifest the modem copy may still be current (first boot with
+         * this firmware); compare before writing. Private keys cannot be read back,
+         * so their compare fails and they are always rewritten.
+         */
+        if (!have_old && modem_key_mgmt_cmp(tag, items[i].type, items[i].data, items[i].len) == 0) {
+            printk("Credential type %d matches modem copy\n", items[i].type);
+            continue;
+        }
+
+        int rc = modem_key_mgmt_write(tag, items[i].type, items[i].data, items[i].len);
+        if (rc) {
+            printk("Writing credential type %d failed: %d\n", items[i].type, rc);
+            if (!err) err = rc;
+        } else {
+            written++;
+        }
+    }
+
+    printk("Credentials for sec tag %d: %d stale, %d written in %u ms\n",
+           tag, n_stale, written, (uint32_t)(k_uptime_get() - t0));
+
+    /* A partial write keeps the old manifest, so the next boot retries */
+    if (!err) {
+        psa_status_t st = psa_its_set(manifest_uid(tag), sizeof(cur), &cur, PSA_STORAGE_FLAG_NONE);
+        if (st != PSA_SUCCESS) {
+            printk("Saving credential manifest failed: %d\n", st);
+        }
+    }
+    return err;
+}
+
+int cred_manifest_forget(sec_tag_t tag, enum modem_key_mgmt_cred_type type)
+{
+    struct cred_manifest m;
+    uint32_t n = 0;
+
+    if (!load_manifest(tag, &m)) return 0;
+
+    for (uint32_t i = 0; i < m.count; i++) {
+        if (m.ent[i].type != (uint32_t)type) m.ent[n++] = m.ent[i];
+    }
+    if (n == m.count) return 0;
+
+    m.count = n;
+    psa_status_t st = psa_its_set(manifest_uid(tag), sizeof(m), &m, PSA_STORAGE_FLAG_NONE);
+    if (st != PSA_SUCCESS) {
+        printk("Updating credential manifest for sec tag %d failed: %d\n", tag, st);
+        return -EIO;
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef CRED_PROV_H
+#define CRED_PROV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <modem/modem_key_mgmt.h>
+
+/*
+ * Boot-time TLS credential provisioning. A SHA-256 manifest of what was last
+ * written to each sec tag is kept in ITS. When the firmware's credentials hash
+ * to the recorded digests, boot issues no AT credential commands at all;
+ * otherwise only the differing credentials are written, back to back while
+ * the modem is still offline.
+ */
+#define CRED_MANIFEST_UID_BASE  0xC0F40000ULL   /* | sec_tag */
+#define CRED_MAX_ITEMS          4
+
+struct cred_item {
+    enum modem_key_mgmt_cred_type type;
+    const uint8_t *data;
+    size_t len;
+};
+
+/* Bring tag in line with items[]; returns 0 or the first write error */
+int cred_provision(sec_tag_t tag, const struct cred_item *items, size_t n);
+
+/*
+ * Drop one credential from tag's manifest so the next boot writes the firmware
+ * copy again; used after a credential was deleted. Credentials written at
+ * runtime leave the manifest alone, so boot only replaces them when the
+ * firmware's own copy changes. -EIO if the manifest could not be updated, in
+ * which case boot still considers the deleted credential current.
+ */
+int cred_manifest_forget(sec_tag_t tag, enum modem_key_mgmt_cred_type type);
+
+#endif /* CRED_PROV_H */
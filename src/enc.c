@@ -1,7 +1,16 @@
+#include "config.h"
 #include <zephyr/kernel.h>
 #include <zephyr/sys/printk.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/storage/stream_flash.h>
 #include "enc.h"
+#include "encryption_helper.h"
+#include "cfg_nonce.h"
+#include "cfg_maint.h"
+#include "cfg_stats.h"
+#include "cfg_mac.h"
+#include "cfg_rotate.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <psa/crypto.h>
@@ -11,24 +20,9 @@
 #include <string.h>
 #include <tfm_ns_interface.h>
 #include "certs.h"
-#define NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE (100)
-#define NRF_CRYPTO_EXAMPLE_AES_BLOCK_SIZE (16)
-#define NRF_CRYPTO_EXAMPLE_AES_IV_SIZE (12)
-#define NRF_CRYPTO_EXAMPLE_AES_ADDITIONAL_SIZE (35)
-#define NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH (16)
-#define AES_KEY_SIZE (32)  // 256-bit key
-
-/* Error codes for AES provisioning */
-#define PROVISIONING_SUCCESS            (0)
-#define PROVISIONING_ERROR_CRYPTO_INIT  (-100)
-#define PROVISIONING_ERROR_KEY_IMPORT   (-101)
-#define PROVISIONING_ERROR_KEY_OPEN     (-102)
-#define PROVISIONING_ERROR_ENCRYPT      (-103)
-#define PROVISIONING_ERROR_DECRYPT      (-104)
-#define PROVISIONING_ERROR_IV_GEN       (-105)
-#define PROVISIONING_ERROR_VERIFICATION (-106)
-#define PROVISIONING_ERROR_KEY_DESTROY  (-107)
-#define PROVISIONING_ERROR_BUFFER_SIZE  (-108)
+
+/* stream_flash write buffer; a multiple of ENTRY_SIZE and of the flash write block */
+#define PROV_WRITE_BUF_SIZE  (4 * ENTRY_SIZE)
 
 /* AES Key - Replace with your actual key */
 /*
@@ -37,22 +31,24 @@ static uint8_t m_aes_key[AES_KEY_SIZE] = {
     0xb4, 0xba, 0x59, 0x61, 0xcd, 0x43, 0xa8, 0xaf, 0xfa, 0xfd, 0xeb, 0xb1, 0x05, 0x92, 0x62, 0xee, 0x81, 0x8e, 0xe8, 0xc9, 0xfb, 0xd4, 0xfb, 0x13, 0x48, 0xbb, 0x9d, 0x57, 0xce, 0x58, 0x37, 0x37
 };
 */
-/* Config data to encrypt - Replace with your actual config data */
-static uint8_t m_config_data[NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE] = {
-    "ec2-18-234-99-151.compute-1.amazonaws.com"
-};
-
 /* Configuration variables as standalone globals */
 static const char m_username[] = "admin";
 static const char m_password[] = "Kalscott123";
 static const char m_hostname[] = "18.234.99.151";
 static const char m_mqtt_hostname[] = "mqtt.example.com";
- 
-/* Additional data for authentication - can be device ID, version, etc. */
-static uint8_t m_additional_data[NRF_CRYPTO_EXAMPLE_AES_ADDITIONAL_SIZE] = {"Test"};
 
-/* Only keep IV as global since it's needed for provisioning output */
-static uint8_t m_iv[NRF_CRYPTO_EXAMPLE_AES_IV_SIZE];
+/* Field manifest: store key and value, written to the blob in this order */
+struct prov_field {
+    const char *key;
+    const char *value;
+};
+
+static const struct prov_field prov_manifest[] = {
+    { "mq_addr",  m_mqtt_hostname },
+    { "mq_user",  m_username },
+    { "mq_pass",  m_password },
+    { "ota_addr", m_hostname },
+};
 
 #define AES_KEY_ID 0x00000005  // or any ID ≥ PSA_KEY_ID_USER_MIN
 
@@ -112,7 +108,8 @@ int import_key(void)
     psa_key_attributes_t key_attributes = PSA_KEY_ATTRIBUTES_INIT;
 
     psa_set_key_id(&key_attributes, persistent_key_id);  // Set persistent key ID
-    psa_set_key_usage_flags(&key_attributes, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT);
+    /* COPY lets the store cache a volatile copy instead of loading it from ITS per call */
+    psa_set_key_usage_flags(&key_attributes, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT | PSA_KEY_USAGE_COPY);
     psa_set_key_lifetime(&key_attributes, PSA_KEY_LIFETIME_PERSISTENT);  // Make key persistent
     psa_set_key_algorithm(&key_attributes, PSA_ALG_GCM);
     psa_set_key_type(&key_attributes, PSA_KEY_TYPE_AES);
@@ -139,6 +136,7 @@ int import_key(void)
         }
     }
     LOG_INF("Key imported return status: %d", status);
+    cfg_key_invalidate();
 
     /* After the key handle is acquired the attributes are not needed */
     psa_reset_key_attributes(&key_attributes);
@@ -156,10 +154,10 @@ int encrypt_config_data(uint8_t *config_data, size_t config_len,
 
     LOG_INF("Encrypting config data using AES GCM MODE...");
 
-    /* Generate a random IV */
-    status = psa_generate_random(iv_out, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
+    /* Counter IV, random if the counter is unavailable */
+    status = cfg_nonce_generate(persistent_key_id, iv_out, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
     if (status != PSA_SUCCESS) {
-        LOG_INF("psa_generate_random failed! (Error: %d)", status);
+        LOG_INF("IV generation failed! (Error: %d)", status);
         return PROVISIONING_ERROR_IV_GEN;
     }
 
@@ -213,158 +211,155 @@ int decrypt_config_data(uint8_t *encrypted_data, size_t encrypted_len,
     return PROVISIONING_SUCCESS;
 }
 
-void print_provisioning_data(uint8_t *iv, uint8_t *encrypted_data, size_t encrypted_len, 
-                             uint8_t *additional_data, size_t additional_len)
+static bool field_fits_slot(const struct prov_field *f)
 {
-    printk("\n=== PROVISIONING DATA (C array format) ===\n\n");
-    k_sleep(K_MSEC(50));
-
-    // IV
-    printk("static uint8_t config_iv[%d] = {", NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
-    for (size_t i = 0; i < NRF_CRYPTO_EXAMPLE_AES_IV_SIZE; i++) {
-        printk("0x%02x", iv[i]);
-        if (i < NRF_CRYPTO_EXAMPLE_AES_IV_SIZE - 1) printk(", ");
-    }
-    printk("};\n\n");
-    k_sleep(K_MSEC(50));
-
-    // Encrypted data
-    printk("static uint8_t encrypted_config[%d] = {", (int)encrypted_len);
-    for (size_t i = 0; i < encrypted_len; i++) {
-        printk("0x%02x", encrypted_data[i]);
-        if (i < encrypted_len - 1) printk(", ");
-    }
-    printk("};\n\n");
-    k_sleep(K_MSEC(50));
-
-    // Additional authenticated data (AAD)
-    printk("static uint8_t additional_auth_data[%d] = {", (int)additional_len);
-    for (size_t i = 0; i < additional_len; i++) {
-        printk("0x%02x", additional_data[i]);
-        if (i < additional_len - 1) printk(", ");
-    }
-    printk("};\n\n");
-    k_sleep(K_MSEC(50));
-
-    printk("=== END PROVISIONING DATA ===\n\n");
-    k_sleep(K_MSEC(50));
+    return 1 + NRF_CRYPTO_EXAMPLE_AES_IV_SIZE + 2 + strlen(f->key) + 2 +
+           strlen(f->value) + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH <= ENTRY_SIZE;
 }
 
-/**
- * @brief Wrapper function for encrypting data and verifying decryption
- * @param config_data Data to encrypt
- * @param config_len Length of data to encrypt
- * @param additional_data Additional authenticated data
- * @param additional_len Length of additional data
- * @param iv_out Output buffer for IV
- * @param encrypted_out Output buffer for encrypted data
- * @param encrypted_len Output length of encrypted data
- * @return PROVISIONING_SUCCESS on success, error code on failure
- */
-int encrypt_and_verify_data(uint8_t *config_data, size_t config_len,
-                           uint8_t *additional_data, size_t additional_len,
-                           uint8_t *iv_out, uint8_t *encrypted_out, size_t *encrypted_len)
+static bool blob_is_blank(void)
 {
-    int status;
-    
-    /* Local buffers for verification */
-    uint8_t decrypted_data[NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE];
-    size_t decrypted_len;
-
-    /* Encrypt the data */
-    status = encrypt_config_data(config_data, config_len,
-                                additional_data, additional_len,
-                                iv_out, encrypted_out, encrypted_len);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Encryption failed with error: %d", status);
-        return status;
+    for (size_t i = 0; i < ENCRYPTED_BLOB_SIZE; i++) {
+        if (ENCRYPTED_BLOB_ADDR[i] != 0xFF) return false;
     }
+    return true;
+}
 
-    /* Print provisioning data */
-    print_provisioning_data(iv_out, encrypted_out, *encrypted_len,
-                           additional_data, additional_len);
+static int erase_blob(void)
+{
+    const struct flash_area *fa;
 
-    /* Verify decryption works (optional test) */
-    status = decrypt_config_data(encrypted_out, *encrypted_len,
-                                iv_out, additional_data, additional_len,
-                                decrypted_data, &decrypted_len);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Decryption failed with error: %d", status);
-        return status;
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
     }
+    err = cfg_flash_erase(fa, 0, ENCRYPTED_BLOB_SIZE);
+    flash_area_close(fa);
+    return err;
+}
 
-    /* Verify the decrypted data matches original */
-    if (memcmp(decrypted_data, config_data, config_len) != 0) {
-        LOG_ERR("Error: Decrypted data doesn't match the original config data");
-        return PROVISIONING_ERROR_VERIFICATION;
-    }
+static int prov_flushed(uint8_t *buf, size_t len, size_t offset)
+{
+    ARG_UNUSED(buf);
+    ARG_UNUSED(offset);
+    cfg_stats_programmed(len);
+    return 0;
+}
 
-    LOG_DBG("Data encryption and verification completed successfully!");
-    return PROVISIONING_SUCCESS;
+/*
+ * Batch check: decrypt every single-slot record straight from flash and
+ * compare with the manifest. Chunked records are read back slot by slot by
+ * the chunk writer as they are programmed.
+ */
+static int verify_fields(size_t count)
+{
+    static char plain[DECRYPTED_OUTPUT_MAX];
+    const uint8_t *p = ENCRYPTED_BLOB_ADDR;
+    int bad = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!field_fits_slot(&prov_manifest[i])) continue;
+
+        const uint8_t *iv = p + 1;
+        size_t aad_len = p[1 + p[0]] | (p[2 + p[0]] << 8);
+        const uint8_t *aad = p + 3 + p[0];
+        size_t ct_len = aad[aad_len] | (aad[aad_len + 1] << 8);
+        size_t plain_len = 0;
+
+        int ret = decrypt_config_field_data((const char *)aad + aad_len + 2, ct_len,
+                                            (const char *)iv, (const char *)aad, aad_len,
+                                            plain, sizeof(plain) - 1, &plain_len);
+        if (ret || plain_len != strlen(prov_manifest[i].value) ||
+            memcmp(plain, prov_manifest[i].value, plain_len) != 0) {
+            LOG_ERR("Verification failed for %s: %d", prov_manifest[i].key, ret);
+            bad++;
+        }
+        p += ENTRY_SIZE;
+    }
+    memset(plain, 0, sizeof(plain));
+    return bad ? PROVISIONING_ERROR_VERIFICATION : PROVISIONING_SUCCESS;
 }
 
-/**
- * @brief Encrypt a single configuration field with its own IV
- * @param field_name Name of the field for logging and AAD
- * @param field_data Data to encrypt
- * @return PROVISIONING_SUCCESS on success, error code on failure
+/*
+ * Single-slot fields are encrypted into slot images and fed to stream_flash,
+ * which programs whole write buffers into the (blank) blob from slot 0.
+ * Fields too large for a slot follow as chunked records (head plus
+ * continuation slots) in the erased slots after them. The trailer stays
+ * erased: the blob is marked as being provisioned in its ITS seal first and
+ * sealed at the end, so a reset in between is recognised and provisioning
+ * starts over.
  */
-int encrypt_config_field(const char *field_name, const char *field_data)
+static int provision_blob(void)
 {
-    int status;
-    size_t field_len;
-    size_t additional_len;
-    size_t encrypted_len;
-    
-    /* Local buffers for this field */
-    uint8_t additional_data[NRF_CRYPTO_EXAMPLE_AES_ADDITIONAL_SIZE];
-    uint8_t iv[NRF_CRYPTO_EXAMPLE_AES_IV_SIZE];
-    uint8_t encrypted_data[NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH];
-
-    if (field_data == NULL || field_name == NULL) {
-        LOG_ERR("Field data or name is NULL");
-        return PROVISIONING_ERROR_VERIFICATION;
+    static uint8_t wbuf[PROV_WRITE_BUF_SIZE];
+    static uint8_t rec[ENTRY_SIZE];
+    struct stream_flash_ctx ctx;
+    const struct flash_area *fa;
+    size_t count = ARRAY_SIZE(prov_manifest);
+    int chunked = 0;
+
+    if (count > CFG_USABLE_SLOTS) return PROVISIONING_ERROR_BUFFER_SIZE;
+
+    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
+    if (err) {
+        LOG_ERR("flash_area_open failed: %d", err);
+        return err;
     }
 
-    field_len = strlen(field_data);
-    if (field_len >= NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE) {
-        LOG_ERR("Field data too large: %s (len: %d)", field_name, field_len);
-        return PROVISIONING_ERROR_BUFFER_SIZE;
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
+    /* stream_flash bypasses the flash wrappers; the blob is sealed once it is complete */
+    err = cfg_mac_provision_begin();
+    if (err) goto out;
+    err = stream_flash_init(&ctx, flash_area_get_device(fa), wbuf, sizeof(wbuf),
+                            fa->fa_off, CFG_MAC_OFFSET, prov_flushed);
+    for (size_t i = 0; !err && i < count; i++) {
+        if (!field_fits_slot(&prov_manifest[i])) {
+            chunked++;
+            continue;
+        }
+        err = create_encrypted_entry_with_aad(prov_manifest[i].key, prov_manifest[i].value, rec);
+        if (!err) {
+            err = stream_flash_buffered_write(&ctx, rec, ENTRY_SIZE, false);
+        }
+    }
+    if (!err) {
+        err = stream_flash_buffered_write(&ctx, NULL, 0, true);
+    }
+    memset(rec, 0, sizeof(rec));
+    if (err) {
+        LOG_ERR("Streaming records failed: %d", err);
+        goto out;
     }
 
-    LOG_DBG("\n=== Processing Field: %s (length: %d) ===", field_name, field_len);
-    LOG_DBG("Field data: %s", field_name); // Don't log actual data for security
-    
-    /* Set field-specific additional authenticated data */
-    snprintf((char*)additional_data, sizeof(additional_data), "Field_%s", field_name);
-    additional_len = strlen((char*)additional_data);
+    for (size_t i = 0; chunked && i < count; i++) {
+        if (field_fits_slot(&prov_manifest[i])) continue;
+        int slot = cfg_provision_chunked(fa, prov_manifest[i].key, prov_manifest[i].value);
+        if (slot < 0) {
+            LOG_ERR("Chunked record for %s failed: %d", prov_manifest[i].key, slot);
+            err = slot;
+            goto out;
+        }
+    }
 
-    LOG_DBG("About to call encrypt_and_verify_data for field: %s", field_name);
+    err = cfg_mac_provision_end();
+    if (err) goto out;
 
-    /* Encrypt and verify this field */
-    status = encrypt_and_verify_data((uint8_t*)field_data, field_len,
-                                    additional_data, additional_len,
-                                    iv, encrypted_data, &encrypted_len);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Field encryption failed for %s: %d", field_name, status);
-        return status;
+    err = verify_fields(count);
+    if (!err) {
+        LOG_INF("Provisioned %u fields (%d chunked)", (unsigned)count, chunked);
     }
 
-    LOG_DBG("=== Field %s processed successfully ===\n", field_name);
-    return PROVISIONING_SUCCESS;
+out:
+    k_mutex_unlock(&cfg_blob_lock);
+    flash_area_close(fa);
+    return err;
 }
 
 int provision_config_data(void)
 {
     int status;
-    size_t encrypted_len;
-    size_t config_len = strlen((char*)m_config_data);
-    size_t additional_len = strlen((char*)m_additional_data);
-    bool process_failed = false;
-    int field_errors = 0;
-    
-    /* Local buffers */
-    uint8_t encrypted_data[NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE + NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH];
 
     LOG_INF("Starting AES-GCM Config Data Provisioning...");
 
@@ -374,87 +369,40 @@ int provision_config_data(void)
         return status;
     }
 
-    status = import_key();
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Key import failed: %d", status);
+    /* After a rotation the built-in key is retired; importing it again would revive it */
+    if (cfg_rotate_active_key() != persistent_key_id) {
+        LOG_INF("Store key rotated, skipping key import and provisioning");
         goto cleanup;
     }
 
-    LOG_INF("Crypto initialized and key imported successfully.");
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
-
-    /* First encrypt the original config data */
-    LOG_DBG("\n=== Processing Original Config Data ===");
-    status = encrypt_and_verify_data(m_config_data, config_len,
-                                    m_additional_data, additional_len,
-                                    m_iv, encrypted_data, &encrypted_len);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Original config data encryption failed: %d", status);
-        process_failed = true;
-    }
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
-
-    /* Now encrypt each configuration field independently */
-    LOG_DBG("\n=== Processing Individual Configuration Fields ===");
-    LOG_DBG("Fields to process: username, password, hostname, mqtt_hostname");
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
-
-    /* Username */
-    LOG_DBG("Processing username field...");
-    status = encrypt_config_field("username", m_username);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Username encryption failed: %d", status);
-        field_errors++;
-        process_failed = true;
-    }
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
-
-    /* Password */
-    LOG_DBG("Processing password field...");
-    status = encrypt_config_field("password", m_password);
+    status = import_key();
     if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Password encryption failed: %d", status);
-        field_errors++;
-        process_failed = true;
+        LOG_ERR("Key import failed: %d", status);
+        goto cleanup;
     }
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
 
-    /* Hostname */
-    LOG_DBG("Processing hostname field...");
-    status = encrypt_config_field("hostname", m_hostname);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("Hostname encryption failed: %d", status);
-        field_errors++;
-        process_failed = true;
+    /* Never overwrite a provisioned store; updates go through config_set() */
+    if (cfg_mac_provision_interrupted()) {
+        LOG_WRN("Previous provisioning was cut off, starting over");
+        status = erase_blob();
+        if (status) goto cleanup;
+    } else if (!blob_is_blank()) {
+        LOG_INF("Config blob already provisioned, skipping");
+        goto cleanup;
     }
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
 
-    /* MQTT Hostname */
-    LOG_DBG("Processing mqtt_hostname field...");
-    status = encrypt_config_field("mqtt_hostname", m_mqtt_hostname);
-    if (status != PROVISIONING_SUCCESS) {
-        LOG_ERR("MQTT hostname encryption failed: %d", status);
-        field_errors++;
-        process_failed = true;
-    }
-    k_sleep(K_MSEC(100)); // Delay for terminal readability
+    status = provision_blob();
 
 cleanup:
     int cleanup_status = crypto_finish();
     if (cleanup_status != PROVISIONING_SUCCESS) {
         LOG_ERR("Crypto cleanup failed with error: %d", cleanup_status);
-        process_failed = true;
     }
 
-    if (process_failed) {
-        if (field_errors > 0) {
-            LOG_ERR("Config data provisioning completed with %d field errors!", field_errors);
-        } else {
-            LOG_ERR("Config data provisioning completed with errors!");
-        }
-        return status;  // Return the last encryption error, not cleanup error
-    } else {
-        LOG_INF("All config data provisioning completed successfully!");
-        return PROVISIONING_SUCCESS;
+    if (status != PROVISIONING_SUCCESS) {
+        LOG_ERR("Config data provisioning failed: %d", status);
+        return status;
     }
-}
\ No newline at end of file
+    LOG_INF("All config data provisioning completed successfully!");
+    return PROVISIONING_SUCCESS;
+}
@@ -1,6 +1,8 @@
 
 #include "config.h"
 #include "encryption_helper.h"
+#include "cfg_stats.h"
+#include "cfg_nonce.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -20,6 +22,190 @@
 psa_key_id_t my_key_id = 0x00000005;
 psa_key_handle_t my_key_handle;
 LOG_MODULE_REGISTER(encrption_helper, LOG_LEVEL_INF);
+
+/*
+ * Key-handle cache. Referencing the persistent id makes TF-M fetch the key
+ * from ITS on every AEAD call, so the key is opened once into a volatile slot
+ * (psa_copy_key when the key allows COPY, an open handle otherwise) and that
+ * id is used until cfg_key_invalidate() after a key-management event.
+ * During a rotation the previous store key is cached the same way.
+ *
+ * Callers hold a reference from cfg_key_get() until cfg_key_put(), so an
+ * invalidation only retires the slot; the copy is destroyed (or the handle
+ * closed) when its last user is done with it. A key that fails to load is
+ * remembered until the next invalidation and used by its persistent id.
+ */
+#define KEY_CACHE_SLOTS 4
+
+struct cached_key {
+    psa_key_id_t id;
+    bool is_copy;
+    bool live;
+    uint8_t refs;
+};
+
+struct key_role {
+    struct cached_key *c;
+    bool load_failed;
+};
+
+static psa_key_id_t prev_key_id = PSA_KEY_ID_NULL;
+static struct cached_key key_slots[KEY_CACHE_SLOTS];
+static struct key_role cur_role;
+static struct key_role prev_role;
+static K_MUTEX_DEFINE(key_cache_lock);
+
+static void release_slot(struct cached_key *c)
+{
+    if (c->is_copy) {
+        psa_destroy_key(c->id);
+    } else {
+        psa_close_key(c->id);
+    }
+    c->id = PSA_KEY_ID_NULL;
+}
+
+static void drop_role(struct key_role *r)
+{
+    if (r->c) {
+        r->c->live = false;
+        if (r->c->refs == 0) {
+            release_slot(r->c);
+        }
+        r->c = NULL;
+    }
+    r->load_failed = false;
+}
+
+static struct cached_key *free_slot(void)
+{
+    for (int i = 0; i < KEY_CACHE_SLOTS; i++) {
+        if (key_slots[i].id == PSA_KEY_ID_NULL) {
+            return &key_slots[i];
+        }
+    }
+    return NULL;
+}
+
+static psa_status_t load_cached_key(psa_key_id_t key_id, struct cached_key *c)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_handle_t handle;
+
+    psa_status_t status = psa_get_key_attributes(key_id, &attr);
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("Store key 0x%08x not found: %d", key_id, status);
+        return status;
+    }
+
+    if (psa_get_key_usage_flags(&attr) & PSA_KEY_USAGE_COPY) {
+        psa_set_key_lifetime(&attr, PSA_KEY_LIFETIME_VOLATILE);
+        status = psa_copy_key(key_id, &attr, &c->id);
+        psa_reset_key_attributes(&attr);
+        if (status == PSA_SUCCESS) {
+            c->is_copy = true;
+            LOG_INF("Store key 0x%08x cached as volatile copy 0x%08x", key_id, c->id);
+            return PSA_SUCCESS;
+        }
+        LOG_WRN("psa_copy_key failed (%d), falling back to an open handle", status);
+    }
+    psa_reset_key_attributes(&attr);
+
+    status = psa_open_key(key_id, &handle);
+    if (status != PSA_SUCCESS) {
+        LOG_ERR("psa_open_key(0x%08x) failed: %d", key_id, status);
+        return status;
+    }
+    c->id = handle;
+    c->is_copy = false;
+    LOG_INF("Store key 0x%08x cached as open handle 0x%08x", key_id, c->id);
+    return PSA_SUCCESS;
+}
+
+static psa_key_id_t get_cached(psa_key_id_t key_id, struct key_role *r)
+{
+    if (key_id == PSA_KEY_ID_NULL) return PSA_KEY_ID_NULL;
+
+    k_mutex_lock(&key_cache_lock, K_FOREVER);
+    if (!r->c && !r->load_failed) {
+        /* All slots still held by retired users: use the persistent id meanwhile */
+        struct cached_key *c = free_slot();
+        if (c) {
+            if (load_cached_key(key_id, c) == PSA_SUCCESS) {
+                c->live = true;
+                c->refs = 0;
+                r->c = c;
+            } else {
+                c->id = PSA_KEY_ID_NULL;
+                r->load_failed = true;
+            }
+        }
+    }
+
+    psa_key_id_t id = key_id;
+    if (r->c) {
+        r->c->refs++;
+        id = r->c->id;
+    }
+    k_mutex_unlock(&key_cache_lock);
+    return id;
+}
+
+psa_key_id_t cfg_key_get(void)
+{
+    return get_cached(my_key_id, &cur_role);
+}
+
+psa_key_id_t cfg_key_get_prev(void)
+{
+    return get_cached(prev_key_id, &prev_role);
+}
+
+bool cfg_key_has_prev(void)
+{
+    return prev_key_id != PSA_KEY_ID_NULL;
+}
+
+void cfg_key_put(psa_key_id_t id)
+{
+    if (id == PSA_KEY_ID_NULL) return;
+
+    k_mutex_lock(&key_cache_lock, K_FOREVER);
+    for (int i = 0; i < KEY_CACHE_SLOTS; i++) {
+        struct cached_key *c = &key_slots[i];
+        if (c->id == id && c->refs > 0) {
+            if (--c->refs == 0 && !c->live) {
+                release_slot(c);
+            }
+            break;
+        }
+    }
+    k_mutex_unlock(&key_cache_lock);
+}
+
+void cfg_key_invalidate(void)
+{
+    k_mutex_lock(&key_cache_lock, K_FOREVER);
+    drop_role(&cur_role);
+    drop_role(&prev_role);
+    k_mutex_unlock(&key_cache_lock);
+}
+
+void cfg_key_set_ids(psa_key_id_t active, psa_key_id_t prev)
+{
+    k_mutex_lock(&key_cache_lock, K_FOREVER);
+    drop_role(&cur_role);
+    drop_role(&prev_role);
+    my_key_id = active;
+    prev_key_id = prev;
+    k_mutex_unlock(&key_cache_lock);
+    LOG_INF("Store key 0x%08x active, previous 0x%08x", active, prev);
+}
+
+psa_key_id_t cfg_key_active_id(void)
+{
+    return my_key_id;
+}
 int open_persistent_key()
 {
     psa_status_t status;
@@ -37,7 +223,7 @@ int open_persistent_key()
 int decrypt_config_field_data(const char *encrypted_data, size_t encrypted_len,
                               const char *iv,
                               const char *additional_data, size_t additional_len,
-                              char *output_buf, size_t *output_len)
+                              char *output_buf, size_t output_size, size_t *output_len)
 {
     if (!encrypted_data || !iv || !additional_data || !output_buf || !output_len) {
         LOG_ERR("Invalid input to decrypt_config_field_data");
@@ -48,13 +234,29 @@ int decrypt_config_field_data(const char *encrypted_data, size_t encrypted_len,
 
     //LOG_INF("Decrypting config field...");
 
-    status = psa_aead_decrypt(my_key_id,
+    uint32_t t0 = k_cycle_get_32();
+    psa_key_id_t key = cfg_key_get();
+    status = psa_aead_decrypt(key,
                               PSA_ALG_GCM,
                               iv, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE,
                               additional_data, additional_len,
                               encrypted_data, encrypted_len,
-                              output_buf, NRF_CRYPTO_EXAMPLE_AES_MAX_TEXT_SIZE,
+                              output_buf, output_size,
                               output_len);
+    cfg_key_put(key);
+    /* Mid-rotation the entry may not have been re-encrypted yet */
+    if (status == PSA_ERROR_INVALID_SIGNATURE && cfg_key_has_prev()) {
+        key = cfg_key_get_prev();
+        status = psa_aead_decrypt(key,
+                                  PSA_ALG_GCM,
+                                  iv, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE,
+                                  additional_data, additional_len,
+                                  encrypted_data, encrypted_len,
+                                  output_buf, output_size,
+                                  output_len);
+        cfg_key_put(key);
+    }
+    cfg_stats_decrypt_done(k_cycle_get_32() - t0, status == PSA_SUCCESS);
 
     if (status != PSA_SUCCESS) {
         LOG_ERR("Field decryption failed (psa_status: %d)", status);
@@ -77,28 +279,29 @@ int encrypt_config_field_data(const char *plaintext_data, size_t plaintext_len,
 
     psa_status_t status;
 
-    status = psa_generate_random((uint8_t*)iv_out, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
+    status = cfg_nonce_generate(my_key_id, (uint8_t*)iv_out, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE);
     if (status != PSA_SUCCESS) {
         LOG_ERR("IV generation failed (psa_status: %d)", status);
         return PROVISIONING_ERROR_IV_GEN;
     }
 
-    LOG_INF("Encrypting config field...");
-
-    status = psa_aead_encrypt(my_key_id,
+    uint32_t t0 = k_cycle_get_32();
+    psa_key_id_t key = cfg_key_get();
+    status = psa_aead_encrypt(key,
                               PSA_ALG_GCM,
                               iv_out, NRF_CRYPTO_EXAMPLE_AES_IV_SIZE,
                               additional_data, additional_len,
                               plaintext_data, plaintext_len,
                               encrypted_out, MAX_CIPHERTEXT_LEN,
                               encrypted_len);
+    cfg_key_put(key);
+    cfg_stats_encrypt_done(k_cycle_get_32() - t0, status == PSA_SUCCESS);
 
     if (status != PSA_SUCCESS) {
         LOG_ERR("Field encryption failed (psa_status: %d)", status);
         return PROVISIONING_ERROR_ENCRYPT;
     }
 
-    LOG_INF("Field encryption successful (length: %u)", *encrypted_len);
     return PROVISIONING_SUCCESS;
 }
 
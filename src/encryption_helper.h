@@ -1,9 +1,29 @@
+#include <stdbool.h>
+#include <psa/crypto.h>
+
 int open_persistent_key();
 
+/*
+ * Id to use for store AEAD calls: cached volatile copy/handle of the persistent
+ * key. Each call takes a reference; hand the id back with cfg_key_put() once
+ * the operation is finished.
+ */
+psa_key_id_t cfg_key_get(void);
+void cfg_key_put(psa_key_id_t id);
+/* Call after importing, destroying or rotating the store key */
+void cfg_key_invalidate(void);
+/* Cached previous store key while a rotation runs, PSA_KEY_ID_NULL otherwise */
+psa_key_id_t cfg_key_get_prev(void);
+/* True while a previous store key is set, without taking a reference */
+bool cfg_key_has_prev(void);
+/* Switch the persistent store key ids (prev may be PSA_KEY_ID_NULL); drops both caches */
+void cfg_key_set_ids(psa_key_id_t active, psa_key_id_t prev);
+psa_key_id_t cfg_key_active_id(void);
+
 int decrypt_config_field_data(const char *encrypted_data, size_t encrypted_len,
                               const char *iv,
                               const char *additional_data, size_t additional_len,
-                              char *output_buf, size_t *output_len);
+                              char *output_buf, size_t output_size, size_t *output_len);
 int encrypt_config_field_data(const char *plaintext_data, size_t plaintext_len,
                               char *iv_out,
                               const char *additional_data, size_t additional_len,
@@ -0,0 +1,418 @@
+#include "config.h"
+#include "factory.h"
+#include "certs.h"
+#include "shell_commands.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/base64.h>
+#include <zephyr/sys/util.h>
+#include <modem/lte_lc.h>
+#include <modem/modem_key_mgmt.h>
+#include <psa/crypto.h>
+#include <zcbor_decode.h>
+
+LOG_MODULE_REGISTER(factory, LOG_LEVEL_INF);
+
+#define SIG_LEN      64
+#define SIG_ALG      PSA_ALG_ECDSA(PSA_ALG_SHA_256)
+#define PW_KEYS      1
+
+struct fac_cred {
+    uint32_t tag;
+    enum modem_key_mgmt_cred_type type;
+    struct zcbor_string pem;
+};
+
+/* Decoded bundle; strings point into the caller's buffer */
+static struct {
+    struct fac_cred cred[FACTORY_MAX_CREDS];
+    size_t n_cred;
+    const char *keys[FACTORY_MAX_CFG + PW_KEYS];
+    const char *values[FACTORY_MAX_CFG + PW_KEYS];
+    int results[FACTORY_MAX_CFG + PW_KEYS];
+    size_t n_cfg;
+    char salt_hex[2 * FACTORY_PW_MAX + 1];
+    char hash_hex[2 * FACTORY_PW_MAX + 1];
+    char pw_ref[12 + 2 * (2 * FACTORY_PW_MAX + 1)];
+} bundle;
+
+static K_MUTEX_DEFINE(factory_lock);
+
+static int verify_signature(const struct zcbor_string *payload, const struct zcbor_string *sig)
+{
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    psa_key_id_t key;
+
+    if (sig->len != SIG_LEN) return -EBADMSG;
+
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_VERIFY_MESSAGE);
+    psa_set_key_algorithm(&attr, SIG_ALG);
+    psa_set_key_type(&attr, PSA_KEY_TYPE_ECC_PUBLIC_KEY(PSA_ECC_FAMILY_SECP_R1));
+    psa_set_key_bits(&attr, 256);
+
+    psa_status_t st = psa_import_key(&attr, factory_pub_key, factory_pub_key_len, &key);
+    psa_reset_key_attributes(&attr);
+    if (st != PSA_SUCCESS) {
+        LOG_ERR("Importing factory key failed: %d", st);
+        return -EIO;
+    }
+
+    st = psa_verify_message(key, SIG_ALG, payload->value, payload->len, sig->value, sig->len);
+    psa_destroy_key(key);
+
+    if (st == PSA_ERROR_INVALID_SIGNATURE) return -EPERM;
+    return (st == PSA_SUCCESS) ? 0 : -EIO;
+}
+
+/*
+ * NUL-terminate a decoded string in place. The byte after a string is the next
+ * item's header, or the signature header for the last one; both are consumed
+ * by then.
+ */
+static const char *terminate(const struct zcbor_string *s)
+{
+    char *p = (char *)s->value;
+
+    p[s->len] = '\0';
+    return p;
+}
+
+static bool decode_creds(zcbor_state_t *zs)
+{
+    if (!zcbor_uint32_expect(zs, 2) || !zcbor_list_start_decode(zs)) return false;
+
+    while (!zcbor_array_at_end(zs)) {
+        struct fac_cred *c = &bundle.cred[bundle.n_cred];
+        uint32_t type;
+
+        if (bundle.n_cred == FACTORY_MAX_CREDS) return false;
+        if (!zcbor_list_start_decode(zs) ||
+            !zcbor_uint32_decode(zs, &c->tag) ||
+            !zcbor_uint32_decode(zs, &type) ||
+            !zcbor_bstr_decode(zs, &c->pem) ||
+            !zcbor_list_end_decode(zs)) {
+            return false;
+        }
+        switch (type) {
+        case 0: c->type = MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN; break;
+        case 1: c->type = MODEM_KEY_MGMT_CRED_TYPE_PUBLIC_CERT; break;
+        case 2: c->type = MODEM_KEY_MGMT_CRED_TYPE_PRIVATE_CERT; break;
+        default: return false;
+        }
+        bundle.n_cred++;
+    }
+    return zcbor_list_end_decode(zs);
+}
+
+static bool decode_cfg(zcbor_state_t *zs, struct zcbor_string *k, struct zcbor_string *v)
+{
+    if (!zcbor_uint32_expect(zs, 3) || !zcbor_list_start_decode(zs)) return false;
+
+    while (!zcbor_array_at_end(zs)) {
+        size_t i = bundle.n_cfg;
+
+        if (i == FACTORY_MAX_CFG) return false;
+        if (!zcbor_list_start_decode(zs) ||
+            !zcbor_tstr_decode(zs, &k[i]) ||
+            !zcbor_tstr_decode(zs, &v[i]) ||
+            !zcbor_list_end_decode(zs)) {
+            return false;
+        }
+        bundle.n_cfg++;
+    }
+    return zcbor_list_end_decode(zs);
+}
+
+/* The password hash is stored as the one PBKDF2_REF_KEY record pw_verify reads */
+static bool decode_pw(zcbor_state_t *zs)
+{
+    struct zcbor_string salt, hash;
+    uint32_t iter;
+
+    if (!zcbor_uint32_expect(zs, 4) ||
+        !zcbor_list_start_decode(zs) ||
+        !zcbor_bstr_decode(zs, &salt) ||
+        !zcbor_bstr_decode(zs, &hash) ||
+        !zcbor_uint32_decode(zs, &iter) ||
+        !zcbor_list_end_decode(zs)) {
+        return false;
+    }
+    if (!salt.len || salt.len > FACTORY_PW_MAX || !hash.len || hash.len > FACTORY_PW_MAX) {
+        return false;
+    }
+    /* Same range a rehash accepts: too low is weak, too high stalls every login */
+    if (iter < PBKDF2_MIN_ITERATIONS || iter > PBKDF2_MAX_ITERATIONS) {
+        LOG_ERR("Bundle PBKDF2 iteration count %u outside %u..%u", iter,
+                PBKDF2_MIN_ITERATIONS, PBKDF2_MAX_ITERATIONS);
+        return false;
+    }
+
+    bin2hex(salt.value, salt.len, bundle.salt_hex, sizeof(bundle.salt_hex));
+    bin2hex(hash.value, hash.len, bundle.hash_hex, sizeof(bundle.hash_hex));
+    snprintk(bundle.pw_ref, sizeof(bundle.pw_ref), "%u:%s:%s", iter, bundle.salt_hex, bundle.hash_hex);
+
+    bundle.keys[bundle.n_cfg] = PBKDF2_REF_KEY;
+    bundle.values[bundle.n_cfg] = bundle.pw_ref;
+    bundle.n_cfg += PW_KEYS;
+    return true;
+}
+
+static int decode_manifest(const struct zcbor_string *payload)
+{
+    static struct zcbor_string k[FACTORY_MAX_CFG], v[FACTORY_MAX_CFG];
+    bool ok;
+
+    ZCBOR_STATE_D(zs, 4, payload->value, payload->len, 1, 0);
+
+    ok = zcbor_map_start_decode(zs) &&
+         zcbor_uint32_expect(zs, 1) &&
+         zcbor_uint32_expect(zs, FACTORY_BUNDLE_VERSION) &&
+         decode_creds(zs) &&
+         decode_cfg(zs, k, v);
+    size_t n_user = bundle.n_cfg;
+    if (ok && !zcbor_array_at_end(zs)) {
+        ok = decode_pw(zs);
+    }
+    ok = ok && zcbor_map_end_decode(zs);
+
+    /* Terminate only once decoding is done: the bytes overwritten are item headers */
+    for (size_t i = 0; ok && i < n_user; i++) {
+        bundle.keys[i] = terminate(&k[i]);
+        bundle.values[i] = terminate(&v[i]);
+    }
+
+    if (!ok) {
+        LOG_ERR("Bundle manifest malformed (zcbor error %d)", zcbor_peek_error(zs));
+        return -EBADMSG;
+    }
+    return 0;
+}
+
+/* All credential writes in one offline window; the previous modem mode is restored after */
+static int write_creds(factory_result_cb_t cb, void *user)
+{
+    enum lte_lc_func_mode prev;
+    bool restore = false;
+    int err = 0;
+    char name[24];
+
+    if (!bundle.n_cred) return 0;
+
+    if (lte_lc_func_mode_get(&prev) == 0 &&
+        prev != LTE_LC_FUNC_MODE_OFFLINE && prev != LTE_LC_FUNC_MODE_POWER_OFF) {
+        int rc = lte_lc_func_mode_set(LTE_LC_FUNC_MODE_OFFLINE);
+        if (rc) {
+            LOG_ERR("Taking the modem offline failed: %d", rc);
+            return rc;
+        }
+        restore = true;
+    }
+
+    for (size_t i = 0; i < bundle.n_cred; i++) {
+        const struct fac_cred *c = &bundle.cred[i];
+
+        int rc = modem_key_mgmt_write(c->tag, c->type, c->pem.value, c->pem.len);
+        snprintk(name, sizeof(name), "%u/%d", c->tag, c->type);
+        cb(user, "cred", name, rc);
+        if (rc && !err) err = rc;
+    }
+
+    if (restore) {
+        lte_lc_func_mode_set(prev);
+    }
+    return err;
+}
+
+int factory_ingest(uint8_t *buf, size_t len, factory_result_cb_t cb, void *user)
+{
+    struct zcbor_string payload, sig;
+    int64_t t0 = k_uptime_get();
+    int err;
+
+    if (!buf || !cb) return -EINVAL;
+
+    ZCBOR_STATE_D(zs, 1, buf, len, 1, 0);
+    if (!zcbor_list_start_decode(zs) ||
+        !zcbor_bstr_decode(zs, &payload) ||
+        !zcbor_bstr_decode(zs, &sig) ||
+        !zcbor_list_end_decode(zs)) {
+        LOG_ERR("Bundle envelope malformed");
+        return -EBADMSG;
+    }
+
+    k_mutex_lock(&factory_lock, K_FOREVER);
+    memset(&bundle, 0, sizeof(bundle));
+
+    err = verify_signature(&payload, &sig);
+    if (err) {
+        LOG_ERR("Bundle signature check failed: %d", err);
+        goto out;
+    }
+    err = decode_manifest(&payload);
+    if (err) goto out;
+
+    uint32_t t_check = (uint32_t)(k_uptime_get() - t0);
+
+    err = write_creds(cb, user);
+    uint32_t t_modem = (uint32_t)(k_uptime_get() - t0) - t_check;
+
+    if (bundle.n_cfg) {
+        int rc = config_set_batch(bundle.keys, bundle.values, bundle.n_cfg, bundle.results);
+        for (size_t i = 0; i < bundle.n_cfg; i++) {
+            cb(user, "cfg", bundle.keys[i], bundle.results[i]);
+        }
+        if (rc && !err) err = rc;
+    }
+
+    LOG_INF("Bundle applied: %u creds, %u keys, check %u ms, modem %u ms, total %u ms",
+            (unsigned)bundle.n_cred, (unsigned)bundle.n_cfg, t_check, t_modem,
+            (uint32_t)(k_uptime_get() - t0));
+
+out:
+    secure_memzero(&bundle, sizeof(bundle));
+    k_mutex_unlock(&factory_lock);
+    return err;
+}
+
+/* ---------- shell: factory begin <bytes> / chunk <base64> / commit / abort ---------- */
+
+static uint8_t up_buf[FACTORY_BUNDLE_MAX];
+static size_t up_len, up_expect;
+static char up_carry[4];
+static size_t up_carry_len;
+static bool up_active;
+static int64_t up_t0;
+
+static void upload_reset(void)
+{
+    secure_memzero(up_buf, up_len);
+    up_len = 0;
+    up_expect = 0;
+    up_carry_len = 0;
+    up_active = false;
+}
+
+/* Decode whole base64 quads into up_buf; a partial quad waits for the next chunk */
+static int upload_append(const char *src, size_t len)
+{
+    size_t olen;
+
+    while (len && up_carry_len) {
+        up_carry[up_carry_len++] = *src++;
+        len--;
+        if (up_carry_len == 4) {
+            if (base64_decode(up_buf + up_len, up_expect - up_len, &olen,
+                              (const uint8_t *)up_carry, 4)) {
+                return -EINVAL;
+            }
+            up_len += olen;
+            up_carry_len = 0;
+        }
+    }
+
+    size_t bulk = len & ~(size_t)3;
+    if (bulk) {
+        if (base64_decode(up_buf + up_len, up_expect - up_len, &olen, (const uint8_t *)src, bulk)) {
+            return -EINVAL;
+        }
+        up_len += olen;
+    }
+    for (size_t i = bulk; i < len; i++) {
+        up_carry[up_carry_len++] = src[i];
+    }
+    return 0;
+}
+
+static void shell_result(void *user, const char *kind, const char *name, int result)
+{
+    const struct shell *sh = user;
+
+    shell_print(sh, "RESULT %s %s %d", kind, name, result);
+}
+
+static int cmd_factory_begin(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    unsigned long n = strtoul(argv[1], NULL, 10);
+    if (n == 0 || n > FACTORY_BUNDLE_MAX) {
+        shell_error(sh, "Bundle size must be 1..%u bytes", FACTORY_BUNDLE_MAX);
+        return -EINVAL;
+    }
+
+    upload_reset();
+    up_expect = n;
+    up_active = true;
+    up_t0 = k_uptime_get();
+    shell_print(sh, "READY %u", (unsigned)n);
+    return 0;
+}
+
+static int cmd_factory_chunk(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    if (!up_active) {
+        shell_error(sh, "No upload; start with 'factory begin <bytes>'");
+        return -EINVAL;
+    }
+    int rc = upload_append(argv[1], strlen(argv[1]));
+    if (rc) {
+        shell_error(sh, "Bad base64 or more than %u bytes, upload aborted", (unsigned)up_expect);
+        upload_reset();
+        return rc;
+    }
+    shell_print(sh, "OK %u/%u", (unsigned)up_len, (unsigned)up_expect);
+    return 0;
+}
+
+static int cmd_factory_commit(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc); ARG_UNUSED(argv);
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    if (!up_active || up_carry_len || up_len != up_expect) {
+        shell_error(sh, "Upload incomplete (%u/%u bytes)", (unsigned)up_len, (unsigned)up_expect);
+        return -EINVAL;
+    }
+
+    uint32_t t_up = (uint32_t)(k_uptime_get() - up_t0);
+    int64_t t0 = k_uptime_get();
+    int rc = factory_ingest(up_buf, up_len, shell_result, (void *)sh);
+    uint32_t t_apply = (uint32_t)(k_uptime_get() - t0);
+
+    shell_print(sh, "DONE %d (upload %u ms, %u B/s; apply %u ms)", rc, t_up,
+                (unsigned)(t_up ? up_len * 1000 / t_up : up_len), t_apply);
+    upload_reset();
+    return rc;
+}
+
+static int cmd_factory_abort(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc); ARG_UNUSED(argv);
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    upload_reset();
+    shell_print(sh, "Aborted");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_factory,
+    SHELL_CMD_ARG(begin,  NULL, "Start a bundle upload: factory begin <bytes>", cmd_factory_begin, 2, 0),
+    SHELL_CMD_ARG(chunk,  NULL, "Append base64 data: factory chunk <base64>", cmd_factory_chunk, 2, 0),
+    SHELL_CMD_ARG(commit, NULL, "Verify and apply the uploaded bundle", cmd_factory_commit, 1, 0),
+    SHELL_CMD_ARG(abort,  NULL, "Drop the upload buffer", cmd_factory_abort, 1, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(factory, &sub_factory, "Factory bulk provisioning from a signed CBOR bundle", NULL);
@@ -0,0 +1,42 @@
+#ifndef FACTORY_H
+#define FACTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Factory bulk provisioning. One signed CBOR bundle carries the modem
+ * credentials, the config key/values and the PBKDF2 password hash for a unit,
+ * so a station does a single upload instead of a command per key or PEM line.
+ *
+ *   bundle  = [ payload: bstr .cbor manifest, signature: bstr .size 64 ]
+ *   manifest = {
+ *     1: 1,                                   ; format version
+ *     2: [* [sec_tag: uint, type: 0..2, pem: bstr]],   ; 0 ca, 1 cert, 2 key
+ *     3: [* [key: tstr, value: tstr]],
+ *     ? 4: [salt: bstr, hash: bstr, iterations: uint],
+ *   }
+ *
+ * The signature is ECDSA P-256 / SHA-256 over the payload bytes, checked
+ * against factory_pub_key before anything is decoded or written. That key is
+ * generated at build time from the FACTORY_PUB_KEY PEM; bundles are built,
+ * signed and checked on the host with scripts/factory_bundle.py.
+ */
+#define FACTORY_BUNDLE_VERSION  1
+#define FACTORY_BUNDLE_MAX      (12 * 1024)
+#define FACTORY_MAX_CREDS       8
+#define FACTORY_MAX_CFG         48
+#define FACTORY_PW_MAX          64
+
+/* Called once per bundle item with its outcome (0 or a negative errno) */
+typedef void (*factory_result_cb_t)(void *user, const char *kind, const char *name, int result);
+
+/*
+ * Verify and apply a bundle. buf is modified (strings are terminated in place).
+ * Credentials are written in one offline modem session, config and password
+ * hash in one blob update. Returns 0 when every item succeeded, -EBADMSG for
+ * a malformed bundle, -EPERM for a bad signature, else the first item error.
+ */
+int factory_ingest(uint8_t *buf, size_t len, factory_result_cb_t cb, void *user);
+
+#endif /* FACTORY_H */
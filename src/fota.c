@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "fota.h"
 #include <zephyr/kernel.h>
 #include <zephyr/dfu/mcuboot.h>
@@ -8,26 +10,113 @@
 #include <zephyr/net/socket.h>
 #include <zephyr/sys/reboot.h>
 #include <zephyr/shell/shell.h>
+#include <zephyr/random/random.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/mgmt/mcumgr/mgmt/mgmt_defines.h>
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
 #include "config.h"
+#include "shell_commands.h"
+#include "fota_stats.h"
+#include "fota_delta.h"
+#include "fota_manifest.h"
+#include "fota_ckpt.h"
+#include "fota_writer.h"
+#include <dfu/dfu_target.h>
 #include <dfu/dfu_target_mcuboot.h>
 #include <modem/nrf_modem_lib.h>
 #include <modem/lte_lc.h>
 #include <modem/modem_key_mgmt.h>
 #include <net/fota_download.h>
+#include <net/downloader.h>
 #include <nrf_socket.h>
+#include <psa/crypto.h>
+#include <psa/internal_trusted_storage.h>
 
 
 
 
-enum fota_state { IDLE, CONNECTED, UPDATE_DOWNLOAD, UPDATE_PENDING, UPDATE_APPLY };
-static enum fota_state state = IDLE;
+static enum fota_state state = FOTA_STATE_IDLE;
 
+/*
+ * Update checks, downloads and the apply step run here, not on the system
+ * work queue: manifest_fetch() can wait MANIFEST_TIMEOUT for the server.
+ */
+static struct k_work_q fota_wq;
+static K_THREAD_STACK_DEFINE(fota_wq_stack, FOTA_WQ_STACK_SIZE);
 static struct k_work fota_work;
 
 static void fota_work_cb(struct k_work *work);
 static void apply_state(enum fota_state new_state);
+static void poll_schedule(bool failed);
+static void apply_arm(void);
 static int modem_configure_and_connect(void);
 static int update_download(void);
+static int update_check(void);
+static int running_version(struct mcuboot_img_sem_ver *ver);
+
+#define MANIFEST_FILE       "manifest.txt"
+#define MANIFEST_MAX_LEN    256
+#define MANIFEST_TIMEOUT    K_SECONDS(30)
+
+static struct fota_manifest manifest;
+static char manifest_path[MQTT_MAX_STR_LEN];
+static char manifest_text[MANIFEST_MAX_LEN + 1];
+static size_t manifest_len;
+static int manifest_err;
+static char manifest_dl_buf[1024];
+static struct downloader manifest_dl;
+static bool manifest_dl_ready;
+static bool delta_active;
+/* Image whose delta failed; the next attempt for it downloads the full image */
+static uint8_t delta_bad_sha256[32];
+static K_SEM_DEFINE(manifest_sem, 0, 1);
+
+static bool ckpt_pending;
+
+/*
+ * Periodic polling. ota_int is the check interval in seconds; each check is
+ * spread by up to +/-POLL_JITTER_PCT so a fleet does not poll in lockstep.
+ * Failed checks or downloads retry after POLL_RETRY_BASE_S, doubling per
+ * consecutive failure up to the interval. A due check waits up to
+ * POLL_ALIGN_MAX_S for the next RRC connected period (a PSM wake-up or other
+ * traffic) so it rides an active window instead of bringing the radio up.
+ */
+#define POLL_DEFAULT_S      (24 * 3600)
+#define POLL_MIN_S          60
+#define POLL_JITTER_PCT     10
+#define POLL_RETRY_BASE_S   60
+#define POLL_ALIGN_MAX_S    900
+
+static struct k_work_delayable poll_work;
+static int64_t poll_next_ms;
+static uint32_t poll_failures;
+static bool poll_due;
+static bool rrc_connected;
+
+#define PENDING_UID         0xC0F50002ULL
+#define PENDING_MAGIC       0x46505431u   /* "FPT1" */
+#define APPLY_RETRY_S       60
+
+/*
+ * A verified image waits in the secondary slot, unmarked, until the apply
+ * policy (ota_apply) opens a window: at once, at the next RRC idle period,
+ * after a delay, or only on request ("fota apply" or an MCUmgr reset). The
+ * record below survives a reboot in between; "applied" is set once the image
+ * is marked for MCUboot, so the next boot can tell a finished or reverted
+ * update from one still waiting.
+ */
+struct fota_pending {
+	uint32_t magic;
+	uint32_t applied;
+	uint32_t size;
+	struct mcuboot_img_sem_ver ver;
+	uint8_t sha256[32];
+};
+
+static struct fota_pending pending;
+static struct k_work_delayable apply_work;
+static fota_apply_check_t apply_check;
+static bool apply_requested;
 
 /**
  * @brief Handler for LTE link control events
@@ -48,17 +137,23 @@ static void lte_lc_handler(const struct lte_lc_evt *const evt)
 
 			printk("LTE network is disconnected.\n");
 			connected = false;
-			if (state == CONNECTED || state == UPDATE_DOWNLOAD) {
-				apply_state(IDLE);
+			if (state == FOTA_STATE_UPDATE_DOWNLOAD) {
+				/* Checkpoint and cancel on the work queue, not in the LTE handler */
+				ckpt_pending = true;
+				k_work_submit_to_queue(&fota_wq, &fota_work);
+			}
+			if (state == FOTA_STATE_CONNECTED || state == FOTA_STATE_UPDATE_CHECK || state == FOTA_STATE_UP_TO_DATE ||
+			    state == FOTA_STATE_RETRY_WAIT || state == FOTA_STATE_UPDATE_DOWNLOAD) {
+				apply_state(FOTA_STATE_IDLE);
 			}
 			break;
 		}
 
 		connected = true;
 
-		if (state == IDLE) {
+		if (state == FOTA_STATE_IDLE) {
 			printk("LTE Link Connected!\n");
-			apply_state(CONNECTED);
+			apply_state(FOTA_STATE_CONNECTED);
 		}
 		break;
 	
@@ -69,6 +164,14 @@ static void lte_lc_handler(const struct lte_lc_evt *const evt)
 	case LTE_LC_EVT_RRC_UPDATE:
 		printk("RRC mode update: %s\n", 
 		       evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED ? "CONNECTED" : "IDLE");
+		rrc_connected = (evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED);
+		if (rrc_connected && poll_due) {
+			k_work_reschedule_for_queue(&fota_wq, &poll_work, K_NO_WAIT);
+		}
+		if (!rrc_connected && state == FOTA_STATE_UPDATE_PENDING &&
+		    ota_config.apply_policy == OTA_APPLY_IDLE) {
+			k_work_reschedule_for_queue(&fota_wq, &apply_work, K_NO_WAIT);
+		}
 		break;
 	
 	case LTE_LC_EVT_CELL_UPDATE:
@@ -90,28 +193,252 @@ static void apply_state(enum fota_state new_state)
 	__ASSERT(state != new_state, "State already set: %d", state);
 
 	state = new_state;
+	fota_stats_state(new_state);
 
 	switch (new_state) {
-	case IDLE:
+	case FOTA_STATE_IDLE:
+		k_work_cancel_delayable(&poll_work);
+		poll_due = false;
 		modem_configure_and_connect();
 		break;
-	case CONNECTED:
-		printk("LTE Connected - Starting FOTA download automatically\n");
-		apply_state(UPDATE_DOWNLOAD);
+	case FOTA_STATE_CONNECTED:
+		printk("LTE Connected - checking for a firmware update\n");
+		apply_state(FOTA_STATE_UPDATE_CHECK);
+		break;
+	case FOTA_STATE_UPDATE_CHECK:
+		k_work_submit_to_queue(&fota_wq, &fota_work);
+		break;
+	case FOTA_STATE_UP_TO_DATE:
+		printk("No newer firmware, skipping download\n");
+		poll_schedule(false);
+		break;
+	case FOTA_STATE_RETRY_WAIT:
+		poll_schedule(true);
 		break;
-	case UPDATE_DOWNLOAD:
-		k_work_submit(&fota_work);
+	case FOTA_STATE_UPDATE_DOWNLOAD:
+		k_work_submit_to_queue(&fota_wq, &fota_work);
 		break;
-	case UPDATE_PENDING:
-		printk("Update pending - applying automatically\n");
-		apply_state(UPDATE_APPLY);
+	case FOTA_STATE_UPDATE_PENDING:
+		apply_arm();
 		break;
-	case UPDATE_APPLY:
-		k_work_submit(&fota_work);
+	case FOTA_STATE_UPDATE_APPLY:
+		k_work_submit_to_queue(&fota_wq, &fota_work);
 		break;
 	}
 }
 
+static uint32_t poll_interval_s(void)
+{
+	if (ota_config.check_interval <= 0) {
+		return POLL_DEFAULT_S;
+	}
+	return MAX((uint32_t)ota_config.check_interval, POLL_MIN_S);
+}
+
+/* Arm the next check: the interval with jitter, or a backoff after a failure */
+static void poll_schedule(bool failed)
+{
+	uint32_t interval = poll_interval_s();
+	uint32_t delay;
+
+	if (failed) {
+		poll_failures++;
+		delay = POLL_RETRY_BASE_S << MIN(poll_failures - 1, 16);
+		delay = MIN(delay, interval);
+	} else {
+		uint32_t span = interval / 100 * POLL_JITTER_PCT;
+
+		poll_failures = 0;
+		delay = interval - span + (span ? sys_rand32_get() % (2 * span + 1) : 0);
+	}
+
+	poll_due = false;
+	poll_next_ms = k_uptime_get() + (int64_t)delay * MSEC_PER_SEC;
+	k_work_reschedule_for_queue(&fota_wq, &poll_work, K_SECONDS(delay));
+
+	fota_stats_schedule(interval, failed ? delay : 0, (uint32_t)(poll_next_ms / MSEC_PER_SEC));
+
+	printk("Next firmware check in %u s%s\n", delay, failed ? " (retry)" : "");
+}
+
+static void poll_work_cb(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	if (state != FOTA_STATE_UP_TO_DATE && state != FOTA_STATE_RETRY_WAIT) {
+		return;
+	}
+
+	/* Due: wait for an active window unless one is open or the wait ran out */
+	if (!rrc_connected && !poll_due) {
+		poll_due = true;
+		k_work_reschedule_for_queue(&fota_wq, &poll_work, K_SECONDS(POLL_ALIGN_MAX_S));
+		return;
+	}
+
+	poll_due = false;
+	apply_state(FOTA_STATE_UPDATE_CHECK);
+}
+
+static int pending_store(void)
+{
+	psa_status_t st = psa_its_set(PENDING_UID, sizeof(pending), &pending, PSA_STORAGE_FLAG_NONE);
+
+	return (st == PSA_SUCCESS) ? 0 : -EIO;
+}
+
+/* The image in the manifest just completed and verified */
+static void pending_record(void)
+{
+	pending = (struct fota_pending) {
+		.magic = PENDING_MAGIC,
+		.size = manifest.size,
+		.ver = manifest.ver,
+	};
+	memcpy(pending.sha256, manifest.sha256, sizeof(pending.sha256));
+
+	if (pending_store()) {
+		printk("Saving the pending update failed, it is lost on reboot\n");
+	}
+}
+
+/* Start the apply window for the pending image according to ota_apply */
+static void apply_arm(void)
+{
+	k_timeout_t delay = K_NO_WAIT;
+
+	switch (ota_config.apply_policy) {
+	case OTA_APPLY_MANUAL:
+		printk("Update pending - waiting for \"fota apply\"\n");
+		return;
+	case OTA_APPLY_DELAY:
+		printk("Update pending - applying in %d s\n", MAX(ota_config.apply_delay_s, 0));
+		delay = K_SECONDS(MAX(ota_config.apply_delay_s, 0));
+		break;
+	case OTA_APPLY_IDLE:
+		printk("Update pending - applying at the next LTE idle period\n");
+		break;
+	default:
+		printk("Update pending - applying now\n");
+		break;
+	}
+	k_work_reschedule_for_queue(&fota_wq, &apply_work, delay);
+}
+
+static void apply_work_cb(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	if (state != FOTA_STATE_UPDATE_PENDING) {
+		return;
+	}
+	if (!apply_requested) {
+		if (ota_config.apply_policy == OTA_APPLY_MANUAL) {
+			return;
+		}
+		/* The RRC idle event reschedules this */
+		if (ota_config.apply_policy == OTA_APPLY_IDLE && rrc_connected) {
+			return;
+		}
+	}
+
+	if (apply_check && !apply_check()) {
+		printk("Update held back by the application, retrying in %d s\n", APPLY_RETRY_S);
+		k_work_reschedule_for_queue(&fota_wq, &apply_work, K_SECONDS(APPLY_RETRY_S));
+		return;
+	}
+
+	apply_requested = false;
+	apply_state(FOTA_STATE_UPDATE_APPLY);
+}
+
+/* Mark the pending image for a test swap; MCUboot reverts it unless the new image confirms */
+static int apply_mark(void)
+{
+	int err;
+
+	err = boot_request_upgrade(BOOT_UPGRADE_TEST);
+	if (err) {
+		return err;
+	}
+	if (mcuboot_swap_type() != BOOT_SWAP_TYPE_TEST) {
+		return -ENOENT;
+	}
+
+	pending.applied = 1;
+	pending_store();
+	return 0;
+}
+
+/*
+ * Boot: drop a record whose image was applied (or reverted by MCUboot); keep
+ * waiting for one that was not, as long as the slot still holds that image.
+ */
+static void pending_restore(void)
+{
+	struct mcuboot_img_sem_ver cur;
+	uint8_t digest[32];
+	size_t len = 0;
+
+	if (psa_its_get(PENDING_UID, 0, sizeof(pending), &pending, &len) != PSA_SUCCESS ||
+	    len != sizeof(pending) || pending.magic != PENDING_MAGIC) {
+		return;
+	}
+
+	if (pending.applied) {
+		if (running_version(&cur) == 0 && fota_ver_cmp(&cur, &pending.ver) == 0) {
+			printk("Pending update %u.%u.%u+%u is running\n", cur.major, cur.minor,
+			       cur.revision, cur.build_num);
+		} else {
+			printk("Pending update was reverted\n");
+		}
+		psa_its_remove(PENDING_UID);
+		return;
+	}
+
+	if (fota_slot1_digest(pending.size, digest) ||
+	    memcmp(digest, pending.sha256, sizeof(digest)) != 0) {
+		printk("Pending update no longer in the secondary slot, dropping it\n");
+		psa_its_remove(PENDING_UID);
+		return;
+	}
+
+	printk("Verified update %u.%u.%u+%u still pending\n", pending.ver.major,
+	       pending.ver.minor, pending.ver.revision, pending.ver.build_num);
+	apply_state(FOTA_STATE_UPDATE_PENDING);
+}
+
+/* MCUmgr "os reset" while an update is pending applies it, unless vetoed */
+static enum mgmt_cb_return os_reset_hook(uint32_t event, enum mgmt_cb_return prev_status,
+					 int32_t *rc, uint16_t *group, bool *abort_more,
+					 void *data, size_t data_size)
+{
+	ARG_UNUSED(event);
+	ARG_UNUSED(prev_status);
+	ARG_UNUSED(group);
+	ARG_UNUSED(abort_more);
+	ARG_UNUSED(data);
+	ARG_UNUSED(data_size);
+
+	if (state != FOTA_STATE_UPDATE_PENDING) {
+		return MGMT_CB_OK;
+	}
+	if (apply_check && !apply_check()) {
+		printk("Reset refused, the application is holding back the update\n");
+		*rc = MGMT_ERR_EBUSY;
+		return MGMT_CB_ERROR_RC;
+	}
+	if (apply_mark() == 0) {
+		printk("Reset applies the pending update\n");
+	}
+	return MGMT_CB_OK;
+}
+
+static struct mgmt_callback os_reset_cb = {
+	.callback = os_reset_hook,
+	.event_id = MGMT_EVT_OP_OS_MGMT_RESET,
+};
+
 /**
  * @brief Configures modem to provide LTE link.
  */
@@ -134,21 +461,321 @@ static int modem_configure_and_connect(void)
 	return 0;
 }
 
+static int manifest_dl_cb(const struct downloader_evt *evt)
+{
+	switch (evt->id) {
+	case DOWNLOADER_EVT_FRAGMENT:
+		if (manifest_len + evt->fragment.len > MANIFEST_MAX_LEN) {
+			manifest_err = -EFBIG;
+			k_sem_give(&manifest_sem);
+			return -1;
+		}
+		memcpy(manifest_text + manifest_len, evt->fragment.buf, evt->fragment.len);
+		manifest_len += evt->fragment.len;
+		return 0;
+	case DOWNLOADER_EVT_DONE:
+		manifest_err = 0;
+		k_sem_give(&manifest_sem);
+		return 0;
+	case DOWNLOADER_EVT_ERROR:
+		manifest_err = evt->error;
+		k_sem_give(&manifest_sem);
+		/* No retries here; the next attach checks again */
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+static int running_version(struct mcuboot_img_sem_ver *ver)
+{
+	struct mcuboot_img_header hdr;
+	int err;
+
+	err = boot_read_bank_header(FIXED_PARTITION_ID(slot0_partition), &hdr, sizeof(hdr));
+	if (err) {
+		return err;
+	}
+	*ver = hdr.h.v1.sem_ver;
+	return 0;
+}
+
+static int delta_dl_cb(const struct downloader_evt *evt);
+
+/* One downloader serves both the manifest and delta patches */
+static int http_dl_cb(const struct downloader_evt *evt)
+{
+	return delta_active ? delta_dl_cb(evt) : manifest_dl_cb(evt);
+}
+
+/* Same directory as the image: firmware_storage/<customer>/<device>/ */
+static void sibling_path(char *out, size_t size, const char *name)
+{
+	const char *slash = strrchr(firmware_filename, '/');
+	int dir_len = slash ? (int)(slash - firmware_filename + 1) : 0;
+
+	snprintk(out, size, "%.*s%s", dir_len, firmware_filename, name);
+}
+
+static int http_get(const char *path)
+{
+	/* The downloader keeps a pointer to the tag list */
+	static int sec_tag;
+	int err;
+
+	sec_tag = atoi(ota_config.cert_tag);
+	struct downloader_host_cfg host = {
+		.sec_tag_list = &sec_tag,
+		.sec_tag_count = (sec_tag != -1) ? 1 : 0,
+	};
+
+	if (!manifest_dl_ready) {
+		struct downloader_cfg cfg = {
+			.callback = http_dl_cb,
+			.buf = manifest_dl_buf,
+			.buf_size = sizeof(manifest_dl_buf),
+		};
+
+		err = downloader_init(&manifest_dl, &cfg);
+		if (err) {
+			return err;
+		}
+		manifest_dl_ready = true;
+	}
+
+	return downloader_get_with_host_and_file(&manifest_dl, &host, ota_config.server_addr,
+						 path, 0);
+}
+
+static int manifest_fetch(void)
+{
+	int err;
+
+	sibling_path(manifest_path, sizeof(manifest_path), MANIFEST_FILE);
+
+	manifest_len = 0;
+	manifest_err = -ETIMEDOUT;
+	k_sem_reset(&manifest_sem);
+
+	err = http_get(manifest_path);
+	if (err) {
+		return err;
+	}
+	if (k_sem_take(&manifest_sem, MANIFEST_TIMEOUT)) {
+		downloader_cancel(&manifest_dl);
+		return -ETIMEDOUT;
+	}
+	if (manifest_err) {
+		return manifest_err;
+	}
+
+	manifest_text[manifest_len] = '\0';
+	return fota_manifest_parse(manifest_text, &manifest);
+}
+
+/**
+ * @brief Compare the server manifest with the running image.
+ *
+ * @return 1 if the server has a newer image, 0 if not, negative errno on failure.
+ */
+static int update_check(void)
+{
+	struct mcuboot_img_sem_ver cur;
+	int err;
+
+	err = manifest_fetch();
+	if (err) {
+		printk("Manifest fetch from %s failed, err %d\n", manifest_path, err);
+		return err;
+	}
+
+	err = running_version(&cur);
+	if (err) {
+		printk("Reading running image version failed, err %d\n", err);
+		return err;
+	}
+
+	printk("Running %u.%u.%u+%u, server has %u.%u.%u+%u (%u bytes)\n",
+	       cur.major, cur.minor, cur.revision, cur.build_num,
+	       manifest.ver.major, manifest.ver.minor, manifest.ver.revision,
+	       manifest.ver.build_num, manifest.size);
+
+	return fota_manifest_is_newer(&manifest, &cur);
+}
+
+/* Runs on the downloader thread; every way out of a patch ends here */
+static void delta_end(int err, bool bad_patch)
+{
+	delta_active = false;
+	fota_delta_abort();
+	fota_stats_dl_end(false);
+
+	if (state != FOTA_STATE_UPDATE_DOWNLOAD) {
+		/* Cancelled by a link drop; the next check starts over */
+		return;
+	}
+	if (bad_patch) {
+		printk("Delta update failed, err %d, falling back to the full image\n", err);
+		memcpy(delta_bad_sha256, manifest.sha256, sizeof(delta_bad_sha256));
+		/* Still FOTA_STATE_UPDATE_DOWNLOAD: rerun it, now with fota_download */
+		k_work_submit_to_queue(&fota_wq, &fota_work);
+	} else {
+		printk("Delta download failed, err %d\n", err);
+		apply_state(FOTA_STATE_RETRY_WAIT);
+	}
+}
+
+static int delta_dl_cb(const struct downloader_evt *evt)
+{
+	int err;
+
+	switch (evt->id) {
+	case DOWNLOADER_EVT_FRAGMENT:
+		/* The writer counts the patched output; this is what came over the air */
+		fota_stats_rx(evt->fragment.len);
+		err = fota_delta_write(evt->fragment.buf, evt->fragment.len);
+		if (err) {
+			delta_end(err, true);
+			return -1;
+		}
+		return 0;
+	case DOWNLOADER_EVT_DONE:
+		err = fota_delta_finish();
+		if (err) {
+			delta_end(err, true);
+			return 0;
+		}
+		delta_active = false;
+		fota_stats_dl_end(true);
+		fota_ckpt_clear();
+		printk("Delta update applied\n");
+		pending_record();
+		apply_state(FOTA_STATE_UPDATE_PENDING);
+		return 0;
+	case DOWNLOADER_EVT_ERROR:
+		delta_end(evt->error, false);
+		return -1;
+	case DOWNLOADER_EVT_STOPPED:
+		delta_end(-ECANCELED, false);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+/* Use the patch only for the version it was made from, and not after it failed for this image */
+static bool delta_usable(void)
+{
+	struct mcuboot_img_sem_ver cur;
+
+	return manifest.has_delta &&
+	       memcmp(delta_bad_sha256, manifest.sha256, sizeof(delta_bad_sha256)) != 0 &&
+	       running_version(&cur) == 0 && fota_ver_cmp(&cur, &manifest.delta_from) == 0;
+}
+
+static int delta_start(void)
+{
+	static char delta_path[MQTT_MAX_STR_LEN];
+	int err;
+
+	sibling_path(delta_path, sizeof(delta_path), manifest.delta_file);
+
+	/* The secondary slot is rebuilt from scratch, so no checkpoint applies */
+	fota_ckpt_clear();
+	fota_writer_resume_from(0, NULL);
+	err = fota_delta_begin(manifest.sha256, manifest.size);
+	if (err) {
+		return err;
+	}
+
+	printk("Applying delta %s\n", delta_path);
+	fota_stats_dl_begin();
+	delta_active = true;
+	err = http_get(delta_path);
+	if (err) {
+		delta_active = false;
+		fota_delta_abort();
+		fota_stats_dl_end(false);
+	}
+	return err;
+}
+
+/* Link lost mid-download: stop fota_download and record how far the slot is valid */
+static void download_pause(void)
+{
+	size_t offset = 0;
+
+	ckpt_pending = false;
+	if (delta_active) {
+		/* The patch cannot resume; the downloader thread cleans up on the stop event */
+		downloader_cancel(&manifest_dl);
+		return;
+	}
+	if (dfu_target_offset_get(&offset)) {
+		offset = 0;
+	}
+	/* fota_download_cancel() resets the target; keep the slot this checkpoint describes */
+	fota_writer_pause(true);
+	fota_download_cancel();
+	fota_writer_pause(false);
+	fota_writer_expect(NULL, 0);
+	fota_stats_dl_end(false);
+
+	if (fota_ckpt_save(manifest.size, manifest.sha256, offset) == 0) {
+		printk("Download paused at %u of %u bytes\n", (unsigned int)offset, manifest.size);
+	}
+}
+
+/*
+ * Before (re)starting: a partial secondary slot may only be resumed if its
+ * checkpoint belongs to the image in the manifest. The writer then checks the
+ * slot against it at the offset fota_download actually resumes from.
+ */
+static void download_prepare(void)
+{
+	fota_ckpt_prepare(manifest.size, manifest.sha256);
+}
+
 static void fota_work_cb(struct k_work *work)
 {
 	int err;
 
 	ARG_UNUSED(work);
 
+	if (ckpt_pending) {
+		download_pause();
+	}
+
 	switch (state) {
-	case UPDATE_DOWNLOAD:
+	case FOTA_STATE_UPDATE_CHECK:
+		err = update_check();
+		fota_stats_check(err < 0);
+		/* The link may have dropped while the manifest was fetched */
+		if (state != FOTA_STATE_UPDATE_CHECK) {
+			break;
+		}
+		if (err < 0) {
+			apply_state(FOTA_STATE_RETRY_WAIT);
+		} else {
+			apply_state(err > 0 ? FOTA_STATE_UPDATE_DOWNLOAD : FOTA_STATE_UP_TO_DATE);
+		}
+		break;
+	case FOTA_STATE_UPDATE_DOWNLOAD:
 		err = update_download();
 		if (err) {
 			printk("Download failed, err %d\n", err);
-			apply_state(CONNECTED);
+			apply_state(FOTA_STATE_RETRY_WAIT);
 		}
 		break;
-	case UPDATE_APPLY:
+	case FOTA_STATE_UPDATE_APPLY:
+		/* Only an image that passed verification reaches FOTA_STATE_UPDATE_PENDING */
+		err = apply_mark();
+		if (err) {
+			printk("Marking the update for MCUboot failed, err %d, not rebooting\n", err);
+			apply_state(FOTA_STATE_RETRY_WAIT);
+			break;
+		}
+		printk("Rebooting into the update\n");
 		lte_lc_power_off();
 		sys_reboot(SYS_REBOOT_WARM);
 		break;
@@ -157,15 +784,68 @@ static void fota_work_cb(struct k_work *work)
 	}
 }
 
+/*
+ * fota_download reports neither received bytes nor its socket retries: on
+ * -ECONNRESET and similar it answers the downloader's error event with 0, and
+ * the downloader reconnects and resumes with a range request. Its
+ * downloader_init() is wrapped at link time to see those events. The
+ * manifest/delta downloader is left alone; delta_dl_cb() counts its bytes.
+ */
+static downloader_callback_t fota_download_cb;
+
+static int fota_download_stats_cb(const struct downloader_evt *evt)
+{
+	int ret = fota_download_cb(evt);
+
+	if (evt->id == DOWNLOADER_EVT_FRAGMENT) {
+		fota_stats_rx(evt->fragment.len);
+	} else if (evt->id == DOWNLOADER_EVT_ERROR && ret == 0) {
+		printk("Download socket error %d, resuming\n", evt->error);
+		fota_stats_retry();
+	}
+	return ret;
+}
+
+int __real_downloader_init(struct downloader *dl, struct downloader_cfg *cfg);
+
+int __wrap_downloader_init(struct downloader *dl, struct downloader_cfg *cfg)
+{
+	/* Not twice: fota_download may hand the same configuration in again */
+	if (dl != &manifest_dl && cfg->callback != fota_download_stats_cb) {
+		fota_download_cb = cfg->callback;
+		cfg->callback = fota_download_stats_cb;
+	}
+	return __real_downloader_init(dl, cfg);
+}
+
 static void fota_dl_handler(const struct fota_download_evt *evt)
 {
+	static int last_progress;
+
 	switch (evt->id) {
+	case FOTA_DOWNLOAD_EVT_PROGRESS:
+		/* One event per fragment; only log every 10 % */
+		if (evt->progress / 10 != last_progress / 10) {
+			printk("Download progress: %d%%\n", evt->progress);
+		}
+		last_progress = evt->progress;
+		break;
 	case FOTA_DOWNLOAD_EVT_ERROR:
 		printk("Received error from fota_download\n");
-		apply_state(CONNECTED);
+		fota_writer_pause(false);
+		fota_writer_expect(NULL, 0);
+		fota_stats_dl_end(false);
+		/* After a link drop the state is already FOTA_STATE_IDLE; reconnect will resume */
+		if (state == FOTA_STATE_UPDATE_DOWNLOAD) {
+			apply_state(FOTA_STATE_RETRY_WAIT);
+		}
 		break;
 	case FOTA_DOWNLOAD_EVT_FINISHED:
-		apply_state(UPDATE_PENDING);
+		fota_writer_expect(NULL, 0);
+		fota_stats_dl_end(true);
+		fota_ckpt_clear();
+		pending_record();
+		apply_state(FOTA_STATE_UPDATE_PENDING);
 		break;
 	default:
 		break;
@@ -182,11 +862,28 @@ static int update_download(void)
 		return 0;
 	}
 
+	/* The delta applier checks its own output */
+	fota_writer_expect(NULL, 0);
+	if (delta_usable()) {
+		err = delta_start();
+		if (!err) {
+			return 0;
+		}
+		printk("Delta update could not start, err %d, downloading the full image\n", err);
+		memcpy(delta_bad_sha256, manifest.sha256, sizeof(delta_bad_sha256));
+	}
+
+	download_prepare();
+
 	printk("Uploading firmware from %s\n", ota_config.server_addr);
 	printk("Firmware filename: %s\n", firmware_filename);
+	fota_stats_dl_begin();
+	fota_writer_expect(manifest.sha256, manifest.size);
 	err = fota_download_start(ota_config.server_addr, firmware_filename, atoi(ota_config.cert_tag), 0, 0);
 	if (err) {
 		printk("fota_download_start() failed, err %d\n", err);
+		fota_writer_expect(NULL, 0);
+		fota_stats_dl_end(false);
 		return err;
 	}
 
@@ -202,7 +899,22 @@ int fota_init_and_start(void)
 	boot_write_img_confirmed();
 
 
+	struct k_work_queue_config wq_cfg = { .name = "fota" };
+
+	k_work_queue_start(&fota_wq, fota_wq_stack, K_THREAD_STACK_SIZEOF(fota_wq_stack),
+			   K_LOWEST_APPLICATION_THREAD_PRIO, &wq_cfg);
 	k_work_init(&fota_work, fota_work_cb);
+	k_work_init_delayable(&poll_work, poll_work_cb);
+	k_work_init_delayable(&apply_work, apply_work_cb);
+	mgmt_callback_register(&os_reset_cb);
+
+	err = fota_stats_init();
+	if (err) {
+		printk("FOTA stats registration failed: %d\n", err);
+	}
+
+	/* Only now: main.c has registered the MQTT apply check */
+	pending_restore();
 
 	err = modem_configure_and_connect();
 	if (err) {
@@ -212,3 +924,88 @@ int fota_init_and_start(void)
 
 	return 0;
 }
+
+static int cmd_fota_schedule(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	shell_print(sh, "Interval: %u s, consecutive failures: %u",
+		    poll_interval_s(), poll_failures);
+
+	if (state != FOTA_STATE_UP_TO_DATE && state != FOTA_STATE_RETRY_WAIT) {
+		shell_print(sh, "No check scheduled (state %d)", state);
+	} else if (poll_due) {
+		shell_print(sh, "Check due, waiting for an active LTE window");
+	} else {
+		int64_t left = poll_next_ms - k_uptime_get();
+
+		shell_print(sh, "Next check in %u s", (uint32_t)(MAX(left, 0) / MSEC_PER_SEC));
+	}
+	return 0;
+}
+
+void fota_set_apply_check(fota_apply_check_t check)
+{
+	apply_check = check;
+}
+
+int fota_apply_request(void)
+{
+	if (state != FOTA_STATE_UPDATE_PENDING) {
+		return -ENOENT;
+	}
+	apply_requested = true;
+	k_work_reschedule_for_queue(&fota_wq, &apply_work, K_NO_WAIT);
+	return 0;
+}
+
+bool fota_slot_in_use(void)
+{
+	struct psa_storage_info_t info;
+
+	if (state == FOTA_STATE_UPDATE_DOWNLOAD || state == FOTA_STATE_UPDATE_PENDING ||
+	    state == FOTA_STATE_UPDATE_APPLY) {
+		return true;
+	}
+	/* A checkpointed partial download or an unapplied image survives in slot 1 across reboots */
+	return fota_ckpt_present() ||
+	       psa_its_get_info(PENDING_UID, &info) == PSA_SUCCESS;
+}
+
+static int cmd_fota_apply(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	if (fota_apply_request()) {
+		shell_error(sh, "No update pending");
+		return -ENOENT;
+	}
+	shell_print(sh, "Applying the pending update");
+	return 0;
+}
+
+static int cmd_fota_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	fota_stats_print(sh);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_fota,
+	SHELL_CMD_ARG(status, NULL, "Show download metrics and time per state", cmd_fota_status, 1, 0),
+	SHELL_CMD_ARG(schedule, NULL, "Show the firmware check schedule", cmd_fota_schedule, 1, 0),
+	SHELL_CMD_ARG(apply, NULL, "Apply a pending update now (the application may still hold it back)", cmd_fota_apply, 1, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(fota, &sub_fota, "Firmware update", NULL);
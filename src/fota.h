@@ -1 +1,27 @@
-int fota_init_and_start(void);
\ No newline at end of file
+#ifndef FOTA_H
+#define FOTA_H
+
+#include <stdbool.h>
+
+#define FOTA_WQ_STACK_SIZE  4096
+
+enum fota_state { FOTA_STATE_IDLE, FOTA_STATE_CONNECTED, FOTA_STATE_UPDATE_CHECK, FOTA_STATE_UP_TO_DATE, FOTA_STATE_RETRY_WAIT, FOTA_STATE_UPDATE_DOWNLOAD, FOTA_STATE_UPDATE_PENDING, FOTA_STATE_UPDATE_APPLY };
+#define FOTA_STATE_COUNT (FOTA_STATE_UPDATE_APPLY + 1)
+
+int fota_init_and_start(void);
+
+/*
+ * Asked before a pending update reboots the device; return false to hold it
+ * back (mqtt_pub.c: publishes queued or in flight). Register it before
+ * fota_init_and_start(), which restores a pending update from before a reboot.
+ */
+typedef bool (*fota_apply_check_t)(void);
+void fota_set_apply_check(fota_apply_check_t check);
+
+/* Apply the pending update now regardless of ota_apply; -ENOENT if none is pending */
+int fota_apply_request(void);
+
+/* True while the secondary slot holds a download, a resumable partial image or a pending update */
+bool fota_slot_in_use(void);
+
+#endif /* FOTA_H */
@@ -0,0 +1,98 @@
+#include "fota_ckpt.h"
+#include "fota_writer.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/storage/flash_map.h>
+#include <psa/crypto.h>
+#include <psa/internal_trusted_storage.h>
+
+#define CKPT_READ_CHUNK     512
+
+int fota_slot1_digest(uint32_t len, uint8_t *digest)
+{
+    const struct flash_area *fa;
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t buf[CKPT_READ_CHUNK];
+    size_t out_len;
+    psa_status_t st;
+    int err;
+
+    err = flash_area_open(FIXED_PARTITION_ID(slot1_partition), &fa);
+    if (err) {
+        return err;
+    }
+
+    st = psa_hash_setup(&op, PSA_ALG_SHA_256);
+    for (uint32_t off = 0; st == PSA_SUCCESS && off < len; off += sizeof(buf)) {
+        size_t n = MIN(sizeof(buf), len - off);
+
+        err = flash_area_read(fa, off, buf, n);
+        if (err) {
+            break;
+        }
+        st = psa_hash_update(&op, buf, n);
+    }
+    if (!err && st == PSA_SUCCESS) {
+        st = psa_hash_finish(&op, digest, 32, &out_len);
+    }
+    psa_hash_abort(&op);
+    flash_area_close(fa);
+
+    if (err) {
+        return err;
+    }
+    return (st == PSA_SUCCESS) ? 0 : -EIO;
+}
+
+int fota_ckpt_save(uint32_t size, const uint8_t *image_sha256, uint32_t offset)
+{
+    struct fota_ckpt ck = {
+        .magic = FOTA_CKPT_MAGIC,
+        .size = size,
+        .offset = offset,
+    };
+    psa_status_t st;
+
+    memcpy(ck.image_sha256, image_sha256, sizeof(ck.image_sha256));
+    if (offset && fota_slot1_digest(offset, ck.prefix_sha256)) {
+        ck.offset = 0;
+    }
+
+    st = psa_its_set(FOTA_CKPT_UID, sizeof(ck), &ck, PSA_STORAGE_FLAG_NONE);
+    return (st == PSA_SUCCESS) ? 0 : -EIO;
+}
+
+uint32_t fota_ckpt_prepare(uint32_t size, const uint8_t *image_sha256)
+{
+    struct fota_ckpt ck;
+    size_t len = 0;
+
+    if (psa_its_get(FOTA_CKPT_UID, 0, sizeof(ck), &ck, &len) == PSA_SUCCESS &&
+        len == sizeof(ck) && ck.magic == FOTA_CKPT_MAGIC && ck.size == size &&
+        memcmp(ck.image_sha256, image_sha256, sizeof(ck.image_sha256)) == 0) {
+        fota_writer_resume_from(ck.offset, ck.prefix_sha256);
+        return ck.offset;
+    }
+
+    /*
+     * No dfu_target_mcuboot_reset(): it erases the whole slot synchronously,
+     * and the writer erases every page again before programming it. With no
+     * checkpoint the writer refuses any saved progress and restarts at 0.
+     */
+    fota_writer_resume_from(0, NULL);
+    fota_ckpt_save(size, image_sha256, 0);
+    return 0;
+}
+
+void fota_ckpt_clear(void)
+{
+    psa_its_remove(FOTA_CKPT_UID);
+}
+
+bool fota_ckpt_present(void)
+{
+    struct psa_storage_info_t info;
+
+    return psa_its_get_info(FOTA_CKPT_UID, &info) == PSA_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#ifndef FOTA_CKPT_H
+#define FOTA_CKPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Download checkpoint in ITS. Written with offset 0 when a download starts, so
+ * the partial secondary slot is always tied to the image it came from, and
+ * again with the flushed offset and a digest of slot1[0, offset) when the link
+ * drops. fota_download resumes from the dfu_target stream progress with an
+ * HTTP range request; the writer keeps that progress only if it lies within
+ * the checkpoint and the slot prefix still matches its digest. Kept apart from
+ * fota.c so tests/fota_writer can drive it across a simulated reboot.
+ */
+#define FOTA_CKPT_UID       0xC0F50001ULL
+#define FOTA_CKPT_MAGIC     0x46434B31u   /* "FCK1" */
+
+struct fota_ckpt {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t image_sha256[32];
+    uint8_t prefix_sha256[32];
+};
+
+/* SHA-256 of the first len bytes of the secondary slot */
+int fota_slot1_digest(uint32_t len, uint8_t *digest);
+
+/* Record that slot1[0, offset) belongs to the image; offset 0 if the prefix cannot be hashed */
+int fota_ckpt_save(uint32_t size, const uint8_t *image_sha256, uint32_t offset);
+
+/*
+ * download_prepare(): arm the writer with the saved checkpoint if it belongs
+ * to this image, else make the writer refuse saved progress and save an
+ * offset 0 checkpoint. The slot is not erased here; the writer erases it.
+ * Returns the checkpoint offset armed, 0 for a fresh start.
+ */
+uint32_t fota_ckpt_prepare(uint32_t size, const uint8_t *image_sha256);
+
+void fota_ckpt_clear(void);
+bool fota_ckpt_present(void);
+
+#endif /* FOTA_CKPT_H */
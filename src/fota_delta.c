@@ -0,0 +1,306 @@
+#include "fota_delta.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/storage/flash_map.h>
+#include <dfu/dfu_target.h>
+#include <dfu/dfu_target_mcuboot.h>
+#include <psa/crypto.h>
+
+#define DIGEST_LEN      32
+#define COPY_CHUNK      512
+#define STREAM_BUF_LEN  1024
+#define OP_COPY_LEN     9    /* op, src_off, len */
+#define OP_DATA_LEN     5    /* op, len */
+
+enum parse_state { P_HDR, P_OP, P_DATA, P_DONE };
+
+static struct {
+    bool open;
+    enum parse_state ps;
+    uint8_t acc[FOTA_DELTA_HDR_LEN];
+    size_t acc_len;
+    size_t acc_need;
+    uint32_t src_size;
+    uint32_t dst_size;
+    uint32_t out;
+    uint32_t data_left;
+    uint8_t dst_sha256[DIGEST_LEN];
+    psa_hash_operation_t hash;
+    const struct flash_area *src;
+} d;
+
+static uint8_t copy_buf[COPY_CHUNK];
+/* dfu_target_mcuboot needs a write buffer; fota_download brings its own */
+static uint8_t stream_buf[STREAM_BUF_LEN] __aligned(4);
+
+static void dfu_evt(enum dfu_target_evt_id evt_id)
+{
+    ARG_UNUSED(evt_id);
+}
+
+static int emit(const uint8_t *buf, size_t len)
+{
+    if (len > d.dst_size - d.out) {
+        return -EBADMSG;
+    }
+    if (psa_hash_update(&d.hash, buf, len) != PSA_SUCCESS) {
+        return -EIO;
+    }
+    int err = dfu_target_write(buf, len);
+    if (err) {
+        return err;
+    }
+    d.out += len;
+    return 0;
+}
+
+static int copy_from_source(uint32_t off, uint32_t len)
+{
+    if (off > d.src_size || len > d.src_size - off) {
+        return -EBADMSG;
+    }
+
+    while (len) {
+        size_t n = MIN(len, sizeof(copy_buf));
+        int err = flash_area_read(d.src, off, copy_buf, n);
+        if (!err) {
+            err = emit(copy_buf, n);
+        }
+        if (err) {
+            return err;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* The patch only applies to the exact image it was made from */
+static int check_source(const uint8_t *src_sha256)
+{
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t digest[DIGEST_LEN];
+    size_t out_len;
+    psa_status_t st;
+    int err = 0;
+
+    if (d.src_size == 0 || d.src_size > d.src->fa_size) {
+        return -EBADMSG;
+    }
+
+    st = psa_hash_setup(&op, PSA_ALG_SHA_256);
+    for (uint32_t off = 0; st == PSA_SUCCESS && off < d.src_size; off += sizeof(copy_buf)) {
+        size_t n = MIN(sizeof(copy_buf), d.src_size - off);
+
+        err = flash_area_read(d.src, off, copy_buf, n);
+        if (err) {
+            break;
+        }
+        st = psa_hash_update(&op, copy_buf, n);
+    }
+    if (!err && st == PSA_SUCCESS) {
+        st = psa_hash_finish(&op, digest, sizeof(digest), &out_len);
+    }
+    psa_hash_abort(&op);
+
+    if (err) {
+        return err;
+    }
+    if (st != PSA_SUCCESS) {
+        return -EIO;
+    }
+    return memcmp(digest, src_sha256, DIGEST_LEN) ? -ESTALE : 0;
+}
+
+static int parse_header(void)
+{
+    const uint8_t *h = d.acc;
+
+    if (sys_get_le32(h) != FOTA_DELTA_MAGIC) {
+        return -EBADMSG;
+    }
+    d.src_size = sys_get_le32(h + 4);
+
+    /* The patch must produce the image the manifest announced */
+    if (sys_get_le32(h + 8) != d.dst_size || memcmp(h + 48, d.dst_sha256, DIGEST_LEN)) {
+        return -EBADMSG;
+    }
+    return check_source(h + 16);
+}
+
+/* A complete op sits in acc; run it or switch to literal data */
+static int run_op(void)
+{
+    if (d.acc[0] == FOTA_DELTA_OP_COPY) {
+        return copy_from_source(sys_get_le32(d.acc + 1), sys_get_le32(d.acc + 5));
+    }
+
+    d.data_left = sys_get_le32(d.acc + 1);
+    if (d.data_left > d.dst_size - d.out) {
+        return -EBADMSG;
+    }
+    if (d.data_left) {
+        d.ps = P_DATA;
+    }
+    return 0;
+}
+
+static void next_op(void)
+{
+    d.acc_len = 0;
+    d.acc_need = 1;
+    d.ps = (d.out == d.dst_size) ? P_DONE : P_OP;
+}
+
+int fota_delta_begin(const uint8_t *dst_sha256, uint32_t dst_size)
+{
+    int err;
+
+    fota_delta_abort();
+    memset(&d, 0, sizeof(d));
+
+    err = flash_area_open(FIXED_PARTITION_ID(slot0_partition), &d.src);
+    if (err) {
+        return err;
+    }
+
+    /*
+     * Stream progress from another image is useless. The writer drops it at
+     * init (no checkpoint is armed) and erases each page before programming
+     * it, so the slot is not reset here.
+     */
+    err = dfu_target_mcuboot_set_buf(stream_buf, sizeof(stream_buf));
+    if (!err) {
+        err = dfu_target_init(DFU_TARGET_IMAGE_TYPE_MCUBOOT, 0, dst_size, dfu_evt);
+    }
+    if (err) {
+        flash_area_close(d.src);
+        return err;
+    }
+
+    d.hash = psa_hash_operation_init();
+    if (psa_hash_setup(&d.hash, PSA_ALG_SHA_256) != PSA_SUCCESS) {
+        dfu_target_reset();
+        flash_area_close(d.src);
+        return -EIO;
+    }
+
+    memcpy(d.dst_sha256, dst_sha256, DIGEST_LEN);
+    d.dst_size = dst_size;
+    d.ps = P_HDR;
+    d.acc_need = FOTA_DELTA_HDR_LEN;
+    d.open = true;
+    return 0;
+}
+
+int fota_delta_write(const uint8_t *buf, size_t len)
+{
+    int err = 0;
+
+    if (!d.open) {
+        return -EACCES;
+    }
+
+    while (len && !err) {
+        if (d.ps == P_DONE) {
+            return -EBADMSG;
+        }
+
+        if (d.ps == P_DATA) {
+            size_t n = MIN(len, d.data_left);
+
+            err = emit(buf, n);
+            buf += n;
+            len -= n;
+            d.data_left -= n;
+            if (!err && d.data_left == 0) {
+                next_op();
+            }
+            continue;
+        }
+
+        /* Header or op bytes: gather until the record is complete */
+        size_t n = MIN(len, d.acc_need - d.acc_len);
+
+        memcpy(d.acc + d.acc_len, buf, n);
+        d.acc_len += n;
+        buf += n;
+        len -= n;
+
+        if (d.ps == P_OP && d.acc_len == 1) {
+            if (d.acc[0] == FOTA_DELTA_OP_COPY) {
+                d.acc_need = OP_COPY_LEN;
+            } else if (d.acc[0] == FOTA_DELTA_OP_DATA) {
+                d.acc_need = OP_DATA_LEN;
+            } else {
+                err = -EBADMSG;
+            }
+            continue;
+        }
+        if (d.acc_len < d.acc_need) {
+            continue;
+        }
+
+        if (d.ps == P_HDR) {
+            err = parse_header();
+            if (!err) {
+                next_op();
+            }
+        } else {
+            err = run_op();
+            if (!err && d.ps == P_OP) {
+                next_op();
+            }
+        }
+    }
+    return err;
+}
+
+int fota_delta_finish(void)
+{
+    uint8_t digest[DIGEST_LEN];
+    size_t out_len;
+    int err;
+
+    if (!d.open) {
+        return -EACCES;
+    }
+    if (d.ps != P_DONE) {
+        printk("Delta patch ended early: %u of %u bytes\n", d.out, d.dst_size);
+        fota_delta_abort();
+        return -EBADMSG;
+    }
+
+    if (psa_hash_finish(&d.hash, digest, sizeof(digest), &out_len) != PSA_SUCCESS ||
+        memcmp(digest, d.dst_sha256, DIGEST_LEN)) {
+        printk("Delta output hash mismatch\n");
+        fota_delta_abort();
+        return -EBADMSG;
+    }
+
+    d.open = false;
+    flash_area_close(d.src);
+
+    err = dfu_target_done(true);
+    if (!err) {
+        err = dfu_target_schedule_update(0);
+    }
+    if (err) {
+        dfu_target_reset();
+    }
+    return err;
+}
+
+void fota_delta_abort(void)
+{
+    if (!d.open) {
+        return;
+    }
+    d.open = false;
+    psa_hash_abort(&d.hash);
+    flash_area_close(d.src);
+    dfu_target_reset();
+}
@@ -0,0 +1,40 @@
+#ifndef FOTA_DELTA_H
+#define FOTA_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Delta FOTA images. A patch rebuilds the target MCUboot image from the one
+ * running in slot0, streamed straight into the secondary slot through
+ * dfu_target, so neither the patch nor the image is ever held in RAM.
+ * Produced by scripts/fota_delta.py. All integers are little-endian.
+ *
+ *   header: magic "FDL1", src_size u32, dst_size u32, reserved u32,
+ *           src_sha256[32], dst_sha256[32]
+ *   op 'C': src_off u32, len u32    copy len bytes of slot0 from src_off
+ *   op 'D': len u32, data[len]      literal bytes
+ *
+ * Ops run until dst_size bytes are produced; trailing bytes are an error.
+ * The source must hash to src_sha256 before anything is written, and the
+ * output must hash to dst_sha256 (and the manifest's sha256) before the
+ * image is marked for upgrade.
+ */
+#define FOTA_DELTA_MAGIC        0x314C4446u   /* "FDL1" */
+#define FOTA_DELTA_HDR_LEN      80
+#define FOTA_DELTA_OP_COPY      'C'
+#define FOTA_DELTA_OP_DATA      'D'
+
+/* Start a patch for an image of dst_size bytes hashing to dst_sha256; erases the secondary slot */
+int fota_delta_begin(const uint8_t *dst_sha256, uint32_t dst_size);
+
+/* Feed the next patch bytes; -EBADMSG for a malformed patch, -ESTALE if slot0 is not the base */
+int fota_delta_write(const uint8_t *buf, size_t len);
+
+/* Check the output is complete and matches, then close the slot; aborts on failure */
+int fota_delta_finish(void);
+
+/* Drop a partial image; safe to call when no patch is open */
+void fota_delta_abort(void);
+
+#endif /* FOTA_DELTA_H */
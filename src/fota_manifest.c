@@ -0,0 +1,84 @@
+#include "fota_manifest.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/sys/util.h>
+
+int fota_version_parse(const char *s, struct mcuboot_img_sem_ver *ver)
+{
+    unsigned int maj, min, rev, build = 0;
+
+    if (sscanf(s, "%u.%u.%u+%u", &maj, &min, &rev, &build) < 3 ||
+        maj > UINT8_MAX || min > UINT8_MAX || rev > UINT16_MAX) {
+        return -EBADMSG;
+    }
+    ver->major = maj;
+    ver->minor = min;
+    ver->revision = rev;
+    ver->build_num = build;
+    return 0;
+}
+
+int fota_manifest_parse(char *text, struct fota_manifest *m)
+{
+    bool have_ver = false, have_size = false, have_hash = false;
+    bool have_from = false, have_delta = false;
+    char *save;
+
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        size_t n = strlen(line);
+
+        if (n && line[n - 1] == '\r') {
+            line[--n] = '\0';
+        }
+
+        if (strncmp(line, "version=", 8) == 0) {
+            if (fota_version_parse(line + 8, &m->ver)) {
+                return -EBADMSG;
+            }
+            have_ver = true;
+        } else if (strncmp(line, "delta_from=", 11) == 0) {
+            have_from = (fota_version_parse(line + 11, &m->delta_from) == 0);
+        } else if (strncmp(line, "delta=", 6) == 0) {
+            /* A bare file name; the patch lives next to the image */
+            have_delta = (n > 6 && n - 6 < sizeof(m->delta_file) && !strchr(line + 6, '/'));
+            if (have_delta) {
+                strcpy(m->delta_file, line + 6);
+            }
+        } else if (strncmp(line, "size=", 5) == 0) {
+            char *end;
+
+            m->size = strtoul(line + 5, &end, 10);
+            have_size = (end != line + 5 && m->size > 0);
+        } else if (strncmp(line, "sha256=", 7) == 0) {
+            have_hash = (n - 7 == 2 * sizeof(m->sha256)) &&
+                        hex2bin(line + 7, n - 7, m->sha256, sizeof(m->sha256)) == sizeof(m->sha256);
+        }
+    }
+
+    m->has_delta = have_from && have_delta;
+    return (have_ver && have_size && have_hash) ? 0 : -EBADMSG;
+}
+
+int fota_ver_cmp(const struct mcuboot_img_sem_ver *a, const struct mcuboot_img_sem_ver *b)
+{
+    if (a->major != b->major) {
+        return a->major < b->major ? -1 : 1;
+    }
+    if (a->minor != b->minor) {
+        return a->minor < b->minor ? -1 : 1;
+    }
+    if (a->revision != b->revision) {
+        return a->revision < b->revision ? -1 : 1;
+    }
+    if (a->build_num != b->build_num) {
+        return a->build_num < b->build_num ? -1 : 1;
+    }
+    return 0;
+}
+
+bool fota_manifest_is_newer(const struct fota_manifest *m, const struct mcuboot_img_sem_ver *running)
+{
+    return fota_ver_cmp(&m->ver, running) > 0;
+}
@@ -0,0 +1,46 @@
+#ifndef FOTA_MANIFEST_H
+#define FOTA_MANIFEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/dfu/mcuboot.h>
+
+/*
+ * manifest.txt, published next to the image, one key per line:
+ *   version=<major>.<minor>.<revision>+<build>
+ *   size=<image bytes>
+ *   sha256=<64 hex digits>
+ * and optionally a delta patch (see fota_delta.h) from one older version:
+ *   delta_from=<major>.<minor>.<revision>+<build>
+ *   delta=<patch file name, same directory>
+ * Unknown keys are ignored so the format can grow. Kept apart from fota.c
+ * so tests/fota_manifest can run it on native_sim.
+ */
+#define FOTA_DELTA_NAME_MAX 64
+
+struct fota_manifest {
+    struct mcuboot_img_sem_ver ver;
+    uint32_t size;
+    uint8_t sha256[32];
+    bool has_delta;
+    struct mcuboot_img_sem_ver delta_from;
+    char delta_file[FOTA_DELTA_NAME_MAX];
+};
+
+/* "<major>.<minor>.<revision>[+<build>]"; -EBADMSG if malformed or out of range */
+int fota_version_parse(const char *s, struct mcuboot_img_sem_ver *ver);
+
+/*
+ * Parse text in place (lines are split with strtok_r). -EBADMSG unless
+ * version, size and sha256 are all present and valid. has_delta is set only
+ * when both delta keys are valid; a bad delta never fails the manifest.
+ */
+int fota_manifest_parse(char *text, struct fota_manifest *m);
+
+/* <0, 0 or >0 as a is older than, equal to or newer than b, build number included */
+int fota_ver_cmp(const struct mcuboot_img_sem_ver *a, const struct mcuboot_img_sem_ver *b);
+
+/* Download only a strictly newer image: equal or older is up to date */
+bool fota_manifest_is_newer(const struct fota_manifest *m, const struct mcuboot_img_sem_ver *running);
+
+#endif /* FOTA_MANIFEST_H */
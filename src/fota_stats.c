@@ -0,0 +1,259 @@
+#include "fota_stats.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/stats/stats.h>
+
+STATS_SECT_START(fota)
+STATS_SECT_ENTRY32(checks)
+STATS_SECT_ENTRY32(check_fail)
+STATS_SECT_ENTRY32(interval_s)
+STATS_SECT_ENTRY32(backoff_s)
+STATS_SECT_ENTRY32(next_check_s)
+STATS_SECT_ENTRY32(dl_started)
+STATS_SECT_ENTRY32(dl_done)
+STATS_SECT_ENTRY32(dl_failed)
+STATS_SECT_ENTRY32(dl_retries)
+STATS_SECT_ENTRY32(bytes_total)
+STATS_SECT_ENTRY32(dl_bytes)
+STATS_SECT_ENTRY32(dl_ms)
+STATS_SECT_ENTRY32(dl_bps)
+STATS_SECT_ENTRY32(frags)
+STATS_SECT_ENTRY32(frag_min)
+STATS_SECT_ENTRY32(frag_max)
+STATS_SECT_ENTRY32(frag_avg)
+STATS_SECT_ENTRY32(wr_bytes)
+STATS_SECT_ENTRY32(wr_stall_ms)
+STATS_SECT_ENTRY32(wr_max_us)
+STATS_SECT_ENTRY32(erase_wait_ms)
+STATS_SECT_ENTRY32(t_idle_s)
+STATS_SECT_ENTRY32(t_conn_s)
+STATS_SECT_ENTRY32(t_check_s)
+STATS_SECT_ENTRY32(t_current_s)
+STATS_SECT_ENTRY32(t_retry_s)
+STATS_SECT_ENTRY32(t_dl_s)
+STATS_SECT_ENTRY32(t_pending_s)
+STATS_SECT_ENTRY32(t_apply_s)
+STATS_SECT_END;
+
+STATS_SECT_DECL(fota) fota_stats;
+
+STATS_NAME_START(fota)
+STATS_NAME(fota, checks)
+STATS_NAME(fota, check_fail)
+STATS_NAME(fota, interval_s)
+STATS_NAME(fota, backoff_s)
+STATS_NAME(fota, next_check_s)
+STATS_NAME(fota, dl_started)
+STATS_NAME(fota, dl_done)
+STATS_NAME(fota, dl_failed)
+STATS_NAME(fota, dl_retries)
+STATS_NAME(fota, bytes_total)
+STATS_NAME(fota, dl_bytes)
+STATS_NAME(fota, dl_ms)
+STATS_NAME(fota, dl_bps)
+STATS_NAME(fota, frags)
+STATS_NAME(fota, frag_min)
+STATS_NAME(fota, frag_max)
+STATS_NAME(fota, frag_avg)
+STATS_NAME(fota, wr_bytes)
+STATS_NAME(fota, wr_stall_ms)
+STATS_NAME(fota, wr_max_us)
+STATS_NAME(fota, erase_wait_ms)
+STATS_NAME(fota, t_idle_s)
+STATS_NAME(fota, t_conn_s)
+STATS_NAME(fota, t_check_s)
+STATS_NAME(fota, t_current_s)
+STATS_NAME(fota, t_retry_s)
+STATS_NAME(fota, t_dl_s)
+STATS_NAME(fota, t_pending_s)
+STATS_NAME(fota, t_apply_s)
+STATS_NAME_END(fota);
+
+static const char *const state_names[FOTA_STATE_COUNT] = {
+    [FOTA_STATE_IDLE] = "idle",
+    [FOTA_STATE_CONNECTED] = "connected",
+    [FOTA_STATE_UPDATE_CHECK] = "check",
+    [FOTA_STATE_UP_TO_DATE] = "up-to-date",
+    [FOTA_STATE_RETRY_WAIT] = "retry-wait",
+    [FOTA_STATE_UPDATE_DOWNLOAD] = "download",
+    [FOTA_STATE_UPDATE_PENDING] = "pending",
+    [FOTA_STATE_UPDATE_APPLY] = "apply",
+};
+
+static enum fota_state cur_state = FOTA_STATE_IDLE;
+static int64_t state_since;
+static uint64_t state_ms[FOTA_STATE_COUNT];
+
+/* Last download session; bytes and fragments are counted only while one is open */
+static struct {
+    bool open;
+    int64_t start_ms;
+    uint32_t ms;
+    uint32_t bytes;
+    uint32_t retries;
+    uint32_t written;
+    uint32_t frags;
+    uint32_t frag_min;
+    uint32_t frag_max;
+    uint64_t write_us;
+    uint32_t write_max_us;
+    uint64_t erase_wait_us;
+} dl;
+
+int fota_stats_init(void)
+{
+    state_since = k_uptime_get();
+
+    return stats_init_and_reg(STATS_HDR(fota_stats),
+                              STATS_SIZE_INIT_PARMS(fota_stats, STATS_SIZE_32),
+                              STATS_NAME_INIT_PARMS(fota), "fota");
+}
+
+static uint32_t state_secs(enum fota_state st)
+{
+    return (uint32_t)(state_ms[st] / MSEC_PER_SEC);
+}
+
+void fota_stats_state(enum fota_state st)
+{
+    int64_t now = k_uptime_get();
+
+    state_ms[cur_state] += now - state_since;
+    state_since = now;
+    cur_state = st;
+
+    STATS_SET(fota_stats, t_idle_s, state_secs(FOTA_STATE_IDLE));
+    STATS_SET(fota_stats, t_conn_s, state_secs(FOTA_STATE_CONNECTED));
+    STATS_SET(fota_stats, t_check_s, state_secs(FOTA_STATE_UPDATE_CHECK));
+    STATS_SET(fota_stats, t_current_s, state_secs(FOTA_STATE_UP_TO_DATE));
+    STATS_SET(fota_stats, t_retry_s, state_secs(FOTA_STATE_RETRY_WAIT));
+    STATS_SET(fota_stats, t_dl_s, state_secs(FOTA_STATE_UPDATE_DOWNLOAD));
+    STATS_SET(fota_stats, t_pending_s, state_secs(FOTA_STATE_UPDATE_PENDING));
+    STATS_SET(fota_stats, t_apply_s, state_secs(FOTA_STATE_UPDATE_APPLY));
+}
+
+void fota_stats_check(bool failed)
+{
+    STATS_INC(fota_stats, checks);
+    if (failed) {
+        STATS_INC(fota_stats, check_fail);
+    }
+}
+
+void fota_stats_schedule(uint32_t interval_s, uint32_t backoff_s, uint32_t next_check_s)
+{
+    STATS_SET(fota_stats, interval_s, interval_s);
+    STATS_SET(fota_stats, backoff_s, backoff_s);
+    STATS_SET(fota_stats, next_check_s, next_check_s);
+}
+
+void fota_stats_dl_begin(void)
+{
+    dl.open = true;
+    dl.start_ms = k_uptime_get();
+    dl.ms = 0;
+    dl.bytes = 0;
+    dl.retries = 0;
+    dl.written = 0;
+    dl.frags = 0;
+    dl.frag_min = UINT32_MAX;
+    dl.frag_max = 0;
+    dl.write_us = 0;
+    dl.write_max_us = 0;
+    dl.erase_wait_us = 0;
+
+    STATS_INC(fota_stats, dl_started);
+}
+
+void fota_stats_dl_end(bool ok)
+{
+    if (!dl.open) {
+        return;
+    }
+    dl.open = false;
+    dl.ms = (uint32_t)(k_uptime_get() - dl.start_ms);
+    if (ok) {
+        STATS_INC(fota_stats, dl_done);
+    } else {
+        STATS_INC(fota_stats, dl_failed);
+    }
+
+    STATS_SET(fota_stats, dl_ms, dl.ms);
+    STATS_SET(fota_stats, dl_bps, dl.ms ? (uint32_t)((uint64_t)dl.bytes * MSEC_PER_SEC / dl.ms) : 0);
+    STATS_SET(fota_stats, frag_min, dl.frags ? dl.frag_min : 0);
+    STATS_SET(fota_stats, frag_avg, dl.frags ? dl.written / dl.frags : 0);
+    STATS_SET(fota_stats, wr_stall_ms, (uint32_t)(dl.write_us / USEC_PER_MSEC));
+    STATS_SET(fota_stats, erase_wait_ms, (uint32_t)(dl.erase_wait_us / USEC_PER_MSEC));
+}
+
+void fota_stats_rx(size_t len)
+{
+    if (!dl.open) {
+        return;
+    }
+
+    dl.bytes += len;
+    STATS_SET(fota_stats, dl_bytes, dl.bytes);
+    STATS_INCN(fota_stats, bytes_total, len);
+}
+
+void fota_stats_retry(void)
+{
+    if (!dl.open) {
+        return;
+    }
+
+    dl.retries++;
+    STATS_INC(fota_stats, dl_retries);
+}
+
+void fota_stats_fragment(size_t len, uint32_t write_us, uint32_t erase_wait_us)
+{
+    if (!dl.open) {
+        return;
+    }
+
+    dl.frags++;
+    dl.written += len;
+    dl.frag_min = MIN(dl.frag_min, (uint32_t)len);
+    dl.frag_max = MAX(dl.frag_max, (uint32_t)len);
+    dl.write_us += write_us;
+    dl.write_max_us = MAX(dl.write_max_us, write_us);
+    dl.erase_wait_us += erase_wait_us;
+
+    STATS_SET(fota_stats, frags, dl.frags);
+    STATS_SET(fota_stats, wr_bytes, dl.written);
+    STATS_SET(fota_stats, frag_max, dl.frag_max);
+    STATS_SET(fota_stats, wr_max_us, dl.write_max_us);
+}
+
+void fota_stats_print(const struct shell *sh)
+{
+    int64_t now = k_uptime_get();
+    uint32_t ms = dl.open ? (uint32_t)(now - dl.start_ms) : dl.ms;
+
+    shell_print(sh, "State: %s for %u s", state_names[cur_state],
+                (uint32_t)((now - state_since) / MSEC_PER_SEC));
+    shell_print(sh, "Checks: %u (%u failed)", fota_stats.checks, fota_stats.check_fail);
+    shell_print(sh, "Downloads: %u started, %u done, %u failed, %u retries, %u bytes total",
+                fota_stats.dl_started, fota_stats.dl_done, fota_stats.dl_failed,
+                fota_stats.dl_retries, fota_stats.bytes_total);
+
+    if (fota_stats.dl_started) {
+        shell_print(sh, "%s download: %u bytes received in %u ms (%u B/s), %u retries",
+                    dl.open ? "Current" : "Last", dl.bytes, ms,
+                    ms ? (uint32_t)((uint64_t)dl.bytes * MSEC_PER_SEC / ms) : 0, dl.retries);
+        shell_print(sh, "Fragments: %u, size min/avg/max %u/%u/%u",
+                    dl.frags, dl.frags ? dl.frag_min : 0,
+                    dl.frags ? dl.written / dl.frags : 0, dl.frag_max);
+        shell_print(sh, "Flash write: %u bytes, %u ms total, longest %u us, %u ms waiting for erase",
+                    dl.written, (uint32_t)(dl.write_us / USEC_PER_MSEC), dl.write_max_us,
+                    (uint32_t)(dl.erase_wait_us / USEC_PER_MSEC));
+    }
+
+    for (int i = 0; i < FOTA_STATE_COUNT; i++) {
+        uint64_t t = state_ms[i] + (i == cur_state ? now - state_since : 0);
+
+        shell_print(sh, "  %-11s %u s", state_names[i], (uint32_t)(t / MSEC_PER_SEC));
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef FOTA_STATS_H
+#define FOTA_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/shell/shell.h>
+#include "fota.h"
+
+/*
+ * FOTA metrics, published as the "fota" STATS group (MCUmgr stat group) and
+ * by "fota status". Download figures describe the last download session.
+ * Received bytes and retries come from the HTTP downloader (fota.c); fragment
+ * sizes and flash-write stalls are reported by the secondary-slot writer
+ * (fota_writer.c), which sees every dfu_target_write() call. The two differ
+ * for a delta update, where the writer sees the patched image.
+ */
+
+int fota_stats_init(void);
+
+/* State machine transition; accumulates time spent in the state being left */
+void fota_stats_state(enum fota_state st);
+
+void fota_stats_check(bool failed);
+void fota_stats_schedule(uint32_t interval_s, uint32_t backoff_s, uint32_t next_check_s);
+
+void fota_stats_dl_begin(void);
+void fota_stats_dl_end(bool ok);
+
+/* Bytes received from the server in the open session */
+void fota_stats_rx(size_t len);
+
+/* The downloader reconnects after a socket error and resumes with a range request */
+void fota_stats_retry(void);
+
+/* One dfu_target_write(): total time in the call and the part spent waiting for erases */
+void fota_stats_fragment(size_t len, uint32_t write_us, uint32_t erase_wait_us);
+
+void fota_stats_print(const struct shell *sh);
+
+#endif /* FOTA_STATS_H */
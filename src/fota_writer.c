@@ -0,0 +1,486 @@
+#include "config.h"
+#include "fota_writer.h"
+#include "fota_stats.h"
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/storage/flash_map.h>
+#include <dfu/dfu_target.h>
+#include <psa/crypto.h>
+
+#define PAGE    FLASH_PAGE_SIZE
+
+static struct k_work_q erase_wq;
+static K_THREAD_STACK_DEFINE(erase_stack, FOTA_ERASE_STACK_SIZE);
+static struct k_work erase_work;
+static K_MUTEX_DEFINE(w_lock);
+static K_SEM_DEFINE(erase_progress, 0, 1);
+
+static uint32_t ahead_pages = FOTA_ERASE_AHEAD_PAGES;
+
+/* Offsets are relative to the secondary slot; [0, erased_end) may be programmed */
+static struct {
+    bool active;
+    const struct flash_area *fa;
+    uint32_t pos;
+    uint32_t erased_end;
+    uint32_t want_end;
+    int err;
+} w;
+
+static uint8_t page_buf[PAGE];
+
+/* Expected image for the next session, armed by fota_writer_expect() */
+static struct {
+    bool armed;
+    bool running;
+    uint32_t size;
+    uint8_t sha256[32];
+    psa_hash_operation_t hash;
+} v;
+
+/* Checkpoint the next session may resume from, set by fota_writer_resume_from() */
+static struct {
+    uint32_t offset;
+    uint8_t prefix_sha256[32];
+    bool hold;
+} resume;
+
+static void erase_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    for (;;) {
+        k_mutex_lock(&w_lock, K_FOREVER);
+        if (!w.active || w.err || w.erased_end >= w.want_end) {
+            k_mutex_unlock(&w_lock);
+            break;
+        }
+        uint32_t off = w.erased_end;
+        const struct flash_area *fa = w.fa;
+        k_mutex_unlock(&w_lock);
+
+        int err = flash_area_erase(fa, off, PAGE);
+
+        k_mutex_lock(&w_lock, K_FOREVER);
+        if (err) {
+            w.err = err;
+        } else if (w.active && w.erased_end == off) {
+            w.erased_end = off + PAGE;
+        }
+        k_mutex_unlock(&w_lock);
+        k_sem_give(&erase_progress);
+    }
+}
+
+/* Let the eraser run up to end (clamped to the slot) */
+static void erase_towards(uint32_t end)
+{
+    k_mutex_lock(&w_lock, K_FOREVER);
+    w.want_end = MAX(w.want_end, MIN(end, w.fa->fa_size));
+    k_mutex_unlock(&w_lock);
+    k_work_submit_to_queue(&erase_wq, &erase_work);
+}
+
+/* Block until [0, end) is erased; returns the time spent waiting */
+static int erase_until(uint32_t end, uint32_t *wait_us)
+{
+    uint32_t t0 = k_cycle_get_32();
+    int err = 0;
+
+    end = MIN(ROUND_UP(end, PAGE), w.fa->fa_size);
+
+    if (ahead_pages == 0) {
+        /* Inline mode, as with progressive erase: the write path erases */
+        while (!err && w.erased_end < end) {
+            err = flash_area_erase(w.fa, w.erased_end, PAGE);
+            if (!err) {
+                w.erased_end += PAGE;
+            }
+        }
+    } else {
+        erase_towards(end);
+        for (;;) {
+            k_mutex_lock(&w_lock, K_FOREVER);
+            bool ready = w.erased_end >= end;
+            err = w.err;
+            k_mutex_unlock(&w_lock);
+            if (ready || err) {
+                break;
+            }
+            if (k_sem_take(&erase_progress, K_MSEC(FOTA_ERASE_WAIT_MS))) {
+                err = -ETIMEDOUT;
+                break;
+            }
+        }
+    }
+
+    *wait_us = k_cyc_to_us_floor32(k_cycle_get_32() - t0);
+    return err;
+}
+
+static bool is_blank(const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void verify_stop(void)
+{
+    if (v.running) {
+        psa_hash_abort(&v.hash);
+        v.running = false;
+    }
+}
+
+/* Start hashing; a resumed session first hashes what earlier sessions wrote */
+static int verify_start(size_t file_size, uint32_t offset)
+{
+    verify_stop();
+    if (!v.armed) {
+        return 0;
+    }
+
+    if (file_size && file_size != v.size) {
+        printk("Image is %u bytes, manifest says %u\n", (unsigned int)file_size, v.size);
+        return -EMSGSIZE;
+    }
+    if (offset > v.size) {
+        return -EMSGSIZE;
+    }
+
+    v.hash = psa_hash_operation_init();
+    if (psa_hash_setup(&v.hash, PSA_ALG_SHA_256) != PSA_SUCCESS) {
+        return -EIO;
+    }
+    v.running = true;
+
+    for (uint32_t off = 0; off < offset; off += PAGE) {
+        size_t n = MIN(PAGE, offset - off);
+        int err = flash_area_read(w.fa, off, page_buf, n);
+
+        if (err) {
+            verify_stop();
+            return err;
+        }
+        if (psa_hash_update(&v.hash, page_buf, n) != PSA_SUCCESS) {
+            verify_stop();
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+static int verify_finish(void)
+{
+    uint8_t digest[32];
+    size_t out_len;
+    psa_status_t st;
+
+    if (!v.running) {
+        return 0;
+    }
+    v.running = false;
+
+    if (w.pos != v.size) {
+        psa_hash_abort(&v.hash);
+        printk("Image ended at %u bytes, manifest says %u\n", w.pos, v.size);
+        return -EMSGSIZE;
+    }
+    st = psa_hash_finish(&v.hash, digest, sizeof(digest), &out_len);
+    if (st != PSA_SUCCESS) {
+        return -EIO;
+    }
+    if (memcmp(digest, v.sha256, sizeof(digest))) {
+        printk("Image SHA-256 does not match the manifest\n");
+        return -EBADMSG;
+    }
+    printk("Image SHA-256 verified\n");
+    return 0;
+}
+
+static void writer_stop(void)
+{
+    verify_stop();
+
+    if (!w.active) {
+        return;
+    }
+    k_mutex_lock(&w_lock, K_FOREVER);
+    w.active = false;
+    k_mutex_unlock(&w_lock);
+
+    /* Let an erase in flight finish before the slot is handed back */
+    struct k_work_sync sync;
+    k_work_cancel_sync(&erase_work, &sync);
+    flash_area_close(w.fa);
+}
+
+/*
+ * verified is the end of the checkpoint a resumed session was accepted on.
+ * Pages below it are not erased again: their bytes are verified and the
+ * stream programs the same image bytes over them, so a reset during the
+ * session still finds the checkpoint intact.
+ */
+static int writer_start(size_t file_size, uint32_t verified)
+{
+    static bool started;
+    size_t offset = 0;
+    int err;
+
+    if (!started) {
+        struct k_work_queue_config cfg = { .name = "fota_erase" };
+
+        k_work_queue_start(&erase_wq, erase_stack, K_THREAD_STACK_SIZEOF(erase_stack),
+                           K_LOWEST_APPLICATION_THREAD_PRIO, &cfg);
+        k_work_init(&erase_work, erase_work_handler);
+        started = true;
+    }
+
+    writer_stop();
+
+    err = flash_area_open(FIXED_PARTITION_ID(slot1_partition), &w.fa);
+    if (err) {
+        return err;
+    }
+    if (dfu_target_offset_get(&offset)) {
+        offset = 0;
+    }
+
+    err = verify_start(file_size, offset);
+    if (err) {
+        flash_area_close(w.fa);
+        return err;
+    }
+
+    k_mutex_lock(&w_lock, K_FOREVER);
+    w.pos = offset;
+    w.erased_end = MIN(ROUND_UP(MAX(offset, verified), PAGE), w.fa->fa_size);
+    w.want_end = w.erased_end;
+    w.err = 0;
+    w.active = true;
+    k_mutex_unlock(&w_lock);
+    k_sem_reset(&erase_progress);
+
+    if (ahead_pages) {
+        erase_towards(w.erased_end + ahead_pages * PAGE);
+    }
+    return 0;
+}
+
+/*
+ * Saved progress is trusted only inside the checkpoint, and only while the
+ * slot still hashes to it. Saved progress can trail what was flushed, so the
+ * page holding the checkpoint end is never erased to clean it up: its tail
+ * past the checkpoint must still be blank, or the session starts over.
+ */
+static bool resume_allowed(size_t offset)
+{
+    const struct flash_area *fa;
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t digest[32];
+    size_t out_len;
+    psa_status_t st;
+    bool ok;
+
+    if (offset > resume.offset || flash_area_open(FIXED_PARTITION_ID(slot1_partition), &fa)) {
+        return false;
+    }
+
+    st = psa_hash_setup(&op, PSA_ALG_SHA_256);
+    for (uint32_t off = 0; st == PSA_SUCCESS && off < resume.offset; off += PAGE) {
+        size_t n = MIN(PAGE, resume.offset - off);
+
+        if (flash_area_read(fa, off, page_buf, n)) {
+            flash_area_close(fa);
+            psa_hash_abort(&op);
+            return false;
+        }
+        st = psa_hash_update(&op, page_buf, n);
+    }
+    if (st == PSA_SUCCESS) {
+        st = psa_hash_finish(&op, digest, sizeof(digest), &out_len);
+    }
+    psa_hash_abort(&op);
+    ok = st == PSA_SUCCESS && memcmp(digest, resume.prefix_sha256, sizeof(digest)) == 0;
+
+    uint32_t tail_end = MIN(ROUND_UP(resume.offset, PAGE), fa->fa_size);
+    if (ok && resume.offset < tail_end) {
+        size_t n = tail_end - resume.offset;
+
+        ok = !flash_area_read(fa, resume.offset, page_buf, n) && is_blank(page_buf, n);
+        if (!ok) {
+            printk("Page at 0x%x holds data past the checkpoint\n", ROUND_DOWN(resume.offset, PAGE));
+        }
+    }
+    flash_area_close(fa);
+    return ok;
+}
+
+int __real_dfu_target_init(int img_type, int img_num, size_t file_size, dfu_target_callback_t cb);
+int __real_dfu_target_write(const void *const buf, size_t len);
+int __real_dfu_target_done(bool successful);
+int __real_dfu_target_reset(void);
+
+int __wrap_dfu_target_init(int img_type, int img_num, size_t file_size, dfu_target_callback_t cb)
+{
+    int err = __real_dfu_target_init(img_type, img_num, file_size, cb);
+
+    uint32_t verified = 0;
+
+    resume.hold = false;
+    if (!err && img_type == DFU_TARGET_IMAGE_TYPE_MCUBOOT) {
+        size_t offset = 0;
+
+        /* fota_download asks for the saved progress right after this and resumes there */
+        if (!dfu_target_offset_get(&offset) && offset) {
+            if (resume_allowed(offset)) {
+                verified = resume.offset;
+                printk("Resuming at %u bytes, checkpoint of %u bytes verified\n",
+                       (unsigned int)offset, resume.offset);
+            } else {
+                printk("Saved progress of %u bytes is not covered by a valid checkpoint, restarting\n",
+                       (unsigned int)offset);
+                __real_dfu_target_reset();
+                err = __real_dfu_target_init(img_type, img_num, file_size, cb);
+            }
+        }
+        memset(&resume, 0, sizeof(resume));
+    }
+
+    if (!err && img_type == DFU_TARGET_IMAGE_TYPE_MCUBOOT) {
+        err = writer_start(file_size, verified);
+        if (err) {
+            printk("Secondary slot writer failed to start: %d\n", err);
+            __real_dfu_target_reset();
+        }
+    }
+    return err;
+}
+
+/* fota_download -> dfu_target_write() once per fragment */
+int __wrap_dfu_target_write(const void *const buf, size_t len)
+{
+    uint32_t wait_us = 0;
+    uint32_t t0 = k_cycle_get_32();
+    int err = 0;
+
+    if (w.active) {
+        /* Abort as soon as the stream outgrows the announced image */
+        if (v.running && len > v.size - w.pos) {
+            printk("Image exceeds the manifest size of %u bytes\n", v.size);
+            return -EMSGSIZE;
+        }
+        if (v.running && psa_hash_update(&v.hash, buf, len) != PSA_SUCCESS) {
+            return -EIO;
+        }
+
+        /* stream_flash never programs past what it has been given */
+        err = erase_until(w.pos + len, &wait_us);
+        if (!err) {
+            w.pos += len;
+            if (ahead_pages) {
+                erase_towards(ROUND_UP(w.pos, PAGE) + ahead_pages * PAGE);
+            }
+        }
+    }
+    if (!err) {
+        err = __real_dfu_target_write(buf, len);
+    }
+
+    fota_stats_fragment(len, k_cyc_to_us_floor32(k_cycle_get_32() - t0), wait_us);
+    return err;
+}
+
+int __wrap_dfu_target_done(bool successful)
+{
+    uint32_t wait_us;
+    int err;
+
+    /* The session ends here, not in a paused reset */
+    resume.hold = false;
+    if (successful && w.active) {
+        /* Never mark an image for upgrade that does not match the manifest */
+        err = verify_finish();
+        if (!err) {
+            /* The rest of the slot, so MCUboot's trailer can be written */
+            err = erase_until(w.fa->fa_size, &wait_us);
+        }
+        if (err) {
+            printk("Secondary slot not completed: %d\n", err);
+            writer_stop();
+            __real_dfu_target_reset();
+            return err;
+        }
+    }
+    writer_stop();
+    return __real_dfu_target_done(successful);
+}
+
+int __wrap_dfu_target_reset(void)
+{
+    bool hold = resume.hold;
+
+    resume.hold = false;
+    writer_stop();
+    if (hold) {
+        /* A paused download: close the session but keep the slot and its saved progress */
+        return __real_dfu_target_done(false);
+    }
+    return __real_dfu_target_reset();
+}
+
+/* fota.c marks the image for MCUboot itself, when its apply policy allows */
+int __wrap_dfu_target_schedule_update(int img_num)
+{
+    ARG_UNUSED(img_num);
+    return 0;
+}
+
+void fota_writer_expect(const uint8_t *sha256, uint32_t size)
+{
+    v.armed = (sha256 != NULL);
+    if (v.armed) {
+        memcpy(v.sha256, sha256, sizeof(v.sha256));
+        v.size = size;
+    }
+}
+
+void fota_writer_resume_from(uint32_t offset, const uint8_t *prefix_sha256)
+{
+    resume.offset = prefix_sha256 ? offset : 0;
+    if (resume.offset) {
+        memcpy(resume.prefix_sha256, prefix_sha256, sizeof(resume.prefix_sha256));
+    }
+}
+
+void fota_writer_pause(bool hold)
+{
+    /* Without an open session there is no reset to hold */
+    resume.hold = hold && w.active;
+}
+
+int fota_writer_set_ahead(uint32_t pages)
+{
+    if (w.active) {
+        return -EBUSY;
+    }
+    ahead_pages = pages;
+    return 0;
+}
+
+uint32_t fota_writer_get_ahead(void)
+{
+    return ahead_pages;
+}
+
+bool fota_writer_busy(void)
+{
+    return w.active;
+}
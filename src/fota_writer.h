@@ -0,0 +1,63 @@
+#ifndef FOTA_WRITER_H
+#define FOTA_WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Erase-ahead writer for the MCUboot secondary slot. dfu_target_init/write/
+ * done/reset are wrapped at link time (--wrap), so fota_download and the
+ * delta applier both go through it unchanged. With progressive erase off,
+ * stream_flash only programs; this module keeps FOTA_ERASE_AHEAD_PAGES pages
+ * past the write position erased from its own work queue, so page erases run
+ * while the downloader waits on the socket instead of inside a write. A write
+ * only waits when it catches up with the eraser. On completion the rest of
+ * the slot, including the MCUboot trailer, is erased before the image is
+ * marked for upgrade.
+ *
+ * fota_download resumes from the saved dfu_target progress. It is kept only
+ * if it lies inside the checkpoint set by fota_writer_resume_from() and the
+ * slot prefix still hashes to it; otherwise the target is reset and the
+ * session starts from 0, so a resume never builds on unverified bytes.
+ *
+ * Pages holding checkpointed bytes are never erased on resume. Where the
+ * saved progress trails the checkpoint, the stream programs the same image
+ * bytes over them again; pages past the checkpoint are erased as usual, and
+ * the tail of the page it ends in must still be blank.
+ *
+ * With an expected image armed, every written byte is also hashed (a resumed
+ * session first hashes the part already in the slot). A stream longer than
+ * the expected size is refused at once, and dfu_target_done(true) fails and
+ * drops the image unless size and SHA-256 match, so it is never scheduled.
+ *
+ * dfu_target_schedule_update() is a no-op: a completed image stays in the
+ * slot unmarked until fota.c requests the upgrade in its apply window.
+ */
+#define FOTA_ERASE_AHEAD_PAGES  4
+#define FOTA_ERASE_STACK_SIZE   1024
+#define FOTA_ERASE_WAIT_MS      5000
+
+/* Size and SHA-256 the next session must produce; NULL to stop checking */
+void fota_writer_expect(const uint8_t *sha256, uint32_t size);
+
+/*
+ * Checkpoint for the next session: saved progress up to offset is resumed if
+ * the slot prefix [0, offset) hashes to prefix_sha256. 0 or NULL allows none.
+ */
+void fota_writer_resume_from(uint32_t offset, const uint8_t *prefix_sha256);
+
+/*
+ * true: the reset in the next fota_download_cancel() keeps the slot and its
+ * saved progress. false drops that again, for when the cancel did not reach
+ * the reset, so a later failure still resets the target.
+ */
+void fota_writer_pause(bool hold);
+
+/* Pages kept erased ahead of the writer; 0 erases inline in the write path. -EBUSY mid-session */
+int fota_writer_set_ahead(uint32_t pages);
+uint32_t fota_writer_get_ahead(void);
+
+/* True while an MCUboot dfu_target session is open */
+bool fota_writer_busy(void);
+
+#endif /* FOTA_WRITER_H */
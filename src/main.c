@@ -13,9 +13,16 @@
 #include <stdlib.h>
 #include <tfm_ns_interface.h>
 #include "fota.h"
+#include "mqtt_pub.h"
 #include "enc.h"
 #include "test.h"
 #include "config.h"
+#include "cfg_maint.h"
+#include "cfg_stats.h"
+#include "cfg_settings.h"
+#include "cfg_mac.h"
+#include "cfg_rotate.h"
+#include "cred_prov.h"
 #include <zephyr/kernel.h>
 #include <zephyr/shell/shell.h>
 #include <zephyr/init.h>
@@ -25,8 +32,6 @@
 
 
 
-#define PBKDF2_ITERATIONS 64000u
-
 #define NRF_CRYPTO_EXAMPLE_HMAC_TEXT_SIZE (100)
 #define NRF_CRYPTO_EXAMPLE_HMAC_KEY_SIZE (32)
 #define SAMPLE_PERS_KEY_ID				PSA_KEY_ID_USER_MIN
@@ -89,11 +94,7 @@ static bool hex_to_bytes(const char*hex,size_t n,uint8_t*out,size_t*out_len){
 }
 
 static const ConfigEntry* find_entry(const char* key){
-    size_t klen=strlen(key);
-    for(int i=0;i<num_entries;i++){
-        if(entries[i].aad_len==klen && memcmp(entries[i].aad,key,klen)==0) return &entries[i];
-    }
-    return NULL;
+    return cfg_find_entry(key);
 }
 
 static int derive_pbkdf2_sha256(const uint8_t* pw,size_t pw_len,
@@ -119,22 +120,6 @@ done:
 
 
 
-static int provision_cert(enum modem_key_mgmt_cred_type type, const uint8_t *data, size_t data_len)
-{
-    printk("Provisioning certificate type %d...\n", type);
-    bool exists;
-    modem_key_mgmt_exists(TLS_SEC_TAG, type, &exists);
-    if (exists) { 
-        printk("Certificate type %d already exists.\n", type);
-        return 0;
-    }
-
-    printk("Writing certificate type %d...\n", type);
-    return modem_key_mgmt_write(TLS_SEC_TAG, type, data, data_len);
-}
-
-
-
 psa_status_t key_exists(psa_key_id_t key_id)
 {
     psa_status_t status;
@@ -164,12 +149,13 @@ int provision_all(void)
 		return err;
 	}
 
-	err = provision_cert(MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN, ca_cert, ca_cert_len);
-    printk("provision ca_cert: %d\n", err);
-    err = provision_cert(MODEM_KEY_MGMT_CRED_TYPE_PUBLIC_CERT, public_cert, public_cert_len);
-    printk("provision public_cert: %d\n", err);
-    err = provision_cert(MODEM_KEY_MGMT_CRED_TYPE_PRIVATE_CERT, private_key, private_key_len);
-    printk("provision private_key: %d\n", err);
+	const struct cred_item creds[] = {
+		{ MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN,     ca_cert,     ca_cert_len },
+		{ MODEM_KEY_MGMT_CRED_TYPE_PUBLIC_CERT,  public_cert, public_cert_len },
+		{ MODEM_KEY_MGMT_CRED_TYPE_PRIVATE_CERT, private_key, private_key_len },
+	};
+	err = cred_provision(TLS_SEC_TAG, creds, ARRAY_SIZE(creds));
+	printk("provision credentials: %d\n", err);
 
 	err = provision_config_data();
 	if (err) {
@@ -191,8 +177,22 @@ int main(void)
         provision_all();
         printk("Provisioning finished.\n");
 		k_sleep(K_MSEC(1000));
-		parse_encrypted_blob();
-        config_init();
+		cfg_stats_init();
+		/* One MAC pass decides whether the blob is trusted before any field is decrypted */
+		int mac = cfg_mac_check();
+		/* Fail closed: nothing loads, recovers or reseals an unauthenticated blob */
+		if (mac) {
+			cfg_stats_auth_failed();
+			printk("Config blob failed authentication (%d), not loading it\n", mac);
+		} else {
+			parse_encrypted_blob();
+			config_batch_recover();
+			cfg_rotate_init();
+			cfg_settings_init();
+			config_init();
+			cfg_maint_init();
+			cfg_rotate_resume();
+		}
 		
 
 		printf("Parsed %d config entries\n", num_entries);
@@ -209,6 +209,8 @@ int main(void)
         //test_pbkdf2_verify_from_blob_simple();
         k_sleep(K_MSEC(5000 * 1));
 		printk("INIT FOTA");
+		/* Before FOTA restores a pending update that could apply right away */
+		mqtt_pub_init();
 		fota_init_and_start();
 		printk("FOTA initialization complete.\n");
         return 0;
@@ -0,0 +1,83 @@
+#include "mqtt_pub.h"
+#include "fota.h"
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+
+static struct k_spinlock lock;
+static uint32_t queued;
+static uint32_t in_flight;
+
+static bool fota_apply_allowed(void)
+{
+    uint32_t q, f;
+
+    mqtt_pub_counts(&q, &f);
+    if (q || f) {
+        printk("MQTT busy: %u queued, %u awaiting acknowledgement\n", q, f);
+        return false;
+    }
+    return true;
+}
+
+void mqtt_pub_init(void)
+{
+    fota_set_apply_check(fota_apply_allowed);
+}
+
+void mqtt_pub_queued(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    queued++;
+    k_spin_unlock(&lock, key);
+}
+
+void mqtt_pub_sent(enum mqtt_qos qos, int err)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (queued) {
+        queued--;
+    }
+    if (!err && qos != MQTT_QOS_0_AT_MOST_ONCE) {
+        in_flight++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void mqtt_pub_acked(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    /* A duplicate acknowledgement must not hide a message still in flight */
+    if (in_flight) {
+        in_flight--;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void mqtt_pub_disconnected(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    queued += in_flight;
+    in_flight = 0;
+    k_spin_unlock(&lock, key);
+}
+
+void mqtt_pub_counts(uint32_t *queued_out, uint32_t *in_flight_out)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    *queued_out = queued;
+    *in_flight_out = in_flight;
+    k_spin_unlock(&lock, key);
+}
+
+bool mqtt_pub_idle(void)
+{
+    uint32_t q, f;
+
+    mqtt_pub_counts(&q, &f);
+    return !q && !f;
+}
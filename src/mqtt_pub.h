@@ -0,0 +1,33 @@
+#ifndef MQTT_PUB_H
+#define MQTT_PUB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/net/mqtt.h>
+
+/*
+ * Publish accounting for the MQTT client, and the FOTA apply check built on
+ * it: a pending update does not reboot the device while a message is queued
+ * or waiting for the broker. The client reports a message when it is queued,
+ * when mqtt_publish() has sent it, and when its PUBACK (QoS 1) or PUBCOMP
+ * (QoS 2) arrives. A QoS 0 message is done once sent.
+ */
+
+/* Registers the apply check; must run before fota_init_and_start() restores a pending update */
+void mqtt_pub_init(void);
+
+void mqtt_pub_queued(void);
+
+/* mqtt_publish() returned err; a failed message is dropped unless queued again */
+void mqtt_pub_sent(enum mqtt_qos qos, int err);
+
+/* MQTT_EVT_PUBACK or MQTT_EVT_PUBCOMP */
+void mqtt_pub_acked(void);
+
+/* Unacknowledged messages are published again after the reconnect: count them as queued */
+void mqtt_pub_disconnected(void);
+
+bool mqtt_pub_idle(void);
+void mqtt_pub_counts(uint32_t *queued, uint32_t *in_flight);
+
+#endif /* MQTT_PUB_H */
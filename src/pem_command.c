@@ -8,12 +8,14 @@
 #include <zephyr/net/mqtt.h>
 #include <zephyr/net/tls_credentials.h>
 #include <zephyr/random/random.h>
+#include <zephyr/sys/base64.h>
 #include <nrf_modem_at.h>
 #include <dk_buttons_and_leds.h>
 #include <modem/modem_key_mgmt.h>
 #include "shell_commands.h"
 #include "config.h"
 #include "fota.h"
+#include "cred_prov.h"
 #include <zephyr/shell/shell.h>
 
 
@@ -24,6 +26,9 @@ static int cmd_keymgmt_status(const struct shell *sh, size_t argc, char **argv);
 static int cmd_keymgmt_abort(const struct shell *sh, size_t argc, char **argv);
 static int cmd_keymgmt_print(const struct shell *sh, size_t argc, char **argv);
 static int cmd_keymgmt_delete(const struct shell *sh, size_t argc, char **argv);
+static int cmd_keymgmt_begin(const struct shell *sh, size_t argc, char **argv);
+static int cmd_keymgmt_chunk(const struct shell *sh, size_t argc, char **argv);
+static int cmd_keymgmt_commit(const struct shell *sh, size_t argc, char **argv);
 /* ... helpers, globals, etc ... */
 
 /* Subcommand table (file scope, not inside any function) */
@@ -43,6 +48,15 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_keymgmt,
     SHELL_CMD_ARG(delete, NULL,
         "Delete credential: keymgmt delete <sec_tag> <ca|cert|key>",
         cmd_keymgmt_delete, 3, 0),
+    SHELL_CMD_ARG(begin,  NULL,
+        "Start a chunked upload: keymgmt begin <sec_tag> <ca|cert|key> [der|pem]",
+        cmd_keymgmt_begin,  3, 1),
+    SHELL_CMD_ARG(chunk,  NULL,
+        "Append base64 data: keymgmt chunk <base64>",
+        cmd_keymgmt_chunk,  2, 0),
+    SHELL_CMD_ARG(commit, NULL,
+        "Convert and write the uploaded credential",
+        cmd_keymgmt_commit, 1, 0),
     SHELL_SUBCMD_SET_END
 );
 
@@ -56,6 +70,14 @@ static size_t g_len;
 static uint8_t g_buf[MAX_BLOB];  // Static buffer instead of pointer
 static bool g_active = false;    // Track if session is active
 
+/* Chunked upload (keymgmt begin/chunk/commit): decoded bytes accumulate in g_buf */
+static bool g_stream;            // Session was opened by 'begin'
+static bool g_der;               // Payload is DER, PEM-wrapped on commit
+static char g_carry[4];          // Base64 chars left over from the last chunk
+static size_t g_carry_len;
+static bool g_b64_end;           // Padding seen, no more data may follow
+static int64_t g_t0;
+
 static const char *type_to_str(enum modem_key_mgmt_cred_type t)
 {
 	switch (t) {
@@ -108,6 +130,9 @@ static void session_reset(void)
 	g_len = 0; 
 	g_tag = -1;
 	g_active = false;
+	g_stream = false;
+	g_carry_len = 0;
+	g_b64_end = false;
 }
 
 static int session_ensure(sec_tag_t tag, enum modem_key_mgmt_cred_type type)
@@ -119,7 +144,7 @@ static int session_ensure(sec_tag_t tag, enum modem_key_mgmt_cred_type type)
 		g_active = true;
 		return 0;
 	}
-	if (g_tag == tag && g_type == type) return 0;
+	if (!g_stream && g_tag == tag && g_type == type) return 0;
 	return -EBUSY;
 }
 
@@ -219,8 +244,9 @@ static int cmd_keymgmt_status(const struct shell *sh, size_t argc, char **argv)
 	if (!g_active) {
 		shell_print(sh, "IDLE");
 	} else {
-		shell_print(sh, "IN-PROGRESS tag=%d type=%s size=%u/%u",
-		            g_tag, type_to_str(g_type), (unsigned)g_len, (unsigned)MAX_BLOB);
+		shell_print(sh, "IN-PROGRESS tag=%d type=%s size=%u/%u%s",
+		            g_tag, type_to_str(g_type), (unsigned)g_len, (unsigned)MAX_BLOB,
+		            !g_stream ? "" : g_der ? " (chunked der)" : " (chunked pem)");
 	}
 	k_mutex_unlock(&g_lock);
 	return 0;
@@ -344,6 +370,9 @@ static int cmd_keymgmt_delete(const struct shell *sh, size_t argc, char **argv)
 	int ret = modem_key_mgmt_delete(tag, type);
 	if (ret == 0) {
 		shell_print(sh, "OK deleted tag=%d type=%s", tag, type_to_str(type));
+		if (cred_manifest_forget(tag, type)) {
+			shell_warn(sh, "Manifest not updated: boot will not restore the firmware copy");
+		}
 	} else if (ret == -ENOENT) {
 		shell_warn(sh, "Credential not found: tag=%d type=%s", tag, type_to_str(type));
 	} else {
@@ -352,4 +381,299 @@ static int cmd_keymgmt_delete(const struct shell *sh, size_t argc, char **argv)
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
+/* ---- Chunked upload ---------------------------------------------------- */
+
+#define PEM_LINE_LEN   64
+#define PEM_MAX_BLOCKS 8
+
+struct der_block {
+	size_t len;
+	const char *label;
+};
+
+/* Length of the DER element at p (header included), 0 if malformed */
+static size_t der_elem_len(const uint8_t *p, size_t avail, size_t *hdr)
+{
+	if (avail < 2) return 0;
+
+	size_t len = p[1];
+	size_t h = 2;
+	if (len & 0x80) {
+		size_t n = len & 0x7f;
+		if (n == 0 || n > 3 || avail < 2 + n) return 0;
+		len = 0;
+		for (size_t i = 0; i < n; i++) {
+			len = (len << 8) | p[2 + i];
+		}
+		h += n;
+	}
+	if (len > avail - h) return 0;
+	if (hdr) *hdr = h;
+	return h + len;
+}
+
+/* PKCS#8, SEC1 and PKCS#1 keys differ in what follows the version INTEGER */
+static const char *key_label(const uint8_t *p, size_t len)
+{
+	size_t h;
+
+	if (!der_elem_len(p, len, &h) || len < h + 4 || p[h] != 0x02 || p[h + 1] != 0x01) {
+		return NULL;
+	}
+	uint8_t version = p[h + 2];
+	uint8_t next = p[h + 3];
+
+	if (version == 0 && next == 0x30) return "PRIVATE KEY";
+	if (version == 0 && next == 0x02) return "RSA PRIVATE KEY";
+	if (version == 1 && next == 0x04) return "EC PRIVATE KEY";
+	return NULL;
+}
+
+/* Split der into top-level SEQUENCEs; certificates may be chained, keys are single */
+static int der_split(const uint8_t *der, size_t len, enum modem_key_mgmt_cred_type type,
+		     struct der_block *blk, size_t *n_blk)
+{
+	size_t off = 0, n = 0;
+
+	while (off < len) {
+		size_t el = (der[off] == 0x30) ? der_elem_len(der + off, len - off, NULL) : 0;
+		if (!el || n == PEM_MAX_BLOCKS) return -EBADMSG;
+
+		blk[n].len = el;
+		blk[n].label = "CERTIFICATE";
+		if (type == MODEM_KEY_MGMT_CRED_TYPE_PRIVATE_CERT) {
+			blk[n].label = key_label(der + off, el);
+			if (!blk[n].label || off + el != len) return -EBADMSG;
+		}
+		off += el;
+		n++;
+	}
+	*n_blk = n;
+	return n ? 0 : -EBADMSG;
+}
+
+static size_t pem_block_size(const struct der_block *b)
+{
+	size_t b64 = 4 * ((b->len + 2) / 3);
+	size_t lines = (b64 + PEM_LINE_LEN - 1) / PEM_LINE_LEN;
+
+	/* "-----BEGIN " label "-----\n" body "-----END " label "-----\n" */
+	return 11 + strlen(b->label) + 6 + b64 + lines + 9 + strlen(b->label) + 6;
+}
+
+static void put_str(size_t *w, const char *s)
+{
+	size_t n = strlen(s);
+	memcpy(g_buf + *w, s, n);
+	*w += n;
+}
+
+/*
+ * PEM-wrap the DER in g_buf[0..g_len) in place. The DER is moved to the end
+ * of g_buf and encoded from the front; the encoder never overtakes its input
+ * because the output only grows faster than the input while the total fits.
+ */
+static int der_to_pem(size_t *pem_len)
+{
+	struct der_block blk[PEM_MAX_BLOCKS];
+	size_t n_blk, total = 0;
+
+	int err = der_split(g_buf, g_len, g_type, blk, &n_blk);
+	if (err) return err;
+
+	for (size_t i = 0; i < n_blk; i++) {
+		total += pem_block_size(&blk[i]);
+	}
+	if (total > MAX_BLOB) return -EOVERFLOW;
+
+	size_t r = MAX_BLOB - g_len;
+	size_t w = 0;
+	memmove(g_buf + r, g_buf, g_len);
+
+	for (size_t i = 0; i < n_blk; i++) {
+		size_t end = r + blk[i].len;
+
+		put_str(&w, "-----BEGIN ");
+		put_str(&w, blk[i].label);
+		put_str(&w, "-----\n");
+		while (r < end) {
+			uint8_t line[PEM_LINE_LEN + 1];
+			size_t in = MIN(end - r, PEM_LINE_LEN / 4 * 3);
+			size_t olen;
+
+			if (base64_encode(line, sizeof(line), &olen, g_buf + r, in)) return -EINVAL;
+			r += in;
+			memcpy(g_buf + w, line, olen);
+			w += olen;
+			g_buf[w++] = '\n';
+		}
+		put_str(&w, "-----END ");
+		put_str(&w, blk[i].label);
+		put_str(&w, "-----\n");
+	}
+	*pem_len = w;
+	return 0;
+}
+
+/* Decode whole base64 quads from src into g_buf; a partial quad is carried over */
+static int b64_append(const char *src, size_t len)
+{
+	size_t olen;
+
+	if (len && g_b64_end) return -EINVAL;
+
+	while (len && g_carry_len) {
+		g_carry[g_carry_len++] = *src++;
+		len--;
+		if (g_carry_len == 4) {
+			if (base64_decode(g_buf + g_len, MAX_BLOB - g_len, &olen, (const uint8_t *)g_carry, 4)) return -EINVAL;
+			g_len += olen;
+			g_carry_len = 0;
+			/* Only a decoded quad that carries padding ends the stream */
+			g_b64_end = (g_carry[3] == '=');
+		}
+	}
+
+	if (len && g_b64_end) return -EINVAL;
+
+	size_t bulk = len & ~(size_t)3;
+	if (bulk) {
+		if (base64_decode(g_buf + g_len, MAX_BLOB - g_len, &olen, (const uint8_t *)src, bulk)) return -EINVAL;
+		g_len += olen;
+		g_b64_end = (src[bulk - 1] == '=');
+	}
+	if (bulk < len && g_b64_end) return -EINVAL;
+	for (size_t i = bulk; i < len; i++) {
+		g_carry[g_carry_len++] = src[i];
+	}
+	return 0;
+}
+
+/* keymgmt begin <sec_tag> <ca|cert|key> [der|pem] */
+static int cmd_keymgmt_begin(const struct shell *sh, size_t argc, char **argv)
+{
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	sec_tag_t tag = (sec_tag_t)strtol(argv[1], NULL, 10);
+	enum modem_key_mgmt_cred_type type;
+	if (!map_type(argv[2], &type)) {
+		shell_error(sh, "Unknown type: %s (use: ca|cert|key)", argv[2]);
+		return -EINVAL;
+	}
+
+	bool der = true;
+	if (argc > 3) {
+		if (!strcmp(argv[3], "pem")) {
+			der = false;
+		} else if (strcmp(argv[3], "der")) {
+			shell_error(sh, "Unknown format: %s (use: der|pem)", argv[3]);
+			return -EINVAL;
+		}
+	}
+
+	k_mutex_lock(&g_lock, K_FOREVER);
+	if (g_active) {
+		shell_error(sh, "Busy: in-progress tag=%d type=%s; finish or 'keymgmt abort'",
+		            g_tag, type_to_str(g_type));
+		k_mutex_unlock(&g_lock);
+		return -EBUSY;
+	}
+	session_ensure(tag, type);
+	g_stream = true;
+	g_der = der;
+	g_t0 = k_uptime_get();
+	k_mutex_unlock(&g_lock);
+
+	shell_print(sh, "READY tag=%d type=%s format=%s max=%u", tag, type_to_str(type),
+	            der ? "der" : "pem", (unsigned)MAX_BLOB);
+	return 0;
+}
+
+/* keymgmt chunk <base64> */
+static int cmd_keymgmt_chunk(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	int ret = 0;
+
+	k_mutex_lock(&g_lock, K_FOREVER);
+	if (!g_active || !g_stream) {
+		shell_error(sh, "No chunked upload; start with 'keymgmt begin'");
+		ret = -EINVAL;
+	} else {
+		ret = b64_append(argv[1], strlen(argv[1]));
+		if (ret) {
+			shell_error(sh, "Bad base64 or too big (> %u), upload aborted", MAX_BLOB);
+			session_reset();
+		} else {
+			shell_print(sh, "OK %u", (unsigned)g_len);
+		}
+	}
+	k_mutex_unlock(&g_lock);
+	return ret;
+}
+
+/* keymgmt commit */
+static int cmd_keymgmt_commit(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc); ARG_UNUSED(argv);
+	AUTH_TOUCH();
+	REQUIRE_AUTH(sh);
+
+	int ret = 0;
+	bool keep = false;
+	size_t out_len;
+
+	k_mutex_lock(&g_lock, K_FOREVER);
+	do {
+		if (!g_active || !g_stream) {
+			shell_error(sh, "No chunked upload; start with 'keymgmt begin'");
+			ret = -EINVAL;
+			break;
+		}
+		if (g_carry_len || g_len == 0) {
+			shell_error(sh, "Incomplete base64 (%u bytes, %u chars pending)",
+			            (unsigned)g_len, (unsigned)g_carry_len);
+			ret = -EINVAL;
+			keep = true;
+			break;
+		}
+
+		size_t in_len = g_len;
+		uint32_t t_up = (uint32_t)(k_uptime_get() - g_t0);
+
+		out_len = g_len;
+		if (g_der) {
+			ret = der_to_pem(&out_len);
+			if (ret) {
+				shell_error(sh, "DER conversion failed: %d", ret);
+				break;
+			}
+		}
+
+		int64_t t0 = k_uptime_get();
+		ret = modem_key_mgmt_write(g_tag, g_type, g_buf, out_len);
+		uint32_t t_w = (uint32_t)(k_uptime_get() - t0);
+		if (ret) {
+			shell_error(sh, "modem_key_mgmt_write err %d", ret);
+			break;
+		}
+
+		shell_print(sh, "OK wrote tag=%d type=%s (%u bytes in, %u bytes PEM)",
+		            g_tag, type_to_str(g_type), (unsigned)in_len, (unsigned)out_len);
+		shell_print(sh, "Upload %u ms (%u B/s), modem write %u ms",
+		            t_up, (unsigned)(t_up ? in_len * 1000 / t_up : in_len), t_w);
+	} while (0);
+
+	/* Either way the buffer may hold key material or a half-converted image */
+	if (g_active && g_stream && !keep) {
+		memset(g_buf, 0, sizeof(g_buf));
+		session_reset();
+	}
+	k_mutex_unlock(&g_lock);
+	return ret;
+}
@@ -0,0 +1,351 @@
+#include "config.h"
+#include "pw_verify.h"
+#include "cfg_maint.h"
+#include "shell_commands.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#include <psa/crypto.h>
+
+LOG_MODULE_REGISTER(pw_verify, LOG_LEVEL_INF);
+
+#define TAG_LEN     NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH
+#define REF_MAX     64
+
+static struct k_work_q pw_verify_wq;
+static K_THREAD_STACK_DEFINE(pw_verify_stack, PW_VERIFY_STACK_SIZE);
+static struct k_work job_work;
+
+enum job_op {
+    JOB_VERIFY,
+    JOB_REHASH,
+    JOB_CALIBRATE,
+};
+
+static atomic_t busy;
+static struct {
+    enum job_op op;
+    char pw[MAX_INPUT_LEN];
+    uint32_t arg;               /* iterations for REHASH, target ms for CALIBRATE */
+    pw_verify_cb_t verify_cb;
+    pw_result_cb_t result_cb;
+    void *user;
+} job;
+
+/*
+ * Decoded reference, kept only in this module. It is tied to the GCM tags of
+ * the blob records it was decoded from, so a changed reference is picked up
+ * on the next login without any explicit invalidation.
+ */
+static struct {
+    bool valid;
+    bool legacy;                /* decoded from the per-field keys */
+    uint8_t tags[3][TAG_LEN];   /* record, or salt/hash/iter; zero when not stored */
+    uint32_t iterations;
+    uint8_t salt[REF_MAX];
+    size_t salt_len;
+    uint8_t hash[REF_MAX];
+    size_t hash_len;
+} ref;
+
+/* Plaintext of the record being decoded, only touched on the work queue thread */
+static char text[12 + 2 * (2 * REF_MAX + 1)];
+
+static const char *const legacy_keys[] = { "pbkdf2.salt", "pbkdf2.hash", "pbkdf2.iter" };
+
+static int consttime_cmp(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= (uint8_t)(a[i] ^ b[i]);
+    return diff;  /* 0 == equal */
+}
+
+static int derive_pbkdf2_sha256(const uint8_t *pw, size_t pw_len,
+                                const uint8_t *salt, size_t salt_len,
+                                uint32_t iters,
+                                uint8_t *out, size_t out_len)
+{
+    psa_status_t st;
+    psa_key_derivation_operation_t op = PSA_KEY_DERIVATION_OPERATION_INIT;
+
+    st = psa_key_derivation_setup(&op, PSA_ALG_PBKDF2_HMAC(PSA_ALG_SHA_256)); if (st) goto done;
+    st = psa_key_derivation_input_integer(&op, PSA_KEY_DERIVATION_INPUT_COST, iters); if (st) goto done;
+    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_SALT, salt, salt_len); if (st) goto done;
+    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_PASSWORD, pw, pw_len); if (st) goto done;
+    st = psa_key_derivation_output_bytes(&op, out, out_len);
+done:
+    psa_key_derivation_abort(&op);
+    return (st == PSA_SUCCESS) ? 0 : -1;
+}
+
+static bool record_tag(const char *key, uint8_t *tag)
+{
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    const ConfigEntry *e = cfg_find_entry(key);
+    bool ok = e && cfg_entry_tag(e, tag) == 0;
+    k_mutex_unlock(&cfg_blob_lock);
+    return ok;
+}
+
+/* Decode a hex config value straight into out; returns the byte count or 0 */
+static size_t load_hex(const char *key, uint8_t *out, size_t out_size)
+{
+    const char *hex = get_config(key, text, sizeof(text));
+    if (!hex || strcmp(hex, "NULL") == 0) return 0;
+
+    return hex2bin(hex, strnlen(hex, 2 * out_size), out, out_size);
+}
+
+static bool decode_record(const char *val)
+{
+    char *end;
+
+    if (!val || !isdigit((unsigned char)val[0])) return false;
+
+    unsigned long n = strtoul(val, &end, 10);
+    const char *salt = end + 1;
+    const char *sep = (*end == ':') ? strchr(salt, ':') : NULL;
+    if (!sep || n == 0 || n > PBKDF2_MAX_ITERATIONS) return false;
+
+    ref.iterations = n;
+    ref.salt_len = hex2bin(salt, sep - salt, ref.salt, sizeof(ref.salt));
+    ref.hash_len = hex2bin(sep + 1, strlen(sep + 1), ref.hash, sizeof(ref.hash));
+    return ref.salt_len && ref.hash_len;
+}
+
+static bool decode_legacy(bool has_iter)
+{
+    ref.salt_len = load_hex("pbkdf2.salt", ref.salt, sizeof(ref.salt));
+    ref.hash_len = load_hex("pbkdf2.hash", ref.hash, sizeof(ref.hash));
+    if (ref.salt_len == 0 || ref.hash_len == 0) return false;
+
+    ref.iterations = PBKDF2_ITERATIONS;
+    if (has_iter) {
+        const char *val = get_config("pbkdf2.iter", text, sizeof(text));
+        unsigned long n = val ? strtoul(val, NULL, 10) : 0;
+        if (n == 0 || n > PBKDF2_MAX_ITERATIONS) return false;
+        ref.iterations = n;
+    }
+    return true;
+}
+
+static bool load_reference(void)
+{
+    uint8_t tags[3][TAG_LEN] = {0};
+    bool legacy = !record_tag(PBKDF2_REF_KEY, tags[0]);
+
+    if (legacy && (!record_tag("pbkdf2.salt", tags[0]) || !record_tag("pbkdf2.hash", tags[1]))) {
+        pw_verify_forget();
+        return false;
+    }
+    bool has_iter = legacy && record_tag("pbkdf2.iter", tags[2]);
+
+    if (ref.valid && ref.legacy == legacy && memcmp(ref.tags, tags, sizeof(tags)) == 0) {
+        return true;
+    }
+
+    pw_verify_forget();
+    bool ok = legacy ? decode_legacy(has_iter) :
+                       decode_record(get_config(PBKDF2_REF_KEY, text, sizeof(text)));
+    secure_memzero(text, sizeof(text));
+    if (!ok) {
+        LOG_ERR("Password reference %s is malformed", legacy ? "pbkdf2.salt/hash/iter" : PBKDF2_REF_KEY);
+        pw_verify_forget();
+        return false;
+    }
+
+    memcpy(ref.tags, tags, sizeof(tags));
+    ref.legacy = legacy;
+    ref.valid = true;
+    return true;
+}
+
+static bool check_password(const char *pw)
+{
+    uint8_t cand[REF_MAX];
+
+    if (!load_reference()) return false;
+
+    if (derive_pbkdf2_sha256((const uint8_t *)pw, strlen(pw),
+                             ref.salt, ref.salt_len, ref.iterations,
+                             cand, ref.hash_len) != 0) {
+        return false;
+    }
+
+    bool ok = (consttime_cmp(cand, ref.hash, ref.hash_len) == 0);
+    secure_memzero(cand, sizeof(cand));
+    return ok;
+}
+
+/* Iteration count that takes about target_ms here, scaled from one timed run */
+static int calibrate(uint32_t target_ms, uint32_t *iterations)
+{
+    static const uint8_t pw[] = "calibration";
+    uint8_t salt[PBKDF2_SALT_LEN] = {0};
+    uint8_t out[PBKDF2_HASH_LEN];
+
+    uint32_t t0 = k_cycle_get_32();
+    int err = derive_pbkdf2_sha256(pw, sizeof(pw) - 1, salt, sizeof(salt),
+                                   PBKDF2_CALIB_ITERATIONS, out, sizeof(out));
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - t0);
+    if (err) return -EIO;
+
+    uint64_t n = (uint64_t)PBKDF2_CALIB_ITERATIONS * target_ms * 1000U / MAX(us, 1U);
+    n = (n / 1000U) * 1000U;
+    *iterations = CLAMP(n, PBKDF2_MIN_ITERATIONS, PBKDF2_MAX_ITERATIONS);
+
+    LOG_INF("PBKDF2: %u iterations in %u us -> %u iterations for %u ms",
+            PBKDF2_CALIB_ITERATIONS, us, *iterations, target_ms);
+    return 0;
+}
+
+/*
+ * Salt, hash and cost go into the single PBKDF2_REF_KEY record, which the
+ * blob replaces atomically: a reset leaves either the old or the new
+ * reference. Per-field keys from older blobs are shadowed by it from then on
+ * and only erased afterwards.
+ */
+static int rehash(const char *pw, uint32_t *iterations)
+{
+    uint8_t salt[PBKDF2_SALT_LEN];
+    uint8_t hash[PBKDF2_HASH_LEN];
+    char salt_hex[2 * PBKDF2_SALT_LEN + 1];
+    char hash_hex[2 * PBKDF2_HASH_LEN + 1];
+    char rec[12 + sizeof(salt_hex) + sizeof(hash_hex)];
+    int err;
+
+    if (!check_password(pw)) return -EPERM;
+
+    if (*iterations == 0) {
+        err = calibrate(PBKDF2_TARGET_MS, iterations);
+        if (err) return err;
+    }
+
+    if (psa_generate_random(salt, sizeof(salt)) != PSA_SUCCESS) return -EIO;
+    if (derive_pbkdf2_sha256((const uint8_t *)pw, strlen(pw), salt, sizeof(salt),
+                             *iterations, hash, sizeof(hash)) != 0) {
+        return -EIO;
+    }
+
+    bin2hex(salt, sizeof(salt), salt_hex, sizeof(salt_hex));
+    bin2hex(hash, sizeof(hash), hash_hex, sizeof(hash_hex));
+    snprintk(rec, sizeof(rec), "%u:%s:%s", *iterations, salt_hex, hash_hex);
+    secure_memzero(hash, sizeof(hash));
+    secure_memzero(hash_hex, sizeof(hash_hex));
+
+    err = config_set(PBKDF2_REF_KEY, rec);
+    secure_memzero(rec, sizeof(rec));
+    for (int i = 0; !err && i < ARRAY_SIZE(legacy_keys); i++) {
+        int ret = config_erase(legacy_keys[i]);
+        if (ret && ret != -ENOENT) {
+            LOG_WRN("Erasing stale %s failed: %d", legacy_keys[i], ret);
+        }
+    }
+
+    pw_verify_forget();
+    if (err) {
+        LOG_ERR("Storing the new password hash failed: %d", err);
+    } else {
+        LOG_INF("Password re-hashed at %u iterations", *iterations);
+    }
+    return err;
+}
+
+static void job_work_handler(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    int64_t start = k_uptime_get();
+    uint32_t iterations = job.arg;
+    bool ok = false;
+    int err = 0;
+
+    switch (job.op) {
+    case JOB_VERIFY:
+        ok = check_password(job.pw);
+        break;
+    case JOB_REHASH:
+        err = rehash(job.pw, &iterations);
+        break;
+    case JOB_CALIBRATE:
+        err = calibrate(job.arg, &iterations);
+        break;
+    }
+    secure_memzero(job.pw, sizeof(job.pw));
+
+    LOG_DBG("PBKDF2 job %d took %lld ms", job.op, k_uptime_get() - start);
+
+    enum job_op op = job.op;
+    pw_verify_cb_t verify_cb = job.verify_cb;
+    pw_result_cb_t result_cb = job.result_cb;
+    void *user = job.user;
+    atomic_clear(&busy);
+
+    if (op == JOB_VERIFY) {
+        if (verify_cb) verify_cb(ok, user);
+    } else if (result_cb) {
+        result_cb(err, iterations, user);
+    }
+}
+
+static int submit(enum job_op op, const char *pw, uint32_t arg,
+                  pw_verify_cb_t verify_cb, pw_result_cb_t result_cb, void *user)
+{
+    if (pw && strlen(pw) >= sizeof(job.pw)) return -E2BIG;
+    if (!atomic_cas(&busy, 0, 1)) return -EBUSY;
+
+    job.op = op;
+    if (pw) {
+        strcpy(job.pw, pw);
+    }
+    job.arg = arg;
+    job.verify_cb = verify_cb;
+    job.result_cb = result_cb;
+    job.user = user;
+
+    k_work_submit_to_queue(&pw_verify_wq, &job_work);
+    return 0;
+}
+
+int pw_verify_submit(const char *pw, pw_verify_cb_t cb, void *user)
+{
+    if (!pw) return -EINVAL;
+    return submit(JOB_VERIFY, pw, 0, cb, NULL, user);
+}
+
+int pw_rehash_submit(const char *pw, uint32_t iterations, pw_result_cb_t cb, void *user)
+{
+    if (!pw) return -EINVAL;
+    if (iterations != 0 && (iterations < PBKDF2_MIN_ITERATIONS || iterations > PBKDF2_MAX_ITERATIONS)) {
+        return -EINVAL;
+    }
+    return submit(JOB_REHASH, pw, iterations, NULL, cb, user);
+}
+
+int pw_calibrate_submit(uint32_t target_ms, pw_result_cb_t cb, void *user)
+{
+    if (target_ms == 0) return -EINVAL;
+    return submit(JOB_CALIBRATE, NULL, target_ms, NULL, cb, user);
+}
+
+void pw_verify_forget(void)
+{
+    secure_memzero(&ref, sizeof(ref));
+}
+
+static int pw_verify_init(void)
+{
+    struct k_work_queue_config cfg = { .name = "pw_verify" };
+
+    k_work_queue_start(&pw_verify_wq, pw_verify_stack,
+                       K_THREAD_STACK_SIZEOF(pw_verify_stack),
+                       PW_VERIFY_PRIORITY, &cfg);
+    k_work_init(&job_work, job_work_handler);
+    return 0;
+}
+SYS_INIT(pw_verify_init, APPLICATION, 60);
@@ -0,0 +1,34 @@
+#ifndef PW_VERIFY_H
+#define PW_VERIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PW_VERIFY_STACK_SIZE  2048
+/* Low priority so the shell and MCUmgr threads preempt a running derivation */
+#define PW_VERIFY_PRIORITY    K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* Callbacks run on the crypto work queue thread once the job is done */
+typedef void (*pw_verify_cb_t)(bool ok, void *user);
+typedef void (*pw_result_cb_t)(int err, uint32_t iterations, void *user);
+
+/*
+ * Queue a PBKDF2 check of pw against the stored reference. The password
+ * is copied, so the caller's buffer can be reused immediately.
+ * Returns -EBUSY while a previous check is still running.
+ */
+int pw_verify_submit(const char *pw, pw_verify_cb_t cb, void *user);
+
+/*
+ * Re-hash pw (which must match the current hash) with a fresh salt and store
+ * it as one PBKDF2_REF_KEY record. iterations == 0 calibrates first.
+ */
+int pw_rehash_submit(const char *pw, uint32_t iterations, pw_result_cb_t cb, void *user);
+
+/* Time PBKDF2 on this device and report the count for target_ms, without storing it */
+int pw_calibrate_submit(uint32_t target_ms, pw_result_cb_t cb, void *user);
+
+/* Drop the decoded salt/hash held in RAM */
+void pw_verify_forget(void);
+
+#endif /* PW_VERIFY_H */
@@ -10,6 +10,12 @@
 #include <stdio.h>
 #include "encryption_helper.h"
 #include "config.h"
+#include "cfg_maint.h"
+#include "cfg_stats.h"
+#include "cfg_its.h"
+#include "cfg_mac.h"
+#include "cfg_rotate.h"
+#include "pw_verify.h"
 
 
 
@@ -27,6 +33,9 @@ LOG_MODULE_REGISTER(aes_gcm, LOG_LEVEL_DBG);
     } while (0)
 /* --- state --- */
 
+/* login_done() runs on the pw_verify work queue, the rest on the shell and auto-logout threads */
+static K_MUTEX_DEFINE(auth_lock);
+
 uint8_t  s_fail_count;
 
 int64_t  s_lock_until_ms;    
@@ -34,76 +43,6 @@ int64_t  s_lock_until_ms;
 int64_t  s_last_activity_ms; 
 bool     s_authed;
 
-static inline int consttime_cmp(const uint8_t *a, const uint8_t *b, size_t len) {
-    uint8_t diff = 0;
-    for (size_t i = 0; i < len; i++) diff |= (uint8_t)(a[i] ^ b[i]);
-    return diff;  /* 0 == equal */
-}
-
-static inline int derive_pbkdf2_sha256(const uint8_t *pw, size_t pw_len,
-                                       const uint8_t *salt, size_t salt_len,
-                                       uint32_t iters,
-                                       uint8_t *out, size_t out_len)
-{
-    psa_status_t st;
-    psa_key_derivation_operation_t op = PSA_KEY_DERIVATION_OPERATION_INIT;
-
-    st = psa_key_derivation_setup(&op, PSA_ALG_PBKDF2_HMAC(PSA_ALG_SHA_256)); if (st) goto done;
-    st = psa_key_derivation_input_integer(&op, PSA_KEY_DERIVATION_INPUT_COST, iters); if (st) goto done;
-    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_SALT, salt, salt_len); if (st) goto done;
-    st = psa_key_derivation_input_bytes(&op, PSA_KEY_DERIVATION_INPUT_PASSWORD, pw, pw_len); if (st) goto done;
-    st = psa_key_derivation_output_bytes(&op, out, out_len);
-done:
-    psa_key_derivation_abort(&op);
-    return (st == PSA_SUCCESS) ? 0 : -1;
-}
-
-
-static inline bool check_password(const char *pw)
-{
-    if (!pw) return false;
-
-    /* 1) COPY OUT the static results immediately */
-    char salt_hex[128];
-    char hash_hex[256];
-
-    const char *s_ptr = get_config("pbkdf2.salt");
-    if (!s_ptr) return false;
-    /* strnlen guard + copy with termination */
-    size_t s_len = strnlen(s_ptr, sizeof(salt_hex) - 1);
-    memcpy(salt_hex, s_ptr, s_len);
-    salt_hex[s_len] = '\0';
-
-    const char *h_ptr = get_config("pbkdf2.hash");
-    if (!h_ptr) return false;
-    size_t h_len = strnlen(h_ptr, sizeof(hash_hex) - 1);
-    memcpy(hash_hex, h_ptr, h_len);
-    hash_hex[h_len] = '\0';
-
-
-
-
-    /* 3) Hex -> bytes */
-    uint8_t salt[64], hash_ref[64], cand[64];
-    size_t salt_len = hex2bin(salt_hex, s_len, salt, sizeof(salt));
-    size_t hash_len = hex2bin(hash_hex, h_len, hash_ref, sizeof(hash_ref));
-    if (salt_len == 0 || hash_len == 0 || hash_len > sizeof(cand)) return false;
-
-
-    /* 4) Derive & compare */
-    if (derive_pbkdf2_sha256((const uint8_t *)pw, strlen(pw),
-                             salt, salt_len, PBKDF2_ITERATIONS,
-                             cand, hash_len) != 0) {
-        return false;
-    }
-
-
-    bool ok = (consttime_cmp(cand, hash_ref, hash_len) == 0);
-    memset(cand, 0, hash_len);
-    return ok;
-}
-
-
 #define REQUIRE_AUTH(sh) \
     do { if (!s_authed) { shell_error(sh, "Not authenticated."); return -EPERM; } } while (0)
 
@@ -113,33 +52,67 @@ static inline bool check_password(const char *pw)
 
 static inline void set_locked_state(const struct shell *sh)
 {
+    k_mutex_lock(&auth_lock, K_FOREVER);
     s_authed = false;
+    k_mutex_unlock(&auth_lock);
     shell_obscure_set(sh, true);               
     shell_prompt_change(sh, "login> ");         
 }
 
 static inline void set_unlocked_state(const struct shell *sh)
 {
+    k_mutex_lock(&auth_lock, K_FOREVER);
     s_authed = true;
     s_fail_count = 0;
     s_lock_until_ms = 0;
+    s_last_activity_ms = k_uptime_get();
+    k_mutex_unlock(&auth_lock);
     shell_obscure_set(sh, false);
     shell_prompt_change(sh, "dev> ");
-    s_last_activity_ms = k_uptime_get();
 }
 
 
+static void login_done(bool ok, void *user)
+{
+    const struct shell *sh = user;
+
+    if (ok) {
+        set_unlocked_state(sh);
+        shell_print(sh, "OK");
+        return;
+    }
+
+    k_mutex_lock(&auth_lock, K_FOREVER);
+    uint8_t fails = ++s_fail_count;
+    if (fails >= MAX_TRIES) {
+        s_lock_until_ms = k_uptime_get() + LOCKOUT_MS;
+        s_fail_count = 0;
+    }
+    k_mutex_unlock(&auth_lock);
+
+    if (fails >= MAX_TRIES) {
+        shell_error(sh, "Bad password. Locked for %d s.", LOCKOUT_MS/1000);
+    } else {
+        shell_error(sh, "Bad password. %u/%u attempt(s) used.", fails, MAX_TRIES);
+    }
+}
+
 static int cmd_login(const struct shell *sh, size_t argc, char **argv)
 {
     const int64_t now = k_uptime_get();
 
-    if (s_authed) {
+    k_mutex_lock(&auth_lock, K_FOREVER);
+    bool authed = s_authed;
+    int64_t lock_until = s_lock_until_ms;
+    k_mutex_unlock(&auth_lock);
+
+    if (authed) {
         shell_print(sh, "Already authenticated.");
         return 0;
     }
 
-    if (now < s_lock_until_ms) {
-        const int32_t left = (int32_t)(s_lock_until_ms - now);
+    if (now < lock_until) {
+        const int32_t left = (int32_t)(lock_until - now);
         shell_warn(sh, "Locked. Try again in %d.%03ds", left/1000, left%1000);
         return -EAGAIN;
     }
@@ -149,21 +122,19 @@ static int cmd_login(const struct shell *sh, size_t argc, char **argv)
         return -EINVAL;
     }
 
-    if (check_password(argv[1])) {
-        shell_print(sh, "OK");
-        set_unlocked_state(sh);
-        return 0;
+    int err = pw_verify_submit(argv[1], login_done, (void *)sh);
+    if (err == -EBUSY) {
+        shell_warn(sh, "Verification already in progress");
+        return err;
     }
-
-    s_fail_count++;
-    if (s_fail_count >= MAX_TRIES) {
-        s_lock_until_ms = now + LOCKOUT_MS;
-        s_fail_count = 0;
-        shell_error(sh, "Bad password. Locked for %d s.", LOCKOUT_MS/1000);
-    } else {
-        shell_error(sh, "Bad password. %u/%u attempt(s) used.", s_fail_count, MAX_TRIES);
+    if (err) {
+        shell_error(sh, "Login failed (err %d)", err);
+        return err;
     }
-    return -EPERM;
+
+    /* Result is printed by login_done() once the derivation finishes */
+    shell_print(sh, "Verifying...");
+    return 0;
 }
 
 static int cmd_logout(const struct shell *sh, size_t argc, char **argv)
@@ -181,12 +152,12 @@ static void auto_logout_thread(void)
     const struct shell *sh = shell_backend_uart_get_ptr();
     while (1) {
         k_sleep(K_SECONDS(1));
-        if (s_authed) {
-            int64_t now = k_uptime_get();
-            if (now - s_last_activity_ms >= AUTO_LOGOUT_MS) {
-                set_locked_state(sh);
-                shell_warn(sh, "Auto-logout after %d s inactivity", AUTO_LOGOUT_MS/1000);
-            }
+        k_mutex_lock(&auth_lock, K_FOREVER);
+        bool idle = s_authed && k_uptime_get() - s_last_activity_ms >= AUTO_LOGOUT_MS;
+        k_mutex_unlock(&auth_lock);
+        if (idle) {
+            set_locked_state(sh);
+            shell_warn(sh, "Auto-logout after %d s inactivity", AUTO_LOGOUT_MS/1000);
         }
     }
 }
@@ -245,7 +216,9 @@ static int cmd_crc_update(const struct shell *shell, size_t argc, char **argv)
         return -EINVAL;
     }
 
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
     int ret = update_crc();
+    k_mutex_unlock(&cfg_blob_lock);
     if (ret == 0) {
         shell_print(shell, "CRC update completed successfully.");
     } else {
@@ -255,85 +228,6 @@ static int cmd_crc_update(const struct shell *shell, size_t argc, char **argv)
     return ret;
 }
 
-static int erase_entry_by_aad(const char *aad)
-{
-    if (!aad) {
-        LOG_ERR("AAD is NULL");
-        return -EINVAL;
-    }
-
-    /* Search entries[] for matching AAD */
-    int found_index = -1;
-    for (int i = 0; i < num_entries; i++) {
-        if (entries[i].aad_len == strlen(aad) &&
-            memcmp(entries[i].aad, aad, entries[i].aad_len) == 0) {
-            found_index = i;
-            break;
-        }
-    }
-
-    if (found_index < 0) {
-        LOG_WRN("No entry found for AAD '%s'", aad);
-        return -ENOENT;
-    }
-
-    LOG_INF("Erasing entry %d (AAD='%s')", found_index, aad);
-
-    /* Page & entry calculations */
-    size_t entry_offset = (size_t)found_index * ENTRY_SIZE;
-    if (entry_offset + ENTRY_SIZE > CRC_LOCATION_OFFSET) {
-        LOG_ERR("Entry %d would overwrite CRC location", found_index);
-        return -EINVAL;
-    }
-
-    int page_index = found_index / ENTRIES_PER_PAGE;
-    int entry_in_page = found_index % ENTRIES_PER_PAGE;
-    size_t page_offset = page_index * FLASH_PAGE_SIZE;
-
-    uint8_t page_buf[FLASH_PAGE_SIZE];
-
-    const struct flash_area *fa;
-    int err = flash_area_open(FLASH_AREA_ID(encrypted_blob_slot0), &fa);
-    if (err) {
-        LOG_ERR("flash_area_open failed: %d", err);
-        return err;
-    }
-
-    /* Read the whole page */
-    err = flash_area_read(fa, page_offset, page_buf, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_read failed: %d", err);
-        flash_area_close(fa);
-        return err;
-    }
-
-    /* Fill the entry with 0xFF (or 0x00 depending on your "empty" definition) */
-    size_t entry_offset_in_page = entry_in_page * ENTRY_SIZE;
-    memset(&page_buf[entry_offset_in_page], 0xFF, ENTRY_SIZE);
-
-    /* Erase the page */
-    err = flash_area_erase(fa, page_offset, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_erase failed: %d", err);
-        flash_area_close(fa);
-        return err;
-    }
-
-    /* Write the modified page back */
-    err = flash_area_write(fa, page_offset, page_buf, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_write failed: %d", err);
-        flash_area_close(fa);
-        return err;
-    }
-
-    flash_area_close(fa);
-
-    LOG_INF("Erased entry %d in page %d (4KB-aligned)", found_index, page_index);
-
-    /* Recalculate CRC */
-    return update_crc();
-}
 static int cmd_erase_entry(const struct shell *shell, size_t argc, char **argv)
 {
     AUTH_TOUCH();
@@ -345,7 +239,7 @@ static int cmd_erase_entry(const struct shell *shell, size_t argc, char **argv)
     }
 
     const char *aad = argv[1];
-    int ret = erase_entry_by_aad(aad);
+    int ret = config_erase(aad);
 
     if (ret == 0) {
         shell_print(shell, "Entry with AAD '%s' erased successfully", aad);
@@ -396,16 +290,8 @@ static int update_single_entry(int index, const uint8_t *new_data, size_t data_l
     size_t entry_offset_in_page = entry_in_page * ENTRY_SIZE;
     memcpy(&page_buf[entry_offset_in_page], new_data, ENTRY_SIZE);
 
-    err = flash_area_erase(fa, page_offset, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_erase failed: %d (offset: 0x%x)", err, (unsigned int)page_offset);
-        flash_area_close(fa);
-        return err;
-    }
-
-    err = flash_area_write(fa, page_offset, page_buf, FLASH_PAGE_SIZE);
+    err = cfg_flash_rewrite_page(fa, page_offset, page_buf, FLASH_PAGE_SIZE);
     if (err) {
-        LOG_ERR("flash_area_write failed: %d", err);
         flash_area_close(fa);
         return err;
     }
@@ -419,6 +305,12 @@ static int update_single_entry(int index, const uint8_t *new_data, size_t data_l
 
 /* ---------- read/inspect commands (no auth required) ---------- */
 
+static int shell_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    shell_fprintf((const struct shell *)ctx, SHELL_NORMAL, "%.*s", (int)len, (const char *)data);
+    return 0;
+}
+
 static int cmd_get_config(const struct shell *shell, size_t argc, char **argv)
 {
     AUTH_TOUCH();
@@ -430,7 +322,28 @@ static int cmd_get_config(const struct shell *shell, size_t argc, char **argv)
     }
 
     const char *aad = argv[1];
-    const char *value = get_config(aad);
+    char value_buf[DECRYPTED_OUTPUT_MAX];
+
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    const ConfigEntry *e = cfg_find_entry(aad);
+    int chunks = e ? e->chunks : 0;
+    k_mutex_unlock(&cfg_blob_lock);
+
+    if (chunks) {
+        size_t total = 0;
+
+        shell_print(shell, "%s =", aad);
+        int err = get_config_stream(aad, shell_sink, (void *)shell, &total);
+        shell_fprintf(shell, SHELL_NORMAL, "\n");
+        if (err) {
+            shell_error(shell, "Streaming '%s' failed: %d (output above is not authentic)", aad, err);
+            return err;
+        }
+        shell_print(shell, "(%u bytes, %u slots)", (unsigned)total, chunks + 1);
+        return 0;
+    }
+
+    const char *value = get_config(aad, value_buf, sizeof(value_buf));
 
     if (!value) {
         shell_error(shell, "No entry found or decryption failed for AAD: %s", aad);
@@ -457,16 +370,8 @@ static int overwrite_config_page(int page_index, const uint8_t *page_data)
         return err;
     }
 
-    err = flash_area_erase(fa, page_offset, FLASH_PAGE_SIZE);
+    err = cfg_flash_rewrite_page(fa, page_offset, page_data, FLASH_PAGE_SIZE);
     if (err) {
-        LOG_ERR("flash_area_erase failed: %d (offset: 0x%x)", err, (unsigned int)page_offset);
-        flash_area_close(fa);
-        return err;
-    }
-
-    err = flash_area_write(fa, page_offset, page_data, FLASH_PAGE_SIZE);
-    if (err) {
-        LOG_ERR("flash_area_write failed: %d", err);
         flash_area_close(fa);
         return err;
     }
@@ -533,7 +438,10 @@ static int cmd_set_page(const struct shell *shell, size_t argc, char **argv)
     }
 
     shell_print(shell, "Writing page %d with %d entries", page, ENTRIES_PER_PAGE);
-    return overwrite_config_page(page, page_buf);
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    int ret = overwrite_config_page(page, page_buf);
+    k_mutex_unlock(&cfg_blob_lock);
+    return ret;
 }
 
 static int cmd_set_entry(const struct shell *shell, size_t argc, char **argv)
@@ -549,13 +457,32 @@ static int cmd_set_entry(const struct shell *shell, size_t argc, char **argv)
     const char *aad = argv[1];
     const char *data = argv[2];
 
+    int ret = config_set(aad, data);
+    if (ret != -ENOSPC) {
+        if (ret == 0) {
+            shell_print(shell, "Stored entry (AAD: \"%s\")", aad);
+        } else {
+            shell_error(shell, "Failed to store entry: %d", ret);
+        }
+        return ret;
+    }
+
+    /* No erased slot left: fall back to overriding the existing copy in place */
+    if (1 + NRF_CRYPTO_EXAMPLE_AES_IV_SIZE + 2 + strlen(aad) + 2 + strlen(data) +
+        NRF_CRYPTO_EXAMPLE_AES_GCM_TAG_LENGTH > ENTRY_SIZE) {
+        shell_error(shell, "Not enough erased slots for a chunked entry; run 'cfg compact' first");
+        return ret;
+    }
     uint8_t encrypted_entry[ENTRY_SIZE];
-    int ret = create_encrypted_entry_with_aad(aad, data, encrypted_entry);
+    ret = create_encrypted_entry_with_aad(aad, data, encrypted_entry);
     if (ret != 0) {
         shell_error(shell, "Failed to create encrypted entry: %d", ret);
         return ret;
     }
 
+    /* Hold the blob lock so the compactor cannot move slots between scan and write */
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+
     int selected_index = -1;
     for (int i = 0; i < TOTAL_ENTRIES; i++) {
         size_t entry_offset = i * ENTRY_SIZE;
@@ -570,6 +497,9 @@ static int cmd_set_entry(const struct shell *shell, size_t argc, char **argv)
             continue;
         }
 
+        if (entry_ptr[0] == CFG_SLOT_TOMBSTONE)
+            continue;
+
         uint8_t iv_len = entry_ptr[0];
         const uint8_t *aad_len_ptr = entry_ptr + 1 + iv_len;
         uint16_t existing_aad_len = aad_len_ptr[0] | (aad_len_ptr[1] << 8);
@@ -582,12 +512,15 @@ static int cmd_set_entry(const struct shell *shell, size_t argc, char **argv)
     }
 
     if (selected_index == -1) {
+        k_mutex_unlock(&cfg_blob_lock);
         shell_error(shell, "No free slot and no matching AAD to override");
         return -ENOSPC;
     }
 
     shell_print(shell, "Writing entry at index %d (AAD: \"%s\")...", selected_index, aad);
-    return update_single_entry(selected_index, encrypted_entry, ENTRY_SIZE);
+    ret = update_single_entry(selected_index, encrypted_entry, ENTRY_SIZE);
+    k_mutex_unlock(&cfg_blob_lock);
+    return ret;
 }
 
 
@@ -671,11 +604,20 @@ static int cmd_get_crc_info(const struct shell *shell, size_t argc, char **argv)
     uint32_t computed_crc = manual_crc32(ENCRYPTED_BLOB_ADDR, ENCRYPTED_BLOB_SIZE - 4);
     uint32_t stored_crc = *(uint32_t *)(ENCRYPTED_BLOB_ADDR + CRC_LOCATION_OFFSET);
     
-    shell_print(shell, "CRC Information:");
+    shell_print(shell, "CRC Information (legacy blobs only; neither written nor checked, the MAC covers the blob):");
     shell_print(shell, "  Location: 0x%x (last 4 bytes)", CRC_LOCATION_OFFSET);
     shell_print(shell, "  Computed: 0x%08X", computed_crc);
-    shell_print(shell, "  Stored:   0x%08X", stored_crc);
-    shell_print(shell, "  Status:   %s", (computed_crc == stored_crc) ? "VALID" : "INVALID");
+    if (stored_crc == 0xFFFFFFFFu) {
+        shell_print(shell, "  Stored:   none");
+    } else {
+        shell_print(shell, "  Stored:   0x%08X", stored_crc);
+        shell_print(shell, "  Status:   %s", (computed_crc == stored_crc) ? "VALID" : "STALE");
+    }
+
+    int mac = cfg_mac_verify();
+    shell_print(shell, "MAC (HMAC-SHA256 over 0..0x%x, key 0x%08x, seal in ITS): %s", CFG_MAC_OFFSET,
+                CFG_MAC_KEY_ID, mac == 0 ? "VALID" : (mac == -EBADMSG ? "INVALID" : "UNAVAILABLE"));
+    shell_print(shell, "  Seal writes to ITS since boot: %u", cfg_mac_seal_writes());
     
     return 0;
 }
@@ -734,7 +676,9 @@ static int cmd_erase_page(const struct shell *shell, size_t argc, char **argv)
 
     off_t offset = (page - 1) * FLASH_PAGE_SIZE;
 
-    err = flash_area_erase(fa, offset, FLASH_PAGE_SIZE);
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    err = cfg_flash_erase(fa, offset, FLASH_PAGE_SIZE);
+    k_mutex_unlock(&cfg_blob_lock);
     if (err) {
         shell_error(shell, "Failed to erase page %d: %d", page, err);
     } else {
@@ -748,29 +692,36 @@ static int cmd_erase_page(const struct shell *shell, size_t argc, char **argv)
 
 
 
-void get_all_config_entries(const struct shell *shell)
+struct list_ctx {
+    const struct shell *shell;
+    int count;
+};
+
+static int print_entry_cb(const ConfigEntry *e, void *user)
 {
-    char decrypted[DECRYPTED_OUTPUT_MAX];
-    size_t decrypted_len = 0;
+    struct list_ctx *ctx = user;
+    char key[MAX_AAD_LEN + 1];
+    char value_buf[DECRYPTED_OUTPUT_MAX];
 
-    for (int i = 0; i < num_entries; i++) {
-        ConfigEntry *e = &entries[i];
+    memcpy(key, e->aad, e->aad_len);
+    key[e->aad_len] = '\0';
 
-        int ret = decrypt_config_field_data(
-            (const char *)e->ciphertext, e->ciphertext_len,
-            (const char *)e->iv,
-            (const char *)e->aad, e->aad_len,
-            decrypted, &decrypted_len
-        );
+    /* get_config() falls back to later copies if this one does not authenticate */
+    const char *val = get_config(key, value_buf, sizeof(value_buf));
+    if (!val) {
+        shell_error(ctx->shell, "Failed to decrypt entry @0x%04x (AAD: %s)", (unsigned)e->mem_offset, key);
+    } else {
+        shell_print(ctx->shell, "%s = %s", key, val);
+    }
+    ctx->count++;
+    return 0;
+}
 
-        if (ret != 0) {
-            shell_error(shell, "Failed to decrypt entry %d (AAD: %.*s)", i, e->aad_len, e->aad);
-            continue;
-        }
+void get_all_config_entries(const struct shell *shell)
+{
+    struct list_ctx ctx = { .shell = shell };
 
-        decrypted[decrypted_len] = '\0';
-        shell_print(shell, "%.*s = %s", e->aad_len, e->aad, decrypted);
-    }
+    cfg_foreach_prefix("", print_entry_cb, &ctx);
 }
 
 static int cmd_get_all(const struct shell *shell, size_t argc, char **argv)
@@ -784,6 +735,19 @@ static int cmd_get_all(const struct shell *shell, size_t argc, char **argv)
     return 0;
 }
 
+static int cmd_list(const struct shell *shell, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(shell);
+
+    const char *prefix = (argc > 1) ? argv[1] : "";
+    struct list_ctx ctx = { .shell = shell };
+
+    cfg_foreach_prefix(prefix, print_entry_cb, &ctx);
+    shell_print(shell, "%d key(s) matching '%s'", ctx.count, prefix);
+    return 0;
+}
+
 
 
 
@@ -887,16 +851,8 @@ advance:
             next_off += ENTRY_SIZE;
         }
 
-        /* Erase + write the page slice */
-        err = flash_area_erase(fa, page_off, FLASH_PAGE_SIZE);
-        if (err) {
-            LOG_ERR("erase @0x%x: %d", (unsigned)page_off, err);
-            flash_area_close(fa);
-            return err;
-        }
-
-        /* Write only the valid portion of this page that belongs to body_len */
-        err = flash_area_write(fa, page_off, page_buf, write_len);
+        /* Erase + write only the valid portion of this page that belongs to body_len */
+        err = cfg_flash_rewrite_page(fa, page_off, page_buf, write_len);
         if (err) {
             LOG_ERR("write @0x%x: %d", (unsigned)page_off, err);
             flash_area_close(fa);
@@ -918,7 +874,7 @@ int rebuild_and_update_crc(void)
 {
     int rc = rebuild_blob_compact_from_entries_stack();
     if (rc) return rc;
-    return update_crc();  /* writes CRC at CRC_LOCATION_OFFSET */
+    return update_crc();  /* commits the blob seal */
 }
 static int cmd_rebuild_blob(const struct shell *shell, size_t argc, char **argv)
 {
@@ -927,14 +883,25 @@ static int cmd_rebuild_blob(const struct shell *shell, size_t argc, char **argv)
     AUTH_TOUCH();
     REQUIRE_AUTH(shell);
 
+    /* entries[] only holds the head of chunked records */
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].chunks) {
+            shell_error(shell, "Blob holds chunked entries; use 'cfg compact' instead");
+            return -ENOTSUP;
+        }
+    }
+
     shell_print(shell, "Rebuilding blob from entries[] (compacted layout)...");
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
     int rc = rebuild_blob_compact_from_entries_stack();
     if (rc) {
+        k_mutex_unlock(&cfg_blob_lock);
         shell_error(shell, "Blob rebuild failed: %d", rc);
         return rc;
     }
 
     rc = update_crc();
+    k_mutex_unlock(&cfg_blob_lock);
     if (rc) {
         shell_error(shell, "CRC update failed: %d", rc);
         return rc;
@@ -943,6 +910,142 @@ static int cmd_rebuild_blob(const struct shell *shell, size_t argc, char **argv)
     shell_print(shell, "Blob rebuilt and CRC updated successfully");
     return 0;
 }
+static int cmd_compact(const struct shell *shell, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(shell);
+
+    if (argc == 2 && strcmp(argv[1], "run") == 0) {
+        cfg_compact_kick(true);
+        shell_print(shell, "Compaction queued on the maintenance work queue");
+        return 0;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "status") != 0) {
+        shell_error(shell, "Usage: cfg compact [status|run]");
+        return -EINVAL;
+    }
+
+    struct cfg_compact_status st;
+    cfg_compact_get_status(&st);
+
+    shell_print(shell, "Compaction status:");
+    shell_print(shell, "  Live slots:     %d", st.live);
+    shell_print(shell, "  Dead slots:     %d", st.dead);
+    shell_print(shell, "  Erased slots:   %d (%d holes)", st.erased, st.holes);
+    shell_print(shell, "  Fragmentation:  %d%% (threshold %d%%)", st.frag_pct, CFG_COMPACT_FRAG_THRESHOLD_PCT);
+    shell_print(shell, "  Running:        %s", st.running ? "yes" : "no");
+    shell_print(shell, "  Journal:        %s", st.journal_open ? "step in progress" : "clean");
+    return 0;
+}
+
+static int cmd_rotate(const struct shell *shell, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(shell);
+
+    if (argc == 2 && strcmp(argv[1], "start") == 0) {
+        int rc = cfg_rotate_start();
+        if (rc == -EBUSY) {
+            shell_error(shell, "A key rotation is already running");
+        } else if (rc == -ENODATA) {
+            shell_error(shell, "Rotation state unknown and no entry to probe the keys with");
+        } else if (rc) {
+            shell_error(shell, "Key rotation start failed: %d", rc);
+        } else {
+            shell_print(shell, "Key rotation queued on the maintenance work queue");
+        }
+        return rc;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "status") != 0) {
+        shell_error(shell, "Usage: cfg rotate [status|start]");
+        return -EINVAL;
+    }
+
+    struct cfg_rot_state st;
+    cfg_rotate_get_state(&st);
+
+    shell_print(shell, "Key rotation status:");
+    shell_print(shell, "  Active key:     0x%08x", st.active_key);
+    if (st.phase == CFG_ROT_RUNNING) {
+        shell_print(shell, "  Previous key:   0x%08x", st.prev_key);
+        shell_print(shell, "  Running:        yes (page %u of %d)", st.next_page, CONFIG_PAGE_COUNT);
+    } else {
+        shell_print(shell, "  Running:        no");
+    }
+    return 0;
+}
+
+static int cmd_its(const struct shell *shell, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(shell);
+
+    if (argc == 1 || strcmp(argv[1], "status") == 0) {
+        shell_print(shell, "ITS hot tier (%s):", IS_ENABLED(CFG_ITS_TIER_ENABLED) ? "enabled" : "disabled");
+        for (int i = 0; cfg_its_policy_key(i); i++) {
+            const char *key = cfg_its_policy_key(i);
+            int st = cfg_its_state(key);
+            shell_print(shell, "  %-14s %s", key,
+                        st == 1 ? "fresh" : st == 0 ? "stale" : st == -ENOENT ? "not mirrored" : "error");
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "bench") != 0 || argc < 3) {
+        shell_error(shell, "Usage: cfg its [status|bench <aad> [n]]");
+        return -EINVAL;
+    }
+
+    const char *key = argv[2];
+    int n = (argc > 3) ? atoi(argv[3]) : 20;
+    char out[DECRYPTED_OUTPUT_MAX];
+    size_t len;
+
+    if (!cfg_its_is_hot(key) || n <= 0) {
+        shell_error(shell, "'%s' is not a stored key in the ITS policy", key);
+        return -EINVAL;
+    }
+
+    /* Hold the blob lock so a reparse cannot move e under the timing loops */
+    k_mutex_lock(&cfg_blob_lock, K_FOREVER);
+    const ConfigEntry *e = cfg_find_entry(key);
+    if (!e) {
+        k_mutex_unlock(&cfg_blob_lock);
+        shell_error(shell, "'%s' is not a stored key in the ITS policy", key);
+        return -EINVAL;
+    }
+
+    /* A blob read refreshes a missing or stale mirror */
+    if (cfg_its_get(key, e, out, sizeof(out), &len) != 0 && !get_config(key, out, sizeof(out))) {
+        k_mutex_unlock(&cfg_blob_lock);
+        shell_error(shell, "Decryption of '%s' failed", key);
+        return -EIO;
+    }
+
+    uint32_t t0 = k_cycle_get_32();
+    for (int i = 0; i < n; i++) {
+        cfg_its_get(key, e, out, sizeof(out), &len);
+    }
+    uint32_t its_cyc = k_cycle_get_32() - t0;
+
+    t0 = k_cycle_get_32();
+    for (int i = 0; i < n; i++) {
+        decrypt_config_field_data((const char *)e->ciphertext, e->ciphertext_len,
+                                  (const char *)e->iv, (const char *)e->aad, e->aad_len,
+                                  out, sizeof(out), &len);
+    }
+    uint32_t dec_cyc = k_cycle_get_32() - t0;
+    k_mutex_unlock(&cfg_blob_lock);
+    memset(out, 0, sizeof(out));
+
+    shell_print(shell, "%s, %d reads:", key, n);
+    shell_print(shell, "  psa_its_get:  %u us/read", k_cyc_to_us_floor32(its_cyc / n));
+    shell_print(shell, "  blob decrypt: %u us/read", k_cyc_to_us_floor32(dec_cyc / n));
+    return 0;
+}
+
 /* ====================== Command group: cfg ====================== */
 static int cmd_cfg_help(const struct shell *shell, size_t argc, char **argv);
 
@@ -955,6 +1058,7 @@ SHELL_STATIC_SUBCMD_SET_CREATE(cfg_cmds,
     SHELL_CMD(parse,       NULL, "Parse encrypted blob into RAM index",           cmd_parse_blob),
     SHELL_CMD_ARG(get_config, NULL, "Decrypt value by AAD: cfg get_config <aad>", cmd_get_config, 2, 0),
     SHELL_CMD(get_all,     NULL, "List all AAD=value pairs",                      cmd_get_all),
+    SHELL_CMD_ARG(list,    NULL, "List keys by prefix in key order: cfg list [prefix]", cmd_list, 1, 1),
     SHELL_CMD_ARG(set,     NULL, "Set/override entry (auth): cfg set <aad> <data>", cmd_set_entry, 3, 0),
     SHELL_CMD_ARG(set_page,NULL, "Write a full page (auth): cfg set_page <1|2> [aad data] ...", cmd_set_page, 3, ENTRIES_PER_PAGE*2),
     SHELL_CMD_ARG(get_hex, NULL, "Hex dump entry: cfg get_hex <index>",           cmd_get_entry_hex, 2, 0),
@@ -966,6 +1070,9 @@ SHELL_STATIC_SUBCMD_SET_CREATE(cfg_cmds,
     SHELL_CMD(erase_entry, NULL, "Erase entry by AAD: cfg erase_entry <aad> (auth)", cmd_erase_entry),
     SHELL_CMD(crc, &cfg_crc_cmds, "CRC operations: cfg crc update",               NULL),
     SHELL_CMD(rebuild_blob, NULL, "Rebuild blob from entries[] (compacted layout)", cmd_rebuild_blob),
+    SHELL_CMD_ARG(compact, NULL, "Background compaction: cfg compact [status|run]", cmd_compact, 1, 1),
+    SHELL_CMD_ARG(rotate,  NULL, "Store key rotation: cfg rotate [status|start]", cmd_rotate, 1, 1),
+    SHELL_CMD_ARG(its,     NULL, "ITS hot tier: cfg its [status|bench <aad> [n]]", cmd_its, 1, 3),
     SHELL_CMD(help,       NULL,  "Show this help",                                 cmd_cfg_help),
     SHELL_SUBCMD_SET_END
 );
@@ -976,6 +1083,60 @@ SHELL_CMD_REGISTER(cfg, &cfg_cmds, "Config blob commands", NULL);
 SHELL_CMD_REGISTER(login,  NULL, "Authenticate: login <password>",  cmd_login);
 SHELL_CMD_REGISTER(logout, NULL, "Logout and re-lock the shell",     cmd_logout);
 
+static void passwd_done(int err, uint32_t iterations, void *user)
+{
+    const struct shell *sh = user;
+
+    if (err == -EPERM) {
+        shell_error(sh, "Current password does not match");
+    } else if (err) {
+        shell_error(sh, "PBKDF2 job failed (err %d)", err);
+    } else {
+        shell_print(sh, "PBKDF2 cost: %u iterations", iterations);
+    }
+}
+
+static int cmd_passwd_calibrate(const struct shell *sh, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    uint32_t target_ms = (argc > 1) ? strtoul(argv[1], NULL, 10) : PBKDF2_TARGET_MS;
+    int err = pw_calibrate_submit(target_ms, passwd_done, (void *)sh);
+    if (err) {
+        shell_error(sh, "Calibration not started (err %d)", err);
+        return err;
+    }
+    shell_print(sh, "Timing PBKDF2 for a %u ms target...", target_ms);
+    return 0;
+}
+
+static int cmd_passwd_rehash(const struct shell *sh, size_t argc, char **argv)
+{
+    AUTH_TOUCH();
+    REQUIRE_AUTH(sh);
+
+    uint32_t iterations = 0;
+    if (argc > 2 && strcmp(argv[2], "auto") != 0) {
+        iterations = strtoul(argv[2], NULL, 10);
+    }
+
+    int err = pw_rehash_submit(argv[1], iterations, passwd_done, (void *)sh);
+    if (err) {
+        shell_error(sh, "Re-hash not started (err %d)", err);
+        return err;
+    }
+    shell_print(sh, "Re-hashing password...");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(passwd_cmds,
+    SHELL_CMD_ARG(calibrate, NULL, "Time PBKDF2: passwd calibrate [target_ms]", cmd_passwd_calibrate, 1, 1),
+    SHELL_CMD_ARG(rehash,    NULL, "Re-hash at a new cost: passwd rehash <password> [iterations|auto]", cmd_passwd_rehash, 2, 1),
+    SHELL_SUBCMD_SET_END
+);
+SHELL_CMD_REGISTER(passwd, &passwd_cmds, "Password hash maintenance (auth)", NULL);
+
 static int cmd_cfg_help(const struct shell *shell, size_t argc, char **argv)
 {
     ARG_UNUSED(argc); ARG_UNUSED(argv);
@@ -987,6 +1148,7 @@ static int cmd_cfg_help(const struct shell *shell, size_t argc, char **argv)
         "  parse                         Parse encrypted blob into RAM index\n"
         "  get_config <aad>              Decrypt and print value by AAD\n"
         "  get_all                       Print all AAD=value pairs\n"
+        "  list [prefix]                 Print AAD=value pairs by prefix, sorted\n"
         "  set <aad> <data>              Create/override entry (auth)\n"
         "  set_page <1|2> [aad data]...  Create a full page image (auth)\n"
         "  get_hex <index>               Dump one entry in hex\n"
@@ -996,11 +1158,16 @@ static int cmd_cfg_help(const struct shell *shell, size_t argc, char **argv)
         "  crc update                    Recompute/write CRC (auth)\n"
         "  show_layout                   Show blob memory layout\n"
         "  rebuild_blob                Rebuild blob from entries[] (compacted layout)\n"
+        "  compact [status|run]          Incremental background compaction\n"
+        "  rotate [status|start]         Re-encrypt the store under a fresh key\n"
+        "  its [status|bench <aad> [n]]  ITS hot tier state / ITS vs blob read time\n"
         "  erase_entry <aad>             Erase entry by AAD (auth)\n"
         "  erase page <1|2>              Erase page (auth)\n"
         "\nAuth:\n"
         "  login <password>              Authenticate \n"
         "  logout                        Re-lock the shell\n"
+        "  passwd calibrate [target_ms]  Time PBKDF2, suggest an iteration count\n"
+        "  passwd rehash <pw> [n|auto]   Re-hash password at a new cost\n"
         "\nNotes:\n"
         "  - Logs are always available.\n"
         "  - Auto-logout after %d s inactivity; lockout %d s after %d bad tries.\n",
@@ -1052,7 +1219,7 @@ static int erase_slot(const struct flash_area *fa)
 {
     /* Erase exactly 8KB in 4KB steps from offset 0 */
     for (size_t off = 0; off < BLOB_SLOT_SIZE_BYTES; off += ERASE_STEP_BYTES) {
-        int err = flash_area_erase(fa, off, ERASE_STEP_BYTES);
+        int err = cfg_flash_erase(fa, off, ERASE_STEP_BYTES);
         if (err) {
             LOG_ERR("Erase failed at off=0x%zx err=%d", off, err);
             return err;
@@ -1112,7 +1279,7 @@ static int copy_slot(int src_slot, int dst_slot)
             goto out_close;
         }
 
-        err = flash_area_write(dst_fa, off, buf, chunk);
+        err = cfg_flash_write(dst_fa, off, buf, chunk);
         if (err) {
             LOG_ERR("Write dst failed off=0x%zx err=%d", off, err);
             goto out_close;
@@ -0,0 +1,82 @@
+/*
+ * "bench crypto" rows on native_sim with the software PSA driver: every
+ * benchmark must run to the end with all PSA calls succeeding. The figures
+ * are printed for reference only; host timings say nothing about the nRF9160.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <psa/crypto.h>
+#include "bench.h"
+#include "bench_psa.h"
+
+#define REPS 4
+
+static void *suite_setup(void)
+{
+    zassert_equal(psa_crypto_init(), PSA_SUCCESS);
+    return NULL;
+}
+
+ZTEST(bench, test_aead)
+{
+    struct bench_aead_row rows[BENCH_AEAD_ROWS];
+    psa_key_id_t key;
+
+    zassert_equal(bench_key_volatile(PSA_KEY_TYPE_AES, PSA_ALG_GCM,
+                                     PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT, 256, &key),
+                  PSA_SUCCESS);
+    int err = bench_psa_aead(key, REPS, rows);
+    psa_destroy_key(key);
+    zassert_ok(err);
+
+    for (int s = 0; s < BENCH_AEAD_ROWS; s++) {
+        zassert_equal(rows[s].len, bench_aead_sizes[s]);
+        TC_PRINT("AES-256-GCM %4u B: enc %u us, dec %u us\n", (unsigned)rows[s].len,
+                 rows[s].enc_us, rows[s].dec_us);
+    }
+}
+
+/* A key that cannot encrypt must fail the row, not report a time */
+ZTEST(bench, test_aead_failure_is_reported)
+{
+    struct bench_aead_row rows[BENCH_AEAD_ROWS];
+    psa_key_id_t key;
+
+    zassert_equal(bench_key_volatile(PSA_KEY_TYPE_AES, PSA_ALG_GCM, PSA_KEY_USAGE_DECRYPT,
+                                     256, &key), PSA_SUCCESS);
+    int err = bench_psa_aead(key, REPS, rows);
+    psa_destroy_key(key);
+    zassert_equal(err, -EIO);
+}
+
+ZTEST(bench, test_pbkdf2)
+{
+    uint32_t fixed_us, per_iter_ns;
+
+    zassert_ok(bench_psa_pbkdf2(&fixed_us, &per_iter_ns));
+    TC_PRINT("PBKDF2-HMAC-SHA256: %u ns/iteration, %u us fixed\n", per_iter_ns, fixed_us);
+}
+
+ZTEST(bench, test_hmac_sha3_random)
+{
+    uint32_t us;
+
+    for (size_t len = 64; len <= BENCH_MAX_PAYLOAD; len *= 16) {
+        zassert_ok(bench_psa_hmac(len, REPS, &us));
+        TC_PRINT("HMAC-SHA256 %4u B: %u us\n", (unsigned)len, us);
+        zassert_ok(bench_psa_sha3(len, REPS, &us));
+        TC_PRINT("SHA3-256    %4u B: %u us\n", (unsigned)len, us);
+    }
+    zassert_ok(bench_psa_random(256, REPS, &us));
+    zassert_equal(bench_psa_hmac(BENCH_MAX_PAYLOAD + 1, REPS, &us), -EINVAL);
+}
+
+/* No TF-M on native_sim */
+ZTEST(bench, test_transition_unavailable)
+{
+    uint32_t us;
+
+    zassert_equal(bench_psa_transition(REPS, &us), -ENOTSUP);
+}
+
+ZTEST_SUITE(bench, NULL, suite_setup, NULL, NULL, NULL);
@@ -0,0 +1 @@
+/* Empty: protected storage is not used by the code under test */
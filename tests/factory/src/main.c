@@ -0,0 +1,199 @@
+/*
+ * Factory bundles on native_sim: scripts/factory_bundle.py makes a signing
+ * key at build time, the firmware key source from it and a bundle signed with
+ * it, plus the same bundle signed by a key the firmware does not know.
+ * factory_ingest() must apply the first and refuse the others before any
+ * credential or config write. The modem and the config store are stubbed.
+ */
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <modem/lte_lc.h>
+#include <modem/modem_key_mgmt.h>
+#include <psa/crypto.h>
+#include "config.h"
+#include "factory.h"
+
+#define MAX_WRITES 8
+
+static const uint8_t good[] = {
+#include "good.cbor.inc"
+};
+static const uint8_t foreign[] = {
+#include "foreign.cbor.inc"
+};
+
+/* tests/factory/bundle/ca.pem and spec.json */
+static const char ca_pem[] = "-----BEGIN CERTIFICATE-----\nMIIBfactorytest\n-----END CERTIFICATE-----\n";
+#define SPEC_ITERATIONS "10000"
+
+static uint8_t buf[FACTORY_BUNDLE_MAX];
+
+bool s_authed;
+int64_t s_last_activity_ms;
+
+void secure_memzero(void *v, size_t n)
+{
+    volatile uint8_t *p = v;
+
+    while (n--) {
+        *p++ = 0;
+    }
+}
+
+static enum lte_lc_func_mode modem_mode;
+static struct {
+    uint32_t tag;
+    enum modem_key_mgmt_cred_type type;
+    size_t len;
+    bool offline;
+    bool pem_ok;
+} cred[MAX_WRITES];
+static int n_cred;
+
+static char cfg_key[MAX_WRITES][MAX_AAD_LEN + 1];
+static char cfg_val[MAX_WRITES][160];
+static int n_cfg;
+static int batch_err;
+
+static int n_results, n_failed;
+
+int lte_lc_func_mode_get(enum lte_lc_func_mode *mode)
+{
+    *mode = modem_mode;
+    return 0;
+}
+
+int lte_lc_func_mode_set(enum lte_lc_func_mode mode)
+{
+    modem_mode = mode;
+    return 0;
+}
+
+int modem_key_mgmt_write(nrf_sec_tag_t sec_tag, enum modem_key_mgmt_cred_type cred_type,
+                         const void *data, size_t len)
+{
+    zassert_true(n_cred < MAX_WRITES);
+    cred[n_cred].tag = sec_tag;
+    cred[n_cred].type = cred_type;
+    cred[n_cred].len = len;
+    cred[n_cred].offline = (modem_mode == LTE_LC_FUNC_MODE_OFFLINE);
+    cred[n_cred].pem_ok = (len == strlen(ca_pem) && memcmp(data, ca_pem, len) == 0);
+    n_cred++;
+    return 0;
+}
+
+int config_set_batch(const char *const *keys, const char *const *values, size_t n, int *results)
+{
+    for (size_t i = 0; i < n; i++) {
+        zassert_true(n_cfg < MAX_WRITES);
+        strncpy(cfg_key[n_cfg], keys[i], sizeof(cfg_key[n_cfg]) - 1);
+        strncpy(cfg_val[n_cfg], values[i], sizeof(cfg_val[n_cfg]) - 1);
+        n_cfg++;
+        results[i] = batch_err ? -ECANCELED : 0;
+    }
+    if (batch_err && n) {
+        results[0] = batch_err;
+    }
+    return batch_err;
+}
+
+static void result_cb(void *user, const char *kind, const char *name, int result)
+{
+    ARG_UNUSED(user);
+    TC_PRINT("RESULT %s %s %d\n", kind, name, result);
+    n_results++;
+    if (result) {
+        n_failed++;
+    }
+}
+
+static int ingest(const uint8_t *bundle, size_t len)
+{
+    memcpy(buf, bundle, len);
+    return factory_ingest(buf, len, result_cb, NULL);
+}
+
+static void assert_nothing_written(void)
+{
+    zassert_equal(n_cred, 0, "credential written from a rejected bundle");
+    zassert_equal(n_cfg, 0, "config written from a rejected bundle");
+    zassert_equal(n_results, 0);
+}
+
+static void *suite_setup(void)
+{
+    zassert_equal(psa_crypto_init(), PSA_SUCCESS);
+    zassert_true(sizeof(good) <= sizeof(buf));
+    zassert_true(sizeof(foreign) <= sizeof(buf));
+    return NULL;
+}
+
+static void before_each(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    memset(cred, 0, sizeof(cred));
+    memset(cfg_key, 0, sizeof(cfg_key));
+    memset(cfg_val, 0, sizeof(cfg_val));
+    n_cred = n_cfg = n_results = n_failed = 0;
+    batch_err = 0;
+    modem_mode = LTE_LC_FUNC_MODE_NORMAL;
+}
+
+ZTEST(factory, test_signed_bundle_applies)
+{
+    zassert_ok(ingest(good, sizeof(good)));
+
+    zassert_equal(n_cred, 1);
+    zassert_equal(cred[0].tag, 42);
+    zassert_equal(cred[0].type, MODEM_KEY_MGMT_CRED_TYPE_CA_CHAIN);
+    zassert_true(cred[0].pem_ok, "PEM differs from bundle/ca.pem");
+    zassert_true(cred[0].offline, "credential written with the modem online");
+    zassert_equal(modem_mode, LTE_LC_FUNC_MODE_NORMAL, "modem mode not restored");
+
+    /* Spec order, then the password hash as the one reference record */
+    zassert_equal(n_cfg, 3);
+    zassert_str_equal(cfg_key[0], "mq_addr");
+    zassert_str_equal(cfg_val[0], "broker.example.com");
+    zassert_str_equal(cfg_key[1], "mq_port");
+    zassert_str_equal(cfg_val[1], "8883");
+    zassert_str_equal(cfg_key[2], PBKDF2_REF_KEY);
+    zassert_equal(strncmp(cfg_val[2], SPEC_ITERATIONS ":", strlen(SPEC_ITERATIONS ":")), 0);
+    zassert_equal(strlen(cfg_val[2]),
+                  strlen(SPEC_ITERATIONS) + 1 + 2 * PBKDF2_SALT_LEN + 1 + 2 * PBKDF2_HASH_LEN);
+
+    zassert_equal(n_results, 4);
+    zassert_equal(n_failed, 0);
+}
+
+ZTEST(factory, test_foreign_key_rejected)
+{
+    zassert_equal(ingest(foreign, sizeof(foreign)), -EPERM);
+    assert_nothing_written();
+}
+
+ZTEST(factory, test_tampered_payload_rejected)
+{
+    memcpy(buf, good, sizeof(good));
+    /* Past the envelope and payload headers: a manifest byte */
+    buf[8] ^= 0x01;
+    zassert_equal(factory_ingest(buf, sizeof(good), result_cb, NULL), -EPERM);
+    assert_nothing_written();
+}
+
+ZTEST(factory, test_truncated_bundle_rejected)
+{
+    zassert_equal(ingest(good, sizeof(good) - 1), -EBADMSG);
+    assert_nothing_written();
+}
+
+/* The store's error reaches the caller and every config item reports an outcome */
+ZTEST(factory, test_config_failure_reported)
+{
+    batch_err = -ENOSPC;
+    zassert_equal(ingest(good, sizeof(good)), -ENOSPC);
+    zassert_equal(n_results, 4);
+    zassert_equal(n_failed, 3);
+}
+
+ZTEST_SUITE(factory, NULL, suite_setup, before_each, NULL, NULL);
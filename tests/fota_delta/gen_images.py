@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""Write old.bin and new.bin for the delta test into the given directory.
+
+new.bin is old.bin with the edits a rebuild typically makes: a changed
+header, code inserted and replaced in the middle, and a longer tail.
+"""
+
+import os
+import sys
+
+OLD_SIZE = 48 * 1024
+
+
+def lcg(seed, n):
+    out = bytearray(n)
+    x = seed
+    for i in range(n):
+        x = (x * 1664525 + 1013904223) & 0xFFFFFFFF
+        out[i] = x >> 24
+    return out
+
+
+def main():
+    out_dir = sys.argv[1]
+    old = lcg(0x2545F491, OLD_SIZE)
+
+    new = bytearray(old)
+    new[4:8] = b"\x01\x02\x00\x00"                            # version bump
+    new[30 * 1024:32 * 1024] = lcg(0x1B873593, 2048)          # replaced function
+    new[10 * 1024:10 * 1024] = lcg(0xCC9E2D51, 700)           # inserted code
+    new += lcg(0x85EBCA6B, 1500)                              # longer tail
+
+    os.makedirs(out_dir, exist_ok=True)
+    for name, data in (("old.bin", old), ("new.bin", new)):
+        with open(os.path.join(out_dir, name), "wb") as f:
+            f.write(data)
+
+
+if __name__ == "__main__":
+    main()
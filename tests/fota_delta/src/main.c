@@ -0,0 +1,196 @@
+/*
+ * Delta FOTA on native_sim: slot0 holds old.bin, and the patch made by
+ * scripts/fota_delta.py at build time must rebuild new.bin in the secondary
+ * slot through fota_writer, as on the device. A patch that fails leaves the
+ * slot to the full-image download, which fota.c starts next; that download
+ * must then succeed in the same slot.
+ */
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <zephyr/storage/flash_map.h>
+#include <dfu/dfu_target.h>
+#include <dfu/dfu_target_mcuboot.h>
+#include <psa/crypto.h>
+#include "config.h"
+#include "fota_delta.h"
+#include "fota_writer.h"
+#include "fota_stats.h"
+
+#define FRAGMENT        1024    /* one downloader fragment */
+#define ODD_FRAGMENT    97      /* splits headers and ops across writes */
+#define STREAM_BUF_LEN  512
+
+static const uint8_t old_img[] = {
+#include "old.bin.inc"
+};
+static const uint8_t new_img[] = {
+#include "new.bin.inc"
+};
+static const uint8_t patch[] = {
+#include "delta.patch.inc"
+};
+
+static uint8_t new_sha256[32];
+static uint8_t bad_patch[sizeof(patch)];
+static uint8_t stream_buf[STREAM_BUF_LEN] __aligned(4);
+
+BUILD_ASSERT(sizeof(old_img) % 4 == 0, "old.bin must be whole flash words");
+
+void fota_stats_fragment(size_t len, uint32_t write_us, uint32_t erase_wait_us)
+{
+    ARG_UNUSED(len);
+    ARG_UNUSED(write_us);
+    ARG_UNUSED(erase_wait_us);
+}
+
+static void dfu_evt(enum dfu_target_evt_id evt_id)
+{
+    ARG_UNUSED(evt_id);
+}
+
+static void slot_write(uint8_t id, uint32_t off, const void *data, size_t len)
+{
+    const struct flash_area *fa;
+
+    zassert_ok(flash_area_open(id, &fa));
+    zassert_ok(flash_area_write(fa, off, data, len));
+    flash_area_close(fa);
+}
+
+static void slot0_load(void)
+{
+    const struct flash_area *fa;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(slot0_partition), &fa));
+    zassert_ok(flash_area_erase(fa, 0, ROUND_UP(sizeof(old_img), FLASH_PAGE_SIZE)));
+    zassert_ok(flash_area_write(fa, 0, old_img, sizeof(old_img)));
+    flash_area_close(fa);
+}
+
+static void slot1_check(void)
+{
+    const struct flash_area *fa;
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t buf[256], digest[32];
+    size_t out_len;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(slot1_partition), &fa));
+    zassert_equal(psa_hash_setup(&op, PSA_ALG_SHA_256), PSA_SUCCESS);
+    for (uint32_t off = 0; off < sizeof(new_img); off += sizeof(buf)) {
+        size_t n = MIN(sizeof(buf), sizeof(new_img) - off);
+
+        zassert_ok(flash_area_read(fa, off, buf, n));
+        zassert_equal(psa_hash_update(&op, buf, n), PSA_SUCCESS);
+    }
+    zassert_equal(psa_hash_finish(&op, digest, sizeof(digest), &out_len), PSA_SUCCESS);
+    flash_area_close(fa);
+    zassert_mem_equal(digest, new_sha256, sizeof(digest), "secondary slot is not new.bin");
+}
+
+/* update_download() -> delta_start(); the first error ends the patch like delta_dl_cb() */
+static int delta_apply(const uint8_t *p, size_t len, size_t fragment)
+{
+    int err;
+
+    fota_writer_expect(NULL, 0);
+    fota_writer_resume_from(0, NULL);
+    err = fota_delta_begin(new_sha256, sizeof(new_img));
+    if (err) {
+        return err;
+    }
+    for (size_t off = 0; off < len; off += fragment) {
+        err = fota_delta_write(p + off, MIN(fragment, len - off));
+        if (err) {
+            fota_delta_abort();
+            return err;
+        }
+    }
+    return fota_delta_finish();
+}
+
+/* The fallback: download_prepare() and fota_download streaming new.bin */
+static void full_image_download(void)
+{
+    dfu_target_mcuboot_reset();
+    fota_writer_resume_from(0, NULL);
+    fota_writer_expect(new_sha256, sizeof(new_img));
+    zassert_ok(dfu_target_mcuboot_set_buf(stream_buf, sizeof(stream_buf)));
+    zassert_ok(dfu_target_init(DFU_TARGET_IMAGE_TYPE_MCUBOOT, 0, sizeof(new_img), dfu_evt));
+    for (size_t off = 0; off < sizeof(new_img); off += FRAGMENT) {
+        zassert_ok(dfu_target_write(new_img + off, MIN(FRAGMENT, sizeof(new_img) - off)));
+    }
+    zassert_ok(dfu_target_done(true), "full image not verified");
+    fota_writer_expect(NULL, 0);
+    slot1_check();
+}
+
+static void *suite_setup(void)
+{
+    size_t out_len;
+
+    zassert_equal(psa_crypto_init(), PSA_SUCCESS);
+    zassert_equal(psa_hash_compute(PSA_ALG_SHA_256, new_img, sizeof(new_img),
+                                   new_sha256, sizeof(new_sha256), &out_len), PSA_SUCCESS);
+    zassert_true(sizeof(patch) < sizeof(new_img), "patch is no smaller than the image");
+    return NULL;
+}
+
+static void before_each(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    slot0_load();
+    memcpy(bad_patch, patch, sizeof(patch));
+}
+
+static void after_each(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    fota_delta_abort();
+    dfu_target_reset();
+}
+
+ZTEST(fota_delta, test_patch_applies)
+{
+    zassert_ok(delta_apply(patch, sizeof(patch), FRAGMENT));
+    slot1_check();
+}
+
+ZTEST(fota_delta, test_patch_applies_in_odd_fragments)
+{
+    zassert_ok(delta_apply(patch, sizeof(patch), ODD_FRAGMENT));
+    slot1_check();
+}
+
+ZTEST(fota_delta, test_bad_op_falls_back)
+{
+    bad_patch[FOTA_DELTA_HDR_LEN] = 'X';
+    zassert_equal(delta_apply(bad_patch, sizeof(bad_patch), FRAGMENT), -EBADMSG);
+    full_image_download();
+}
+
+ZTEST(fota_delta, test_bad_output_falls_back)
+{
+    /* The patch ends in literal bytes; one flipped bit only shows in the output hash */
+    bad_patch[sizeof(bad_patch) - 1] ^= 0x01;
+    zassert_equal(delta_apply(bad_patch, sizeof(bad_patch), FRAGMENT), -EBADMSG);
+    full_image_download();
+}
+
+ZTEST(fota_delta, test_truncated_patch_falls_back)
+{
+    zassert_equal(delta_apply(patch, sizeof(patch) - 1, FRAGMENT), -EBADMSG);
+    full_image_download();
+}
+
+ZTEST(fota_delta, test_other_base_falls_back)
+{
+    static const uint8_t zero[4];
+
+    slot_write(FIXED_PARTITION_ID(slot0_partition), ROUND_DOWN(sizeof(old_img) / 2, 4),
+               zero, sizeof(zero));
+    zassert_equal(delta_apply(patch, sizeof(patch), FRAGMENT), -ESTALE);
+    full_image_download();
+}
+
+ZTEST_SUITE(fota_delta, NULL, suite_setup, before_each, after_each, NULL);
@@ -0,0 +1,154 @@
+/*
+ * manifest.txt parsing and the version decision behind the update check:
+ * malformed input is refused, and only a strictly newer image is downloaded.
+ */
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include "fota_manifest.h"
+
+#define SHA_HEX "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+
+static char text[512];
+static struct fota_manifest m;
+
+static int parse(const char *s)
+{
+    strncpy(text, s, sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    memset(&m, 0xA5, sizeof(m));
+    return fota_manifest_parse(text, &m);
+}
+
+static struct mcuboot_img_sem_ver ver(uint8_t maj, uint8_t min, uint16_t rev, uint32_t build)
+{
+    struct mcuboot_img_sem_ver v = {
+        .major = maj, .minor = min, .revision = rev, .build_num = build,
+    };
+    return v;
+}
+
+ZTEST(fota_manifest, test_version_parse)
+{
+    struct mcuboot_img_sem_ver v;
+
+    zassert_ok(fota_version_parse("1.2.3+4", &v));
+    zassert_equal(v.major, 1);
+    zassert_equal(v.minor, 2);
+    zassert_equal(v.revision, 3);
+    zassert_equal(v.build_num, 4);
+
+    /* The build number is optional */
+    zassert_ok(fota_version_parse("255.255.65535", &v));
+    zassert_equal(v.major, 255);
+    zassert_equal(v.revision, 65535);
+    zassert_equal(v.build_num, 0);
+}
+
+ZTEST(fota_manifest, test_version_parse_malformed)
+{
+    static const char *const bad[] = {
+        "", "1", "1.2", "1.2.", "a.b.c", "v1.2.3", "256.0.0", "0.256.0", "0.0.65536",
+    };
+    struct mcuboot_img_sem_ver v;
+
+    for (size_t i = 0; i < ARRAY_SIZE(bad); i++) {
+        zassert_equal(fota_version_parse(bad[i], &v), -EBADMSG, "accepted '%s'", bad[i]);
+    }
+}
+
+ZTEST(fota_manifest, test_manifest_parse)
+{
+    zassert_ok(parse("version=1.4.0+7\r\nsize=123456\r\nsha256=" SHA_HEX "\r\n"
+                     "notes=ignored\r\n"));
+    zassert_equal(m.ver.major, 1);
+    zassert_equal(m.ver.minor, 4);
+    zassert_equal(m.ver.revision, 0);
+    zassert_equal(m.ver.build_num, 7);
+    zassert_equal(m.size, 123456);
+    zassert_equal(m.sha256[0], 0x00);
+    zassert_equal(m.sha256[31], 0x1f);
+    zassert_false(m.has_delta);
+}
+
+ZTEST(fota_manifest, test_manifest_parse_delta)
+{
+    zassert_ok(parse("version=1.4.0\nsize=10\nsha256=" SHA_HEX "\n"
+                     "delta_from=1.3.2+1\ndelta=app_1.3.2.patch\n"));
+    zassert_true(m.has_delta);
+    zassert_str_equal(m.delta_file, "app_1.3.2.patch");
+    zassert_equal(m.delta_from.minor, 3);
+    zassert_equal(m.delta_from.build_num, 1);
+
+    /* A bad or half delta announcement only drops the delta */
+    zassert_ok(parse("version=1.4.0\nsize=10\nsha256=" SHA_HEX "\ndelta=app.patch\n"));
+    zassert_false(m.has_delta);
+    zassert_ok(parse("version=1.4.0\nsize=10\nsha256=" SHA_HEX "\n"
+                     "delta_from=1.3\ndelta=app.patch\n"));
+    zassert_false(m.has_delta);
+    zassert_ok(parse("version=1.4.0\nsize=10\nsha256=" SHA_HEX "\n"
+                     "delta_from=1.3.2\ndelta=../app.patch\n"));
+    zassert_false(m.has_delta);
+}
+
+ZTEST(fota_manifest, test_manifest_parse_malformed)
+{
+    static const char *const bad[] = {
+        "",
+        "size=10\nsha256=" SHA_HEX "\n",                        /* no version */
+        "version=1.4.0\nsha256=" SHA_HEX "\n",                  /* no size */
+        "version=1.4.0\nsize=10\n",                             /* no hash */
+        "version=1.4\nsize=10\nsha256=" SHA_HEX "\n",
+        "version=1.4.0\nsize=0\nsha256=" SHA_HEX "\n",
+        "version=1.4.0\nsize=big\nsha256=" SHA_HEX "\n",
+        "version=1.4.0\nsize=10\nsha256=" SHA_HEX "00\n",       /* too long */
+        "version=1.4.0\nsize=10\nsha256=0001\n",                /* too short */
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(bad); i++) {
+        zassert_equal(parse(bad[i]), -EBADMSG, "accepted manifest %u", (unsigned)i);
+    }
+
+    /* Not hex, right length */
+    char hex[] = SHA_HEX;
+    hex[10] = 'g';
+    snprintk(text, sizeof(text), "version=1.4.0\nsize=10\nsha256=%s\n", hex);
+    zassert_equal(fota_manifest_parse(text, &m), -EBADMSG);
+}
+
+ZTEST(fota_manifest, test_ver_cmp)
+{
+    struct mcuboot_img_sem_ver a = ver(1, 2, 3, 4);
+    struct mcuboot_img_sem_ver b = a;
+
+    zassert_equal(fota_ver_cmp(&a, &b), 0);
+
+    /* Each field decides when the ones before it are equal, build number last */
+    const struct mcuboot_img_sem_ver newer[] = {
+        ver(2, 0, 0, 0), ver(1, 3, 0, 0), ver(1, 2, 4, 0), ver(1, 2, 3, 5),
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(newer); i++) {
+        zassert_true(fota_ver_cmp(&newer[i], &a) > 0, "case %u", (unsigned)i);
+        zassert_true(fota_ver_cmp(&a, &newer[i]) < 0, "case %u", (unsigned)i);
+    }
+}
+
+/* update_check(): equal or older is up to date, only newer is downloaded */
+ZTEST(fota_manifest, test_up_to_date_skip)
+{
+    struct mcuboot_img_sem_ver running = ver(1, 4, 0, 7);
+
+    zassert_ok(parse("version=1.4.0+7\nsize=10\nsha256=" SHA_HEX "\n"));
+    zassert_false(fota_manifest_is_newer(&m, &running), "equal version downloaded");
+
+    zassert_ok(parse("version=1.3.9+99\nsize=10\nsha256=" SHA_HEX "\n"));
+    zassert_false(fota_manifest_is_newer(&m, &running), "older version downloaded");
+
+    zassert_ok(parse("version=1.4.0+8\nsize=10\nsha256=" SHA_HEX "\n"));
+    zassert_true(fota_manifest_is_newer(&m, &running), "newer build skipped");
+
+    zassert_ok(parse("version=2.0.0\nsize=10\nsha256=" SHA_HEX "\n"));
+    zassert_true(fota_manifest_is_newer(&m, &running), "newer major skipped");
+}
+
+ZTEST_SUITE(fota_manifest, NULL, NULL, NULL, NULL, NULL);
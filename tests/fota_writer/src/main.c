@@ -0,0 +1,456 @@
+/*
+ * Secondary-slot writer on native_sim: pause/resume against the checkpoint,
+ * the same across a reboot through fota_ckpt.c, and the erase-ahead
+ * benchmark. The flash simulator is given nRF9160-like
+ * erase and write times in prj.conf, so the blocked times are comparable to
+ * "bench dfu" on the device.
+ */
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/storage/flash_map.h>
+#include <dfu/dfu_target.h>
+#include <dfu/dfu_target_mcuboot.h>
+#include <psa/crypto.h>
+#include <psa/internal_trusted_storage.h>
+#include "config.h"
+#include "fota_ckpt.h"
+#include "fota_writer.h"
+#include "fota_stats.h"
+
+#define IMAGE_SIZE      (96 * 1024 + 300)
+#define FRAGMENT        1024    /* one fota_download fragment */
+#define STREAM_BUF_LEN  512     /* fota_download's MCUboot stream buffer */
+#define CUT             (21 * 1024 + 512)
+#define BENCH_SIZE      (128 * 1024)
+#define BENCH_NET_MS    20
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t image_sha256[32];
+static uint8_t stream_buf[STREAM_BUF_LEN] __aligned(4);
+
+static uint32_t blocked_us;
+static uint32_t worst_us;
+
+/* ITS survives a reset on the device; here it is RAM the "reboot" does not touch */
+static struct {
+    bool used;
+    psa_storage_uid_t uid;
+    size_t len;
+    uint8_t data[sizeof(struct fota_ckpt)];
+} its[2];
+
+static int its_find(psa_storage_uid_t uid)
+{
+    for (int i = 0; i < ARRAY_SIZE(its); i++) {
+        if (its[i].used && its[i].uid == uid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+psa_status_t psa_its_set(psa_storage_uid_t uid, size_t data_length, const void *p_data,
+                         psa_storage_create_flags_t create_flags)
+{
+    int i = its_find(uid);
+
+    ARG_UNUSED(create_flags);
+    for (int j = 0; i < 0 && j < ARRAY_SIZE(its); j++) {
+        if (!its[j].used) {
+            i = j;
+        }
+    }
+    if (i < 0 || data_length > sizeof(its[i].data)) {
+        return PSA_ERROR_INSUFFICIENT_STORAGE;
+    }
+    its[i].used = true;
+    its[i].uid = uid;
+    its[i].len = data_length;
+    memcpy(its[i].data, p_data, data_length);
+    return PSA_SUCCESS;
+}
+
+psa_status_t psa_its_get(psa_storage_uid_t uid, size_t data_offset, size_t data_size,
+                         void *p_data, size_t *p_data_length)
+{
+    int i = its_find(uid);
+
+    if (i < 0) {
+        return PSA_ERROR_DOES_NOT_EXIST;
+    }
+    if (data_offset > its[i].len) {
+        return PSA_ERROR_INVALID_ARGUMENT;
+    }
+    *p_data_length = MIN(data_size, its[i].len - data_offset);
+    memcpy(p_data, its[i].data + data_offset, *p_data_length);
+    return PSA_SUCCESS;
+}
+
+psa_status_t psa_its_get_info(psa_storage_uid_t uid, struct psa_storage_info_t *p_info)
+{
+    int i = its_find(uid);
+
+    if (i < 0) {
+        return PSA_ERROR_DOES_NOT_EXIST;
+    }
+    p_info->capacity = p_info->size = its[i].len;
+    p_info->flags = PSA_STORAGE_FLAG_NONE;
+    return PSA_SUCCESS;
+}
+
+psa_status_t psa_its_remove(psa_storage_uid_t uid)
+{
+    int i = its_find(uid);
+
+    if (i < 0) {
+        return PSA_ERROR_DOES_NOT_EXIST;
+    }
+    its[i].used = false;
+    return PSA_SUCCESS;
+}
+
+/* fota_writer reports every write here; the benchmark reads it back */
+void fota_stats_fragment(size_t len, uint32_t write_us, uint32_t erase_wait_us)
+{
+    ARG_UNUSED(len);
+    ARG_UNUSED(erase_wait_us);
+    blocked_us += write_us;
+    worst_us = MAX(worst_us, write_us);
+}
+
+static void dfu_evt(enum dfu_target_evt_id evt_id)
+{
+    ARG_UNUSED(evt_id);
+}
+
+static int session_start(size_t size)
+{
+    int err = dfu_target_mcuboot_set_buf(stream_buf, sizeof(stream_buf));
+
+    return err ? err : dfu_target_init(DFU_TARGET_IMAGE_TYPE_MCUBOOT, 0, size, dfu_evt);
+}
+
+static int feed(const uint8_t *data, size_t from, size_t to)
+{
+    for (size_t off = from; off < to; off += FRAGMENT) {
+        int err = dfu_target_write(data + off, MIN(FRAGMENT, to - off));
+
+        if (err) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static void slot_digest(uint32_t len, uint8_t *digest)
+{
+    const struct flash_area *fa;
+    psa_hash_operation_t op = PSA_HASH_OPERATION_INIT;
+    uint8_t buf[256];
+    size_t out_len;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(slot1_partition), &fa));
+    zassert_equal(psa_hash_setup(&op, PSA_ALG_SHA_256), PSA_SUCCESS);
+    for (uint32_t off = 0; off < len; off += sizeof(buf)) {
+        size_t n = MIN(sizeof(buf), len - off);
+
+        zassert_ok(flash_area_read(fa, off, buf, n));
+        zassert_equal(psa_hash_update(&op, buf, n), PSA_SUCCESS);
+    }
+    zassert_equal(psa_hash_finish(&op, digest, 32, &out_len), PSA_SUCCESS);
+    flash_area_close(fa);
+}
+
+static void slot_program(uint32_t off, const void *data, size_t len)
+{
+    const struct flash_area *fa;
+
+    zassert_ok(flash_area_open(FIXED_PARTITION_ID(slot1_partition), &fa));
+    zassert_ok(flash_area_write(fa, off, data, len));
+    flash_area_close(fa);
+}
+
+/* Download up to CUT, then pause the way download_pause() does; returns the checkpoint */
+static size_t download_and_pause(uint8_t *prefix_sha256)
+{
+    size_t offset = 0;
+
+    dfu_target_mcuboot_reset();
+    fota_writer_resume_from(0, NULL);
+    fota_writer_expect(image_sha256, IMAGE_SIZE);
+    zassert_ok(session_start(IMAGE_SIZE));
+    zassert_ok(feed(image, 0, CUT));
+
+    zassert_ok(dfu_target_offset_get(&offset));
+    zassert_true(offset > 0 && offset <= CUT, "offset %u", (unsigned int)offset);
+    slot_digest(offset, prefix_sha256);
+
+    /* fota_download_cancel() ends in dfu_target_reset() */
+    fota_writer_pause(true);
+    zassert_ok(dfu_target_reset());
+    return offset;
+}
+
+static size_t resume(size_t ckpt, const uint8_t *prefix_sha256)
+{
+    size_t offset = SIZE_MAX;
+
+    fota_writer_resume_from(ckpt, prefix_sha256);
+    fota_writer_expect(image_sha256, IMAGE_SIZE);
+    zassert_ok(session_start(IMAGE_SIZE));
+    zassert_ok(dfu_target_offset_get(&offset));
+    return offset;
+}
+
+static void finish_from(size_t offset)
+{
+    uint8_t digest[32];
+
+    zassert_ok(feed(image, offset, IMAGE_SIZE));
+    zassert_ok(dfu_target_done(true), "image not verified");
+    slot_digest(IMAGE_SIZE, digest);
+    zassert_mem_equal(digest, image_sha256, sizeof(digest));
+}
+
+static void *suite_setup(void)
+{
+    size_t out_len;
+
+    zassert_equal(psa_crypto_init(), PSA_SUCCESS);
+    zassert_ok(settings_subsys_init());
+
+    uint32_t x = 0x2545F491;
+    for (size_t i = 0; i < sizeof(image); i++) {
+        x = x * 1664525U + 1013904223U;
+        image[i] = x >> 24;
+    }
+    zassert_equal(psa_hash_compute(PSA_ALG_SHA_256, image, sizeof(image),
+                                   image_sha256, sizeof(image_sha256), &out_len), PSA_SUCCESS);
+    return NULL;
+}
+
+static void after_each(void *fixture)
+{
+    ARG_UNUSED(fixture);
+    dfu_target_reset();
+    fota_writer_set_ahead(FOTA_ERASE_AHEAD_PAGES);
+    fota_ckpt_clear();
+}
+
+ZTEST(fota_writer, test_pause_keeps_slot_and_resumes)
+{
+    uint8_t ckpt_sha256[32], digest[32];
+    size_t ckpt = download_and_pause(ckpt_sha256);
+
+    slot_digest(ckpt, digest);
+    zassert_mem_equal(digest, ckpt_sha256, sizeof(digest), "pause wiped the slot");
+
+    size_t offset = resume(ckpt, ckpt_sha256);
+    zassert_equal(offset, ckpt, "resumed at %u, checkpoint %u", (unsigned int)offset,
+                  (unsigned int)ckpt);
+
+    /* Let the eraser run ahead; the checkpointed pages must survive it */
+    k_sleep(K_MSEC(FOTA_ERASE_AHEAD_PAGES * 100));
+    slot_digest(ckpt, digest);
+    zassert_mem_equal(digest, ckpt_sha256, sizeof(digest), "resume erased verified bytes");
+
+    finish_from(offset);
+}
+
+/* download_pause() whose fota_download_cancel() never reached the reset */
+ZTEST(fota_writer, test_dropped_pause_resets)
+{
+    uint8_t prefix_sha256[32];
+    size_t offset = 0;
+
+    fota_writer_resume_from(0, NULL);
+    fota_writer_expect(image_sha256, IMAGE_SIZE);
+    zassert_ok(session_start(IMAGE_SIZE));
+    zassert_ok(feed(image, 0, CUT));
+    zassert_ok(dfu_target_offset_get(&offset));
+    slot_digest(offset, prefix_sha256);
+
+    fota_writer_pause(true);
+    fota_writer_pause(false);
+
+    /* The session then fails: the target must be reset, not kept as paused */
+    zassert_ok(dfu_target_reset());
+    zassert_equal(resume(offset, prefix_sha256), 0, "failed session kept as paused");
+    finish_from(0);
+}
+
+ZTEST(fota_writer, test_progress_without_checkpoint_restarts)
+{
+    uint8_t ckpt_sha256[32];
+
+    download_and_pause(ckpt_sha256);
+
+    /* download_prepare() for an image with no matching checkpoint */
+    zassert_equal(resume(0, NULL), 0, "resumed on unverified bytes");
+    finish_from(0);
+}
+
+ZTEST(fota_writer, test_progress_past_checkpoint_restarts)
+{
+    uint8_t digest[32];
+    size_t ckpt = download_and_pause(digest);
+    size_t shorter = ckpt - STREAM_BUF_LEN;
+
+    slot_digest(shorter, digest);
+    zassert_equal(resume(shorter, digest), 0, "resumed past the checkpoint");
+    finish_from(0);
+}
+
+ZTEST(fota_writer, test_changed_prefix_restarts)
+{
+    static const uint8_t zero[4];
+    uint8_t ckpt_sha256[32];
+    size_t ckpt = download_and_pause(ckpt_sha256);
+
+    slot_program(0, zero, sizeof(zero));
+    zassert_equal(resume(ckpt, ckpt_sha256), 0, "resumed on a changed slot");
+    finish_from(0);
+}
+
+ZTEST(fota_writer, test_dirty_tail_restarts)
+{
+    static const uint8_t zero[4];
+    uint8_t ckpt_sha256[32];
+    size_t ckpt = download_and_pause(ckpt_sha256);
+
+    zassert_true(ckpt % FLASH_PAGE_SIZE != 0);
+    slot_program(ROUND_UP(ckpt, 4), zero, sizeof(zero));
+    zassert_equal(resume(ckpt, ckpt_sha256), 0, "resumed over data past the checkpoint");
+    finish_from(0);
+}
+
+/*
+ * fota.c across a reset: download_prepare(), the download, download_pause()
+ * on a link drop, then a reboot. Only flash, the saved stream progress and
+ * ITS survive it; the next download_prepare() must find the checkpoint and
+ * the writer must verify the slot before the session resumes.
+ */
+static uint32_t download_pause_reboot(const uint8_t *sha256)
+{
+    uint8_t digest[32];
+    size_t offset = 0;
+
+    zassert_equal(fota_ckpt_prepare(IMAGE_SIZE, sha256), 0, "fresh download resumed");
+    zassert_true(fota_ckpt_present(), "no offset 0 checkpoint at download start");
+    fota_writer_expect(sha256, IMAGE_SIZE);
+    zassert_ok(session_start(IMAGE_SIZE));
+    zassert_ok(feed(image, 0, CUT));
+
+    /* download_pause() */
+    zassert_ok(dfu_target_offset_get(&offset));
+    fota_writer_pause(true);
+    zassert_ok(dfu_target_reset());
+    fota_writer_expect(NULL, 0);
+    zassert_ok(fota_ckpt_save(IMAGE_SIZE, sha256, offset));
+
+    /* What the checkpoint holds is all the next boot knows */
+    struct fota_ckpt ck;
+    size_t len;
+    zassert_equal(psa_its_get(FOTA_CKPT_UID, 0, sizeof(ck), &ck, &len), PSA_SUCCESS);
+    zassert_equal(len, sizeof(ck));
+    zassert_equal(ck.offset, offset);
+    zassert_equal(ck.size, IMAGE_SIZE);
+    zassert_mem_equal(ck.image_sha256, sha256, sizeof(ck.image_sha256));
+    slot_digest(offset, digest);
+    zassert_mem_equal(ck.prefix_sha256, digest, sizeof(digest), "checkpoint digest is not the slot");
+    return offset;
+}
+
+/* download_prepare() after the reboot, then fota_download's session start */
+static size_t reboot_resume(uint32_t *armed)
+{
+    size_t offset = SIZE_MAX;
+
+    *armed = fota_ckpt_prepare(IMAGE_SIZE, image_sha256);
+    fota_writer_expect(image_sha256, IMAGE_SIZE);
+    zassert_ok(session_start(IMAGE_SIZE));
+    zassert_ok(dfu_target_offset_get(&offset));
+    return offset;
+}
+
+ZTEST(fota_writer, test_reboot_resumes_from_checkpoint)
+{
+    uint32_t armed;
+    uint32_t ckpt = download_pause_reboot(image_sha256);
+    size_t offset = reboot_resume(&armed);
+
+    zassert_equal(armed, ckpt, "checkpoint not restored");
+    zassert_equal(offset, ckpt, "resumed at %u, checkpoint %u", (unsigned int)offset,
+                  (unsigned int)ckpt);
+    finish_from(offset);
+}
+
+ZTEST(fota_writer, test_reboot_changed_slot_restarts)
+{
+    static const uint8_t zero[4];
+    uint32_t armed;
+    uint32_t ckpt = download_pause_reboot(image_sha256);
+
+    /* The checkpoint still names this image, but the slot no longer hashes to it */
+    slot_program(0, zero, sizeof(zero));
+    zassert_equal(reboot_resume(&armed), 0, "resumed on a changed slot");
+    zassert_equal(armed, ckpt);
+    finish_from(0);
+}
+
+ZTEST(fota_writer, test_reboot_other_image_restarts)
+{
+    uint8_t other_sha256[32];
+    uint32_t armed;
+
+    memcpy(other_sha256, image_sha256, sizeof(other_sha256));
+    other_sha256[0] ^= 0xFF;
+    download_pause_reboot(other_sha256);
+
+    /* The manifest now announces another image: its checkpoint must not be used */
+    zassert_equal(reboot_resume(&armed), 0, "resumed another image's bytes");
+    zassert_equal(armed, 0);
+    finish_from(0);
+}
+
+static void bench_run(uint32_t ahead)
+{
+    blocked_us = 0;
+    worst_us = 0;
+
+    zassert_ok(fota_writer_set_ahead(ahead));
+    dfu_target_mcuboot_reset();
+    fota_writer_resume_from(0, NULL);
+    fota_writer_expect(NULL, 0);
+    zassert_ok(session_start(BENCH_SIZE));
+
+    int64_t t0 = k_uptime_get();
+    for (size_t off = 0; off < BENCH_SIZE; off += FRAGMENT) {
+        /* The socket wait an erase-ahead writer can use */
+        k_sleep(K_MSEC(BENCH_NET_MS));
+        zassert_ok(dfu_target_write(image + (off % (IMAGE_SIZE - FRAGMENT)), FRAGMENT));
+    }
+    uint32_t total_ms = (uint32_t)(k_uptime_get() - t0);
+    zassert_ok(dfu_target_reset());
+
+    TC_PRINT("%-12s total %6u ms  blocked %6u ms  longest write %7u us\n",
+             ahead ? "erase-ahead" : "inline", total_ms, blocked_us / 1000U, worst_us);
+}
+
+ZTEST(fota_writer_bench, test_erase_ahead)
+{
+    TC_PRINT("%u KiB in %u B fragments, %u ms network wait each\n",
+             BENCH_SIZE / 1024, FRAGMENT, BENCH_NET_MS);
+
+    bench_run(0);
+    uint32_t inline_us = blocked_us;
+
+    bench_run(FOTA_ERASE_AHEAD_PAGES);
+    zassert_true(blocked_us < inline_us, "erase-ahead blocked %u us, inline %u us",
+                 blocked_us, inline_us);
+}
+
+ZTEST_SUITE(fota_writer, NULL, suite_setup, NULL, after_each, NULL);
+ZTEST_SUITE(fota_writer_bench, NULL, suite_setup, NULL, after_each, NULL);
@@ -0,0 +1,28 @@
+/* ITS for the download checkpoint; src/main.c keeps it in RAM so it outlives a simulated reboot */
+#ifndef PSA_INTERNAL_TRUSTED_STORAGE_H
+#define PSA_INTERNAL_TRUSTED_STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <psa/crypto.h>
+
+#ifndef PSA_STORAGE_COMMON_H
+#define PSA_STORAGE_COMMON_H
+typedef uint64_t psa_storage_uid_t;
+typedef uint32_t psa_storage_create_flags_t;
+struct psa_storage_info_t {
+    uint32_t capacity;
+    uint32_t size;
+    psa_storage_create_flags_t flags;
+};
+#define PSA_STORAGE_FLAG_NONE 0u
+#endif
+
+psa_status_t psa_its_set(psa_storage_uid_t uid, size_t data_length, const void *p_data,
+                         psa_storage_create_flags_t create_flags);
+psa_status_t psa_its_get(psa_storage_uid_t uid, size_t data_offset, size_t data_size,
+                         void *p_data, size_t *p_data_length);
+psa_status_t psa_its_get_info(psa_storage_uid_t uid, struct psa_storage_info_t *p_info);
+psa_status_t psa_its_remove(psa_storage_uid_t uid);
+
+#endif
@@ -0,0 +1 @@
+/* Empty: the TF-M NS interface is not used by the code under test */